@@ -29,6 +29,11 @@ include(${PROJECT_SOURCE_DIR}/cmake/AddGoogleTest.cmake)
 #find_package(Boost 1.69.0 COMPONENTS system date_time filesystem context iostreams coroutine thread atomic REQUIRED)
 find_package(Boost 1.65.1 COMPONENTS system date_time filesystem context iostreams coroutine thread atomic REQUIRED)
 
+############################################################################################################
+# ZLIB LIBRARY
+############################################################################################################
+find_package(ZLIB REQUIRED)
+
 ############################################################################################################
 # NANOPOLISH LIBRARY
 ############################################################################################################
@@ -54,7 +59,8 @@ set(embed_LINK_LIBRARIES
         Boost::iostreams
         Boost::coroutine
         Boost::thread
-        Boost::atomic)
+        Boost::atomic
+        ZLIB::ZLIB)
 
 if (nanopolish_FOUND)
     set(nanopolish_LIB nanopolish::nanopolishlib)
@@ -10,6 +10,8 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
 
 
 using namespace embed_utils;
@@ -115,6 +117,40 @@ void AlignmentFile::filter_by_positions(PositionsFile *pf, boost::filesystem::pa
 }
 
 
+/**
+ * Only parse rows whose kmer overlaps a target region. Rows are dropped before any field is converted and the
+ * number of rows read and dropped is added to the region index. nullptr parses every row.
+ *
+ * @param region_index: target regions, must outlive the parsing
+ */
+void AlignmentFile::set_regions(const RegionIndex* region_index){
+  this->regions = region_index;
+  this->region_intervals = nullptr;
+  this->region_contig_set = false;
+}
+
+/**
+ * Does the kmer of a row, [reference_index, reference_index + k), overlap a target region.
+ * Only the contig and reference index fields are read.
+ */
+bool AlignmentFile::in_regions(const string& line){
+  size_t first_tab = line.find('\t');
+  if (first_tab == string::npos){
+//    malformed rows are dropped by the field count check
+    return true;
+  }
+  if (!region_contig_set or line.compare(0, first_tab, region_contig) != 0){
+    region_contig.assign(line, 0, first_tab);
+    region_intervals = regions->get_intervals(region_contig, this->strand);
+    region_contig_set = true;
+  }
+  if (region_intervals == nullptr){
+    return false;
+  }
+  uint64_t reference_index = strtoull(line.data() + first_tab + 1, nullptr, 10);
+  return region_intervals->overlaps(reference_index, reference_index + k);
+}
+
 /**
  * Create a push type coroutine for parsing an alignment file
 */
@@ -123,7 +159,16 @@ void AlignmentFile::push_iterate(full_sa_coro::push_type& yield){
     in_file.clear();
     in_file.seekg(0, ios::beg);
     string line;
+    uint64_t rows = 0;
+    uint64_t skipped_rows = 0;
     while(getline(this->in_file, line)) {
+      if (regions != nullptr){
+        rows += 1;
+        if (!this->in_regions(line)){
+          skipped_rows += 1;
+          continue;
+        }
+      }
       vector<string> fields = split_string(line, '\t');
       if (fields.size() != 16) {
         continue;
@@ -139,6 +184,9 @@ void AlignmentFile::push_iterate(full_sa_coro::push_type& yield){
         yield(sa);
       }
     }
+    if (regions != nullptr){
+      regions->count_rows(rows, skipped_rows);
+    }
   }
 }
 
@@ -178,6 +226,72 @@ full_sa_coro::pull_type AlignmentFile::filter_by_ref_bases(string& bases) {
   return event;
 }
 
+void VariantCallScratch::set_ambig_bases(const string& new_ambig_bases,
+                                         const std::map<string, string>* new_ambig_bases_map) {
+  if (new_ambig_bases == ambig_bases and new_ambig_bases_map == ambig_bases_map){
+    return;
+  }
+  ambig_bases = new_ambig_bases;
+  ambig_bases_map = new_ambig_bases_map;
+  ambig_id.fill(-1);
+  variant_bases.clear();
+  base_index.clear();
+  for (auto &c: ambig_bases){
+    auto ambig = (uint8_t) c;
+    if (ambig_id[ambig] != -1){
+      continue;
+    }
+    auto found = ambig_bases_map->find(string(1, c));
+    if (found == ambig_bases_map->end()){
+//      only an error if a read uses it
+      ambig_id[ambig] = MISSING_AMBIG;
+      continue;
+    }
+    throw_assert(found->second.length() <= MAX_VARIANTS,
+                 "Ambiguous base " + string(1, c) + " stands for more than " + to_string(MAX_VARIANTS) + " bases")
+    throw_assert(variant_bases.size() < 64, "At most 64 ambiguous bases can be called at once")
+    ambig_id[ambig] = (int16_t) variant_bases.size();
+    variant_bases.push_back(found->second);
+    base_index.emplace_back();
+    base_index.back().fill(-1);
+    for (size_t i = 0; i < found->second.length(); ++i){
+      auto& index = base_index.back()[(uint8_t) found->second[i]];
+      if (index == -1){
+        index = (int8_t) i;
+      }
+    }
+  }
+}
+
+VariantCallScratch::Accumulator& VariantCallScratch::get_accumulator(uint64_t position, int16_t id) {
+  if (window.empty()){
+    window_start = position;
+  }
+  if (position < window_start){
+//    grow to the left by at least the current size so reads walking backwards are not shifted every position
+    throw_assert(window.size() + (window_start - position) <= MAX_WINDOW,
+                 "Variant calls of a read span more than " + to_string(MAX_WINDOW) + " reference positions")
+    uint64_t grow = std::min(std::max(window_start - position, (uint64_t) window.size()),
+                             std::min(window_start, MAX_WINDOW - window.size()));
+    window.insert(window.begin(), grow, -1);
+    window_start -= grow;
+  }
+  uint64_t offset = position - window_start;
+  if (offset >= window.size()){
+    throw_assert(offset < MAX_WINDOW,
+                 "Variant calls of a read span more than " + to_string(MAX_WINDOW) + " reference positions")
+    window.resize(std::min(std::max(offset + 1, 2 * (uint64_t) window.size()), MAX_WINDOW), -1);
+  }
+  int32_t& slot = window[offset];
+  if (slot < 0){
+    slot = (int32_t) accumulators.size();
+    accumulators.emplace_back();
+    accumulators.back().position = position;
+    accumulators.back().ambig_id = id;
+  }
+  return accumulators[slot];
+}
+
 /**
  * Get variant calls from full alignment file
  *
@@ -186,88 +300,119 @@ full_sa_coro::pull_type AlignmentFile::filter_by_ref_bases(string& bases) {
  * @return: vector of variant calls
 */
 vector<VariantCall> AlignmentFile::get_variant_calls(string &ambig_bases, std::map<string, string> *ambig_bases_map) {
+  VariantCallScratch scratch;
+  vector<VariantCall> calls;
+  this->get_variant_calls(ambig_bases, ambig_bases_map, scratch, calls);
+  return calls;
+}
 
-  std::map<uint64_t, VariantCall> variant_calls;
-  std::map<uint64_t, VariantCall>::iterator it;
-  std::size_t location;
-  uint64_t position;
-  uint64_t path_kmer_pos;
-  uint64_t index;
-  string possible_bases;
-  VariantCall position_call;
-  vector<VariantCall> final_output;
-  string s;
-
-//  loop through file
-  try {
-    for (auto &event: this->iterate()) {
-      for (char &c : ambig_bases) {
-        path_kmer_pos = event.aligned_kmer.find(c);
-        if (path_kmer_pos != std::string::npos) {
-//        get position of ambiguous base
-          if (rna){
-            position = event.reference_index - path_kmer_pos + (k-1);
-          } else {
-            if (this->strand == "+") {
-              position = event.reference_index + path_kmer_pos;
-            } else {
-              position = event.reference_index + (this->k - path_kmer_pos - 1);
-            }
-          }
-          s = string(1, c);
-          possible_bases = (*ambig_bases_map).at(s);
-//        positon_call = VariantCalls[position];
-          it = variant_calls.find(position);
-          if (it == variant_calls.end()) {
-//        initialize VariantCall if empty
-//          position_call = VariantCall();
-            position_call = VariantCall(event.contig, this->strand, position, possible_bases);
-            for (int i = 0; i < possible_bases.length(); ++i) {
-              position_call.normalized_probs.push_back(0.0);
-              position_call.positional_probs.push_back(0.0);
-              position_call.positional_probs2.push_back(0.0);
-            }
-          } else {
-            position_call = variant_calls[position];
-          }
-//        get corresponding index for base call
-          index = possible_bases.find(event.path_kmer[path_kmer_pos]);
-          if (index != std::string::npos) {
-            if (location == 0) {
-              position_call.positional_probs[index] += event.posterior_probability;
-            } else {
-              position_call.positional_probs2[index] += event.posterior_probability;
-            }
-            variant_calls[position] = position_call;
-          } else {
-            throw runtime_error("Programmer Error: This should never happen yo.");
-          }
-        }
+/**
+ * Get variant calls from full alignment file, parsing lines in place and summing probabilities in a reusable scratch
+ *
+ * @param ambig_bases: the list of possible ambiguous calls
+ * @param ambig_bases_map: map of ambig bases to represented nucleotides
+ * @param scratch: buffers kept between reads, one per thread
+ * @param calls: replaced with the variant calls sorted by reference position
+*/
+void AlignmentFile::get_variant_calls(string &ambig_bases, std::map<string, string> *ambig_bases_map,
+                                      VariantCallScratch& scratch, vector<VariantCall>& calls) {
+  scratch.set_ambig_bases(ambig_bases, ambig_bases_map);
+  scratch.clear();
+  calls.clear();
+  if (!this->good_file){
+    return;
+  }
+  in_file.clear();
+  in_file.seekg(0, ios::beg);
+  string& line = scratch.line;
+  vector<size_t>& field_starts = scratch.field_starts;
+  uint64_t rows = 0;
+  uint64_t skipped_rows = 0;
+  while (getline(this->in_file, line)) {
+    if (regions != nullptr){
+      rows += 1;
+      if (!this->in_regions(line)){
+        skipped_rows += 1;
+        continue;
       }
     }
-
-    // Iterate over the map using c++11 range based for loop
-    for (std::pair<uint64_t, VariantCall> element : variant_calls) {
-      double sum_of_elements = std::accumulate(element.second.positional_probs.begin(),
-                                               element.second.positional_probs.end(), 0.0);
-
-      if (sum_of_elements > 0.0) {
-        for (size_t i = 0; i < element.second.positional_probs.size(); ++i)
-          element.second.normalized_probs[i] =
-              element.second.positional_probs[i] / sum_of_elements;
+    field_starts.clear();
+    field_starts.push_back(0);
+    for (size_t i = 0; i < line.size(); ++i){
+      if (line[i] == '\t'){
+        field_starts.push_back(i + 1);
+      }
+    }
+    if (field_starts.size() != 16) {
+      continue;
+    }
+    const char* aligned_kmer = line.data() + field_starts[9];
+    size_t aligned_kmer_length = field_starts[10] - field_starts[9] - 1;
+    const char* path_kmer = line.data() + field_starts[15];
+    size_t path_kmer_length = line.size() - field_starts[15];
+    uint64_t seen = 0;
+    bool parsed = false;
+    uint64_t reference_index = 0;
+    double posterior_probability = 0;
+    for (size_t path_kmer_pos = 0; path_kmer_pos < aligned_kmer_length; ++path_kmer_pos){
+      int16_t id = scratch.ambig_id[(uint8_t) aligned_kmer[path_kmer_pos]];
+      if (id == -1 or (id >= 0 and (seen >> id) & 1)){
+        continue;
+      }
+      if (id == VariantCallScratch::MISSING_AMBIG){
+        throw runtime_error("Programmer Error: ambig_bases not in ambig_bases_map. base: " +
+            string(1, aligned_kmer[path_kmer_pos]));
+      }
+      seen |= 1ULL << id;
+      if (!parsed){
+        reference_index = strtoull(line.data() + field_starts[1], nullptr, 10);
+        posterior_probability = strtof(line.data() + field_starts[12], nullptr);
+        parsed = true;
+      }
+//      get position of ambiguous base
+      uint64_t position;
+      if (rna){
+        position = reference_index - path_kmer_pos + (k-1);
       } else {
-        sum_of_elements = std::accumulate(element.second.positional_probs2.begin(),
-                                                 element.second.positional_probs2.end(), 0.0);
-        for (size_t i = 0; i < element.second.positional_probs2.size(); ++i)
-          element.second.normalized_probs[i] =
-              element.second.positional_probs2[i] / sum_of_elements;
+        if (this->strand == "+") {
+          position = reference_index + path_kmer_pos;
+        } else {
+          position = reference_index + (this->k - path_kmer_pos - 1);
+        }
+      }
+//      get corresponding index for base call
+      int8_t index = path_kmer_pos < path_kmer_length ?
+          scratch.base_index[id][(uint8_t) path_kmer[path_kmer_pos]] : (int8_t) -1;
+      if (index < 0) {
+        throw runtime_error("Programmer Error: This should never happen yo.");
+      }
+//      the kmer overlaps a region but this base may not
+      if (regions != nullptr and !region_intervals->contains(position)){
+        continue;
       }
-      final_output.push_back(element.second);
+      scratch.get_accumulator(position, id).probs[index] += posterior_probability;
     }
-  } catch (const std::out_of_range& oor) {
-    throw runtime_error("Programmer Error: ambig_bases not in ambig_bases_map. base: " + s);
+  }
+  if (regions != nullptr){
+    regions->count_rows(rows, skipped_rows);
   }
 
-  return final_output;
+  std::sort(scratch.accumulators.begin(), scratch.accumulators.end(),
+            [](const VariantCallScratch::Accumulator& a, const VariantCallScratch::Accumulator& b){
+              return a.position < b.position;
+            });
+  calls.reserve(scratch.accumulators.size());
+  for (auto &accumulator: scratch.accumulators){
+    const string& bases = scratch.variant_bases[accumulator.ambig_id];
+    calls.emplace_back(this->contig, this->strand, accumulator.position, bases);
+    VariantCall& call = calls.back();
+    call.positional_probs.assign(accumulator.probs, accumulator.probs + bases.length());
+    call.positional_probs2.assign(bases.length(), 0.0);
+    double sum_of_elements = std::accumulate(call.positional_probs.begin(), call.positional_probs.end(), 0.0);
+    call.normalized_probs.resize(bases.length());
+    for (size_t i = 0; i < bases.length(); ++i){
+      call.normalized_probs[i] = call.positional_probs[i] / sum_of_elements;
+    }
+  }
 }
 
@@ -7,9 +7,13 @@
 
 #include "PositionsFile.hpp"
 #include "VariantCall.hpp"
+#include "MemoryReport.hpp"
+#include "RegionIndex.hpp"
 #include <boost/filesystem.hpp>
 #include <boost/coroutine2/all.hpp>
 #include <utility>
+#include <array>
+#include <map>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -51,8 +55,15 @@ class FullSaEvent {
   }
 
   ~FullSaEvent() = default;
-  string format_line(bool write_full=true) const{
-    ostringstream person_info;
+  uint64_t memory_usage() const {
+    return string_memory(contig) + string_memory(reference_kmer) + string_memory(read_file) + string_memory(strand) +
+        string_memory(aligned_kmer) + string_memory(path_kmer);
+  }
+  /**
+  Write the event as a tab separated line to any stream with operator<<, eg. an ostream or a TextWriter
+  */
+  template<class Stream>
+  void write_line(Stream& person_info, bool write_full=true) const{
     if (write_full) {
       person_info << contig << '\t' << reference_index << '\t' << reference_kmer << '\t' << read_file << '\t'
                   << strand << '\t' << event_index << '\t' << event_mean << '\t' << event_noise << '\t'
@@ -63,6 +74,10 @@ class FullSaEvent {
       person_info << path_kmer << '\t' << strand << '\t' << descaled_event_mean << '\t'
                   << posterior_probability << '\n';
     }
+  }
+  string format_line(bool write_full=true) const{
+    ostringstream person_info;
+    this->write_line(person_info, write_full);
     return person_info.str();
   };
 
@@ -70,6 +85,65 @@ class FullSaEvent {
 
 typedef coroutine<FullSaEvent> full_sa_coro;
 
+/**
+Reusable buffers for AlignmentFile::get_variant_calls. A thread keeps one scratch so calling variants on many reads
+only allocates the returned calls. Ambiguous characters and the bases they stand for are turned into lookup tables
+whenever the ambiguous characters change, and probabilities are summed into fixed size arrays found through a flat
+window of reference positions.
+*/
+class VariantCallScratch {
+ public:
+  static const uint64_t MAX_VARIANTS = 16;
+  static const uint64_t MAX_WINDOW = 1ULL << 26;
+//  an ambiguous character which is not in the ambig bases map
+  static const int16_t MISSING_AMBIG = -2;
+
+  struct Accumulator {
+    uint64_t position;
+    int16_t ambig_id;
+    double probs[MAX_VARIANTS];
+  };
+
+  VariantCallScratch() {
+    ambig_id.fill(-1);
+  }
+
+  /**
+  Build the lookup tables for a set of ambiguous characters unless they are already built
+  */
+  void set_ambig_bases(const string& new_ambig_bases, const std::map<string, string>* new_ambig_bases_map);
+
+  /**
+  Forget the accumulators of the last read, keeping every buffer
+  */
+  void clear() {
+    accumulators.clear();
+    window.clear();
+  }
+
+  /**
+  Accumulator of a reference position, created with zeroed probabilities the first time the position is seen
+  */
+  Accumulator& get_accumulator(uint64_t position, int16_t id);
+
+//  ambiguous character -> index into variant_bases, -1 if not ambiguous or MISSING_AMBIG
+  std::array<int16_t, 256> ambig_id{};
+//  bases each ambiguous character stands for
+  vector<string> variant_bases;
+//  [ambiguous character index][base] -> index of base in variant_bases, -1 if not one of them
+  vector<std::array<int8_t, 256>> base_index;
+  vector<Accumulator> accumulators;
+//  line buffer and tab separated field starts of the line being parsed
+  string line;
+  vector<size_t> field_starts;
+
+ private:
+  string ambig_bases;
+  const std::map<string, string>* ambig_bases_map = nullptr;
+  vector<int32_t> window;
+  uint64_t window_start = 0;
+};
+
 
 class AlignmentFile
 {
@@ -83,6 +157,9 @@ class AlignmentFile
   full_sa_coro::pull_type iterate();
   full_sa_coro::pull_type filter_by_ref_bases(string& bases);
   vector<VariantCall> get_variant_calls(string& ambig_bases, std::map<string, string> *ambig_bases_map);
+  void get_variant_calls(string& ambig_bases, std::map<string, string> *ambig_bases_map, VariantCallScratch& scratch,
+                         vector<VariantCall>& calls);
+  void set_regions(const RegionIndex* region_index);
     //
   string file_path;
   bool good_file;
@@ -96,6 +173,12 @@ class AlignmentFile
 
  private:
   std::ifstream in_file;
+//  target regions and the intervals of the contig of the last row checked against them
+  const RegionIndex* regions = nullptr;
+  const RegionIntervals* region_intervals = nullptr;
+  string region_contig;
+  bool region_contig_set = false;
+  bool in_regions(const string& line);
   void push_iterate(full_sa_coro::push_type& yield);
   void push_filter_by_ref_bases(full_sa_coro::push_type& yield, string bases);
 
@@ -69,7 +69,7 @@ class AmbigModel {
         }
       } else {
         throw_assert(in_canonical_counterpart(i), "Character("+ string(1, i) +")in kmer not in ambig model");
-        std::set<char> canonical_chars = canonical_counterpart[i];
+        std::set<char> canonical_chars = canonical_counterpart.at(i);
         vector<string> intermediate_kmers;
         for (auto &c: canonical_chars){
           vector<string> tmp_kmers = canonical_kmers;
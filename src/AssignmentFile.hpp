@@ -5,6 +5,7 @@
 #ifndef EMBED_FAST5_SRC_ASSIGNMENTFILE_HPP_
 #define EMBED_FAST5_SRC_ASSIGNMENTFILE_HPP_
 
+#include "MemoryReport.hpp"
 #include <boost/coroutine2/all.hpp>
 #include <string>
 #include <sstream>
@@ -28,9 +29,19 @@ struct eventkmer
   {
   }
   ~eventkmer() = default;
+  uint64_t memory_usage() const {
+    return string_memory(path_kmer) + string_memory(strand);
+  }
+  /**
+  Write the event as a tab separated line to any stream with operator<<, eg. an ostream or a TextWriter
+  */
+  template<class Stream>
+  void write_line(Stream& person_info, __unused bool trim=false) const{
+    person_info << path_kmer << '\t' << strand << '\t' << descaled_event_mean << '\t' << posterior_probability << '\n';
+  }
   string format_line(__unused bool trim=false) const{
     ostringstream person_info;
-    person_info << path_kmer << '\t' << strand << '\t' << descaled_event_mean << '\t' << posterior_probability << '\n';
+    this->write_line(person_info, trim);
     return person_info.str();
   };
 
@@ -7,6 +7,7 @@
 
 // embed lib
 #include "EmbedUtils.hpp"
+#include "MemoryReport.hpp"
 // stdlib
 #include <unordered_map>
 #include <set>
@@ -21,6 +22,11 @@ class PosKmerIndex {
   uint64_t name_length;
   uint64_t sequence_byte_index;
   uint64_t sequence_length;
+  uint64_t sequence_byte_length = 0;
+
+  uint64_t memory_usage() const {
+    return string_memory(name);
+  }
 };
 
 class KmerIndex {
@@ -40,6 +46,18 @@ class KmerIndex {
     kmer_index_ptrs.push_back(kmer_index_ptr);
   }
 
+  /**
+  Heap bytes owned by the index. Pointed to PosKmerIndexes are owned by the PositionIndexes
+  */
+  uint64_t memory_usage() const {
+    uint64_t bytes = string_memory(kmer) + vector_memory(kmer_index_ptrs) + vector_memory(positions) +
+        vector_memory(contig_strands);
+    for (auto &contig_strand: contig_strands){
+      bytes += string_memory(contig_strand);
+    }
+    return bytes;
+  }
+
 };
 
 class ByKmerIndex {
@@ -65,6 +83,14 @@ class ByKmerIndex {
     return kmer_index_map.find(kmer) != kmer_index_map.end();
   }
 
+  uint64_t memory_usage() const {
+    uint64_t bytes = unordered_map_memory(kmer_index_map);
+    for (auto &kmer_pair: kmer_index_map){
+      bytes += string_memory(kmer_pair.first) + kmer_pair.second.memory_usage();
+    }
+    return bytes;
+  }
+
  private:
   unordered_map<string, KmerIndex> kmer_index_map;
 
@@ -95,9 +121,100 @@ class PositionIndex {
     return v;
   }
 
+  uint64_t memory_usage() const {
+    uint64_t bytes = unordered_map_memory(kmer_indexes);
+    for (auto &kmer_pair: kmer_indexes){
+      bytes += string_memory(kmer_pair.first) + make_shared_memory<PosKmerIndex>() + kmer_pair.second->memory_usage();
+    }
+    return bytes;
+  }
+
 };
 
 
+/**
+Packs kmers of a fixed length into integers using the rank of each base in the alphabet. Packed kmers sort in the
+same order as the kmer strings.
+
+@param alphabet: alphabet of the kmers
+@param kmer_length: length of kmers
+*/
+class KmerPacker {
+ public:
+  KmerPacker(const set<char>& alphabet, const uint64_t& kmer_length) :
+      kmer_length(kmer_length), bases(char_set_to_string(alphabet)) {
+    throw_assert(!bases.empty(), "Alphabet must be set in order to pack kmers")
+    while ((1ULL << bits_per_base) < bases.size()){
+      bits_per_base += 1;
+    }
+    throw_assert(bits_per_base * kmer_length <= 64,
+                 "Kmer length " + to_string(kmer_length) + " is too long to pack with alphabet " + bases)
+    for (uint64_t i = 0; i < bases.size(); ++i){
+      base_ranks[(unsigned char) bases[i]] = i;
+    }
+  }
+  KmerPacker() = default;
+
+  /**
+  Check if kmers of kmer_length over alphabet fit in 64 bits
+  */
+  static bool can_pack(const set<char>& alphabet, const uint64_t& kmer_length){
+    uint64_t bits = 1;
+    while ((1ULL << bits) < alphabet.size()){
+      bits += 1;
+    }
+    return !alphabet.empty() and bits * kmer_length <= 64;
+  }
+
+  uint64_t pack(const string& kmer) const {
+    throw_assert(kmer.size() == kmer_length,
+                 "Kmer: " + kmer + " is not of length " + to_string(kmer_length))
+    uint64_t packed = 0;
+    for (auto &base: kmer){
+      int64_t rank = base_ranks[(unsigned char) base];
+      throw_assert(rank >= 0, "Kmer: " + kmer + " has a base not in the alphabet " + bases)
+      packed = (packed << bits_per_base) | (uint64_t) rank;
+    }
+    return packed;
+  }
+
+  /**
+  Pack a kmer without throwing
+  @return false if the kmer has the wrong length or a base outside of the alphabet
+  */
+  bool try_pack(const string& kmer, uint64_t& packed) const {
+    if (kmer.size() != kmer_length){
+      return false;
+    }
+    packed = 0;
+    for (auto &base: kmer){
+      int64_t rank = base_ranks[(unsigned char) base];
+      if (rank < 0){
+        return false;
+      }
+      packed = (packed << bits_per_base) | (uint64_t) rank;
+    }
+    return true;
+  }
+
+  string unpack(uint64_t packed) const {
+    string kmer(kmer_length, ' ');
+    uint64_t mask = (1ULL << bits_per_base) - 1;
+    for (uint64_t i = kmer_length; i > 0; --i){
+      kmer[i - 1] = bases[packed & mask];
+      packed >>= bits_per_base;
+    }
+    return kmer;
+  }
+
+  uint64_t kmer_length = 0;
+  uint64_t bits_per_base = 1;
+  string bases;
+
+ private:
+  vector<int64_t> base_ranks = vector<int64_t>(256, -1);
+};
+
 /**
 Simple data structure for kmer data
 
@@ -141,15 +258,26 @@ static bool operator==(const Event& a, const Event& b) {
 /**
 Simple data structure for keeping track of events aligned to a kmer
 
+Events are kept as a min heap on posterior probability. In bulk mode (bulk_factor > 0) events are appended unordered
+and, when max_events is set, the buffer is compacted to the max_events most probable events with nth_element once it
+holds bulk_factor * max_events events. Events not above the smallest event kept by the last compaction are dropped
+on insert. finalize() restores the capped heap layout. It is called at write and query boundaries
+(BinaryEventWriter, EventRunFile and the EventDataHandler queries) and num_events and get_hist assert it was.
+
 @param kmer: string representation
 @param max_kmers: limit number of events
+@param bulk_factor: multiple of max_events to buffer before compacting (0 keeps a heap on every insert)
 */
 struct PosKmer {
   string kmer;
   vector<Event> events;
   uint64_t max_events;
   bool max_events_set = false;
-  uint64_t num_ignored_kmers;
+  uint64_t num_ignored_kmers = 0;
+  uint64_t bulk_factor = 0;
+  bool finalized = true;
+  bool bulk_threshold_set = false;
+  float bulk_threshold = 0;
 
   PosKmerIndex index;
 
@@ -160,6 +288,12 @@ struct PosKmer {
 //    add one for extra when adding extras
     events.reserve(max_events + 1);
   }
+  PosKmer(string kmer, uint64_t max_events, uint64_t bulk_factor) :
+      kmer(move(kmer)), max_events(move(max_events)), max_events_set(max_events > 0), bulk_factor(bulk_factor) {
+    if (max_events_set){
+      events.reserve(max_events + 1);
+    }
+  }
   PosKmer() {}
   ~PosKmer() = default;
 //  Kmer(const Kmer& mE)            = default;
@@ -169,7 +303,11 @@ struct PosKmer {
       events{other.events},
       max_events{other.max_events},
       max_events_set{other.max_events_set},
-      num_ignored_kmers{other.num_ignored_kmers}        {
+      num_ignored_kmers{other.num_ignored_kmers},
+      bulk_factor{other.bulk_factor},
+      finalized{other.finalized},
+      bulk_threshold_set{other.bulk_threshold_set},
+      bulk_threshold{other.bulk_threshold} {
 //    cout << kmer + ": KMER COPY CONSTRUCTOR" << '\n';
   }
 
@@ -181,6 +319,10 @@ struct PosKmer {
       max_events = other.max_events;
       max_events_set = other.max_events_set;
       num_ignored_kmers = other.num_ignored_kmers;
+      bulk_factor = other.bulk_factor;
+      finalized = other.finalized;
+      bulk_threshold_set = other.bulk_threshold_set;
+      bulk_threshold = other.bulk_threshold;
 //      cout << kmer + ": KMER COPY ASSIGNMENT" << '\n';
     }
     return *this;
@@ -191,7 +333,11 @@ struct PosKmer {
       events{move(other.events)},
       max_events{move(other.max_events)},
       max_events_set{move(other.max_events_set)},
-      num_ignored_kmers{move(other.num_ignored_kmers)} {
+      num_ignored_kmers{move(other.num_ignored_kmers)},
+      bulk_factor{other.bulk_factor},
+      finalized{other.finalized},
+      bulk_threshold_set{other.bulk_threshold_set},
+      bulk_threshold{other.bulk_threshold} {
 //    cout << kmer + ": KMER MOVE CONSTRUCTOR" << '\n';
   }
 
@@ -202,6 +348,10 @@ struct PosKmer {
       max_events = move(other.max_events);
       max_events_set = move(other.max_events_set);
       num_ignored_kmers = move(other.num_ignored_kmers);
+      bulk_factor = other.bulk_factor;
+      finalized = other.finalized;
+      bulk_threshold_set = other.bulk_threshold_set;
+      bulk_threshold = other.bulk_threshold;
 //      cout << kmer + ": KMER MOVE ASSIGNMENT" << '\n';
     }
     return *this;
@@ -212,9 +362,22 @@ struct PosKmer {
 
   @param descaled_event_mean: descaled_event_mean
   @param posterior_probability: posterior_probability
+  @return change in the number of stored events, negative when a bulk compaction drops more than it keeps
   */
-  void add_event(float descaled_event_mean, float posterior_probability) {
-    if (!max_events_set) {
+  int64_t add_event(float descaled_event_mean, float posterior_probability) {
+    uint64_t num_stored = events.size();
+    if (bulk_factor > 0) {
+//    anything not above the smallest kept event after the last compaction can never make the top max_events
+      if (bulk_threshold_set and posterior_probability <= bulk_threshold) {
+        num_ignored_kmers += 1;
+        return 0;
+      }
+      events.emplace_back(descaled_event_mean, posterior_probability);
+      finalized = false;
+      if (max_events_set and events.size() >= bulk_factor * max_events) {
+        this->compact();
+      }
+    } else if (!max_events_set) {
       events.emplace_back(descaled_event_mean, posterior_probability);
       std::push_heap(events.begin(), events.end(), event_greater_than);
     } else {
@@ -236,26 +399,80 @@ struct PosKmer {
         num_ignored_kmers += 1;
       }
     }
+    return (int64_t) events.size() - (int64_t) num_stored;
   }
   /**
   Add an event to the priority queue
 
   @param Event: event already built
+  @return change in the number of stored events
+  */
+  int64_t add_event(Event& event) {
+    return this->add_event(event.descaled_event_mean, event.posterior_probability);
+  }
+
+  /**
+  Keep only the max_events most probable events of the bulk buffer. Order of the kept events is unspecified.
+  */
+  void compact() {
+    if (max_events_set and events.size() > max_events) {
+      std::nth_element(events.begin(), events.begin() + (max_events - 1), events.end(), event_greater_than);
+      num_ignored_kmers += events.size() - max_events;
+      events.resize(max_events);
+      bulk_threshold = events.back().posterior_probability;
+      bulk_threshold_set = true;
+    }
+  }
+
+  /**
+  Compact the bulk buffer and rebuild the heap so events are in the same layout as the per event heap path
+  */
+  void finalize() {
+    if (!finalized) {
+      this->compact();
+      std::make_heap(events.begin(), events.end(), event_greater_than);
+      finalized = true;
+    }
+  }
+
+  /**
+  Replace the events with an already collected batch and apply the max_events cap
+
+  @param new_events: events aligned to this kmer
   */
-  void add_event(Event& event) {
-    this->add_event(event.descaled_event_mean, event.posterior_probability);
+  void set_events(vector<Event> new_events) {
+    events = move(new_events);
+    finalized = false;
+    this->finalize();
   }
+
   /**
   Return the number of events aligned to this kmer
 
   @return: uint64_t number of events
   */
 
-  uint64_t num_events(){
+  uint64_t num_events() const {
+    throw_assert(finalized, "Kmer " + kmer + " must be finalized before its events are read")
     return events.size();
   }
 
-  vector<uint64_t> get_hist(const float& min, const float& max, const uint64_t& steps, const float& threshold=0.0){
+  /**
+  Heap bytes held by the event vector
+  */
+  uint64_t event_memory() const {
+    return vector_memory(events);
+  }
+
+  /**
+  Heap bytes owned by the kmer, including the event vector
+  */
+  uint64_t memory_usage() const {
+    return string_memory(kmer) + this->event_memory() + index.memory_usage();
+  }
+
+  vector<uint64_t> get_hist(const float& min, const float& max, const uint64_t& steps,
+                            const float& threshold=0.0) const {
     vector<uint64_t> counts(steps, 0);
     get_hist(counts, min, max, steps, threshold);
     return counts;
@@ -265,7 +482,8 @@ struct PosKmer {
                 const float& min,
                 const float& max,
                 const uint64_t& steps,
-                const float& threshold=0.0){
+                const float& threshold=0.0) const {
+    throw_assert(finalized, "Kmer " + kmer + " must be finalized before its events are read")
     throw_assert(counts.size() == steps,
         "Must pass in correctly sized vector. counts size:"+
         to_string(counts.size())+" n_steps:"+to_string(steps))
@@ -348,6 +566,28 @@ struct Kmer {
     return csp;
   }
 
+  /**
+  Drop every PosKmer so the kmer can be read again
+  */
+  void clear(){
+    unordered_map<string, shared_ptr<PosKmer>>().swap(pos_kmer_map);
+    vector<tuple<string, uint64_t>>().swap(contig_positions);
+  }
+
+  /**
+  Heap bytes owned by the kmer. PosKmers are owned by their Position so only the pointers are counted
+  */
+  uint64_t memory_usage() const {
+    uint64_t bytes = string_memory(kmer) + unordered_map_memory(pos_kmer_map) + vector_memory(contig_positions);
+    for (auto &pos_kmer: pos_kmer_map){
+      bytes += string_memory(pos_kmer.first);
+    }
+    for (auto &contig_position: contig_positions){
+      bytes += string_memory(std::get<0>(contig_position));
+    }
+    return bytes;
+  }
+
 };
 
 class ByKmer {
@@ -390,12 +630,34 @@ class ByKmer {
     return kmer_map.find(kmer) != kmer_map.end();
   }
 
+  uint64_t memory_usage() const {
+    uint64_t bytes = unordered_map_memory(kmer_map);
+    for (auto &kmer_pair: kmer_map){
+      bytes += string_memory(kmer_pair.first) + kmer_pair.second.memory_usage();
+    }
+    return bytes;
+  }
+
  private:
   unordered_map<string, Kmer> kmer_map;
 
 };
 
 
+/**
+Effect of adding one event to a Position, so callers can keep counters up to date without walking the position
+
+@param stored_events: change in the number of stored events, see PosKmer::add_event
+@param event_bytes: change in the heap bytes held by the event vector
+@param pos_kmer_bytes: heap bytes of a newly created PosKmer, its key and its node in the position map (0 if the
+  kmer was already at the position)
+*/
+struct KmerEventChange {
+  int64_t stored_events = 0;
+  int64_t event_bytes = 0;
+  uint64_t pos_kmer_bytes = 0;
+};
+
 /**
 Data structure for keeping track of kmers aligned to a position
 
@@ -409,6 +671,8 @@ struct Position
   uint64_t position;
   bool has_data = false;
   bool populated = false;
+//  already streamed to an event file, so no more events may be added
+  bool flushed = false;
   Position(uint64_t position) :
       position(move(position))
   {}
@@ -445,18 +709,63 @@ struct Position
   Add event to kmer or create and add kmer data structure
 
   @param kmer: kmer string
-  @param event: Event data structure
+  @param descaled_event_mean: descaled_event_mean
+  @param posterior_probability: posterior_probability
+  @param max_events: cap on events kept for a newly created kmer (0 keeps all events)
+  @param bulk_factor: bulk mode buffer multiple for a newly created kmer (0 keeps a heap on every insert)
+  @return changes to the stored events and heap bytes of the position
   */
-  void soft_add_kmer_event(string kmer, const float &descaled_event_mean, const float &posterior_probability){
+  KmerEventChange soft_add_kmer_event(string kmer, const float &descaled_event_mean,
+                                      const float &posterior_probability, const uint64_t &max_events=0,
+                                      const uint64_t &bulk_factor=0){
+    KmerEventChange change;
     auto search = kmers.find(kmer);
     if (search != kmers.end()) {
-      kmers[kmer]->add_event(descaled_event_mean, posterior_probability);
+      uint64_t event_bytes = search->second->event_memory();
+      change.stored_events = search->second->add_event(descaled_event_mean, posterior_probability);
+      change.event_bytes = (int64_t) search->second->event_memory() - (int64_t) event_bytes;
     } else {
-      shared_ptr<PosKmer> kmer1 = make_shared<PosKmer>(kmer);
-      kmer1->add_event(descaled_event_mean, posterior_probability);
-      kmers.insert({move(kmer), move(kmer1)});
+      uint64_t map_bytes = unordered_map_memory(kmers);
+      shared_ptr<PosKmer> kmer1 = make_shared<PosKmer>(kmer, max_events, bulk_factor);
+      change.stored_events = kmer1->add_event(descaled_event_mean, posterior_probability);
+      change.event_bytes = kmer1->event_memory();
+      auto inserted = kmers.insert({move(kmer), move(kmer1)});
+      change.pos_kmer_bytes = unordered_map_memory(kmers) - map_bytes + string_memory(inserted.first->first) +
+          make_shared_memory<PosKmer>() + inserted.first->second->memory_usage() - change.event_bytes;
     }
     has_data = true;
+    return change;
+  }
+
+  /**
+  Drop all kmers and events so the position can be refilled
+  */
+  void clear(){
+    unordered_map<string, shared_ptr<PosKmer>>().swap(kmers);
+    has_data = false;
+    populated = false;
+  }
+
+  /**
+  Heap bytes owned by the position, including the PosKmers and their events
+  */
+  uint64_t memory_usage() const {
+    uint64_t bytes = unordered_map_memory(kmers);
+    for (auto &kmer_pair: kmers){
+      bytes += string_memory(kmer_pair.first) + make_shared_memory<PosKmer>() + kmer_pair.second->memory_usage();
+    }
+    return bytes;
+  }
+
+  /**
+  Heap bytes held by the event vectors of the position's PosKmers
+  */
+  uint64_t event_memory() const {
+    uint64_t bytes = 0;
+    for (auto &kmer_pair: kmers){
+      bytes += kmer_pair.second->event_memory();
+    }
+    return bytes;
   }
 
   /**
@@ -484,6 +793,15 @@ struct Position
     return v;
   }
 
+  /**
+  Finalize every kmer at the position, see PosKmer::finalize
+  */
+  void finalize(){
+    for (auto &kmer_pair: kmers){
+      kmer_pair.second->finalize();
+    }
+  }
+
   vector<shared_ptr<PosKmer>> get_kmer_pointers(){
     vector<shared_ptr<PosKmer>> v;
     for (auto i : kmers) {
@@ -517,6 +835,15 @@ class ContigStrandIndex {
 //  PosKmerIndex& get_kmer_index(const uint64_t& position, const string& kmer) {
 //    return get_position_index(position).get_kmer_index(kmer);
 //  }
+
+  uint64_t memory_usage() const {
+    uint64_t bytes = string_memory(contig) + string_memory(strand) + string_memory(nanopore_strand) +
+        unordered_map_memory(position_indexes);
+    for (auto &pos_pair: position_indexes){
+      bytes += pos_pair.second.memory_usage();
+    }
+    return bytes;
+  }
 };
 
 
@@ -604,6 +931,29 @@ struct ContigStrand
                      + to_string(position) + " num_positions: "+ to_string(num_positions));
     positions[position].soft_add_kmer_event(kmer, event);
   }
+
+  /**
+  Heap bytes owned by the contig strand, including every position, PosKmer and event
+  */
+  uint64_t memory_usage() const {
+    uint64_t bytes = string_memory(contig) + string_memory(strand) + string_memory(nanopore_strand) +
+        vector_memory(positions);
+    for (auto &position: positions){
+      bytes += position.memory_usage();
+    }
+    return bytes;
+  }
+
+  /**
+  Heap bytes held by event vectors of the contig strand
+  */
+  uint64_t event_memory() const {
+    uint64_t bytes = 0;
+    for (auto &position: positions){
+      bytes += position.event_memory();
+    }
+    return bytes;
+  }
 };
 
 
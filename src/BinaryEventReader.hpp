@@ -8,13 +8,62 @@
 
 // embed libs
 #include "BinaryEventWriter.hpp"
+#include "EventFileFormat.hpp"
 #include <utility>
+#include <memory>
+#include <algorithm>
+#include <numeric>
 
 using namespace std;
 using namespace embed_utils;
 using namespace boost::filesystem;
 using namespace std;
 
+/**
+Events of every kmer in a region as flat arrays. The events of kmer row i are
+[event_offsets[i], event_offsets[i + 1]) in descaled_event_means and posterior_probabilities.
+
+@param positions: reference position of each kmer row, ascending
+@param kmers: kmer of each kmer row, sorted within a position
+@param event_offsets: first event of each kmer row followed by the total number of events
+@param num_byte_ranges: number of contiguous payload ranges the region was read with
+*/
+struct RegionEvents {
+  vector<uint64_t> positions;
+  vector<string> kmers;
+  vector<uint64_t> event_offsets{0};
+  vector<float> descaled_event_means;
+  vector<float> posterior_probabilities;
+  uint64_t num_byte_ranges = 0;
+
+  uint64_t num_kmers() const {
+    return kmers.size();
+  }
+
+  uint64_t num_events() const {
+    return descaled_event_means.size();
+  }
+
+  void clear(){
+    positions.clear();
+    kmers.clear();
+    event_offsets.assign(1, 0);
+    descaled_event_means.clear();
+    posterior_probabilities.clear();
+    num_byte_ranges = 0;
+  }
+
+  void add_kmer(const uint64_t& position, const string& kmer, const vector<Event>& events){
+    positions.push_back(position);
+    kmers.push_back(kmer);
+    for (auto &event: events){
+      descaled_event_means.push_back(event.descaled_event_mean);
+      posterior_probabilities.push_back(event.posterior_probability);
+    }
+    event_offsets.push_back(descaled_event_means.size());
+  }
+};
+
 
 class BinaryEventReader {
  public:
@@ -45,29 +94,46 @@ class BinaryEventReader {
     // Find file size in bytes
     this->file_length = lseek(this->sequence_file_descriptor, 0, SEEK_END);
 
-    // Initialize remaining parameters using the file footer data
-    this->read_footer();
+    if (this->has_flat_index()){
+      // Version 2 tables are used in place from a mapping of the file
+      this->version = EVENT_FILE_VERSION;
+      this->read_flat_indexes();
+    } else {
+      // Initialize remaining parameters using the file footer data
+      this->read_footer();
 
-    // Read table of contents, needed for indexed reading
-    this->read_indexes();
+      // Read table of contents, needed for indexed reading
+      this->read_indexes();
+    }
   }
 
   void close() {
-    if (this->initialized){
+    if (this->initialized and this->sequence_file_descriptor >= 0){
+      this->file_region.reset();
       ::close(sequence_file_descriptor);
+      this->sequence_file_descriptor = -1;
     }
   }
 
   shared_ptr<PosKmer> get_position_kmer(const string& kmer, const string& contig_name, const string& strand,
                          const uint64_t& position, const string nanopore_strand= "t"){
-    shared_ptr<PosKmerIndex> ki = this->get_pos_kmer_index(contig_name, strand, nanopore_strand, position, kmer);
     shared_ptr<PosKmer> kmer_struct = make_shared<PosKmer>();
+    if (version == EVENT_FILE_VERSION){
+      uint64_t position_row = this->find_position_row(contig_name, strand, nanopore_strand, position);
+      this->read_kmer_row(*kmer_struct, this->find_kmer_row(position_row, kmer));
+      return kmer_struct;
+    }
+    shared_ptr<PosKmerIndex> ki = this->get_pos_kmer_index(contig_name, strand, nanopore_strand, position, kmer);
     get_position_kmer(kmer_struct, ki);
     return kmer_struct;
   }
 
   void get_position_kmer(shared_ptr<PosKmer> kmer_struct, shared_ptr<PosKmerIndex> ki){
     kmer_struct->kmer = ki->name;
+    if (version == EVENT_FILE_VERSION){
+      this->read_kmer_payload(*kmer_struct, ki->sequence_byte_index, ki->sequence_byte_length, ki->sequence_length);
+      return;
+    }
     off_t byte_index = ki->sequence_byte_index;
     uint64_t sequence_length = ki->sequence_length;
     kmer_struct->events.reserve(sequence_length);
@@ -77,18 +143,46 @@ class BinaryEventReader {
 
   void get_position(Position& position_struct, const string& contig_name, const string& strand,
                 const uint64_t& position, const string nanopore_strand="t"){
+    if (version == EVENT_FILE_VERSION){
+      const EventFilePositionRecord& record =
+          this->position_record(this->find_position_row(contig_name, strand, nanopore_strand, position));
+      vector<pair<uint64_t, uint64_t>> ranges;
+      for (uint64_t row = record.first_kmer_row; row < record.first_kmer_row + record.num_kmers; ++row){
+        ranges.emplace_back(this->kmer_record(row).byte_offset, this->kmer_record(row).byte_length);
+      }
+      this->prefetch_payloads(ranges);
+      for (uint64_t row = record.first_kmer_row; row < record.first_kmer_row + record.num_kmers; ++row){
+        string kmer = packer.unpack(this->kmer_record(row).kmer);
+        if (!position_struct.has_kmer(kmer)){
+          shared_ptr<PosKmer> k = make_shared<PosKmer>();
+          this->read_kmer_row(*k, row);
+          position_struct.add_kmer(k);
+        }
+        position_struct.populated = true;
+      }
+      return;
+    }
     PositionIndex& pi = this->get_position_index(contig_name, strand, nanopore_strand, position);
     vector<string> kmers= pi.get_kmers();
+    vector<shared_ptr<PosKmer>> kmer_structs;
+    vector<ReadRequest> requests;
     for (auto &kmer: kmers){
       if (!position_struct.has_kmer(kmer)){
-        shared_ptr<PosKmer> k = get_position_kmer(kmer, contig_name, strand, position, nanopore_strand);
-        position_struct.add_kmer(k);
+        kmer_structs.push_back(make_shared<PosKmer>());
+        this->add_read_request(*kmer_structs.back(), *pi.kmer_indexes.at(kmer), requests);
       }
+    }
+    pread_batch(this->sequence_file_descriptor, requests);
+    for (auto &k: kmer_structs){
+      position_struct.add_kmer(k);
+    }
+    if (!kmers.empty()){
       position_struct.populated = true;
     }
   }
 
   ContigStrandIndex& get_contig_index(const string& contig, const string& strand, const string& nanopore_strand){
+    this->load_indexes();
     string contig_strand = contig+strand+nanopore_strand;
     auto found = indexes.find(contig_strand);
     if (found != indexes.end()) {
@@ -108,31 +202,260 @@ class BinaryEventReader {
   }
 
   KmerIndex& get_kmer_index(const string& kmer){
+    this->load_indexes();
     return kmer_map.get_kmer_index(kmer);
   }
 
   bool has_kmer_index(const string& kmer){
+    if (version == EVENT_FILE_VERSION){
+      pair<uint64_t, uint64_t> rows = this->find_by_kmer_rows(kmer);
+      return rows.first != rows.second;
+    }
     return kmer_map.has_kmer_index(kmer);
   }
 
+  /**
+  Number of contig strand positions which have events for a kmer
+  */
+  uint64_t num_kmer_positions(const string& kmer){
+    if (version == EVENT_FILE_VERSION){
+      pair<uint64_t, uint64_t> rows = this->find_by_kmer_rows(kmer);
+      if (rows.first == rows.second){
+        throw runtime_error(kmer + " was not found in kmer index map");
+      }
+      return rows.second - rows.first;
+    }
+    return kmer_map.get_kmer_index(kmer).positions.size();
+  }
+
+  /**
+  Build the contig strand and by kmer indexes from the tables of a version 2 file. Version 1 files always have them.
+  Only the legacy accessors which hand out index references need this, every other query is answered from the
+  tables directly.
+  */
+  void load_indexes(){
+    if (version != EVENT_FILE_VERSION or indexes_loaded){
+      return;
+    }
+    indexes_loaded = true;
+    for (uint64_t contig_row = 0; contig_row < footer.num_contig_strands; ++contig_row){
+      const EventFileContigRecord& contig_record = contig_table[contig_row];
+      ContigStrandIndex index_element;
+      index_element.contig = this->contig_name(contig_record);
+      index_element.contig_string_length = contig_record.name_length;
+      index_element.strand = string(1, contig_record.strand);
+      index_element.nanopore_strand = string(1, contig_record.nanopore_strand);
+      index_element.num_positions = contig_record.num_positions;
+      index_element.num_written_positions = contig_record.num_written_positions;
+      index_element.position_indexes.reserve(contig_record.num_written_positions);
+      string contig_strand = index_element.contig+index_element.strand+index_element.nanopore_strand;
+      for (uint64_t i = 0; i < contig_record.num_written_positions; ++i){
+        const EventFilePositionRecord& record = this->position_record(contig_record.first_position_row + i);
+        PositionIndex pi;
+        pi.position = record.position;
+        pi.num_kmers = record.num_kmers;
+        pi.kmer_indexes.reserve(record.num_kmers);
+        for (uint64_t row = record.first_kmer_row; row < record.first_kmer_row + record.num_kmers; ++row){
+          const EventFileKmerRecord& kmer_record = this->kmer_record(row);
+          std::shared_ptr<PosKmerIndex> p = std::make_shared<PosKmerIndex>();
+          p->name = packer.unpack(kmer_record.kmer);
+          p->name_length = p->name.size();
+          p->sequence_byte_index = kmer_record.byte_offset;
+          p->sequence_length = kmer_record.num_events;
+          p->sequence_byte_length = kmer_record.byte_length;
+          kmer_map.add_kmer_index_ptr(contig_strand, pi.position, p);
+          pi.kmer_indexes.emplace(p->name, p);
+        }
+        index_element.position_indexes.emplace(pi.position, move(pi));
+      }
+      indexes.emplace(contig_strand, move(index_element));
+    }
+  }
+
+  /**
+  Heap bytes held by the contig strand and by kmer indexes read from the file footer
+  */
+  uint64_t index_memory_usage() const {
+    uint64_t bytes = unordered_map_memory(indexes) + kmer_map.memory_usage();
+    if (file_region and !file_region->is_mapped()){
+      bytes += file_buffer.length;
+    }
+    for (auto &cs_pair: indexes){
+      bytes += string_memory(cs_pair.first) + cs_pair.second.memory_usage();
+    }
+    return bytes;
+  }
+
+  /**
+  Attributes of every contig strand in the file sorted by (contig, strand, nanopore strand). Position indexes are
+  not filled in.
+  */
+  vector<ContigStrandIndex> get_contig_strands(){
+    vector<ContigStrandIndex> contig_strands;
+    auto add = [&contig_strands](const string& contig, const string& strand, const string& nanopore_strand,
+                                 const uint64_t& num_positions, const uint64_t& num_written_positions){
+      ContigStrandIndex index;
+      index.contig = contig;
+      index.contig_string_length = contig.size();
+      index.strand = strand;
+      index.nanopore_strand = nanopore_strand;
+      index.num_positions = num_positions;
+      index.num_written_positions = num_written_positions;
+      contig_strands.push_back(move(index));
+    };
+    if (version == EVENT_FILE_VERSION){
+      for (uint64_t row = 0; row < footer.num_contig_strands; ++row){
+        const EventFileContigRecord& record = contig_table[row];
+        add(this->contig_name(record), string(1, record.strand), string(1, record.nanopore_strand),
+            record.num_positions, record.num_written_positions);
+      }
+    } else {
+      for (auto &cs_pair: indexes){
+        const ContigStrandIndex& index = cs_pair.second;
+        add(index.contig, index.strand, index.nanopore_strand, index.num_positions, index.num_written_positions);
+      }
+      sort(contig_strands.begin(), contig_strands.end(), [](const ContigStrandIndex& a, const ContigStrandIndex& b){
+        return std::tie(a.contig, a.strand, a.nanopore_strand) < std::tie(b.contig, b.strand, b.nanopore_strand);
+      });
+    }
+    return contig_strands;
+  }
+
+  /**
+  Sorted positions written for a contig strand
+  */
+  vector<uint64_t> get_written_positions(const string& contig, const string& strand, const string& nanopore_strand){
+    vector<uint64_t> positions;
+    if (version == EVENT_FILE_VERSION){
+      const EventFileContigRecord& record = this->find_contig_record(contig, strand, nanopore_strand);
+      positions.reserve(record.num_written_positions);
+      for (uint64_t row = record.first_position_row; row < record.first_position_row + record.num_written_positions;
+           ++row){
+        positions.push_back(position_table[row].position);
+      }
+      return positions;
+    }
+    ContigStrandIndex& index = this->get_contig_index(contig, strand, nanopore_strand);
+    positions.reserve(index.position_indexes.size());
+    for (auto &pi_pair: index.position_indexes){
+      positions.push_back(pi_pair.first);
+    }
+    sort(positions.begin(), positions.end());
+    return positions;
+  }
+
   void populate_kmer(Kmer& kmer){
+    if (version == EVENT_FILE_VERSION){
+      pair<uint64_t, uint64_t> rows = this->find_by_kmer_rows(kmer.kmer);
+      if (rows.first == rows.second){
+        throw runtime_error(kmer.kmer + " was not found in kmer index map");
+      }
+      kmer.pos_kmer_map.reserve(rows.second - rows.first);
+      if (kmer_major){
+//        every event of the kmer is one contiguous range
+        uint64_t begin = kmer_major_offsets[rows.first];
+        uint64_t end = kmer_major_offsets[rows.second];
+        throw_assert(begin >= kmer_major_footer.payload_offset and begin <= end and
+                         end - kmer_major_footer.payload_offset <= kmer_major_footer.payload_length,
+                     "ERROR: corrupt kmer major offsets in events file: " + this->sequence_file_path)
+        this->file_region->advise(begin, end - begin, MADV_WILLNEED);
+      } else {
+        vector<pair<uint64_t, uint64_t>> ranges;
+        for (uint64_t i = rows.first; i < rows.second; ++i){
+          const EventFileKmerRecord& record = this->kmer_record(by_kmer_table[i].kmer_row);
+          ranges.emplace_back(record.byte_offset, record.byte_length);
+        }
+        this->prefetch_payloads(ranges);
+      }
+      for (uint64_t i = rows.first; i < rows.second; ++i){
+        const EventFileByKmerRecord& by_kmer_record = by_kmer_table[i];
+        const EventFilePositionRecord& record = this->position_record(by_kmer_record.position_row);
+        throw_assert(record.contig_row < footer.num_contig_strands,
+                     "ERROR: corrupt position table in events file: " + this->sequence_file_path)
+        const EventFileContigRecord& contig_record = contig_table[record.contig_row];
+        string contig_strand = this->contig_name(contig_record) + contig_record.strand + contig_record.nanopore_strand;
+        if (!kmer.has_pos_kmer(contig_strand, record.position)) {
+          shared_ptr<PosKmer> ptr = make_shared<PosKmer>();
+          if (kmer_major){
+            this->read_kmer_major_row(*ptr, i);
+          } else {
+            this->read_kmer_row(*ptr, by_kmer_record.kmer_row);
+          }
+          kmer.add_pos_kmer(contig_strand, record.position, ptr);
+        }
+      }
+      return;
+    }
     KmerIndex& kmer_index = this->get_kmer_index(kmer.kmer);
     uint64_t size = kmer_index.kmer_index_ptrs.size();
     kmer.pos_kmer_map.reserve(size);
-//    kmer.positions.reserve(size);
-//    kmer.contig_strands.reserve(size);
-//    vector<shared_ptr<PosKmer>> kmer_struct(size);
+    vector<uint64_t> missing;
+    vector<shared_ptr<PosKmer>> kmer_structs;
+    vector<ReadRequest> requests;
     for (uint64_t i = 0; i < size; ++i){
-      uint64_t& pos = kmer_index.positions[i];
-      string& contig_strand = kmer_index.contig_strands[i];
       //      look for pos and contig strand
-      if (!kmer.has_pos_kmer(contig_strand, pos)) {
-//      if both are not found then
-        shared_ptr<PosKmer> ptr = make_shared<PosKmer>();
-        get_position_kmer(ptr, kmer_index.kmer_index_ptrs[i]);
-        kmer.add_pos_kmer(contig_strand, pos, ptr);
+      if (!kmer.has_pos_kmer(kmer_index.contig_strands[i], kmer_index.positions[i])) {
+        missing.push_back(i);
+        kmer_structs.push_back(make_shared<PosKmer>());
+        this->add_read_request(*kmer_structs.back(), *kmer_index.kmer_index_ptrs[i], requests);
+      }
+    }
+//    every missing position is read in one batch straight into its PosKmer
+    pread_batch(this->sequence_file_descriptor, requests);
+    for (uint64_t j = 0; j < missing.size(); ++j){
+      kmer.add_pos_kmer(kmer_index.contig_strands[missing[j]], kmer_index.positions[missing[j]], kmer_structs[j]);
+    }
+  }
+
+
+  /**
+  Read every kmer event in [start, end) of a contig strand. Payloads are laid out in position order, so the kmers of
+  a region are read with one request per contiguous byte range instead of one per kmer.
+
+  @param region: output events, cleared first
+  */
+  void query_region(RegionEvents& region, const string& contig_name, const string& strand, const uint64_t& start,
+                    const uint64_t& end, const string nanopore_strand="t"){
+    region.clear();
+    vector<RegionPayload> payloads;
+    if (version == EVENT_FILE_VERSION){
+      const EventFileContigRecord& contig_record = this->find_contig_record(contig_name, strand, nanopore_strand);
+      const EventFilePositionRecord* first = position_table + contig_record.first_position_row;
+      const EventFilePositionRecord* last = first + contig_record.num_written_positions;
+      const EventFilePositionRecord* found = std::lower_bound(first, last, start,
+          [](const EventFilePositionRecord& record, const uint64_t& p){ return record.position < p; });
+      for (; found != last and found->position < end; ++found){
+        const EventFilePositionRecord& record = this->position_record(found - position_table);
+        for (uint64_t row = record.first_kmer_row; row < record.first_kmer_row + record.num_kmers; ++row){
+          const EventFileKmerRecord& kmer_record = this->kmer_record(row);
+          this->check_kmer_payload(kmer_record.byte_offset, kmer_record.byte_length, kmer_record.num_events);
+          payloads.push_back({record.position, packer.unpack(kmer_record.kmer), kmer_record.byte_offset,
+                              kmer_record.byte_length, kmer_record.num_events});
+        }
+      }
+    } else {
+      ContigStrandIndex& contig_index = this->get_contig_index(contig_name, strand, nanopore_strand);
+      vector<uint64_t> positions;
+      for (auto &pi_pair: contig_index.position_indexes){
+        if (pi_pair.first >= start and pi_pair.first < end){
+          positions.push_back(pi_pair.first);
+        }
+      }
+      sort(positions.begin(), positions.end());
+      for (auto &position: positions){
+        vector<string> kmers = contig_index.position_indexes.at(position).get_kmers();
+        sort(kmers.begin(), kmers.end());
+        for (auto &kmer: kmers){
+          shared_ptr<PosKmerIndex> ki = contig_index.position_indexes.at(position).kmer_indexes.at(kmer);
+          throw_assert(ki->sequence_byte_index <= indexes_start_position and
+                           ki->sequence_byte_length <= indexes_start_position - ki->sequence_byte_index,
+                       "ERROR: corrupt kmer index in events file: " + this->sequence_file_path)
+          payloads.push_back({position, kmer, ki->sequence_byte_index, ki->sequence_byte_length,
+                              ki->sequence_length});
+        }
       }
     }
+    this->read_region_payloads(payloads, region);
   }
 
 
@@ -145,6 +468,9 @@ class BinaryEventReader {
   string alphabet_string;
   bool rna = false;
   bool two_d = false;
+  uint64_t version = 1;
+  bool compressed = false;
+  bool kmer_major = false;
 
   bool initialized = false;
 
@@ -152,25 +478,378 @@ class BinaryEventReader {
 
   /// Attributes ///
   string sequence_file_path;
-  int sequence_file_descriptor;
+  int sequence_file_descriptor = -1;
+  // version 2 tables, pointing into the mapped file
+  unique_ptr<MappedRegion> file_region;
+  BinaryBuffer file_buffer{nullptr, 0};
+  EventFileFooter footer{};
+  uint64_t footer_offset = 0;
+  const EventFileContigRecord* contig_table = nullptr;
+  const EventFilePositionRecord* position_table = nullptr;
+  const EventFileKmerRecord* kmer_table = nullptr;
+  const EventFileByKmerRecord* by_kmer_table = nullptr;
+  EventFileKmerMajorFooter kmer_major_footer{};
+  const uint64_t* kmer_major_offsets = nullptr;
+  KmerPacker packer;
+  bool indexes_loaded = false;
 
   uint64_t indexes_start_position;
   off_t file_length;
 
+  struct RegionPayload {
+    uint64_t position;
+    string kmer;
+    uint64_t byte_offset;
+    uint64_t byte_length;
+    uint64_t num_events;
+  };
+
   /// Methods ///
+  bool has_flat_index(){
+    if (uint64_t(this->file_length) < sizeof(EventFileHeader) + sizeof(EventFileTrailer)){
+      return false;
+    }
+    EventFileTrailer trailer{};
+    off_t byte_index = off_t(this->file_length - sizeof(EventFileTrailer));
+    pread_value_from_binary(this->sequence_file_descriptor, trailer, byte_index);
+    return is_event_file_magic(trailer.magic);
+  }
+
+  bool table_in_bounds(const uint64_t& offset, const uint64_t& num_rows, const uint64_t& row_size,
+                       const uint64_t& end) const {
+    return offset % sizeof(uint64_t) == 0 and offset <= end and num_rows <= (end - offset) / row_size;
+  }
+
+  /**
+  Map the file and check the version 2 header, footer and table bounds. Rows are checked when they are used.
+  */
+  void read_flat_indexes(){
+    this->file_region.reset(new MappedRegion(this->sequence_file_descriptor, 0, this->file_length, MADV_RANDOM));
+    this->file_buffer = this->file_region->buffer();
+    EventFileHeader header{};
+    EventFileTrailer trailer{};
+    uint64_t byte_index = 0;
+    memread_value_from_binary(this->file_buffer, header, byte_index);
+    throw_assert(is_event_file_magic(header.magic), "ERROR: corrupt header in events file: " + this->sequence_file_path)
+    throw_assert(header.version == EVENT_FILE_VERSION,
+                 "ERROR: unsupported events file version " + to_string(header.version) + ": " + this->sequence_file_path)
+    this->compressed = (header.flags & EVENT_FILE_COMPRESSED) != 0;
+    this->kmer_major = (header.flags & EVENT_FILE_KMER_MAJOR) != 0;
+    uint64_t tables_end = this->file_buffer.length - sizeof(EventFileTrailer);
+    byte_index = tables_end;
+    memread_value_from_binary(this->file_buffer, trailer, byte_index);
+    throw_assert(trailer.footer_offset >= sizeof(EventFileHeader) and
+                     table_in_bounds(trailer.footer_offset, 1, sizeof(EventFileFooter), tables_end),
+                 "ERROR: footer is past the end of events file: " + this->sequence_file_path)
+    this->footer_offset = trailer.footer_offset;
+    byte_index = trailer.footer_offset;
+    memread_value_from_binary(this->file_buffer, this->footer, byte_index);
+    throw_assert(table_in_bounds(footer.contig_table_offset, footer.num_contig_strands,
+                                 sizeof(EventFileContigRecord), tables_end) and
+                     table_in_bounds(footer.string_pool_offset, footer.string_pool_length, 1, tables_end) and
+                     table_in_bounds(footer.position_table_offset, footer.num_positions,
+                                     sizeof(EventFilePositionRecord), tables_end) and
+                     table_in_bounds(footer.kmer_table_offset, footer.num_kmers,
+                                     sizeof(EventFileKmerRecord), tables_end) and
+                     table_in_bounds(footer.by_kmer_table_offset, footer.num_kmers,
+                                     sizeof(EventFileByKmerRecord), tables_end) and
+                     this->in_string_pool(footer.alphabet_offset, footer.alphabet_length),
+                 "ERROR: index tables are past the end of events file: " + this->sequence_file_path)
+    this->contig_table = reinterpret_cast<const EventFileContigRecord*>(file_buffer.data + footer.contig_table_offset);
+    this->position_table =
+        reinterpret_cast<const EventFilePositionRecord*>(file_buffer.data + footer.position_table_offset);
+    this->kmer_table = reinterpret_cast<const EventFileKmerRecord*>(file_buffer.data + footer.kmer_table_offset);
+    this->by_kmer_table =
+        reinterpret_cast<const EventFileByKmerRecord*>(file_buffer.data + footer.by_kmer_table_offset);
+    if (kmer_major){
+      byte_index = trailer.footer_offset + sizeof(EventFileFooter);
+      memread_value_from_binary(this->file_buffer, this->kmer_major_footer, byte_index);
+      throw_assert(kmer_major_footer.payload_offset >= sizeof(EventFileHeader) and
+                       kmer_major_footer.payload_offset <= footer_offset and
+                       kmer_major_footer.payload_length <= footer_offset - kmer_major_footer.payload_offset and
+                       table_in_bounds(kmer_major_footer.offset_table_offset, footer.num_kmers + 1,
+                                       sizeof(uint64_t), tables_end),
+                   "ERROR: kmer major payloads are past the end of events file: " + this->sequence_file_path)
+      this->kmer_major_offsets =
+          reinterpret_cast<const uint64_t*>(file_buffer.data + kmer_major_footer.offset_table_offset);
+    }
+    for (uint64_t row = 0; row < footer.num_contig_strands; ++row){
+      const EventFileContigRecord& record = contig_table[row];
+      throw_assert(this->in_string_pool(record.name_offset, record.name_length) and
+                       record.first_position_row <= footer.num_positions and
+                       record.num_written_positions <= footer.num_positions - record.first_position_row,
+                   "ERROR: corrupt contig table in events file: " + this->sequence_file_path)
+    }
+
+    this->kmer_length = footer.kmer_length;
+    this->alphabet_length = footer.alphabet_length;
+    this->alphabet_string = string(file_buffer.data + footer.alphabet_offset, footer.alphabet_length);
+    this->alphabet = string_to_char_set(this->alphabet_string);
+    this->rna = footer.rna != 0;
+    this->two_d = footer.two_d != 0;
+    this->packer = KmerPacker(this->alphabet, this->kmer_length);
+  }
+
+  bool in_string_pool(const uint64_t& offset, const uint64_t& length) const {
+    return offset >= footer.string_pool_offset and length <= footer.string_pool_length and
+        offset - footer.string_pool_offset <= footer.string_pool_length - length;
+  }
+
+  string contig_name(const EventFileContigRecord& record) const {
+    return string(file_buffer.data + record.name_offset, record.name_length);
+  }
+
+  /**
+  Compare a contig table row with a contig strand in the order the writer sorted the table
+  */
+  int compare_contig_record(const EventFileContigRecord& record, const string& contig, const char& strand,
+                            const char& nanopore_strand) const {
+    int compare = std::memcmp(file_buffer.data + record.name_offset, contig.data(),
+                              std::min(record.name_length, (uint64_t) contig.size()));
+    if (compare != 0) return compare;
+    if (record.name_length != contig.size()) return record.name_length < contig.size() ? -1 : 1;
+    if (record.strand != strand) return (unsigned char) record.strand < (unsigned char) strand ? -1 : 1;
+    if (record.nanopore_strand != nanopore_strand){
+      return (unsigned char) record.nanopore_strand < (unsigned char) nanopore_strand ? -1 : 1;
+    }
+    return 0;
+  }
+
+  const EventFileContigRecord& find_contig_record(const string& contig, const string& strand,
+                                                  const string& nanopore_strand) const {
+    if (strand.size() == 1 and nanopore_strand.size() == 1){
+      uint64_t low = 0;
+      uint64_t high = footer.num_contig_strands;
+      while (low < high){
+        uint64_t middle = low + (high - low) / 2;
+        int compare = this->compare_contig_record(contig_table[middle], contig, strand[0], nanopore_strand[0]);
+        if (compare == 0){
+          return contig_table[middle];
+        } else if (compare < 0){
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+    }
+    throw runtime_error(contig+strand+nanopore_strand + " was not found in indexes");
+  }
+
+  const EventFilePositionRecord& position_record(const uint64_t& row) const {
+    throw_assert(row < footer.num_positions, "ERROR: position row is past the end of the position table: " +
+        this->sequence_file_path)
+    const EventFilePositionRecord& record = position_table[row];
+    throw_assert(record.first_kmer_row <= footer.num_kmers and
+                     record.num_kmers <= footer.num_kmers - record.first_kmer_row,
+                 "ERROR: corrupt position table in events file: " + this->sequence_file_path)
+    return record;
+  }
+
+  const EventFileKmerRecord& kmer_record(const uint64_t& row) const {
+    throw_assert(row < footer.num_kmers, "ERROR: kmer row is past the end of the kmer table: " +
+        this->sequence_file_path)
+    return kmer_table[row];
+  }
+
+  uint64_t find_position_row(const string& contig, const string& strand, const string& nanopore_strand,
+                             const uint64_t& position) const {
+    const EventFileContigRecord& contig_record = this->find_contig_record(contig, strand, nanopore_strand);
+    const EventFilePositionRecord* first = position_table + contig_record.first_position_row;
+    const EventFilePositionRecord* last = first + contig_record.num_written_positions;
+    const EventFilePositionRecord* found = std::lower_bound(first, last, position,
+        [](const EventFilePositionRecord& record, const uint64_t& p){ return record.position < p; });
+    if (found == last or found->position != position){
+      throw runtime_error(to_string(position) + " was not found in position index map");
+    }
+    return found - position_table;
+  }
+
+  uint64_t find_kmer_row(const uint64_t& position_row, const string& kmer) const {
+    const EventFilePositionRecord& record = this->position_record(position_row);
+    uint64_t packed = 0;
+    if (packer.try_pack(kmer, packed)){
+      const EventFileKmerRecord* first = kmer_table + record.first_kmer_row;
+      const EventFileKmerRecord* last = first + record.num_kmers;
+      const EventFileKmerRecord* found = std::lower_bound(first, last, packed,
+          [](const EventFileKmerRecord& k, const uint64_t& p){ return k.kmer < p; });
+      if (found != last and found->kmer == packed){
+        return found - kmer_table;
+      }
+    }
+    throw runtime_error(kmer + " was not found in kmer index map");
+  }
+
+  /**
+  Range of by kmer table rows holding a kmer
+  */
+  pair<uint64_t, uint64_t> find_by_kmer_rows(const string& kmer) const {
+    uint64_t packed = 0;
+    if (!packer.try_pack(kmer, packed)){
+      return make_pair(0, 0);
+    }
+    const EventFileByKmerRecord* first = by_kmer_table;
+    const EventFileByKmerRecord* last = by_kmer_table + footer.num_kmers;
+    auto row_kmer = [this](const EventFileByKmerRecord& record){ return this->kmer_record(record.kmer_row).kmer; };
+    const EventFileByKmerRecord* low = std::lower_bound(first, last, packed,
+        [&row_kmer](const EventFileByKmerRecord& record, const uint64_t& p){ return row_kmer(record) < p; });
+    const EventFileByKmerRecord* high = std::upper_bound(low, last, packed,
+        [&row_kmer](const uint64_t& p, const EventFileByKmerRecord& record){ return p < row_kmer(record); });
+    return make_pair(low - first, high - first);
+  }
+
+  /**
+  Copy the events of a kmer table row out of the mapped file
+  */
+  void read_kmer_row(PosKmer& kmer_struct, const uint64_t& row) const {
+    const EventFileKmerRecord& record = this->kmer_record(row);
+    kmer_struct.kmer = packer.unpack(record.kmer);
+    this->read_kmer_payload(kmer_struct, record.byte_offset, record.byte_length, record.num_events);
+  }
+
+  /**
+  Size kmer_struct for a version 1 payload and queue a read of the payload straight into its events
+  */
+  void add_read_request(PosKmer& kmer_struct, const PosKmerIndex& ki, vector<ReadRequest>& requests) const {
+    kmer_struct.kmer = ki.name;
+    kmer_struct.events.resize(ki.sequence_length);
+    requests.push_back({ki.sequence_byte_index, ki.sequence_length * sizeof(Event),
+                        reinterpret_cast<char*>(kmer_struct.events.data())});
+  }
+
+  /**
+  Merge touching (offset, length) payload ranges and ask the kernel to read each merged range ahead in one request
+  rather than faulting in every payload of a version 2 file separately
+  */
+  void prefetch_payloads(vector<pair<uint64_t, uint64_t>>& ranges) const {
+    sort(ranges.begin(), ranges.end());
+    uint64_t start = 0;
+    uint64_t end = 0;
+    for (uint64_t i = 0; i < ranges.size(); ++i){
+      if (i > 0 and ranges[i].first > end){
+        this->file_region->advise(start, end - start, MADV_WILLNEED);
+      }
+      if (i == 0 or ranges[i].first > end){
+        start = ranges[i].first;
+        end = start;
+      }
+      end = std::max(end, ranges[i].first + ranges[i].second);
+    }
+    if (!ranges.empty()){
+      this->file_region->advise(start, end - start, MADV_WILLNEED);
+    }
+  }
+
+  /**
+  Copy the events of a by kmer table row out of the kmer major payloads
+  */
+  void read_kmer_major_row(PosKmer& kmer_struct, const uint64_t& by_kmer_row) const {
+    const EventFileKmerRecord& record = this->kmer_record(by_kmer_table[by_kmer_row].kmer_row);
+    uint64_t byte_offset = kmer_major_offsets[by_kmer_row];
+    throw_assert(kmer_major_offsets[by_kmer_row + 1] >= byte_offset and
+                     kmer_major_offsets[by_kmer_row + 1] - byte_offset == record.byte_length,
+                 "ERROR: corrupt kmer major offsets in events file: " + this->sequence_file_path)
+    kmer_struct.kmer = packer.unpack(record.kmer);
+    this->read_kmer_payload(kmer_struct, byte_offset, record.byte_length, record.num_events);
+  }
+
+  /**
+  Copy or decompress a version 2 payload into kmer_struct.events
+  */
+  void read_kmer_payload(PosKmer& kmer_struct, const uint64_t& byte_offset, const uint64_t& byte_length,
+                         const uint64_t& num_events) const {
+    this->check_kmer_payload(byte_offset, byte_length, num_events);
+    this->decode_kmer_payload(file_buffer.data + byte_offset, byte_length, num_events, kmer_struct.events);
+  }
+
+  void check_kmer_payload(const uint64_t& byte_offset, const uint64_t& byte_length, const uint64_t& num_events) const {
+    throw_assert((compressed or byte_length == num_events * sizeof(Event)) and
+                     byte_offset >= sizeof(EventFileHeader) and byte_offset <= footer_offset and
+                     byte_length <= footer_offset - byte_offset,
+                 "ERROR: corrupt kmer table in events file: " + this->sequence_file_path)
+  }
+
+  void decode_kmer_payload(const char* data, const uint64_t& byte_length, const uint64_t& num_events,
+                           vector<Event>& events) const {
+    if (compressed){
+      decode_event_block(data, byte_length, num_events, events);
+    } else {
+      events.resize(num_events);
+      std::memcpy(events.data(), data, byte_length);
+    }
+  }
+
+  /**
+  Coalesce payloads into contiguous byte ranges, fetch each range with one request (a read ahead hint on the mapping
+  for version 2, one pread for version 1) and decode the payloads into region in the order they were given
+  */
+  void read_region_payloads(const vector<RegionPayload>& payloads, RegionEvents& region) const {
+    vector<uint64_t> order(payloads.size());
+    std::iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&payloads](const uint64_t& a, const uint64_t& b){
+      return payloads[a].byte_offset < payloads[b].byte_offset;
+    });
+    vector<pair<uint64_t, uint64_t>> ranges;
+    vector<uint64_t> payload_range(payloads.size());
+    for (auto &i: order){
+      const RegionPayload& payload = payloads[i];
+      if (ranges.empty() or payload.byte_offset > ranges.back().second){
+        ranges.emplace_back(payload.byte_offset, payload.byte_offset + payload.byte_length);
+      } else {
+        ranges.back().second = std::max(ranges.back().second, payload.byte_offset + payload.byte_length);
+      }
+      payload_range[i] = ranges.size() - 1;
+    }
+    vector<string> range_buffers;
+    if (version == EVENT_FILE_VERSION){
+      for (auto &range: ranges){
+        this->file_region->advise(range.first, range.second - range.first, MADV_WILLNEED);
+      }
+    } else {
+      range_buffers.resize(ranges.size());
+      for (uint64_t r = 0; r < ranges.size(); ++r){
+        off_t byte_index = off_t(ranges[r].first);
+        pread_string_from_binary(this->sequence_file_descriptor, range_buffers[r], ranges[r].second - ranges[r].first,
+                                 byte_index);
+      }
+    }
+    region.num_byte_ranges = ranges.size();
+    region.positions.reserve(payloads.size());
+    region.kmers.reserve(payloads.size());
+    region.event_offsets.reserve(payloads.size() + 1);
+    vector<Event> events;
+    for (uint64_t i = 0; i < payloads.size(); ++i){
+      const RegionPayload& payload = payloads[i];
+      const char* data = file_buffer.data + payload.byte_offset;
+      if (version != EVENT_FILE_VERSION){
+        const pair<uint64_t, uint64_t>& range = ranges[payload_range[i]];
+        data = range_buffers[payload_range[i]].data() + (payload.byte_offset - range.first);
+      }
+      this->decode_kmer_payload(data, payload.byte_length, payload.num_events, events);
+      region.add_kmer(payload.position, payload.kmer, events);
+    }
+  }
+
+  /**
+  Load the whole index footer with one mapping (or one read) and decode it from memory
+  */
   void read_indexes(){
-    off_t byte_index = off_t(this->indexes_start_position);
-    pread_value_from_binary(this->sequence_file_descriptor, this->kmer_length, byte_index);
-    pread_value_from_binary(this->sequence_file_descriptor, this->alphabet_length, byte_index);
-    pread_string_from_binary(this->sequence_file_descriptor, this->alphabet_string, this->alphabet_length, byte_index);
-    pread_value_from_binary(this->sequence_file_descriptor, this->rna, byte_index);
-    pread_value_from_binary(this->sequence_file_descriptor, this->two_d, byte_index);
+    throw_assert(this->indexes_start_position <= uint64_t(this->file_length) - sizeof(uint64_t),
+                 "ERROR: index start is past the end of events file: " + this->sequence_file_path)
+    uint64_t index_length = uint64_t(this->file_length) - sizeof(uint64_t) - this->indexes_start_position;
+    MappedRegion region(this->sequence_file_descriptor, this->indexes_start_position, index_length);
+    BinaryBuffer buffer = region.buffer();
+    uint64_t byte_index = 0;
+    memread_value_from_binary(buffer, this->kmer_length, byte_index);
+    memread_value_from_binary(buffer, this->alphabet_length, byte_index);
+    memread_string_from_binary(buffer, this->alphabet_string, this->alphabet_length, byte_index);
+    memread_value_from_binary(buffer, this->rna, byte_index);
+    memread_value_from_binary(buffer, this->two_d, byte_index);
 
     this->alphabet = string_to_char_set(this->alphabet_string);
 //    read in all other indexes
-    while (byte_index > 0 and uint64_t(byte_index) < (this->file_length - 1*sizeof(uint64_t))){
+    while (byte_index < buffer.length){
       ContigStrandIndex index_element;
-      this->read_contig_strand_index_entry(index_element, byte_index);
+      this->read_contig_strand_index_entry(buffer, index_element, byte_index);
       auto ret = this->indexes.emplace(index_element.contig + index_element.strand + index_element.nanopore_strand, move(index_element));
       throw_assert(ret.second,
           "ERROR: possible duplicate read name (" + ret.first->first + ") found in events file: " +
@@ -179,24 +858,28 @@ class BinaryEventReader {
   }
 
   void read_footer(){
+    throw_assert(this->file_length >= off_t(sizeof(uint64_t)),
+                 "ERROR: events file is too short to hold an index: " + this->sequence_file_path)
     off_t byte_index = off_t(this->file_length - 1*sizeof(uint64_t));
     pread_value_from_binary(this->sequence_file_descriptor, this->indexes_start_position, byte_index);
   }
   
-  void read_kmer_index_entry(PosKmerIndex& index_element, off_t& byte_index){
-    pread_value_from_binary(this->sequence_file_descriptor, index_element.sequence_byte_index, byte_index);
-    pread_value_from_binary(this->sequence_file_descriptor, index_element.sequence_length, byte_index);
-    pread_value_from_binary(this->sequence_file_descriptor, index_element.name_length, byte_index);
-    pread_string_from_binary(this->sequence_file_descriptor, index_element.name, index_element.name_length, byte_index);
+  void read_kmer_index_entry(const BinaryBuffer& buffer, PosKmerIndex& index_element, uint64_t& byte_index){
+    memread_value_from_binary(buffer, index_element.sequence_byte_index, byte_index);
+    memread_value_from_binary(buffer, index_element.sequence_length, byte_index);
+    index_element.sequence_byte_length = index_element.sequence_length * sizeof(Event);
+    memread_value_from_binary(buffer, index_element.name_length, byte_index);
+    memread_string_from_binary(buffer, index_element.name, index_element.name_length, byte_index);
   }
 
-  void read_position_index_entry(PositionIndex& index_element, off_t& byte_index, const string& contig_strand){
-    pread_value_from_binary(this->sequence_file_descriptor, index_element.position, byte_index);
-    pread_value_from_binary(this->sequence_file_descriptor, index_element.num_kmers, byte_index);
+  void read_position_index_entry(const BinaryBuffer& buffer, PositionIndex& index_element, uint64_t& byte_index,
+                                 const string& contig_strand){
+    memread_value_from_binary(buffer, index_element.position, byte_index);
+    memread_value_from_binary(buffer, index_element.num_kmers, byte_index);
     index_element.kmer_indexes.reserve(index_element.num_kmers);
     for (uint64_t i=0; i < index_element.num_kmers; i++){
       std::shared_ptr<PosKmerIndex> p = std::make_shared<PosKmerIndex>();
-      this->read_kmer_index_entry(*p, byte_index);
+      this->read_kmer_index_entry(buffer, *p, byte_index);
       kmer_map.add_kmer_index_ptr(contig_strand, index_element.position, p);
       auto ret = index_element.kmer_indexes.emplace(p->name, p);
       throw_assert(ret.second,
@@ -206,19 +889,20 @@ class BinaryEventReader {
     }
   }
 
-  void read_contig_strand_index_entry(ContigStrandIndex& index_element, off_t& byte_index){
+  void read_contig_strand_index_entry(const BinaryBuffer& buffer, ContigStrandIndex& index_element,
+                                      uint64_t& byte_index){
     // read string length, Contig, strand and nanopore strand
-    pread_value_from_binary(this->sequence_file_descriptor, index_element.contig_string_length, byte_index);
-    pread_string_from_binary(this->sequence_file_descriptor, index_element.contig, index_element.contig_string_length, byte_index);
-    pread_string_from_binary(this->sequence_file_descriptor, index_element.strand, 1, byte_index);
-    pread_string_from_binary(this->sequence_file_descriptor, index_element.nanopore_strand, 1, byte_index);
-    pread_value_from_binary(this->sequence_file_descriptor, index_element.num_positions, byte_index);
-    pread_value_from_binary(this->sequence_file_descriptor, index_element.num_written_positions, byte_index);
+    memread_value_from_binary(buffer, index_element.contig_string_length, byte_index);
+    memread_string_from_binary(buffer, index_element.contig, index_element.contig_string_length, byte_index);
+    memread_string_from_binary(buffer, index_element.strand, 1, byte_index);
+    memread_string_from_binary(buffer, index_element.nanopore_strand, 1, byte_index);
+    memread_value_from_binary(buffer, index_element.num_positions, byte_index);
+    memread_value_from_binary(buffer, index_element.num_written_positions, byte_index);
     index_element.position_indexes.reserve(index_element.num_written_positions);
+    string contig_strand = index_element.contig+index_element.strand+index_element.nanopore_strand;
     for (uint64_t i=0; i < index_element.num_written_positions; i++){
       PositionIndex pi;
-      this->read_position_index_entry(pi, byte_index,
-          index_element.contig+index_element.strand+index_element.nanopore_strand);
+      this->read_position_index_entry(buffer, pi, byte_index, contig_strand);
       auto ret = index_element.position_indexes.emplace(pi.position, move(pi));
       throw_assert(ret.second,
           "ERROR: possible duplicate position (" + to_string(ret.first->first) + ") found in events file: " +
@@ -9,12 +9,18 @@
 // embed libs
 #include "BaseKmer.hpp"
 #include "BinaryIO.hpp"
+#include "EventFileFormat.hpp"
+#include "EventCodec.hpp"
 // boost libs
 #include <boost/filesystem.hpp>
 // std libs
 #include <string>
 #include <vector>
 #include <ostream>
+#include <numeric>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 
 using namespace std;
 using namespace embed_utils;
@@ -22,7 +28,22 @@ using namespace boost::filesystem;
 
 //ostream& operator<<(ostream& s, KmerIndex& index);
 
+/**
+Writes kmer events to a binary file followed by an index of every contig strand, position and kmer.
+Version 2 files (the default) store the index as the flat tables described in EventFileFormat.hpp, version 1 files
+store the original variable width index.
+Positions can be streamed in any order with write_position or write_positions: payloads go to the file straight away
+and only one fixed size index row per position and kmer is kept until write_indexes sorts them into the tables.
 
+@param file_path: path to output file
+@param alphabet: alphabet of the kmers
+@param kmer_len: length of kmers
+@param rna: rna reads
+@param two_d: two_d reads
+@param version: file format version (1 or 2)
+@param compress: quantise and compress event payloads (version 2 only)
+@param kmer_major: also write every payload grouped by kmer (version 2 only)
+*/
 class BinaryEventWriter {
  private:
   /// Attributes ///
@@ -30,10 +51,24 @@ class BinaryEventWriter {
   std::ofstream sequence_file;
   // When writing the binary file, this vector is appended, so the position of each sequence is stored
   vector<ContigStrandIndex> contig_strand_indexes;
+  // contig+strand+nanopore_strand -> location in contig_strand_indexes
+  unordered_map<string, uint64_t> contig_strand_lookup;
   set<char> alphabet;
   uint64_t kmer_len;
   bool rna;
   bool two_d;
+  uint64_t version;
+  bool compress;
+  bool kmer_major;
+  string buffer;
+  string block;
+//  version 2 index rows in the order they were written. contig_row is the location in contig_strand_indexes and
+//  first_kmer_row the location in kmer_records until write_indexes sorts them
+  KmerPacker packer;
+  vector<EventFilePositionRecord> position_records;
+  vector<EventFileKmerRecord> kmer_records;
+//  guards the file and the index rows in write_positions
+  std::mutex write_mutex;
 
   PositionIndex write_position(Position& position){
     PositionIndex index;
@@ -48,6 +83,7 @@ class BinaryEventWriter {
   }
 
   shared_ptr<PosKmerIndex> write_kmer(shared_ptr<PosKmer> kmer){
+    kmer->finalize();
     if (kmer->events.empty()){
       throw runtime_error("ERROR: empty sequence provided to BinaryEventWriter: " + kmer->kmer);
     }
@@ -64,6 +100,200 @@ class BinaryEventWriter {
   }
 
 
+  /**
+  Serialise every kmer of a position into buffer and add its index rows. Kmer byte offsets are relative to
+  base_offset, the file offset the buffer will be written at.
+  */
+  void serialise_position(Position& position, const uint64_t& contig_row, const uint64_t& base_offset,
+                          string& buffer, string& block, vector<EventFilePositionRecord>& positions,
+                          vector<EventFileKmerRecord>& kmers) const {
+    EventFilePositionRecord record{position.position, kmers.size(), position.num_kmers(), contig_row};
+    for (auto &kmer_ptr: position.get_kmer_pointers()){
+      kmer_ptr->finalize();
+      if (kmer_ptr->events.empty()){
+        throw runtime_error("ERROR: empty sequence provided to BinaryEventWriter: " + kmer_ptr->kmer);
+      }
+      EventFileKmerRecord kmer_record{packer.pack(kmer_ptr->kmer), base_offset + buffer.size(),
+                                      kmer_ptr->events.size() * sizeof(Event), kmer_ptr->events.size()};
+      if (compress){
+        encode_event_block(kmer_ptr->events, block);
+        kmer_record.byte_length = block.size();
+        buffer += block;
+      } else {
+        buffer.append(reinterpret_cast<const char*>(kmer_ptr->events.data()), kmer_record.byte_length);
+      }
+      kmers.push_back(kmer_record);
+    }
+    sort(kmers.begin() + record.first_kmer_row, kmers.end(),
+         [](const EventFileKmerRecord& a, const EventFileKmerRecord& b){ return a.kmer < b.kmer; });
+    positions.push_back(record);
+  }
+
+  void write_position_record(const uint64_t& contig_row, Position& position){
+    buffer.clear();
+    this->serialise_position(position, contig_row, this->sequence_file.tellp(), buffer, block, position_records,
+                             kmer_records);
+    write_string_to_binary(this->sequence_file, buffer);
+  }
+
+  void write_padding(){
+    uint64_t remainder = uint64_t(this->sequence_file.tellp()) % sizeof(uint64_t);
+    if (remainder != 0){
+      string padding(sizeof(uint64_t) - remainder, '\0');
+      write_string_to_binary(this->sequence_file, padding);
+    }
+  }
+
+  /**
+  Copy every payload already in the file to the end of the file in by kmer table order
+
+  @param kmer_table: kmer rows in position table order
+  @param by_kmer_table: by kmer rows sorted by kmer
+  @param kmer_major_footer: output location of the copied payloads
+  @param kmer_major_offsets: output offset of each copied payload followed by the end of the copies
+  */
+  void write_kmer_major_payloads(const vector<EventFileKmerRecord>& kmer_table,
+                                 const vector<EventFileByKmerRecord>& by_kmer_table,
+                                 EventFileKmerMajorFooter& kmer_major_footer, vector<uint64_t>& kmer_major_offsets){
+    this->sequence_file.flush();
+    throw_assert(this->sequence_file.good(), "ERROR: failed writing " + sequence_file_path.string())
+    uint64_t payloads_end = this->sequence_file.tellp();
+    int file_descriptor = ::open(sequence_file_path.c_str(), O_RDONLY);
+    throw_assert(file_descriptor != -1, "ERROR: could not read " + sequence_file_path.string())
+    try {
+      MappedRegion region(file_descriptor, 0, payloads_end, MADV_WILLNEED);
+      BinaryBuffer payloads = region.buffer();
+      kmer_major_footer.payload_offset = payloads_end;
+      kmer_major_offsets.reserve(by_kmer_table.size() + 1);
+      for (auto &by_kmer_record: by_kmer_table){
+        const EventFileKmerRecord& record = kmer_table[by_kmer_record.kmer_row];
+        kmer_major_offsets.push_back(this->sequence_file.tellp());
+        this->sequence_file.write(payloads.data + record.byte_offset, record.byte_length);
+      }
+      kmer_major_offsets.push_back(this->sequence_file.tellp());
+      kmer_major_footer.payload_length = kmer_major_offsets.back() - payloads_end;
+    } catch (...) {
+      ::close(file_descriptor);
+      throw;
+    }
+    ::close(file_descriptor);
+  }
+
+  /**
+  Sort the rows collected while writing into the version 2 tables and write them after the payloads
+  */
+  void write_flat_indexes(){
+    uint64_t num_contigs = contig_strand_indexes.size();
+    vector<uint64_t> contig_order(num_contigs);
+    std::iota(contig_order.begin(), contig_order.end(), 0);
+    sort(contig_order.begin(), contig_order.end(), [this](const uint64_t& a, const uint64_t& b){
+      const ContigStrandIndex& ca = contig_strand_indexes[a];
+      const ContigStrandIndex& cb = contig_strand_indexes[b];
+      return std::tie(ca.contig, ca.strand, ca.nanopore_strand) < std::tie(cb.contig, cb.strand, cb.nanopore_strand);
+    });
+    vector<uint64_t> contig_rows(num_contigs);
+    for (uint64_t row = 0; row < num_contigs; ++row){
+      contig_rows[contig_order[row]] = row;
+    }
+    for (auto &record: position_records){
+      record.contig_row = contig_rows[record.contig_row];
+    }
+    sort(position_records.begin(), position_records.end(),
+         [](const EventFilePositionRecord& a, const EventFilePositionRecord& b){
+      return std::tie(a.contig_row, a.position) < std::tie(b.contig_row, b.position);
+    });
+//    regroup kmer rows in position table order
+    vector<EventFileKmerRecord> kmer_table;
+    kmer_table.reserve(kmer_records.size());
+    vector<EventFileByKmerRecord> by_kmer_table;
+    by_kmer_table.reserve(kmer_records.size());
+    for (uint64_t row = 0; row < position_records.size(); ++row){
+      EventFilePositionRecord& record = position_records[row];
+      if (row > 0){
+        EventFilePositionRecord& previous = position_records[row - 1];
+        throw_assert(previous.contig_row != record.contig_row or previous.position != record.position,
+                     "Position " + to_string(record.position) + " was already written for " +
+                         contig_strand_indexes[contig_order[record.contig_row]].contig +
+                         contig_strand_indexes[contig_order[record.contig_row]].strand +
+                         contig_strand_indexes[contig_order[record.contig_row]].nanopore_strand)
+      }
+      uint64_t first_kmer_row = kmer_table.size();
+      for (uint64_t i = 0; i < record.num_kmers; ++i){
+        by_kmer_table.push_back({kmer_table.size(), row});
+        kmer_table.push_back(kmer_records[record.first_kmer_row + i]);
+      }
+      record.first_kmer_row = first_kmer_row;
+    }
+    stable_sort(by_kmer_table.begin(), by_kmer_table.end(),
+                [&kmer_table](const EventFileByKmerRecord& a, const EventFileByKmerRecord& b){
+      return kmer_table[a.kmer_row].kmer < kmer_table[b.kmer_row].kmer;
+    });
+
+    EventFileKmerMajorFooter kmer_major_footer{};
+    vector<uint64_t> kmer_major_offsets;
+    if (kmer_major){
+      this->write_kmer_major_payloads(kmer_table, by_kmer_table, kmer_major_footer, kmer_major_offsets);
+    }
+
+    this->write_padding();
+    EventFileFooter footer{};
+    uint64_t footer_offset = this->sequence_file.tellp();
+    footer.kmer_length = kmer_len;
+    footer.rna = rna;
+    footer.two_d = two_d;
+    footer.num_contig_strands = num_contigs;
+    footer.contig_table_offset = footer_offset + sizeof(EventFileFooter) +
+        (kmer_major ? sizeof(EventFileKmerMajorFooter) : 0);
+    footer.string_pool_offset = footer.contig_table_offset + num_contigs * sizeof(EventFileContigRecord);
+//    contig names followed by the alphabet
+    string string_pool;
+    vector<EventFileContigRecord> contig_table(num_contigs);
+    uint64_t position_row = 0;
+    for (uint64_t row = 0; row < num_contigs; ++row){
+      ContigStrandIndex& index = contig_strand_indexes[contig_order[row]];
+      EventFileContigRecord& record = contig_table[row];
+      record.name_offset = footer.string_pool_offset + string_pool.size();
+      record.name_length = index.contig.size();
+      record.num_positions = index.num_positions;
+      record.num_written_positions = index.num_written_positions;
+      record.first_position_row = position_row;
+      record.strand = index.strand[0];
+      record.nanopore_strand = index.nanopore_strand[0];
+      string_pool += index.contig;
+      position_row += index.num_written_positions;
+    }
+    string alphabet_str = char_set_to_string(alphabet);
+    footer.alphabet_offset = footer.string_pool_offset + string_pool.size();
+    footer.alphabet_length = alphabet_str.size();
+    string_pool += alphabet_str;
+    string_pool.resize((string_pool.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t), '\0');
+    footer.string_pool_length = string_pool.size();
+    footer.num_positions = position_records.size();
+    footer.position_table_offset = footer.string_pool_offset + string_pool.size();
+    footer.num_kmers = kmer_table.size();
+    footer.kmer_table_offset = footer.position_table_offset + position_records.size() * sizeof(EventFilePositionRecord);
+    footer.by_kmer_table_offset = footer.kmer_table_offset + kmer_table.size() * sizeof(EventFileKmerRecord);
+
+    kmer_major_footer.offset_table_offset = footer.by_kmer_table_offset + by_kmer_table.size() *
+        sizeof(EventFileByKmerRecord);
+
+    write_value_to_binary(this->sequence_file, footer);
+    if (kmer_major){
+      write_value_to_binary(this->sequence_file, kmer_major_footer);
+    }
+    write_vector_to_binary(this->sequence_file, contig_table);
+    write_string_to_binary(this->sequence_file, string_pool);
+    write_vector_to_binary(this->sequence_file, position_records);
+    write_vector_to_binary(this->sequence_file, kmer_table);
+    write_vector_to_binary(this->sequence_file, by_kmer_table);
+    write_vector_to_binary(this->sequence_file, kmer_major_offsets);
+    EventFileTrailer trailer{};
+    trailer.footer_offset = footer_offset;
+    std::memcpy(trailer.magic, EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC));
+    write_value_to_binary(this->sequence_file, trailer);
+  }
+
+
   void write_kmer_index(PosKmerIndex& index){
     // Where is the sequence
     write_value_to_binary(this->sequence_file, index.sequence_byte_index);
@@ -105,10 +335,20 @@ class BinaryEventWriter {
                     const set<char> &alphabet,
                     const uint64_t &kmer_len,
                     bool rna,
-                    bool two_d) :
+                    bool two_d,
+                    uint64_t version=EVENT_FILE_VERSION,
+                    bool compress=false,
+                    bool kmer_major=false) :
       alphabet(move(alphabet)), kmer_len(move(kmer_len)), rna(move(rna)),
-      two_d(move(two_d))
+      two_d(move(two_d)), version(version), compress(compress), kmer_major(kmer_major)
   {
+    throw_assert(version == 1 or version == EVENT_FILE_VERSION,
+                 "Unsupported event file version: " + to_string(version))
+    throw_assert(!compress or version == EVENT_FILE_VERSION, "Only version 2 event files can be compressed")
+    throw_assert(!kmer_major or version == EVENT_FILE_VERSION, "Only version 2 event files have a kmer major layout")
+    if (version == EVENT_FILE_VERSION){
+      packer = KmerPacker(this->alphabet, this->kmer_len);
+    }
     this->sequence_file_path = file_path;
     // Ensure that the output directory exists
     if (this->sequence_file_path.has_parent_path()){
@@ -116,6 +356,13 @@ class BinaryEventWriter {
     }
     this->sequence_file = std::ofstream(this->sequence_file_path.c_str(), std::ofstream::binary);
     throw_assert(this->sequence_file.is_open(), "ERROR: could not open file " + file_path.string());
+    if (version == EVENT_FILE_VERSION){
+      EventFileHeader header{};
+      std::memcpy(header.magic, EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC));
+      header.version = version;
+      header.flags = (compress ? EVENT_FILE_COMPRESSED : 0) | (kmer_major ? EVENT_FILE_KMER_MAJOR : 0);
+      write_value_to_binary(this->sequence_file, header);
+    }
   }
 
   ~BinaryEventWriter() {
@@ -127,25 +374,205 @@ class BinaryEventWriter {
   }
 
   void write_contig_strand(ContigStrand& contig){
+    ContigStrandIndex& index = this->add_contig_strand(contig.contig, contig.strand, contig.nanopore_strand,
+                                                       contig.num_positions);
+    uint64_t contig_row = contig_strand_lookup.at(contig.contig+contig.strand+contig.nanopore_strand);
+    for (auto &position: contig.positions){
+      if (position.has_data){
+        if (version == EVENT_FILE_VERSION){
+          this->write_position_record(contig_row, position);
+        } else {
+          index.position_indexes.insert(std::make_pair(position.position, this->write_position(position)));
+        }
+        index.num_written_positions += 1;
+      }
+    }
+  }
+
+  /**
+  Write contig strands with num_threads threads. Each thread serialises shards of up to shard_size positions into its
+  own buffer, reserves a range of the file with an atomic offset and pwrites the shard there, so shards land in the
+  file in the order they finish. The index rows are assembled once every shard is written. Version 1 files are
+  written serially.
+
+  @param contigs: contig strands to write
+  @param num_threads: number of threads
+  @param shard_size: number of positions in a shard
+  */
+  void write_contig_strands(const vector<ContigStrand*>& contigs, const uint64_t& num_threads,
+                            const uint64_t& shard_size=1024){
+    if (version != EVENT_FILE_VERSION or num_threads <= 1){
+      for (auto &contig: contigs){
+        this->write_contig_strand(*contig);
+      }
+      return;
+    }
+    struct Shard {
+      ContigStrand* contig;
+      uint64_t contig_row;
+      uint64_t start;
+      uint64_t end;
+      vector<EventFilePositionRecord> positions;
+      vector<EventFileKmerRecord> kmers;
+    };
+    vector<Shard> shards;
+    for (auto &contig: contigs){
+      this->add_contig_strand(contig->contig, contig->strand, contig->nanopore_strand, contig->num_positions);
+      uint64_t contig_row = contig_strand_lookup.at(contig->contig+contig->strand+contig->nanopore_strand);
+      for (uint64_t start = 0; start < contig->positions.size(); start += shard_size){
+        shards.push_back({contig, contig_row, start, min(start + shard_size, (uint64_t) contig->positions.size()),
+                          {}, {}});
+      }
+    }
+
+    this->sequence_file.flush();
+    throw_assert(this->sequence_file.good(), "ERROR: failed writing " + sequence_file_path.string())
+    int file_descriptor = ::open(sequence_file_path.c_str(), O_WRONLY);
+    throw_assert(file_descriptor != -1, "ERROR: could not open file " + sequence_file_path.string())
+    std::atomic<uint64_t> next_offset((uint64_t) this->sequence_file.tellp());
+    std::atomic<uint64_t> next_shard(0);
+    try {
+      run_on_threads(num_threads, [&](uint64_t){
+        string shard_buffer;
+        string shard_block;
+        uint64_t i;
+        while ((i = next_shard.fetch_add(1)) < shards.size()){
+          Shard& shard = shards[i];
+          shard_buffer.clear();
+          for (uint64_t p = shard.start; p < shard.end; ++p){
+            Position& position = shard.contig->positions[p];
+            if (position.has_data){
+              this->serialise_position(position, shard.contig_row, 0, shard_buffer, shard_block, shard.positions,
+                                       shard.kmers);
+            }
+          }
+          uint64_t offset = next_offset.fetch_add(shard_buffer.size());
+          pwrite_bytes(file_descriptor, shard_buffer.data(), shard_buffer.size(), off_t(offset));
+          for (auto &kmer_record: shard.kmers){
+            kmer_record.byte_offset += offset;
+          }
+        }
+      });
+    } catch (...) {
+      ::close(file_descriptor);
+      throw;
+    }
+    throw_assert(::close(file_descriptor) == 0, "ERROR: failed writing " + sequence_file_path.string())
+    this->sequence_file.seekp(next_offset.load());
+
+    for (auto &shard: shards){
+      contig_strand_indexes[shard.contig_row].num_written_positions += shard.positions.size();
+      uint64_t first_kmer_row = kmer_records.size();
+      for (auto &record: shard.positions){
+        record.first_kmer_row += first_kmer_row;
+        position_records.push_back(record);
+      }
+      kmer_records.insert(kmer_records.end(), shard.kmers.begin(), shard.kmers.end());
+    }
+  }
+
+  /**
+  Register a contig strand in the index without writing any positions. Positions can then be written one at a time
+  with write_position, which is how the spill merge in split_by_position streams data into the file.
+
+  @return reference to the (possibly already existing) contig strand index
+  */
+  ContigStrandIndex& add_contig_strand(const string& contig, const string& strand, const string& nanopore_strand,
+                                       const uint64_t& num_positions){
+    string contig_strand = contig+strand+nanopore_strand;
+    auto found = contig_strand_lookup.find(contig_strand);
+    if (found != contig_strand_lookup.end()){
+      return contig_strand_indexes[found->second];
+    }
     ContigStrandIndex index;
     // Store contig strand attributes
-    index.contig = contig.contig;
-    index.contig_string_length = contig.contig.length();
-    index.strand = contig.strand;
-    index.nanopore_strand = contig.nanopore_strand;
-    index.num_positions = contig.num_positions;
+    index.contig = contig;
+    index.contig_string_length = contig.length();
+    index.strand = strand;
+    index.nanopore_strand = nanopore_strand;
+    index.num_positions = num_positions;
     index.num_written_positions = 0;
+    contig_strand_lookup.emplace(contig_strand, contig_strand_indexes.size());
+    contig_strand_indexes.push_back(move(index));
+    return contig_strand_indexes.back();
+  }
 
-    for (auto &position: contig.positions){
-      if (position.has_data){
-        index.position_indexes.insert(std::make_pair(position.position, this->write_position(position)));
-        index.num_written_positions += 1;
+  /**
+  Write a single position of a contig strand. Each position may only be written once and positions may be written in
+  any order.
+  */
+  void write_position(const string& contig, const string& strand, const string& nanopore_strand,
+                      const uint64_t& num_positions, Position& position){
+    ContigStrandIndex& index = this->add_contig_strand(contig, strand, nanopore_strand, num_positions);
+    if (version == EVENT_FILE_VERSION){
+//      duplicates are caught when the tables are sorted in write_indexes
+      this->write_position_record(contig_strand_lookup.at(contig+strand+nanopore_strand), position);
+    } else {
+      auto ret = index.position_indexes.insert(std::make_pair(position.position, this->write_position(position)));
+      throw_assert(ret.second, "Position " + to_string(position.position) + " was already written for " +
+          contig+strand+nanopore_strand)
+    }
+    index.num_written_positions += 1;
+  }
+
+  /**
+  Write a block of positions of a contig strand. Several threads may call this at once: payloads are serialised
+  outside the lock and only the file write and index update are serialised. Each position may only be written once.
+  */
+  void write_positions(const string& contig, const string& strand, const string& nanopore_strand,
+                       const uint64_t& num_positions, vector<Position>& positions){
+    if (version != EVENT_FILE_VERSION){
+      std::lock_guard<std::mutex> lock(write_mutex);
+      for (auto &position: positions){
+        this->write_position(contig, strand, nanopore_strand, num_positions, position);
       }
+      return;
     }
-    contig_strand_indexes.push_back(index);
+    string block_buffer;
+    string block_scratch;
+    vector<EventFilePositionRecord> block_positions;
+    vector<EventFileKmerRecord> block_kmers;
+    for (auto &position: positions){
+      this->serialise_position(position, 0, 0, block_buffer, block_scratch, block_positions, block_kmers);
+    }
+    std::lock_guard<std::mutex> lock(write_mutex);
+    ContigStrandIndex& index = this->add_contig_strand(contig, strand, nanopore_strand, num_positions);
+    uint64_t contig_row = contig_strand_lookup.at(contig+strand+nanopore_strand);
+    uint64_t offset = this->sequence_file.tellp();
+    write_string_to_binary(this->sequence_file, block_buffer);
+    uint64_t first_kmer_row = kmer_records.size();
+    for (auto &record: block_positions){
+      record.contig_row = contig_row;
+      record.first_kmer_row += first_kmer_row;
+      position_records.push_back(record);
+    }
+    for (auto &record: block_kmers){
+      record.byte_offset += offset;
+      kmer_records.push_back(record);
+    }
+    index.num_written_positions += block_positions.size();
+  }
+
+  /**
+  Heap bytes of the index held until write_indexes
+  */
+  uint64_t index_memory_usage() const {
+    uint64_t bytes = vector_memory(contig_strand_indexes) + unordered_map_memory(contig_strand_lookup) +
+        vector_memory(position_records) + vector_memory(kmer_records);
+    for (auto &index: contig_strand_indexes){
+      bytes += index.memory_usage();
+    }
+    for (auto &lookup: contig_strand_lookup){
+      bytes += string_memory(lookup.first);
+    }
+    return bytes;
   }
 
   void write_indexes(){
+    if (version == EVENT_FILE_VERSION){
+      this->write_flat_indexes();
+      return;
+    }
     // Store the current file byte index so the beginning of the INDEX table can be located later
     uint64_t indexes_start_position = this->sequence_file.tellp();
     write_value_to_binary(this->sequence_file, kmer_len);
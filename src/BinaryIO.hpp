@@ -13,7 +13,11 @@
 #include <stdexcept>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <climits>
 #include <cstring>
+#include <algorithm>
 
 using std::ostream;
 using std::istream;
@@ -92,6 +96,91 @@ inline void pread_bytes(int file_descriptor, char* buffer_pointer, size_t bytes_
   }
 }
 
+inline void pwrite_bytes(int file_descriptor, const char* buffer_pointer, size_t bytes_to_write, off_t byte_index){
+  ///
+  /// Write bytes at an offset with Linux pwrite, which is threadsafe
+  ///
+
+  while (bytes_to_write) {
+    const ssize_t byte_count = ::pwrite(file_descriptor, buffer_pointer, bytes_to_write, byte_index);
+    if (byte_count <= 0) {
+      throw runtime_error("ERROR " + std::to_string(errno) + " while writing: " + string(::strerror(errno)));
+    }
+    bytes_to_write -= byte_count;
+    buffer_pointer += byte_count;
+    byte_index += byte_count;
+  }
+}
+
+/**
+One read of a batch: byte_length bytes at byte_offset land at destination
+*/
+struct ReadRequest {
+  uint64_t byte_offset;
+  uint64_t byte_length;
+  char* destination;
+};
+
+inline void preadv_all(int file_descriptor, vector<iovec>& iov, off_t byte_index){
+  ///
+  /// Fill every buffer of iov from consecutive bytes starting at byte_index, retrying short reads
+  ///
+
+  uint64_t first = 0;
+  while (first < iov.size()) {
+    int count = int(std::min(iov.size() - first, uint64_t(IOV_MAX)));
+    ssize_t byte_count = ::preadv(file_descriptor, &iov[first], count, byte_index);
+    if (byte_count <= 0) {
+      throw runtime_error("ERROR " + std::to_string(errno) + " while reading: " + string(::strerror(errno)));
+    }
+    byte_index += byte_count;
+    auto remaining = uint64_t(byte_count);
+    while (first < iov.size() and remaining >= iov[first].iov_len) {
+      remaining -= iov[first].iov_len;
+      first += 1;
+    }
+    if (remaining > 0) {
+      iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + remaining;
+      iov[first].iov_len -= remaining;
+    }
+  }
+}
+
+inline uint64_t pread_batch(int file_descriptor, vector<ReadRequest>& requests){
+  ///
+  /// Read every request with as few syscalls as possible. Requests are sorted by offset and requests whose bytes
+  /// touch are read together with one preadv straight into their destinations. Returns the number of contiguous
+  /// ranges read.
+  ///
+
+  std::sort(requests.begin(), requests.end(), [](const ReadRequest& a, const ReadRequest& b){
+    return a.byte_offset < b.byte_offset;
+  });
+  uint64_t num_ranges = 0;
+  vector<iovec> iov;
+  uint64_t range_start = 0;
+  uint64_t range_end = 0;
+  for (auto &request: requests) {
+    if (request.byte_length == 0) {
+      continue;
+    }
+    if (!iov.empty() and request.byte_offset != range_end) {
+      preadv_all(file_descriptor, iov, off_t(range_start));
+      iov.clear();
+    }
+    if (iov.empty()) {
+      range_start = request.byte_offset;
+      num_ranges += 1;
+    }
+    iov.push_back({request.destination, request.byte_length});
+    range_end = request.byte_offset + request.byte_length;
+  }
+  if (!iov.empty()) {
+    preadv_all(file_descriptor, iov, off_t(range_start));
+  }
+  return num_ranges;
+}
+
 inline void pread_string_from_binary(int file_descriptor, string& s, uint64_t length, off_t& byte_index){
   ///
   /// Reimplementation of binary read_string_from_binary(), but with Linux pread, which is threadsafe
@@ -132,4 +221,115 @@ template<class T> void pread_vector_from_binary(int file_descriptor, vector<T>&
 }
 
 
+/**
+Read only view of bytes loaded from a file
+*/
+struct BinaryBuffer {
+  const char* data;
+  uint64_t length;
+};
+
+inline void memread_bytes(const BinaryBuffer& buffer, char* destination, size_t bytes_to_read, uint64_t& byte_index){
+  ///
+  /// Reimplementation of pread_bytes() for data already in memory. Throws instead of reading past the buffer
+  ///
+
+  if (byte_index > buffer.length or bytes_to_read > buffer.length - byte_index) {
+    throw runtime_error("ERROR: attempted to read " + std::to_string(bytes_to_read) + " bytes at " +
+        std::to_string(byte_index) + " from a buffer of " + std::to_string(buffer.length) + " bytes");
+  }
+  std::memcpy(destination, buffer.data + byte_index, bytes_to_read);
+  byte_index += bytes_to_read;
+}
+
+inline void memread_string_from_binary(const BinaryBuffer& buffer, string& s, uint64_t length, uint64_t& byte_index){
+  ///
+  /// Reimplementation of pread_string_from_binary() for data already in memory
+  ///
+
+  s.resize(length);
+  memread_bytes(buffer, const_cast<char *>(s.data()), length, byte_index);
+}
+
+template<class T> void memread_value_from_binary(const BinaryBuffer& buffer, T& v, uint64_t& byte_index){
+  ///
+  /// Reimplementation of pread_value_from_binary() for data already in memory
+  ///
+
+  memread_bytes(buffer, reinterpret_cast<char*>(&v), sizeof(T), byte_index);
+}
+
+/**
+Maps length bytes of a file starting at offset. Falls back to a single pread into a heap buffer if the file cannot
+be mapped. The bytes are released when the region is destroyed.
+
+@param file_descriptor: open file descriptor
+@param offset: first byte of the region
+@param length: number of bytes in the region
+@param advice: madvise access pattern for the mapping
+*/
+class MappedRegion {
+ public:
+  MappedRegion(int file_descriptor, uint64_t offset, uint64_t length, int advice=MADV_SEQUENTIAL) :
+      length(length) {
+    if (length == 0){
+      return;
+    }
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t aligned_offset = offset - offset % page_size;
+    map_length = length + (offset - aligned_offset);
+    void* mapped = ::mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE, file_descriptor, off_t(aligned_offset));
+    if (mapped != MAP_FAILED) {
+      map_start = static_cast<char*>(mapped);
+      ::madvise(mapped, map_length, advice);
+      region_start = map_start + (offset - aligned_offset);
+    } else {
+      fallback.resize(length);
+      off_t byte_index = off_t(offset);
+      pread_bytes(file_descriptor, &fallback[0], length, byte_index);
+      region_start = fallback.data();
+    }
+  }
+  ~MappedRegion() {
+    if (map_start != nullptr){
+      ::munmap(map_start, map_length);
+    }
+  }
+  MappedRegion(const MappedRegion&) = delete;
+  MappedRegion& operator=(const MappedRegion&) = delete;
+
+  BinaryBuffer buffer() const {
+    return BinaryBuffer{region_start, length};
+  }
+
+  bool is_mapped() const {
+    return map_start != nullptr;
+  }
+
+  /**
+  Give the kernel an access hint for part of the region, eg. MADV_WILLNEED to read it ahead in one request
+
+  @param offset: start of the range relative to the region
+  @param range_length: bytes in the range
+  @param advice: madvise advice
+  */
+  void advise(uint64_t offset, uint64_t range_length, int advice) const {
+    if (map_start == nullptr or range_length == 0 or offset >= length){
+      return;
+    }
+    range_length = std::min(range_length, length - offset);
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    const char* range_start = region_start + offset;
+    uint64_t page_offset = uint64_t(range_start - map_start) % page_size;
+    ::madvise(const_cast<char*>(range_start - page_offset), range_length + page_offset, advice);
+  }
+
+ private:
+  uint64_t length;
+  uint64_t map_length = 0;
+  char* map_start = nullptr;
+  const char* region_start = nullptr;
+  vector<char> fallback;
+};
+
 #endif //EMBED_FAST5_SRC_BINARYIO_HPP_
@@ -9,10 +9,45 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <sstream>
+
+/**
+Depth and blocking counters of a ConcurrentQueue
+*/
+struct ConcurrentQueueStats {
+  uint64_t pushed = 0;
+  uint64_t popped = 0;
+  uint64_t max_depth = 0;
+//  sum of the depth after every push, for the mean depth
+  uint64_t depth_sum = 0;
+//  pushes which waited for a full queue and pops which waited for an empty one
+  uint64_t full_waits = 0;
+  uint64_t empty_waits = 0;
+
+  double mean_depth() const {
+    return pushed == 0 ? 0.0 : (double) depth_sum / pushed;
+  }
+
+  /**
+  Single line report eg. "pushed=10 popped=10 max_depth=4 mean_depth=2.5 full_waits=1 empty_waits=3"
+  */
+  std::string format() const {
+    std::ostringstream line;
+    line << "pushed=" << pushed << " popped=" << popped << " max_depth=" << max_depth << " mean_depth="
+         << mean_depth() << " full_waits=" << full_waits << " empty_waits=" << empty_waits;
+    return line.str();
+  }
+};
 
 /**
  * Create a concurrent queue which can be written to and read from by multiple threads
  * source: https://www.justsoftwaresolutions.co.uk/threading/implementing-a-thread-safe-queue-using-condition-variables.html
+ *
+ * With a capacity, push blocks while the queue is full so fast producers can not outrun the consumers. Items are
+ * moved in and out, and the bulk methods move many items under one lock acquisition.
 
  * @tparam Data: data class for queue
  */
@@ -23,25 +58,76 @@ class ConcurrentQueue {
   std::queue<Data> the_queue;
   mutable std::mutex the_mutex;
   std::condition_variable the_condition_variable;
+  std::condition_variable not_full;
+  size_t capacity;
+  ConcurrentQueueStats stats;
+
+  bool full() const {
+    return capacity > 0 and the_queue.size() >= capacity and !no_additional_data;
+  }
+
+  void count_push(){
+    stats.pushed += 1;
+    stats.depth_sum += the_queue.size();
+    stats.max_depth = std::max(stats.max_depth, (uint64_t) the_queue.size());
+  }
+
+  void wait_until_not_full(std::unique_lock<std::mutex>& lock){
+    if (this->full()){
+      stats.full_waits += 1;
+      not_full.wait(lock, [this]{ return !this->full(); });
+    }
+  }
 
  public:
-  ConcurrentQueue() : no_additional_data(false) {}
+  /**
+  @param capacity: max number of queued items before push blocks (0 is unbounded)
+  */
+  explicit ConcurrentQueue(size_t capacity=0) : capacity(capacity), no_additional_data(false) {}
   std::atomic<bool> no_additional_data;
 
-  void push(Data const& data)
+  void push(Data&& data)
   {
     std::unique_lock<std::mutex> lock(the_mutex);
-    the_queue.push(data);
+    this->wait_until_not_full(lock);
+    the_queue.push(std::move(data));
+    this->count_push();
     lock.unlock();
     the_condition_variable.notify_one();
   }
 
+  /**
+  Move every item into the queue, waiting for room as needed, and clear items
+  */
+  void push_bulk(std::vector<Data>& items)
+  {
+    size_t next = 0;
+    while (next < items.size()){
+      std::unique_lock<std::mutex> lock(the_mutex);
+      this->wait_until_not_full(lock);
+      while (next < items.size() and !this->full()){
+        the_queue.push(std::move(items[next]));
+        this->count_push();
+        next += 1;
+      }
+      lock.unlock();
+      the_condition_variable.notify_all();
+    }
+    items.clear();
+  }
+
   bool empty() const
   {
     std::unique_lock<std::mutex> lock(the_mutex);
     return the_queue.empty();
   }
 
+  size_t size() const
+  {
+    std::unique_lock<std::mutex> lock(the_mutex);
+    return the_queue.size();
+  }
+
   bool try_pop(Data& popped_value)
   {
     std::unique_lock<std::mutex> lock(the_mutex);
@@ -50,14 +136,20 @@ class ConcurrentQueue {
       return false;
     }
 
-    popped_value=the_queue.front();
+    popped_value=std::move(the_queue.front());
     the_queue.pop();
+    stats.popped += 1;
+    lock.unlock();
+    not_full.notify_one();
     return true;
   }
 
   bool wait_and_pop(Data& popped_value)
   {
     std::unique_lock<std::mutex> lock(the_mutex);
+    if (the_queue.empty() and !no_additional_data){
+      stats.empty_waits += 1;
+    }
     while(the_queue.empty())
     {
       if (no_additional_data){
@@ -65,16 +157,60 @@ class ConcurrentQueue {
       }
       the_condition_variable.wait(lock);
     }
-    popped_value=the_queue.front();
+    popped_value=std::move(the_queue.front());
     the_queue.pop();
+    stats.popped += 1;
+    lock.unlock();
+    not_full.notify_one();
     return true;
   }
 
+  /**
+  Wait for items and move up to max_items of them onto the end of popped_values in one lock acquisition
+
+  @return number of items popped, 0 once the queue is stopped and empty
+  */
+  size_t pop_bulk(std::vector<Data>& popped_values, size_t max_items=(size_t) -1)
+  {
+    std::unique_lock<std::mutex> lock(the_mutex);
+    if (the_queue.empty() and !no_additional_data){
+      stats.empty_waits += 1;
+    }
+    while(the_queue.empty())
+    {
+      if (no_additional_data){
+        return 0;
+      }
+      the_condition_variable.wait(lock);
+    }
+    size_t popped = 0;
+    while (!the_queue.empty() and popped < max_items){
+      popped_values.push_back(std::move(the_queue.front()));
+      the_queue.pop();
+      popped += 1;
+    }
+    stats.popped += popped;
+    lock.unlock();
+    not_full.notify_all();
+    return popped;
+  }
+
+  /**
+  No more items will be pushed. Waiting consumers drain what is left and blocked producers stop waiting for room.
+  */
   void stop(){
-    no_additional_data = true;
+    {
+      std::unique_lock<std::mutex> lock(the_mutex);
+      no_additional_data = true;
+    }
     the_condition_variable.notify_all();
+    not_full.notify_all();
   }
 
+  ConcurrentQueueStats get_stats() const {
+    std::unique_lock<std::mutex> lock(the_mutex);
+    return stats;
+  }
 
 };
 
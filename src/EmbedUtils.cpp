@@ -17,6 +17,9 @@
 #include <map>
 #include <chrono>
 #include <tuple>
+#include <thread>
+#include <mutex>
+#include <exception>
 
 
 using namespace boost::filesystem;
@@ -495,5 +498,38 @@ uint64_t compute_string_hash(string const& s) {
   return hash_value;
 }
 
+/**
+ * Run job(thread_index) on num_threads threads and wait for all of them. The first exception thrown by a job is
+ * rethrown once every thread has joined.
+ *
+ * @param num_threads: number of threads (the calling thread runs job(0))
+ * @param job: function of the thread index
+ */
+void run_on_threads(uint64_t num_threads, const std::function<void(uint64_t)>& job){
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto guarded_job = [&](uint64_t thread_index){
+    try {
+      job(thread_index);
+    } catch (...) {
+      std::lock_guard<std::mutex> lk(error_mutex);
+      if (!error){
+        error = std::current_exception();
+      }
+    }
+  };
+  vector<thread> threads;
+  for (uint64_t t = 1; t < num_threads; ++t){
+    threads.emplace_back(guarded_job, t);
+  }
+  guarded_job(0);
+  for (auto &t: threads){
+    t.join();
+  }
+  if (error){
+    std::rethrow_exception(error);
+  }
+}
+
 
 }
@@ -55,6 +55,7 @@ namespace embed_utils{
   std::set<char> string_to_char_set(const string& a);
   path make_dir(path &output_path);
   uint64_t compute_string_hash(string const& s);
+  void run_on_threads(uint64_t num_threads, const std::function<void(uint64_t)>& job);
   /**
   * Remove all empty file paths from vector
   *
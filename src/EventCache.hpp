@@ -0,0 +1,197 @@
+#ifndef EMBED_FAST5_SRC_EVENTCACHE_HPP_
+#define EMBED_FAST5_SRC_EVENTCACHE_HPP_
+
+// embed libs
+#include "MemoryReport.hpp"
+// std libs
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sstream>
+
+using namespace std;
+
+/**
+Hit, miss and eviction counters of an EventCache
+*/
+struct EventCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+  uint64_t bytes = 0;
+
+  double hit_rate() const {
+    return hits + misses == 0 ? 0.0 : (double) hits / (hits + misses);
+  }
+
+  /**
+  Single line report eg. "hits=10 misses=2 evictions=1 entries=1 bytes=1.00KB"
+  */
+  string format() const {
+    std::ostringstream line;
+    line << "hits=" << hits << " misses=" << misses << " evictions=" << evictions << " entries=" << entries
+         << " bytes=" << MemoryReport::format_bytes(bytes);
+    return line.str();
+  }
+};
+
+/**
+CLOCK (second chance) bookkeeping for data loaded from an event file. The cache only tracks keys and their sizes, the
+caller owns the data and frees it when a key is handed to its evict function.
+
+@param memory_budget: max bytes held by the cached entries (0 is unbounded and no entries are tracked)
+*/
+class EventCache {
+ public:
+  explicit EventCache(uint64_t memory_budget=0) :
+      memory_budget(memory_budget) {}
+  ~EventCache() = default;
+
+  bool enabled() const {
+    return memory_budget > 0;
+  }
+
+  uint64_t get_memory_budget() const {
+    return memory_budget;
+  }
+
+  /**
+  Change the budget and evict down to it. A budget of 0 stops tracking, everything already loaded is kept.
+  */
+  template<class Evict>
+  void set_memory_budget(uint64_t new_memory_budget, Evict evict){
+    memory_budget = new_memory_budget;
+    if (!this->enabled()){
+      this->clear();
+      return;
+    }
+    this->make_room(0, evict);
+  }
+
+  bool contains(const string& key) const {
+    return slot_index.find(key) != slot_index.end();
+  }
+
+  /**
+  Count a lookup answered from memory and give its entry a second chance
+  */
+  void hit(const string& key){
+    stats.hits += 1;
+    auto found = slot_index.find(key);
+    if (found != slot_index.end()){
+      slots[found->second].referenced = true;
+    }
+  }
+
+  /**
+  Count a lookup which had to read the event file
+  */
+  void miss(){
+    stats.misses += 1;
+  }
+
+  /**
+  Track bytes loaded for a key, evicting other entries until they fit in the budget. Bytes are added to the entry if
+  the key is already cached. The key itself is never evicted here so the data just loaded stays valid.
+  */
+  template<class Evict>
+  void insert(const string& key, uint64_t bytes, Evict evict){
+    if (!this->enabled()){
+      return;
+    }
+    auto found = slot_index.find(key);
+    if (found != slot_index.end()){
+      this->make_room(bytes, evict, found->second);
+      slots[found->second].bytes += bytes;
+      slots[found->second].referenced = true;
+      stats.bytes += bytes;
+      return;
+    }
+    this->make_room(bytes, evict);
+    uint64_t slot;
+    if (free_slots.empty()){
+      slot = slots.size();
+      slots.emplace_back();
+    } else {
+      slot = free_slots.back();
+      free_slots.pop_back();
+    }
+    slots[slot].key = key;
+    slots[slot].bytes = bytes;
+    slots[slot].referenced = true;
+    slots[slot].used = true;
+    slot_index.emplace(key, slot);
+    stats.bytes += bytes;
+    stats.entries += 1;
+  }
+
+  /**
+  Forget every entry without evicting it. Counters are kept.
+  */
+  void clear(){
+    slots.clear();
+    free_slots.clear();
+    slot_index.clear();
+    hand = 0;
+    stats.bytes = 0;
+    stats.entries = 0;
+  }
+
+  const EventCacheStats& get_stats() const {
+    return stats;
+  }
+
+  void reset_stats(){
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.evictions = 0;
+  }
+
+ private:
+  struct Slot {
+    string key;
+    uint64_t bytes = 0;
+    bool referenced = false;
+    bool used = false;
+  };
+
+  uint64_t memory_budget;
+  vector<Slot> slots;
+  vector<uint64_t> free_slots;
+  unordered_map<string, uint64_t> slot_index;
+  uint64_t hand = 0;
+  EventCacheStats stats;
+
+  /**
+  Sweep the clock hand, clearing referenced bits and evicting unreferenced entries, until incoming bytes fit.
+  Two sweeps clear every referenced bit so the loop stops once only the protected slot is left.
+  */
+  template<class Evict>
+  void make_room(uint64_t incoming, Evict evict, uint64_t protect=(uint64_t) -1){
+    uint64_t unprotected = stats.entries - (protect == (uint64_t) -1 ? 0 : 1);
+    while (stats.bytes + incoming > memory_budget and unprotected > 0){
+      Slot& slot = slots[hand];
+      uint64_t current = hand;
+      hand = (hand + 1) % slots.size();
+      if (!slot.used or current == protect){
+        continue;
+      }
+      if (slot.referenced){
+        slot.referenced = false;
+        continue;
+      }
+      string key = move(slot.key);
+      stats.bytes -= slot.bytes;
+      stats.entries -= 1;
+      stats.evictions += 1;
+      unprotected -= 1;
+      slot = Slot();
+      slot_index.erase(key);
+      free_slots.push_back(current);
+      evict(key);
+    }
+  }
+};
+
+#endif //EMBED_FAST5_SRC_EVENTCACHE_HPP_
@@ -0,0 +1,135 @@
+#ifndef EMBED_FAST5_SRC_EVENTCODEC_HPP_
+#define EMBED_FAST5_SRC_EVENTCODEC_HPP_
+
+// embed libs
+#include "BaseKmer.hpp"
+// zlib
+#include <zlib.h>
+// std libs
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+/*
+Compressed event payloads. Each kmer payload starts with one EventBlockCodec byte. Means are quantised to 0.01 pA in
+an int16 and probabilities to 1/65535 in a uint16, then the four bytes of every event are split into byte planes so
+similar bytes sit next to each other before deflating. A block falls back to the shuffled bytes when deflate does
+not make it smaller and to raw floats when an event can not be quantised.
+*/
+
+enum EventBlockCodec : uint8_t {
+  EVENT_BLOCK_RAW = 0,
+  EVENT_BLOCK_SHUFFLED = 1,
+  EVENT_BLOCK_DEFLATED = 2
+};
+
+const float EVENT_MEAN_SCALE = 100;
+const float EVENT_PROBABILITY_SCALE = 65535;
+
+/**
+Quantise events and split them into byte planes: mean low bytes, mean high bytes, probability low bytes and
+probability high bytes.
+
+@return false if an event does not fit the quantised range
+*/
+inline bool shuffle_quantised_events(const vector<Event>& events, string& planes){
+  uint64_t n = events.size();
+  planes.resize(4 * n);
+  for (uint64_t i = 0; i < n; ++i){
+    float mean = std::round(events[i].descaled_event_mean * EVENT_MEAN_SCALE);
+    float probability = std::round(events[i].posterior_probability * EVENT_PROBABILITY_SCALE);
+    if (!(mean >= std::numeric_limits<int16_t>::min() and mean <= std::numeric_limits<int16_t>::max() and
+        probability >= 0 and probability <= EVENT_PROBABILITY_SCALE)){
+      return false;
+    }
+    uint16_t quantised_mean = (uint16_t) (int16_t) mean;
+    uint16_t quantised_probability = (uint16_t) probability;
+    planes[i] = char(quantised_mean & 0xFF);
+    planes[n + i] = char(quantised_mean >> 8);
+    planes[2 * n + i] = char(quantised_probability & 0xFF);
+    planes[3 * n + i] = char(quantised_probability >> 8);
+  }
+  return true;
+}
+
+inline void unshuffle_quantised_events(const unsigned char* planes, uint64_t n, Event* events){
+  for (uint64_t i = 0; i < n; ++i){
+    auto quantised_mean = (int16_t) (uint16_t) (planes[i] | (planes[n + i] << 8));
+    auto quantised_probability = (uint16_t) (planes[2 * n + i] | (planes[3 * n + i] << 8));
+    events[i].descaled_event_mean = quantised_mean / EVENT_MEAN_SCALE;
+    events[i].posterior_probability = quantised_probability / EVENT_PROBABILITY_SCALE;
+  }
+}
+
+/**
+Encode events into the smallest block
+
+@param events: events to encode
+@param block: output block, starting with the EventBlockCodec byte
+@param level: zlib compression level
+*/
+inline void encode_event_block(const vector<Event>& events, string& block, int level=Z_DEFAULT_COMPRESSION){
+  string planes;
+  if (!shuffle_quantised_events(events, planes)){
+    block.assign(1, char(EVENT_BLOCK_RAW));
+    block.append(reinterpret_cast<const char*>(events.data()), events.size() * sizeof(Event));
+    return;
+  }
+  uLongf deflated_length = compressBound(planes.size());
+  block.resize(1 + deflated_length);
+  int status = compress2(reinterpret_cast<Bytef*>(&block[1]), &deflated_length,
+                         reinterpret_cast<const Bytef*>(planes.data()), planes.size(), level);
+  if (status == Z_OK and deflated_length < planes.size()){
+    block[0] = char(EVENT_BLOCK_DEFLATED);
+    block.resize(1 + deflated_length);
+  } else {
+    block.assign(1, char(EVENT_BLOCK_SHUFFLED));
+    block += planes;
+  }
+}
+
+/**
+Decode a block written by encode_event_block
+
+@param data: start of the block
+@param length: bytes in the block
+@param num_events: number of events in the block
+@param events: output events, resized to num_events
+*/
+inline void decode_event_block(const char* data, uint64_t length, uint64_t num_events, vector<Event>& events){
+  if (length == 0){
+    throw runtime_error("ERROR: empty event block");
+  }
+  events.resize(num_events);
+  auto codec = (uint8_t) data[0];
+  const char* payload = data + 1;
+  uint64_t payload_length = length - 1;
+  if (codec == EVENT_BLOCK_RAW){
+    if (payload_length != num_events * sizeof(Event)){
+      throw runtime_error("ERROR: raw event block has the wrong length");
+    }
+    std::memcpy(events.data(), payload, payload_length);
+  } else if (codec == EVENT_BLOCK_SHUFFLED){
+    if (payload_length != 4 * num_events){
+      throw runtime_error("ERROR: shuffled event block has the wrong length");
+    }
+    unshuffle_quantised_events(reinterpret_cast<const unsigned char*>(payload), num_events, events.data());
+  } else if (codec == EVENT_BLOCK_DEFLATED){
+    vector<unsigned char> planes(4 * num_events);
+    uLongf planes_length = planes.size();
+    int status = uncompress(planes.data(), &planes_length, reinterpret_cast<const Bytef*>(payload), payload_length);
+    if (status != Z_OK or planes_length != planes.size()){
+      throw runtime_error("ERROR: could not inflate event block");
+    }
+    unshuffle_quantised_events(planes.data(), num_events, events.data());
+  } else {
+    throw runtime_error("ERROR: unknown event block codec " + to_string(codec));
+  }
+}
+
+#endif //EMBED_FAST5_SRC_EVENTCODEC_HPP_
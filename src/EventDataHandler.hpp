@@ -8,6 +8,17 @@
 // embed libs
 #include "ReferenceHandler.hpp"
 #include "BinaryEventReader.hpp"
+#include "EventRunFile.hpp"
+#include "EventCache.hpp"
+// boost libs
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+// std libs
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
@@ -77,6 +88,10 @@ class EventDataHandler {
         }
       }
     }
+    contig_strand_bytes = unordered_map_memory(data);
+    for (auto &cs_pair: data){
+      contig_strand_bytes += string_memory(cs_pair.first) + cs_pair.second.memory_usage();
+    }
   }
 
   void initialize_reader(const string& internal_event_file){
@@ -90,45 +105,326 @@ class EventDataHandler {
 
   void initialize_by_kmer(){
     by_kmer_data.initialize_kmer_map(alphabet, kmer_length);
+    by_kmer_bytes = by_kmer_data.memory_usage();
   }
 
-  void add_kmer_event(const string& contig, const string& strand, const string& nanopore_strand, const uint64_t& reference_index,
-                      const string& path_kmer, const float& descaled_event_mean, const float& posterior_probability){
+  /**
+  Add an event to the kmer at a reference position. The by kmer index is not updated here, it is built from the
+  positions the first time get_kmer needs it.
+
+  @return change in the number of stored events, see PosKmer::add_event
+  */
+  int64_t add_kmer_event(const string& contig, const string& strand, const string& nanopore_strand, const uint64_t& reference_index,
+                         const string& path_kmer, const float& descaled_event_mean, const float& posterior_probability){
     string contig_strand = contig+strand+nanopore_strand;
     Position& pos = data.at(contig_strand).get_position(reference_index);
-    pos.soft_add_kmer_event(path_kmer, descaled_event_mean, posterior_probability);
-    by_kmer_data.add_kmer_ptr(contig_strand, reference_index, pos.get_pos_kmer(path_kmer));
+    throw_assert(!pos.flushed, "Position " + to_string(reference_index) + " of " + contig_strand +
+        " was already flushed to the event file")
+    KmerEventChange change = pos.soft_add_kmer_event(path_kmer, descaled_event_mean, posterior_probability,
+                                                     max_events, bulk_factor);
+    event_bytes += change.event_bytes;
+    if (change.pos_kmer_bytes > 0){
+      pos_kmer_bytes += change.pos_kmer_bytes;
+      num_pos_kmers += 1;
+      by_kmer_built = false;
+    }
+    return change.stored_events;
+  }
+
+  /**
+  Number of PosKmers created by add_kmer_event since the last clear_events
+  */
+  uint64_t get_num_pos_kmers(){
+    return num_pos_kmers;
   }
 
-  void write_to_file(path& output_file){
+  /**
+  Write every in memory event to a binary event file
+
+  @param output_file: path to output event file
+  @param num_threads: number of threads serialising contig strands
+  */
+  void write_to_file(path& output_file, uint64_t num_threads=1){
     throw_assert(kmer_length != (uint64_t)-1, "Kmer length must be set in order to write to file");
     throw_assert(alphabet != set<char>{}, "Alphabet must be set in order to write to file")
-    BinaryEventWriter bew(output_file, alphabet, kmer_length, rna, two_d);
+    throw_assert(!stream_writer, "Close the open event file stream instead of writing to a file")
+    BinaryEventWriter bew(output_file, alphabet, kmer_length, rna, two_d, EVENT_FILE_VERSION, compress, kmer_major);
+    vector<string> keys;
+    keys.reserve(data.size());
     for (auto &cs_pair: data){
-      bew.write_contig_strand(cs_pair.second);
+      keys.push_back(cs_pair.first);
+    }
+    sort(keys.begin(), keys.end());
+    vector<ContigStrand*> contigs;
+    for (auto &key: keys){
+      contigs.push_back(&data.at(key));
     }
+    bew.write_contig_strands(contigs, num_threads);
     bew.write_indexes();
   }
 
+  /**
+  Start streaming events to a binary event file. Finished reference windows are written with flush_positions and
+  released, so only the writer's compact index stays in memory until close_stream writes the rest and the indexes.
+
+  @param output_file: path to output event file
+  */
+  void open_stream(path& output_file){
+    throw_assert(kmer_length != (uint64_t)-1, "Kmer length must be set in order to write to file");
+    throw_assert(alphabet != set<char>{}, "Alphabet must be set in order to write to file")
+    throw_assert(!stream_writer, "An event file stream is already open")
+    stream_writer.reset(new BinaryEventWriter(output_file, alphabet, kmer_length, rna, two_d, EVENT_FILE_VERSION,
+                                              compress, kmer_major));
+    stream_index_bytes = stream_writer->index_memory_usage();
+  }
+
+  bool is_streaming(){
+    return stream_writer != nullptr;
+  }
+
+  /**
+  Write the positions of a contig strand in [start, end) to the open stream and release their events. Adding an
+  event to a flushed position afterwards is an error because the position is already in the file.
+
+  @param block_size: number of positions handed to the writer at once
+  @return number of positions written
+  */
+  uint64_t flush_positions(const string& contig, const string& strand, const string& nanopore_strand,
+                           const uint64_t& start=0, const uint64_t& end=(uint64_t) -1,
+                           const uint64_t& block_size=1024){
+    throw_assert(stream_writer, "An event file stream must be open in order to flush positions")
+    string contig_strand = contig+strand+nanopore_strand;
+    throw_assert(data.find(contig_strand) != data.end(),
+                 "contig_strand: " + contig_strand + " is not in EventDataHandler.")
+    ContigStrand& cs = data.at(contig_strand);
+    vector<Position> block;
+    uint64_t written = 0;
+    for (uint64_t i = start; i < std::min(end, cs.num_positions); ++i){
+      Position& position = cs.positions[i];
+      if (position.has_data){
+//        the copy shares the PosKmers so the original can be released straight away
+        block.push_back(position);
+        uint64_t position_events = position.event_memory();
+        uint64_t position_bytes = position.memory_usage() - position_events;
+        position.clear();
+        event_bytes -= position_events;
+        pos_kmer_bytes -= position_bytes - position.memory_usage();
+      }
+      position.flushed = true;
+      if (block.size() >= block_size){
+        stream_writer->write_positions(contig, strand, nanopore_strand, cs.num_positions, block);
+        written += block.size();
+        block.clear();
+      }
+    }
+    if (!block.empty()){
+      stream_writer->write_positions(contig, strand, nanopore_strand, cs.num_positions, block);
+      written += block.size();
+    }
+    if (written > 0 and by_kmer_built){
+      by_kmer_data = ByKmer(alphabet, kmer_length);
+      by_kmer_bytes = by_kmer_data.memory_usage();
+      by_kmer_built = false;
+    }
+    stream_index_bytes = stream_writer->index_memory_usage();
+    return written;
+  }
+
+  /**
+  Flush every position still in memory and write the indexes of the open stream
+  */
+  void close_stream(){
+    throw_assert(stream_writer, "An event file stream must be open in order to close it")
+    vector<string> keys;
+    for (auto &cs_pair: data){
+      keys.push_back(cs_pair.first);
+    }
+    sort(keys.begin(), keys.end());
+    for (auto &key: keys){
+      ContigStrand& cs = data.at(key);
+      this->flush_positions(cs.contig, cs.strand, cs.nanopore_strand);
+    }
+    stream_writer->write_indexes();
+    stream_writer.reset();
+    stream_index_bytes = 0;
+  }
+
+  /**
+  Write every in memory event to a run file sorted by (contig strand, position, kmer).
+  Contig strand ids in the run header follow the sorted contig strand names so all runs from one handler agree.
+
+  @param run_file: path to run file
+  @return number of records written
+  */
+  uint64_t write_run(const path& run_file){
+    vector<string> keys;
+    keys.reserve(data.size());
+    for (auto &cs_pair: data){
+      keys.push_back(cs_pair.first);
+    }
+    sort(keys.begin(), keys.end());
+    vector<ContigStrandRunEntry> header;
+    for (auto &key: keys){
+      ContigStrand& cs = data.at(key);
+      header.push_back({cs.contig, cs.strand, cs.nanopore_strand, cs.num_positions});
+    }
+    EventRunWriter run_writer(run_file, header);
+    for (uint64_t id = 0; id < keys.size(); ++id){
+      for (auto &position: data.at(keys[id]).positions){
+        if (position.has_data){
+          for (auto &kmer: position.get_kmer_strings()){
+            run_writer.write_pos_kmer(id, position.position, *position.get_pos_kmer(kmer));
+          }
+        }
+      }
+    }
+    run_writer.close();
+    return run_writer.num_records;
+  }
+
+  /**
+  Merge run files written by write_run into a binary event file, capping each kmer to max_events
+
+  @param run_files: run files to merge
+  @param output_file: path to output event file
+  */
+  void write_runs_to_file(const vector<path>& run_files, path& output_file){
+    throw_assert(kmer_length != (uint64_t)-1, "Kmer length must be set in order to write to file");
+    throw_assert(alphabet != set<char>{}, "Alphabet must be set in order to write to file")
+    BinaryEventWriter bew(output_file, alphabet, kmer_length, rna, two_d, EVENT_FILE_VERSION, compress, kmer_major);
+    merge_event_runs(run_files, bew, max_events);
+    bew.write_indexes();
+  }
+
+  /**
+  Drop all events held in memory while keeping the reference layout
+  */
+  void clear_events(){
+    for (auto &cs_pair: data){
+      for (auto &position: cs_pair.second.positions){
+        if (position.has_data or position.populated){
+          position.clear();
+        }
+      }
+    }
+    by_kmer_data = ByKmer(alphabet, kmer_length);
+    by_kmer_bytes = by_kmer_data.memory_usage();
+    by_kmer_built = false;
+    num_pos_kmers = 0;
+    pos_kmer_bytes = 0;
+    event_bytes = 0;
+    std::lock_guard<std::mutex> cache_lk(cache_mutex);
+    cache.clear();
+  }
+
+  /**
+  Heap bytes held by each component of the handler. Positions and PosKmers are reported separately from the event
+  vectors they hold.
+  */
+  MemoryReport memory_report() const {
+    uint64_t positions = unordered_map_memory(data);
+    uint64_t events = 0;
+    for (auto &cs_pair: data){
+      uint64_t cs_events = cs_pair.second.event_memory();
+      positions += string_memory(cs_pair.first) + cs_pair.second.memory_usage() - cs_events;
+      events += cs_events;
+    }
+    MemoryReport report;
+    report.add("contig_strand_positions", positions);
+    report.add("pos_kmer_events", events);
+    report.add("by_kmer", by_kmer_data.memory_usage());
+    report.add("reader_indexes", reader.index_memory_usage());
+    if (stream_writer){
+      report.add("stream_indexes", stream_writer->index_memory_usage());
+    }
+    return report;
+  }
+
+  /**
+  Same components as memory_report, read from byte counters that add_kmer_event, flush_positions, clear_events and
+  the by kmer index build keep up to date, so it never waits for or walks data that is being changed. Positions and
+  kmers read from an event file are not counted, the cache stats account for those.
+  */
+  MemoryReport tracked_memory_report() const {
+    MemoryReport report;
+    report.add("contig_strand_positions", contig_strand_bytes + (uint64_t) pos_kmer_bytes.load());
+    report.add("pos_kmer_events", (uint64_t) event_bytes.load());
+    report.add("by_kmer", by_kmer_bytes);
+    report.add("reader_indexes", reader.index_memory_usage());
+//    the stream may be closed concurrently so its pointer is not read here, a closed stream holds no bytes
+    if (stream_index_bytes > 0){
+      report.add("stream_indexes", stream_index_bytes);
+    }
+    return report;
+  }
+
+  /**
+  Get the events of a kmer at a position, reading only that kmer from the event file if it is not in memory.
+  The kmer is finalized before it is returned. Safe to call from many threads.
+  */
   shared_ptr<PosKmer> get_position_kmer(const string& contig, const string& strand, const string& nanopore_strand,
                              const uint64_t& reference_index, const string& path_kmer){
     string contig_strand = contig+strand+nanopore_strand;
     throw_assert(data.find(contig_strand) != data.end(),
         "contig_strand: " + contig_strand + " is not in EventDataHandler.")
+    boost::shared_lock<boost::shared_mutex> index_lk(index_mutex);
     Position &pos = data.at(contig_strand).get_position(reference_index);
+    std::unique_lock<std::mutex> lk(position_lock(contig_strand, reference_index));
     if (pos.has_kmer(path_kmer)) {
-      return pos.get_pos_kmer(path_kmer);
+      shared_ptr<PosKmer> pos_kmer = pos.get_pos_kmer(path_kmer);
+      pos_kmer->finalize();
+      lk.unlock();
+      if (reader.initialized){
+        this->cache_hit(position_cache_key(contig_strand, reference_index));
+      }
+      return pos_kmer;
     }
+    lk.unlock();
     return get_position_kmer_from_reader(contig, strand, nanopore_strand, reference_index, path_kmer);
   }
 
+  /**
+  Get every PosKmer of a kmer, reading the kmer from the event file if it is not fully in memory. With a cache
+  budget the kmer is cached on its own, independent of the positions, and the reference is valid until the next
+  query. Safe to call from many threads without a cache budget, use query_kmer with one.
+  */
   Kmer& get_kmer(const string& path_kmer){
-    Kmer& kmer_data = by_kmer_data.get_kmer(path_kmer);
-    uint64_t expected_n_kmers = reader.get_kmer_index(path_kmer).positions.size();
-    if (kmer_data.pos_kmer_map.size() != expected_n_kmers) {
-      get_kmer_from_reader(kmer_data);
+    boost::shared_lock<boost::shared_mutex> index_lk(index_mutex);
+    return this->load_kmer(path_kmer, index_lk, nullptr);
+  }
+
+  /**
+  Thread safe snapshot of get_kmer. The snapshot shares the PosKmers with the handler so it stays valid after the
+  kmer is evicted from the cache.
+  */
+  Kmer query_kmer(const string& path_kmer){
+    Kmer snapshot(path_kmer);
+    boost::shared_lock<boost::shared_mutex> index_lk(index_mutex);
+    this->load_kmer(path_kmer, index_lk, &snapshot);
+    return snapshot;
+  }
+
+  /**
+  Build the by kmer index from every PosKmer in memory in one parallel pass over the positions, see
+  build_by_kmer_index_locked. Does nothing if the index is up to date.
+  */
+  void build_by_kmer_index(){
+    if (by_kmer_built){
+      return;
     }
-    return kmer_data;
+    boost::unique_lock<boost::shared_mutex> index_lk(index_mutex);
+    this->build_by_kmer_index_locked();
+  }
+
+  bool is_by_kmer_index_built(){
+    return by_kmer_built;
+  }
+
+  /**
+  Number of threads used to build the by kmer index
+  */
+  void set_index_threads(uint64_t num_threads){
+    index_threads = num_threads;
   }
 
   bool has_kmer(const string& path_kmer){
@@ -139,21 +435,66 @@ class EventDataHandler {
     }
   }
 
+  /**
+  Get a position, reading every kmer at it from the event file the first time. Safe to call from many threads
+  without a cache budget, use query_position with one.
+  */
   Position& get_position(const string& contig, const string& strand, const string& nanopore_strand,
       const uint64_t& reference_index){
+    return this->load_position(contig, strand, nanopore_strand, reference_index, nullptr);
+  }
+
+  /**
+  Thread safe snapshot of get_position. The snapshot shares the PosKmers with the handler so it stays valid after
+  the position is evicted from the cache.
+  */
+  Position query_position(const string& contig, const string& strand, const string& nanopore_strand,
+                          const uint64_t& reference_index){
+    Position snapshot(reference_index);
+    this->load_position(contig, strand, nanopore_strand, reference_index, &snapshot);
+    return snapshot;
+  }
+
+  /**
+  Get every kmer event in [start, end) of a contig strand. Reads the region from the event file in a few contiguous
+  reads when a reader is initialized, otherwise copies it from memory.
+
+  Kmers are finalized before they are copied so bulk mode returns the same capped events the event file would hold.
+  Arguments are in the same order as BinaryEventReader::query_region.
+
+  @param region: output events, cleared first
+  */
+  void query_region(RegionEvents& region, const string& contig, const string& strand,
+                    const uint64_t& start, const uint64_t& end, const string& nanopore_strand){
+    if (reader.initialized){
+      reader.query_region(region, contig, strand, start, end, nanopore_strand);
+      return;
+    }
     string contig_strand = contig+strand+nanopore_strand;
     throw_assert(data.find(contig_strand) != data.end(),
                  "contig_strand: " + contig_strand + " is not in EventDataHandler.")
-    Position& pos = data.at(contig_strand).get_position(reference_index);
-    if (reader.initialized & !pos.populated){
-      reader.get_position(pos, contig, strand, reference_index, nanopore_strand);
+    ContigStrand& cs = data.at(contig_strand);
+    region.clear();
+    boost::shared_lock<boost::shared_mutex> index_lk(index_mutex);
+    for (uint64_t i = start; i < std::min(end, cs.num_positions); ++i){
+      std::lock_guard<std::mutex> lk(position_lock(contig_strand, i));
+      Position& pos = cs.get_position(i);
       for (auto &k: pos.get_kmer_strings()){
-        by_kmer_data.get_kmer(k).soft_add_pos_kmer(contig_strand, reference_index, pos.get_pos_kmer(k));
+        shared_ptr<PosKmer> pos_kmer = pos.get_pos_kmer(k);
+        pos_kmer->finalize();
+        region.add_kmer(i, k, pos_kmer->events);
       }
     }
-    return pos;
   }
 
+  bool has_contig_strand(const string& contig, const string& strand, const string& nanopore_strand){
+    return data.find(contig+strand+nanopore_strand) != data.end();
+  }
+
+  /**
+  Load every position of a contig strand. With a cache budget smaller than the contig strand the first positions are
+  evicted again before this returns, use query_region for large ranges instead.
+  */
   ContigStrand& get_contig_strand(const string& contig, const string& strand, const string& nanopore_strand){
     string contig_strand = contig+strand+nanopore_strand;
     throw_assert(data.find(contig_strand) != data.end(),"contig_strand: " + contig_strand + " is not in EventDataHandler.")
@@ -180,25 +521,374 @@ class EventDataHandler {
     kmer_length = new_kmer_length;
   }
 
+  /**
+  Limit the number of events kept per kmer at each position to the most probable max_events (0 keeps all)
+  */
+  void set_max_events(uint64_t new_max_events){
+    max_events = new_max_events;
+  }
+
+  uint64_t get_max_events(){
+    return max_events;
+  }
+
+  /**
+  Buffer up to bulk_factor * max_events events per kmer and select the top max_events in bulk instead of keeping a
+  heap on every insert (0 disables bulk mode)
+  */
+  void set_bulk_factor(uint64_t new_bulk_factor){
+    bulk_factor = new_bulk_factor;
+  }
+
+  uint64_t get_bulk_factor(){
+    return bulk_factor;
+  }
+
+  /**
+  Quantise and compress event payloads when writing event files
+  */
+  void set_compression(bool new_compress){
+    compress = new_compress;
+  }
+
+  /**
+  Also write every payload grouped by kmer when writing event files, so get_kmer reads one contiguous range
+  */
+  void set_kmer_major(bool new_kmer_major){
+    kmer_major = new_kmer_major;
+  }
+
+  /**
+  Cap the memory held by positions and kmers read from the event file, evicting the least recently used with CLOCK
+  once it is exceeded (0 keeps everything). Set it before querying, data already in memory is not tracked.
+  With a budget, positions and kmers are cached independently so evicting one never walks the other, at the cost of
+  reading an event twice when it is queried both ways.
+
+  @param bytes: memory budget in bytes
+  */
+  void set_cache_budget(uint64_t bytes){
+    std::lock_guard<std::mutex> cache_lk(cache_mutex);
+    cache.set_memory_budget(bytes, cache_evict_function());
+  }
+
+  uint64_t get_cache_budget(){
+    std::lock_guard<std::mutex> cache_lk(cache_mutex);
+    return cache.get_memory_budget();
+  }
+
+  /**
+  Hits and misses of position and kmer queries answered from memory or the event file, and cache evictions
+  */
+  EventCacheStats get_cache_stats(){
+    std::lock_guard<std::mutex> cache_lk(cache_mutex);
+    return cache.get_stats();
+  }
+
+  void reset_cache_stats(){
+    std::lock_guard<std::mutex> cache_lk(cache_mutex);
+    cache.reset_stats();
+  }
+
+  /**
+  Number of locks sharding positions and kmers between querying threads
+  */
+  void set_num_locks(uint64_t new_num_locks){
+    throw_assert(new_num_locks > 0, "Number of locks must be greater than 0")
+    position_locks = vector<std::mutex>(new_num_locks);
+    kmer_locks = vector<std::mutex>(new_num_locks);
+  }
+
  private:
   set<char> alphabet = {};
   uint64_t kmer_length = -1;
   bool two_d = false;
   bool rna;
+  uint64_t max_events = 0;
+  uint64_t bulk_factor = 0;
+  bool compress = false;
+  bool kmer_major = false;
   string event_file;
 
   unordered_map<string, ContigStrand> data;
   ByKmer by_kmer_data;
+  std::atomic<bool> by_kmer_built{false};
+  std::atomic<uint64_t> num_pos_kmers{0};
+//  bytes behind tracked_memory_report. The contig strand layout is fixed once the reference is loaded
+  uint64_t contig_strand_bytes = 0;
+  std::atomic<int64_t> pos_kmer_bytes{0};
+  std::atomic<int64_t> event_bytes{0};
+  std::atomic<uint64_t> by_kmer_bytes{0};
+  std::atomic<uint64_t> stream_index_bytes{0};
+  uint64_t index_threads = 1;
   BinaryEventReader reader;
+  EventCache cache;
+  unique_ptr<BinaryEventWriter> stream_writer;
+//  queries hold the index mutex shared, building the by kmer index holds it exclusively. Positions and kmers are
+//  guarded by sharded locks and the cache by its own mutex, which is never taken while holding a shard lock.
+  boost::shared_mutex index_mutex;
+  vector<std::mutex> position_locks = vector<std::mutex>(1000);
+  vector<std::mutex> kmer_locks = vector<std::mutex>(1000);
+  std::mutex cache_mutex;
+
+  std::mutex& position_lock(const string& contig_strand, const uint64_t& position){
+    return position_locks[(compute_string_hash(contig_strand) + position) % position_locks.size()];
+  }
+
+  std::mutex& kmer_lock(const string& kmer){
+    return kmer_locks[compute_string_hash(kmer) % kmer_locks.size()];
+  }
+
+  void cache_hit(const string& key){
+    std::lock_guard<std::mutex> cache_lk(cache_mutex);
+    cache.hit(key);
+  }
+
+  void cache_miss(const string& key, const uint64_t& bytes){
+    std::lock_guard<std::mutex> cache_lk(cache_mutex);
+    cache.miss();
+    cache.insert(key, bytes, cache_evict_function());
+  }
+
+  bool cache_enabled(){
+    std::lock_guard<std::mutex> cache_lk(cache_mutex);
+    return cache.enabled();
+  }
+
+  /**
+  Kmer of a position collected by the first pass of build_by_kmer_index_locked
+  */
+  struct ByKmerEntry {
+    uint64_t contig_strand_row;
+    uint64_t position;
+    shared_ptr<PosKmer> pos_kmer;
+  };
+
+  /**
+  Add every PosKmer in memory to the by kmer index, the caller holds the index mutex exclusively. Threads scan slices
+  of positions and bucket the kmers by hash, then each thread adds one bucket.
+  */
+  void build_by_kmer_index_locked(){
+    if (by_kmer_built){
+      return;
+    }
+    uint64_t num_threads = max(index_threads, (uint64_t) 1);
+    vector<ContigStrand*> contig_strands;
+    vector<string> contig_strand_names;
+    for (auto &cs_pair: data){
+      contig_strands.push_back(&cs_pair.second);
+      contig_strand_names.push_back(cs_pair.first);
+    }
+    if (num_threads == 1){
+      for (uint64_t row = 0; row < contig_strands.size(); ++row){
+        for (auto &position: contig_strands[row]->positions){
+          if (position.has_data){
+            for (auto &kmer_ptr: position.get_kmer_pointers()){
+              by_kmer_data.add_kmer_ptr(contig_strand_names[row], position.position, kmer_ptr);
+            }
+          }
+        }
+      }
+      by_kmer_bytes = by_kmer_data.memory_usage();
+      by_kmer_built = true;
+      return;
+    }
+//    slices of (contig strand row, first position, end position) handed out to the scanning threads
+    const uint64_t slice_size = 1 << 14;
+    vector<tuple<uint64_t, uint64_t, uint64_t>> slices;
+    for (uint64_t row = 0; row < contig_strands.size(); ++row){
+      uint64_t num_positions = contig_strands[row]->positions.size();
+      for (uint64_t start = 0; start < num_positions; start += slice_size){
+        slices.emplace_back(row, start, min(start + slice_size, num_positions));
+      }
+    }
+//    every position is visited once and its kmers are bucketed by the thread which owns the kmer
+    vector<vector<vector<ByKmerEntry>>> slice_buckets(slices.size(), vector<vector<ByKmerEntry>>(num_threads));
+    atomic<uint64_t> next_slice(0);
+    run_on_threads(num_threads, [&](uint64_t){
+      uint64_t i;
+      while ((i = next_slice.fetch_add(1)) < slices.size()){
+        uint64_t row = get<0>(slices[i]);
+        for (uint64_t p = get<1>(slices[i]); p < get<2>(slices[i]); ++p){
+          Position& position = contig_strands[row]->positions[p];
+          if (!position.has_data){
+            continue;
+          }
+          for (auto &kmer_ptr: position.get_kmer_pointers()){
+            uint64_t bucket = compute_string_hash(kmer_ptr->kmer) % num_threads;
+            slice_buckets[i][bucket].push_back({row, position.position, kmer_ptr});
+          }
+        }
+      }
+    });
+//    each thread adds its own bucket in slice order, so no Kmer is written by two threads and the order of the
+//    positions in each Kmer does not depend on the number of threads
+    run_on_threads(num_threads, [&](uint64_t bucket){
+      for (auto &buckets: slice_buckets){
+        for (auto &entry: buckets[bucket]){
+          by_kmer_data.add_kmer_ptr(contig_strand_names[entry.contig_strand_row], entry.position, entry.pos_kmer);
+        }
+        vector<ByKmerEntry>().swap(buckets[bucket]);
+      }
+    });
+    by_kmer_bytes = by_kmer_data.memory_usage();
+    by_kmer_built = true;
+  }
+
+  /**
+  Read a position from the event file under its shard lock if it is not populated yet
+
+  @param snapshot: if not null, the kmers of the position are copied here before the lock is released
+  */
+  Position& load_position(const string& contig, const string& strand, const string& nanopore_strand,
+                          const uint64_t& reference_index, Position* snapshot){
+    string contig_strand = contig+strand+nanopore_strand;
+    throw_assert(data.find(contig_strand) != data.end(),
+                 "contig_strand: " + contig_strand + " is not in EventDataHandler.")
+    boost::shared_lock<boost::shared_mutex> index_lk(index_mutex);
+    Position& pos = data.at(contig_strand).get_position(reference_index);
+    bool enabled = reader.initialized and this->cache_enabled();
+    std::unique_lock<std::mutex> lk(position_lock(contig_strand, reference_index));
+    bool loaded = false;
+    uint64_t bytes = 0;
+    if (reader.initialized & !pos.populated){
+      bytes = pos.memory_usage();
+      reader.get_position(pos, contig, strand, reference_index, nanopore_strand);
+      bytes = pos.memory_usage() - bytes;
+      loaded = true;
+    }
+    pos.finalize();
+    vector<shared_ptr<PosKmer>> kmer_pointers;
+    bool populated = pos.populated;
+    if (snapshot != nullptr or (loaded and !enabled and by_kmer_built)){
+      kmer_pointers = pos.get_kmer_pointers();
+    }
+    lk.unlock();
+    if (snapshot != nullptr){
+      for (auto &k: kmer_pointers){
+        snapshot->add_kmer(k);
+      }
+      snapshot->populated = populated;
+    }
+    if (loaded and !enabled and by_kmer_built){
+      for (auto &k: kmer_pointers){
+        std::lock_guard<std::mutex> kmer_lk(kmer_lock(k->kmer));
+        by_kmer_data.get_kmer(k->kmer).soft_add_pos_kmer(contig_strand, reference_index, k);
+      }
+    }
+    if (loaded){
+      this->cache_miss(position_cache_key(contig_strand, reference_index), bytes);
+    } else if (reader.initialized){
+      this->cache_hit(position_cache_key(contig_strand, reference_index));
+    }
+    return pos;
+  }
+
+  /**
+  Read the missing PosKmers of a kmer from the event file under its shard lock. Builds the by kmer index first
+  unless positions and kmers are cached independently.
+
+  @param index_lk: shared lock on the index mutex, released while the by kmer index is built
+  @param snapshot: if not null, the PosKmers of the kmer are copied here before the lock is released
+  */
+  Kmer& load_kmer(const string& path_kmer, boost::shared_lock<boost::shared_mutex>& index_lk, Kmer* snapshot){
+    bool enabled = reader.initialized and this->cache_enabled();
+    if (!enabled and !by_kmer_built){
+      index_lk.unlock();
+      {
+        boost::unique_lock<boost::shared_mutex> build_lk(index_mutex);
+        this->build_by_kmer_index_locked();
+      }
+      index_lk.lock();
+    }
+    Kmer& kmer_data = by_kmer_data.get_kmer(path_kmer);
+    std::unique_lock<std::mutex> lk(kmer_lock(path_kmer));
+    bool loaded = false;
+    if (reader.initialized){
+      uint64_t expected_n_kmers = reader.num_kmer_positions(path_kmer);
+      if (kmer_data.pos_kmer_map.size() != expected_n_kmers) {
+        get_kmer_from_reader(kmer_data, enabled);
+        loaded = true;
+      }
+    }
+//    kmers read from the event file are already finalized, in memory ones are finalized under their position locks
+    if (!reader.initialized){
+      for (auto &contig_position: kmer_data.contig_positions){
+        std::lock_guard<std::mutex> pos_lk(position_lock(get<0>(contig_position), get<1>(contig_position)));
+        kmer_data.get_pos_kmer(get<0>(contig_position), get<1>(contig_position))->finalize();
+      }
+    }
+    uint64_t bytes = loaded ? kmer_cache_bytes(kmer_data) : 0;
+    if (snapshot != nullptr){
+      *snapshot = kmer_data;
+    }
+    lk.unlock();
+    if (loaded){
+      this->cache_miss(kmer_cache_key(path_kmer), bytes);
+    } else if (reader.initialized){
+      this->cache_hit(kmer_cache_key(path_kmer));
+    }
+    return kmer_data;
+  }
+
+  static string position_cache_key(const string& contig_strand, const uint64_t& position){
+    return "p" + contig_strand + ":" + to_string(position);
+  }
+
+  static string kmer_cache_key(const string& kmer){
+    return "k" + kmer;
+  }
+
+  static uint64_t kmer_cache_bytes(const Kmer& kmer){
+    uint64_t bytes = kmer.memory_usage();
+    for (auto &pos_kmer: kmer.pos_kmer_map){
+      bytes += make_shared_memory<PosKmer>() + pos_kmer.second->memory_usage();
+    }
+    return bytes;
+  }
+
+  std::function<void(const string&)> cache_evict_function(){
+    return [this](const string& key){ this->evict(key); };
+  }
+
+  /**
+  Free the position or kmer behind a cache key under its shard lock
+  */
+  void evict(const string& key){
+    if (key[0] == 'k'){
+      string kmer = key.substr(1);
+      std::lock_guard<std::mutex> lk(kmer_lock(kmer));
+      by_kmer_data.get_kmer(kmer).clear();
+      return;
+    }
+    uint64_t colon = key.rfind(':');
+    string contig_strand = key.substr(1, colon - 1);
+    uint64_t position = stoull(key.substr(colon + 1));
+    std::lock_guard<std::mutex> lk(position_lock(contig_strand, position));
+    data.at(contig_strand).get_position(position).clear();
+  }
 
 
   shared_ptr<PosKmer> get_position_kmer_from_reader(const string& contig, const string& strand, const string& nanopore_strand,
                                                     const uint64_t& reference_index, const string& path_kmer){
     if (reader.initialized){
+      bool enabled = this->cache_enabled();
       shared_ptr<PosKmer> shared_ptr_pos_kmer = reader.get_position_kmer(path_kmer, contig, strand, reference_index, nanopore_strand);
       string contig_strand = contig+strand+nanopore_strand;
-      data.at(contig_strand).get_position(reference_index).add_kmer(shared_ptr_pos_kmer);
-      by_kmer_data.add_kmer_ptr(contig_strand, reference_index, shared_ptr_pos_kmer);
+      {
+        std::lock_guard<std::mutex> lk(position_lock(contig_strand, reference_index));
+        Position& pos = data.at(contig_strand).get_position(reference_index);
+//        another thread may have read it first
+        if (pos.has_kmer(path_kmer)){
+          return pos.get_pos_kmer(path_kmer);
+        }
+        pos.add_kmer(shared_ptr_pos_kmer);
+      }
+      if (!enabled and by_kmer_built){
+        std::lock_guard<std::mutex> kmer_lk(kmer_lock(path_kmer));
+        by_kmer_data.add_kmer_ptr(contig_strand, reference_index, shared_ptr_pos_kmer);
+      }
+      this->cache_miss(position_cache_key(contig_strand, reference_index),
+                       string_memory(path_kmer) + make_shared_memory<PosKmer>() + shared_ptr_pos_kmer->memory_usage());
       return shared_ptr_pos_kmer;
     }
     // Not there
@@ -206,14 +896,22 @@ class EventDataHandler {
 
   }
 
-  void get_kmer_from_reader(Kmer& kmer){
+  /**
+  Read the missing PosKmers of a kmer, the caller holds the kmer's shard lock. Unless positions and kmers are cached
+  independently, positions without the kmer are given the new PosKmers under their own shard locks.
+  */
+  void get_kmer_from_reader(Kmer& kmer, bool independent){
     if (reader.initialized){
       reader.populate_kmer(kmer);
+      if (independent){
+        return;
+      }
       string contig_strand;
       uint64_t position;
       for (auto &k: kmer.contig_positions){
         contig_strand = get<0>(k);
         position = get<1>(k);
+        std::lock_guard<std::mutex> lk(position_lock(contig_strand, position));
         Position& pos = data.at(contig_strand).get_position(position);
         if (!pos.has_kmer(kmer.kmer))
           pos.add_kmer(kmer.get_pos_kmer(contig_strand, position));
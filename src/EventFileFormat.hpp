@@ -0,0 +1,126 @@
+#ifndef EMBED_FAST5_SRC_EVENTFILEFORMAT_HPP_
+#define EMBED_FAST5_SRC_EVENTFILEFORMAT_HPP_
+
+// std libs
+#include <cstdint>
+#include <cstring>
+
+/*
+Version 2 event file layout. Every offset is an absolute byte offset into the file and every table starts on an
+8 byte boundary so the tables can be used in place from a mapping of the file.
+
+  EventFileHeader
+  kmer payloads (events of one kmer at one position)
+  kmer major payloads (optional)
+  EventFileFooter
+  EventFileKmerMajorFooter (optional)
+  contig table:   EventFileContigRecord[num_contig_strands]   sorted by (contig, strand, nanopore strand)
+  string pool:    contig names and the alphabet
+  position table: EventFilePositionRecord[num_positions]      sorted by (contig row, position)
+  kmer table:     EventFileKmerRecord[num_kmers]              grouped by position row, sorted by packed kmer
+  by kmer table:  EventFileByKmerRecord[num_kmers]            sorted by (packed kmer, position row)
+  kmer major offsets: uint64_t[num_kmers + 1] (optional)
+  EventFileTrailer
+
+When the header flags have EVENT_FILE_COMPRESSED set, every payload is a block written by encode_event_block
+(EventCodec.hpp), otherwise payloads are raw Events.
+
+When the header flags have EVENT_FILE_KMER_MAJOR set, every payload is written a second time in by kmer table order
+so all events of a kmer are one contiguous range. Row i of the by kmer table has its copy at
+[kmer major offsets[i], kmer major offsets[i + 1]).
+
+Version 1 files have no header and end with the offset of a variable width index, which is how readers tell the two
+apart.
+*/
+
+const char EVENT_FILE_MAGIC[8] = {'E', 'M', 'B', 'E', 'D', 'E', 'V', '2'};
+const uint64_t EVENT_FILE_VERSION = 2;
+// EventFileHeader flags
+const uint64_t EVENT_FILE_COMPRESSED = 1;
+const uint64_t EVENT_FILE_KMER_MAJOR = 2;
+
+struct EventFileHeader {
+  char magic[8];
+  uint64_t version;
+  uint64_t flags;
+  uint64_t reserved;
+};
+
+struct EventFileFooter {
+  uint64_t kmer_length;
+  uint64_t alphabet_offset;
+  uint64_t alphabet_length;
+  uint64_t rna;
+  uint64_t two_d;
+  uint64_t num_contig_strands;
+  uint64_t contig_table_offset;
+  uint64_t string_pool_offset;
+  uint64_t string_pool_length;
+  uint64_t num_positions;
+  uint64_t position_table_offset;
+  uint64_t num_kmers;
+  uint64_t kmer_table_offset;
+  uint64_t by_kmer_table_offset;
+};
+
+/**
+@param payload_offset: absolute offset of the first kmer major payload
+@param payload_length: bytes of kmer major payloads
+@param offset_table_offset: absolute offset of the kmer major offsets
+*/
+struct EventFileKmerMajorFooter {
+  uint64_t payload_offset;
+  uint64_t payload_length;
+  uint64_t offset_table_offset;
+};
+
+/**
+@param name_offset: absolute offset of the contig name in the string pool
+@param first_position_row: first row of this contig strand in the position table
+*/
+struct EventFileContigRecord {
+  uint64_t name_offset;
+  uint64_t name_length;
+  uint64_t num_positions;
+  uint64_t num_written_positions;
+  uint64_t first_position_row;
+  char strand;
+  char nanopore_strand;
+  char padding[6];
+};
+
+struct EventFilePositionRecord {
+  uint64_t position;
+  uint64_t first_kmer_row;
+  uint64_t num_kmers;
+  uint64_t contig_row;
+};
+
+/**
+@param kmer: kmer packed with KmerPacker
+@param byte_offset: absolute offset of the payload
+@param byte_length: size of the payload in bytes
+@param num_events: number of events in the payload
+*/
+struct EventFileKmerRecord {
+  uint64_t kmer;
+  uint64_t byte_offset;
+  uint64_t byte_length;
+  uint64_t num_events;
+};
+
+struct EventFileByKmerRecord {
+  uint64_t kmer_row;
+  uint64_t position_row;
+};
+
+struct EventFileTrailer {
+  uint64_t footer_offset;
+  char magic[8];
+};
+
+inline bool is_event_file_magic(const char* magic){
+  return std::memcmp(magic, EVENT_FILE_MAGIC, sizeof(EVENT_FILE_MAGIC)) == 0;
+}
+
+#endif //EMBED_FAST5_SRC_EVENTFILEFORMAT_HPP_
@@ -0,0 +1,242 @@
+#ifndef EMBED_FAST5_SRC_EVENTRUNFILE_HPP_
+#define EMBED_FAST5_SRC_EVENTRUNFILE_HPP_
+
+// embed libs
+#include "BaseKmer.hpp"
+#include "BinaryIO.hpp"
+#include "BinaryEventWriter.hpp"
+// boost libs
+#include <boost/filesystem.hpp>
+// std libs
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <fstream>
+
+using namespace std;
+using namespace embed_utils;
+using namespace boost::filesystem;
+
+/**
+Contig strand described in the header of a run file. The position of an entry in the header is the id used by the
+records of the run.
+*/
+struct ContigStrandRunEntry {
+  string contig;
+  string strand;
+  string nanopore_strand;
+  uint64_t num_positions;
+
+  bool operator==(const ContigStrandRunEntry& other) const {
+    return contig == other.contig and strand == other.strand and nanopore_strand == other.nanopore_strand and
+        num_positions == other.num_positions;
+  }
+};
+
+/**
+All events of a single kmer at a single contig strand position
+*/
+struct EventRunRecord {
+  uint64_t contig_strand_id;
+  uint64_t position;
+  string kmer;
+  vector<Event> events;
+};
+
+/**
+Writes a sorted run of kmer events to disk. Records must be written in (contig strand id, position, kmer) order so
+runs can be k-way merged later.
+
+File layout:
+  num contig strands, [contig length, contig, strand, nanopore strand, num positions]...
+  [contig strand id, position, kmer length, kmer, num events, events]...
+*/
+class EventRunWriter {
+ public:
+  EventRunWriter(const path& file_path, const vector<ContigStrandRunEntry>& contig_strands) :
+      file_path(file_path) {
+    this->run_file = std::ofstream(this->file_path.c_str(), std::ofstream::binary);
+    throw_assert(this->run_file.is_open(), "ERROR: could not open file " + file_path.string());
+    write_value_to_binary(this->run_file, (uint64_t) contig_strands.size());
+    for (auto &entry: contig_strands){
+      string contig = entry.contig;
+      string strand = entry.strand;
+      string nanopore_strand = entry.nanopore_strand;
+      write_value_to_binary(this->run_file, (uint64_t) contig.size());
+      write_string_to_binary(this->run_file, contig);
+      write_string_to_binary(this->run_file, strand);
+      write_string_to_binary(this->run_file, nanopore_strand);
+      write_value_to_binary(this->run_file, entry.num_positions);
+    }
+  }
+  ~EventRunWriter() {
+    this->close();
+  }
+
+  void write_pos_kmer(const uint64_t& contig_strand_id, const uint64_t& position, PosKmer& kmer){
+    kmer.finalize();
+    write_value_to_binary(this->run_file, contig_strand_id);
+    write_value_to_binary(this->run_file, position);
+    write_value_to_binary(this->run_file, (uint64_t) kmer.kmer.size());
+    write_string_to_binary(this->run_file, kmer.kmer);
+    write_value_to_binary(this->run_file, (uint64_t) kmer.events.size());
+    write_vector_to_binary(this->run_file, kmer.events);
+    num_records += 1;
+  }
+
+  void close(){
+    if (this->run_file.is_open()){
+      this->run_file.close();
+      throw_assert(!this->run_file.fail(), "ERROR: failed writing run file " + file_path.string())
+    }
+  }
+
+  uint64_t num_records = 0;
+
+ private:
+  path file_path;
+  std::ofstream run_file;
+};
+
+/**
+Sequentially reads the records of a run file written by EventRunWriter
+*/
+class EventRunReader {
+ public:
+  explicit EventRunReader(const path& file_path) :
+      file_path(file_path) {
+    this->run_file = std::ifstream(this->file_path.c_str(), std::ifstream::binary);
+    throw_assert(this->run_file.is_open(), "ERROR: could not open file " + file_path.string());
+    uint64_t num_contig_strands = 0;
+    read_value_from_binary(this->run_file, num_contig_strands);
+    contig_strands.resize(num_contig_strands);
+    for (auto &entry: contig_strands){
+      uint64_t contig_length = 0;
+      read_value_from_binary(this->run_file, contig_length);
+      read_string_from_binary(this->run_file, entry.contig, contig_length);
+      read_string_from_binary(this->run_file, entry.strand, 1);
+      read_string_from_binary(this->run_file, entry.nanopore_strand, 1);
+      read_value_from_binary(this->run_file, entry.num_positions);
+    }
+    throw_assert(this->run_file.good(), "ERROR: truncated run file header " + file_path.string())
+  }
+  ~EventRunReader() = default;
+
+  /**
+  Load the next record into `record`
+  @return false once the run is exhausted
+  */
+  bool next(){
+    if (this->run_file.peek() == std::char_traits<char>::eof()){
+      return false;
+    }
+    uint64_t kmer_length = 0;
+    uint64_t num_events = 0;
+    read_value_from_binary(this->run_file, record.contig_strand_id);
+    read_value_from_binary(this->run_file, record.position);
+    read_value_from_binary(this->run_file, kmer_length);
+    read_string_from_binary(this->run_file, record.kmer, kmer_length);
+    read_value_from_binary(this->run_file, num_events);
+    read_vector_from_binary(this->run_file, record.events, num_events);
+    throw_assert(this->run_file.good(), "ERROR: truncated record in run file " + file_path.string())
+    return true;
+  }
+
+  vector<ContigStrandRunEntry> contig_strands;
+  EventRunRecord record;
+
+ private:
+  path file_path;
+  std::ifstream run_file;
+};
+
+/**
+Orders run readers by the key of their current record so a priority queue pops the smallest key first
+*/
+struct EventRunReaderGreater {
+  const vector<unique_ptr<EventRunReader>>* readers;
+  bool operator()(const uint64_t& a, const uint64_t& b) const {
+    const EventRunRecord& ra = (*readers)[a]->record;
+    const EventRunRecord& rb = (*readers)[b]->record;
+    if (ra.contig_strand_id != rb.contig_strand_id) return ra.contig_strand_id > rb.contig_strand_id;
+    if (ra.position != rb.position) return ra.position > rb.position;
+    if (ra.kmer != rb.kmer) return ra.kmer > rb.kmer;
+    return a > b;
+  }
+};
+
+/**
+K-way merge sorted run files into a BinaryEventWriter. Records sharing a (contig strand, position, kmer) key are
+combined and capped to the max_events most probable events, so only one position is held in memory at a time.
+
+@param run_files: run files written by EventRunWriter with identical headers
+@param writer: open BinaryEventWriter. write_indexes is left to the caller
+@param max_events: max events to keep per kmer at a position (0 keeps all events)
+*/
+inline void merge_event_runs(const vector<path>& run_files, BinaryEventWriter& writer, const uint64_t& max_events){
+  vector<unique_ptr<EventRunReader>> readers;
+  for (auto &run_file: run_files){
+    readers.emplace_back(new EventRunReader(run_file));
+    throw_assert(readers.back()->contig_strands == readers.front()->contig_strands,
+                 "Run file " + run_file.string() + " was written with a different set of contig strands")
+  }
+  if (readers.empty()){
+    return;
+  }
+  vector<ContigStrandRunEntry>& contig_strands = readers.front()->contig_strands;
+  for (auto &entry: contig_strands){
+    writer.add_contig_strand(entry.contig, entry.strand, entry.nanopore_strand, entry.num_positions);
+  }
+
+  EventRunReaderGreater greater{&readers};
+  priority_queue<uint64_t, vector<uint64_t>, EventRunReaderGreater> heap(greater);
+  for (uint64_t i = 0; i < readers.size(); ++i){
+    if (readers[i]->next()){
+      heap.push(i);
+    }
+  }
+
+  Position current;
+  uint64_t current_contig_strand = 0;
+  bool have_position = false;
+  auto flush = [&](){
+    ContigStrandRunEntry& entry = contig_strands.at(current_contig_strand);
+    writer.write_position(entry.contig, entry.strand, entry.nanopore_strand, entry.num_positions, current);
+  };
+
+  while (!heap.empty()){
+    uint64_t i = heap.top();
+    heap.pop();
+    EventRunRecord& record = readers[i]->record;
+    if (have_position and (record.contig_strand_id != current_contig_strand or record.position != current.position)){
+      flush();
+      have_position = false;
+    }
+    if (!have_position){
+      current.clear();
+      current.position = record.position;
+      current_contig_strand = record.contig_strand_id;
+      have_position = true;
+    }
+    if (!current.has_kmer(record.kmer)){
+      if (max_events > 0){
+        current.add_kmer(make_shared<PosKmer>(record.kmer, max_events));
+      } else {
+        current.add_kmer(make_shared<PosKmer>(record.kmer));
+      }
+    }
+    shared_ptr<PosKmer> kmer = current.get_pos_kmer(record.kmer);
+    for (auto &event: record.events){
+      kmer->add_event(event);
+    }
+    if (readers[i]->next()){
+      heap.push(i);
+    }
+  }
+  if (have_position){
+    flush();
+  }
+}
+
+#endif //EMBED_FAST5_SRC_EVENTRUNFILE_HPP_
@@ -6,6 +6,7 @@
 #include "LoadVariantPaths.hpp"
 #include "AlignmentFile.hpp"
 #include "EmbedUtils.hpp"
+#include "TextWriter.hpp"
 
 using namespace embed_utils;
 
@@ -13,12 +14,11 @@ using namespace embed_utils;
  * Constructor for LoadVariantPaths
  * @param positions_file_path: path to positions file
  * @param full_sa_dir: path to directory with "full" sa output tsv files
-
+ * @param num_locks: ignored, each thread counts paths into its own table
  */
 LoadVariantPaths::LoadVariantPaths(const string &positions_file_path, const string &full_sa_dir, bool rna, uint64_t num_locks) {
   this->vp.load_positions_file(positions_file_path);
   this->num_locks = num_locks;
-  this->initialize_locks();
   this->read_in_sa_files(full_sa_dir, rna);
 }
 
@@ -28,19 +28,9 @@ LoadVariantPaths::LoadVariantPaths(const string &positions_file_path, const stri
 LoadVariantPaths::~LoadVariantPaths()
 = default;
 
-/**
- * Default de-constructor for LoadVariantPaths
- */
-void LoadVariantPaths::initialize_locks() {
-  for (uint64_t i=0; i<this->num_locks; i++){
-    omp_lock_t new_lock;
-    omp_init_lock(&(new_lock));
-    locks.push_back(new_lock);
-  }
-}
-
-
-/** Read in "full" signal align files, generate variant calls and
+/** Read in "full" signal align files, generate variant calls and count the reads of each path. Files are handed out
+ * dynamically because their sizes vary by orders of magnitude and each thread counts into its own table, the tables
+ * are added up by merge_partial_counts.
  * @param full_sa_dir: path to directory with "full" sa output tsv files
  */
 void LoadVariantPaths::read_in_sa_files(const string &full_sa_dir, bool rna){
@@ -55,8 +45,9 @@ void LoadVariantPaths::read_in_sa_files(const string &full_sa_dir, bool rna){
   string* array_of_files = &all_tsvs[0];
   read_id_path_id_map.resize(number_of_files);
   read_id_to_variant_calls.resize(number_of_files);
+  vector<PathCounts> partial_counts(omp_get_max_threads());
 // looping through the files
-#pragma omp parallel for shared(array_of_files, number_of_files, rna) default(none)
+#pragma omp parallel for schedule(dynamic, 1) shared(array_of_files, number_of_files, rna, partial_counts) default(none)
   for(int64_t i=0; i < number_of_files; i++) {
     //    load file
     AlignmentFile af(array_of_files[i], rna);
@@ -67,11 +58,44 @@ void LoadVariantPaths::read_in_sa_files(const string &full_sa_dir, bool rna){
     uint64_t path_id = this->vp.variant_call_to_id(contig_strand, calls);
 //  keep track fo variant path and counts per path
     read_id_path_id_map[i] = make_tuple(contig_strand, af.read_id, path_id);
-    read_id_to_variant_calls[i] = calls;
-//  set lock for creating and addition of path id if needed
-    omp_set_lock(&(locks[path_id % num_locks]));
-    counts[contig_strand][path_id] += 1;
-    omp_unset_lock(&(locks[path_id % num_locks]));
+    read_id_to_variant_calls[i] = move(calls);
+//  no lock needed, only this thread touches its table
+    partial_counts[omp_get_thread_num()][contig_strand][path_id] += 1;
+  }
+  this->merge_partial_counts(partial_counts);
+}
+
+/** Add the path counts of every thread to counts and free them. Each contig_strand is merged by one thread.
+ * @param partial_counts: path counts of each thread
+ */
+void LoadVariantPaths::merge_partial_counts(vector<PathCounts>& partial_counts){
+//  create every contig_strand first so the merge threads do not modify counts itself
+  for (auto &partial: partial_counts){
+    for (auto &contig_map: partial){
+      counts[contig_map.first];
+    }
+  }
+  vector<string> contig_strands;
+  vector<map<uint64_t, uint64_t>*> merged;
+  for (auto &contig_map: counts){
+    contig_strands.push_back(contig_map.first);
+    merged.push_back(&contig_map.second);
+  }
+  auto number_of_jobs = (int64_t) merged.size();
+#pragma omp parallel for schedule(dynamic, 1) shared(number_of_jobs, merged, contig_strands, partial_counts) default(none)
+  for (int64_t i = 0; i < number_of_jobs; i++) {
+    for (auto &partial: partial_counts){
+      auto found = partial.find(contig_strands[i]);
+      if (found == partial.end()){
+        continue;
+      }
+      for (auto &id_map: found->second){
+        (*merged[i])[id_map.first] += id_map.second;
+      }
+    }
+  }
+  for (auto &partial: partial_counts){
+    PathCounts().swap(partial);
   }
 }
 
@@ -79,8 +103,7 @@ void LoadVariantPaths::read_in_sa_files(const string &full_sa_dir, bool rna){
  * @param output_path: path to output file
  */
 void LoadVariantPaths::write_per_read_calls(const string &output_path){
-  std::ofstream out_file;
-  out_file.open(output_path);
+  TextWriter out_file(output_path);
   bool comma = false;
   string base;
   // loop through all contigs
@@ -149,8 +172,7 @@ void LoadVariantPaths::write_per_read_calls(const string &output_path){
  * @param output_path: path to output file
  */
 void LoadVariantPaths::write_per_path_counts(const string &output_path){
-  std::ofstream out_file;
-  out_file.open(output_path);
+  TextWriter out_file(output_path);
   // loop through all contigs
   out_file << "contig_strand" << '\t' << "path_id" << '\t' << "path" << '\t' << "nucleotide_path" << '\t' << "counts" << '\n';
 
@@ -12,19 +12,22 @@
 #include "omp.h"
 using namespace std;
 
+//  number of reads per path: contig_strand -> path_id -> counts
+typedef map<string, map<uint64_t, uint64_t>> PathCounts;
+
 class LoadVariantPaths {
  public:
   VariantPath vp;
   vector<tuple<string, string, uint64_t>> read_id_path_id_map;
   vector<vector<VariantCall>> read_id_to_variant_calls;
-  map<string, map<uint64_t, uint64_t>> counts;
-  std::vector<omp_lock_t> locks;
+  PathCounts counts;
+//  ignored, each thread counts paths into its own table
   uint64_t num_locks;
 
   explicit LoadVariantPaths(const string &positions_file_path, const string &full_sa_dir, bool rna, uint64_t num_locks);
   ~LoadVariantPaths();
-  void initialize_locks();
   void read_in_sa_files(const string &full_sa_dir, bool rna);
+  void merge_partial_counts(vector<PathCounts>& partial_counts);
   void write_per_read_calls(const string &output_path);
   void write_per_path_counts(const string &output_path);
 };
@@ -3,8 +3,13 @@
 //
 
 #include "MarginalizeVariants.hpp"
+#include "EmbedUtils.hpp"
+#include "TextWriter.hpp"
+#include "BinaryIO.hpp"
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <set>
 
 
 
@@ -17,35 +22,88 @@ MarginalizeVariants::~MarginalizeVariants()
 /**
  * Constructor for MarginalizeVariants.
  */
-MarginalizeVariants::MarginalizeVariants() :
-    num_locks(0), initialized_locks(false)
-{
-}
+MarginalizeVariants::MarginalizeVariants() = default;
 
 /**
  * Constructor for MarginalizeVariants.
+ *
+ * @param num_threads: number of threads which load variants, each one counts into its own partial
  */
-MarginalizeVariants::MarginalizeVariants(uint64_t num_locks) :
-num_locks(num_locks), initialized_locks(true) {
-  this->initialize_locks();
+MarginalizeVariants::MarginalizeVariants(uint64_t num_threads) :
+    partials(num_threads) {
+}
 
+/**
+ * Count a variant call into a bed line
+ *
+ * @param bed_entry: counts of the position the call is at
+ * @param call: variant call
+ */
+static void count_variant(bed_line& bed_entry, VariantCall& call){
+  if (bed_entry.start == bed_line::UNSET) {
+    bed_entry.start = call.reference_index;
+    bed_entry.stop = call.reference_index + 1;
+    bed_entry.bases = call.bases;
+    size_t n_entries = call.normalized_probs.size();
+    bed_entry.hits.resize(call.normalized_probs.size());
+    for (size_t j = 0; j < n_entries; ++j) {
+      bed_entry.hits.push_back(0.0);
+    }
+  }
+  bed_entry.coverage += 1;
+  int max_index = max_element(call.normalized_probs.begin(), call.normalized_probs.end()) -
+      call.normalized_probs.begin();
+  bed_entry.hits[max_index] += 1;
 }
 
 /**
-Initialize vector of locks
-*/
-void MarginalizeVariants::initialize_locks() {
-  locks = std::vector<std::mutex>(this->num_locks);
+ * Throw if two bed lines of the same position count different variants
+ *
+ * @param merged: bed line to add to
+ * @param partial: bed line to add
+ */
+static void check_bed_lines_match(const bed_line& merged, const bed_line& partial){
+  throw_assert(merged.start == bed_line::UNSET or partial.start == bed_line::UNSET or
+                   (merged.bases == partial.bases and merged.hits.size() == partial.hits.size()),
+               "Cannot merge counts of different variants at position " + to_string(merged.start) + ": " +
+               merged.bases + " and " + partial.bases)
 }
 
 /**
-Initialize vector of locks
-*/
-void MarginalizeVariants::initialize_locks(uint64_t number_of_locks) {
-  this->num_locks = number_of_locks;
-  locks = std::vector<std::mutex>(this->num_locks);
+ * Check that every position of other can be merged into merged
+ *
+ * @param merged: positions of a contig strand to add to
+ * @param other: positions of the same contig strand to add
+ */
+static void check_strand_matches(const map<uint64_t, bed_line>& merged, const map<uint64_t, bed_line>& other){
+  for (auto &position: other){
+    auto found = merged.find(position.first);
+    if (found != merged.end()){
+      check_bed_lines_match(found->second, position.second);
+    }
+  }
 }
 
+/**
+ * Add the counts of one bed line to another of the same position
+ *
+ * @param merged: bed line to add to
+ * @param partial: bed line to add
+ */
+static void merge_bed_line(bed_line& merged, bed_line& partial){
+  if (merged.start == bed_line::UNSET) {
+    merged = move(partial);
+    return;
+  }
+  if (partial.start == bed_line::UNSET) {
+    return;
+  }
+  check_bed_lines_match(merged, partial);
+  merged.coverage += partial.coverage;
+  for (size_t j = 0; j < partial.hits.size(); ++j) {
+    merged.hits[j] += partial.hits[j];
+  }
+}
 
 /**
  * Load a vector of variants into the per_genomic position data structure.
@@ -54,47 +112,109 @@ void MarginalizeVariants::initialize_locks(uint64_t number_of_locks) {
  */
 void MarginalizeVariants::load_variants(vector<VariantCall>* vector_of_calls){
   for (auto& call: *vector_of_calls){
-    if (this->initialized_locks){
-      std::unique_lock<std::mutex> lk(this->locks[call.reference_index % this->num_locks]);
-//      omp_set_lock(&(this->locks[i.reference_index % this->num_locks]));
-      MarginalizeVariants::load_variant(call);
-      lk.unlock();
-//      omp_unset_lock(&(this->locks[i.reference_index % this->num_locks]));
+    MarginalizeVariants::load_variant(call);
+  }
+}
+
+/**
+ * Load a vector of variants into the partial counts of a thread. No locks are taken so each thread must use its own
+ * thread_id, the partials are combined by merge_partials.
+ *
+ * @param vector_of_calls: vector of variant_calls
+ * @param thread_id: index of the partial counts in [0, num_threads)
+ */
+void MarginalizeVariants::load_variants(vector<VariantCall>* vector_of_calls, uint64_t thread_id){
+  VariantCounts& counts = this->partials.at(thread_id);
+  for (auto& call: *vector_of_calls){
+    auto& contig = counts[call.contig];
+    if (call.strand == "+"){
+      count_variant(contig.first[call.reference_index], call);
     } else {
-      MarginalizeVariants::load_variant(call);
+      count_variant(contig.second[call.reference_index], call);
     }
   }
 }
 
 void MarginalizeVariants::load_variant(VariantCall& call){
-  bed_line bed_entry;
-  int max_index;
   if (call.strand == "+"){
-    bed_entry = this->per_genomic_position[call.contig].first[call.reference_index];
+    count_variant(this->per_genomic_position[call.contig].first[call.reference_index], call);
   } else {
-    bed_entry = this->per_genomic_position[call.contig].second[call.reference_index];
+    count_variant(this->per_genomic_position[call.contig].second[call.reference_index], call);
   }
+}
 
-  if (bed_entry.start == -1) {
-    bed_entry.start = call.reference_index;
-    bed_entry.stop = call.reference_index + 1;
-    bed_entry.bases = call.bases;
-    size_t n_entries = call.normalized_probs.size();
-    bed_entry.hits.resize(call.normalized_probs.size());
-    for (size_t j = 0; j < n_entries; ++j) {
-      bed_entry.hits.push_back(0.0);
+/**
+ * Merge the partial counts of every thread into per_genomic_position and free them. Each contig strand is merged by
+ * one thread so no locks are needed.
+ *
+ * @param num_threads: number of threads to merge with
+ */
+void MarginalizeVariants::merge_partials(uint64_t num_threads){
+//  create every contig first so the merge threads do not modify per_genomic_position itself
+  set<string> contigs;
+  for (auto &partial: this->partials){
+    for (auto &contig: partial){
+      contigs.insert(contig.first);
     }
   }
-  bed_entry.coverage += 1;
-  max_index = max_element(call.normalized_probs.begin(), call.normalized_probs.end()) - call.normalized_probs.begin();
-  bed_entry.hits[max_index] += 1;
-  if (call.strand == "+"){
-    this->per_genomic_position[call.contig].first[call.reference_index] = bed_entry;
-  } else {
-    this->per_genomic_position[call.contig].second[call.reference_index] = bed_entry;
+  vector<pair<string, bool>> jobs;
+  for (auto &contig: contigs){
+    this->per_genomic_position[contig];
+    jobs.emplace_back(contig, true);
+    jobs.emplace_back(contig, false);
+  }
+  std::atomic<uint64_t> next_job(0);
+  embed_utils::run_on_threads(std::max(num_threads, (uint64_t) 1), [&](uint64_t){
+    uint64_t i;
+    while ((i = next_job.fetch_add(1)) < jobs.size()){
+      const string& contig = jobs[i].first;
+      bool plus = jobs[i].second;
+      auto& merged = plus ? this->per_genomic_position.at(contig).first : this->per_genomic_position.at(contig).second;
+      for (auto &partial: this->partials){
+        auto found = partial.find(contig);
+        if (found == partial.end()){
+          continue;
+        }
+        for (auto &position: plus ? found->second.first : found->second.second){
+          merge_bed_line(merged[position.first], position.second);
+        }
+      }
+    }
+  });
+  for (auto &partial: this->partials){
+    VariantCounts().swap(partial);
   }
 }
 
+/**
+ * Add the counts of another MarginalizeVariants, eg. one loaded from the saved state of another shard. The counts of
+ * other are moved and it is left empty. Throws before changing anything if a position counts different variants.
+ *
+ * @param other: counts to add
+ */
+void MarginalizeVariants::merge(MarginalizeVariants& other){
+  this->merge_partials();
+  other.merge_partials();
+//  check every position first so a conflicting merge leaves the counts unchanged
+  for (auto &contig: other.per_genomic_position){
+    auto found = this->per_genomic_position.find(contig.first);
+    if (found != this->per_genomic_position.end()){
+      check_strand_matches(found->second.first, contig.second.first);
+      check_strand_matches(found->second.second, contig.second.second);
+    }
+  }
+  for (auto &contig: other.per_genomic_position){
+    auto& merged = this->per_genomic_position[contig.first];
+    for (auto &position: contig.second.first){
+      merge_bed_line(merged.first[position.first], position.second);
+    }
+    for (auto &position: contig.second.second){
+      merge_bed_line(merged.second[position.first], position.second);
+    }
+  }
+  other.per_genomic_position.clear();
+}
+
 /**
  * Write per_genomic_position to file
  *
@@ -102,32 +222,132 @@ void MarginalizeVariants::load_variant(VariantCall& call){
  * @param path_to_bed: path to bed file
  */
 void MarginalizeVariants::write_to_file(path& path_to_bed) {
-  boost::filesystem::ofstream myfile(path_to_bed);
-  if (myfile.is_open())
-  {
-//    go through each contig
-    for (pair<std::string, pair<map<uint64_t, bed_line>, map<uint64_t, bed_line>>> contig: this->per_genomic_position){
-//      first of pair is plus strand
-      for (pair<uint64_t, bed_line> strand: contig.second.first){
-        myfile << contig.first << "\t" << strand.second.start << "\t" << strand.second.stop << "\t" << "+" << "\t" << strand.second.coverage << "\t" << strand.second.bases;
-        for (uint64_t hit: strand.second.hits) {
-          myfile << "\t";
-          myfile << hit;
-        }
-        myfile << "\n";
+  this->merge_partials();
+  TextWriter myfile(path_to_bed);
+//  go through each contig
+  for (auto &contig: this->per_genomic_position){
+//    first of pair is plus strand
+    for (auto &strand: contig.second.first){
+      myfile << contig.first << '\t' << strand.second.start << '\t' << strand.second.stop << '\t' << '+' << '\t' << strand.second.coverage << '\t' << strand.second.bases;
+      for (uint64_t hit: strand.second.hits) {
+        myfile << '\t' << hit;
       }
-//      second of pair is minus strand
-      for (pair<uint64_t, bed_line> strand2: contig.second.second){
-        myfile << contig.first << "\t" << strand2.second.start << "\t" << strand2.second.stop << "\t" << "-" << "\t" << strand2.second.coverage << "\t" << strand2.second.bases;
-        for (uint64_t hit: strand2.second.hits) {
-          myfile << "\t";
-          myfile << hit;
-        }
-        myfile << "\n";
+      myfile << '\n';
+    }
+//    second of pair is minus strand
+    for (auto &strand2: contig.second.second){
+      myfile << contig.first << '\t' << strand2.second.start << '\t' << strand2.second.stop << '\t' << '-' << '\t' << strand2.second.coverage << '\t' << strand2.second.bases;
+      for (uint64_t hit: strand2.second.hits) {
+        myfile << '\t' << hit;
       }
+      myfile << '\n';
     }
-    myfile.close();
-  } else{
-    cout << "Unable to open file: " << path_to_bed.string() << "\n";
   }
-}
\ No newline at end of file
+  myfile.close();
+}
+
+//  marginal counts state file: magic, version, contigs, then the magic again so truncated files are caught
+static const char MARGINAL_STATE_MAGIC[8] = {'E', 'M', 'B', 'E', 'D', 'M', 'V', '1'};
+static const uint64_t MARGINAL_STATE_VERSION = 1;
+
+static void write_state_string(ostream& file, const string& value){
+  write_value_to_binary(file, (uint64_t) value.size());
+  file.write(value.data(), value.size());
+}
+
+static void write_state_strand(ostream& file, const map<uint64_t, bed_line>& positions){
+  write_value_to_binary(file, (uint64_t) positions.size());
+  for (auto &position: positions){
+    write_value_to_binary(file, position.second.start);
+    write_value_to_binary(file, position.second.stop);
+    write_value_to_binary(file, position.second.coverage);
+    write_state_string(file, position.second.bases);
+    write_value_to_binary(file, (uint64_t) position.second.hits.size());
+    write_vector_to_binary(file, position.second.hits);
+  }
+}
+
+static void read_state_value(istream& file, uint64_t& value, const path& state_path){
+  read_value_from_binary(file, value);
+  throw_assert(file.good(), "ERROR: truncated marginal counts state file: " + state_path.string())
+}
+
+static void read_state_string(istream& file, string& value, const path& state_path){
+  uint64_t length;
+  read_state_value(file, length, state_path);
+  throw_assert(length < (1 << 20), "ERROR: corrupt marginal counts state file: " + state_path.string())
+  read_string_from_binary(file, value, length);
+  throw_assert(file.good(), "ERROR: truncated marginal counts state file: " + state_path.string())
+}
+
+static void read_state_magic(istream& file, const path& state_path){
+  char magic[sizeof(MARGINAL_STATE_MAGIC)];
+  file.read(magic, sizeof(magic));
+  throw_assert(file.good() and std::memcmp(magic, MARGINAL_STATE_MAGIC, sizeof(magic)) == 0,
+               "ERROR: not a marginal counts state file: " + state_path.string())
+}
+
+/**
+ * Save the aggregated counts in a binary file which load_state can add to a later run
+ *
+ * @param state_path: path to state file
+ */
+void MarginalizeVariants::save_state(const path& state_path) {
+  this->merge_partials();
+  std::ofstream file(state_path.string(), std::ofstream::binary);
+  throw_assert(file.is_open(), "ERROR: could not open file " + state_path.string())
+  file.write(MARGINAL_STATE_MAGIC, sizeof(MARGINAL_STATE_MAGIC));
+  write_value_to_binary(file, MARGINAL_STATE_VERSION);
+  write_value_to_binary(file, (uint64_t) this->per_genomic_position.size());
+  for (auto &contig: this->per_genomic_position){
+    write_state_string(file, contig.first);
+    write_state_strand(file, contig.second.first);
+    write_state_strand(file, contig.second.second);
+  }
+  file.write(MARGINAL_STATE_MAGIC, sizeof(MARGINAL_STATE_MAGIC));
+  file.close();
+  throw_assert(!file.fail(), "ERROR: failed writing " + state_path.string())
+}
+
+/**
+ * Add the counts saved by save_state to per_genomic_position. Loading several states combines shards.
+ *
+ * @param state_path: path to state file
+ */
+void MarginalizeVariants::load_state(const path& state_path) {
+  std::ifstream file(state_path.string(), std::ifstream::binary);
+  throw_assert(file.good(), "ERROR: could not read " + state_path.string())
+  read_state_magic(file, state_path);
+  uint64_t version;
+  read_state_value(file, version, state_path);
+  throw_assert(version == MARGINAL_STATE_VERSION,
+               "ERROR: unsupported marginal counts state version " + to_string(version) + ": " + state_path.string())
+  MarginalizeVariants loaded;
+  uint64_t num_contigs;
+  read_state_value(file, num_contigs, state_path);
+  string contig;
+  for (uint64_t i = 0; i < num_contigs; ++i){
+    read_state_string(file, contig, state_path);
+    auto& strands = loaded.per_genomic_position[contig];
+    for (auto positions: {&strands.first, &strands.second}){
+      uint64_t num_positions;
+      read_state_value(file, num_positions, state_path);
+      for (uint64_t j = 0; j < num_positions; ++j){
+        bed_line line;
+        uint64_t num_hits;
+        read_state_value(file, line.start, state_path);
+        read_state_value(file, line.stop, state_path);
+        read_state_value(file, line.coverage, state_path);
+        read_state_string(file, line.bases, state_path);
+        read_state_value(file, num_hits, state_path);
+        throw_assert(num_hits < (1 << 20), "ERROR: corrupt marginal counts state file: " + state_path.string())
+        read_vector_from_binary(file, line.hits, num_hits);
+        throw_assert(file.good(), "ERROR: truncated marginal counts state file: " + state_path.string())
+        (*positions)[line.start] = move(line);
+      }
+    }
+  }
+  read_state_magic(file, state_path);
+//  only add the counts once the whole file is read so a corrupt file leaves this unchanged
+  this->merge(loaded);
+}
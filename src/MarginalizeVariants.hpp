@@ -10,7 +10,7 @@
 #include <vector>
 #include <string>
 #include <map>
-#include <mutex>
+#include <unordered_map>
 #include <thread>
 #include <omp.h>
 
@@ -20,35 +20,41 @@ using namespace std;
 using namespace boost::filesystem;
 
 struct bed_line{
+//  start and stop of a position which has not counted a call yet
+  static const uint64_t UNSET = (uint64_t) -1;
   uint64_t start;
   uint64_t stop;
   uint64_t coverage;
   vector<uint64_t> hits;
   string bases;
   bed_line(){
-    start=-1;
-    stop=-1;
+    start=UNSET;
+    stop=UNSET;
     coverage=0;
   }
 };
 
+//  partial counts of one thread: contig -> (plus strand, minus strand) position counts
+typedef unordered_map<string, pair<unordered_map<uint64_t, bed_line>, unordered_map<uint64_t, bed_line>>> VariantCounts;
 
 class MarginalizeVariants {
 
  public:
   MarginalizeVariants();
-  explicit MarginalizeVariants(uint64_t num_locks);
+  explicit MarginalizeVariants(uint64_t num_threads);
   ~MarginalizeVariants();
   void load_variants(vector<VariantCall>* vector_of_calls);
+  void load_variants(vector<VariantCall>* vector_of_calls, uint64_t thread_id);
   void load_variant(VariantCall& call);
+  void merge_partials(uint64_t num_threads=1);
+  void merge(MarginalizeVariants& other);
   void write_to_file(path& path_to_bed);
-  void initialize_locks();
-  void initialize_locks(uint64_t number_of_locks);
+  void save_state(const path& state_path);
+  void load_state(const path& state_path);
 //  per_genomic_position[contig][strand] = map of positions
-  uint64_t num_locks{};
-  bool initialized_locks{};
-  std::vector<mutex> locks;
   map<std::string, pair<map<uint64_t, bed_line>, map<uint64_t, bed_line>>> per_genomic_position;
+//  one set of counts per loading thread, merged into per_genomic_position by merge_partials
+  vector<VariantCounts> partials;
 };
 
 #endif //EMBED_FAST5_SRC_MARGINALIZEVARIANTS_HPP_
@@ -9,6 +9,8 @@
 #include "AlignmentFile.hpp"
 
 #include "EmbedUtils.hpp"
+#include "MemoryReport.hpp"
+#include "TextWriter.hpp"
 #include <boost/filesystem.hpp>
 #include <boost/heap/priority_queue.hpp>
 #include <mutex>
@@ -131,11 +133,10 @@ class MaxKmers{
    * @param output_path
    */
   void write_to_file(boost::filesystem::path &output_path, bool write_full) {
-    std::ofstream out_file;
-    out_file.open(output_path.string());
+    TextWriter out_file(output_path);
     for (auto &pq: this->kmer_queues){
       for (auto &event: pq){
-        out_file << event.format_line(write_full);
+        event.write_line(out_file, write_full);
       }
     }
     out_file.close();
@@ -148,18 +149,15 @@ class MaxKmers{
    * @param write_full: boolean option to write full output
    */
   void write_to_file(boost::filesystem::path &output_path, boost::filesystem::path &log_path, bool write_full) {
-    std::ofstream out_file;
-    out_file.open(output_path.string());
-
-    std::ofstream out_log;
-    out_log.open(log_path.string());
+    TextWriter out_file(output_path);
+    TextWriter out_log(log_path);
     out_log << "kmers" << '\t' << "num_events" << '\t' << "min_prob" << '\n';
 
     size_t kmer_index = 0;
     for (auto &pq: this->kmer_queues){
 // loop through all queues
       for (auto &event: pq){
-        out_file << event.format_line(write_full);
+        event.write_line(out_file, write_full);
 //      keep track of number of events
       }
       //    log info about queue
@@ -179,6 +177,24 @@ class MaxKmers{
     out_log.close();
   }
 
+  /**
+  Heap bytes held by the kmer heaps and their events. Each heap is locked while it is measured.
+  */
+  MemoryReport memory_report() {
+    uint64_t bytes = vector_memory(kmer_queues);
+    for (size_t i = 0; i < kmer_queues.size(); ++i){
+      std::unique_lock<std::mutex> lock(this->locks[i]);
+      bytes += kmer_queues[i].size() * sizeof(T);
+      for (auto &event: kmer_queues[i]){
+        bytes += event.memory_usage();
+      }
+    }
+    MemoryReport report;
+    report.add("max_kmers_heaps", bytes);
+    report.add("locks", vector_memory(locks));
+    return report;
+  }
+
   /**
   Add kmer data to the heap data structure for said kmer if probability is greater than the smallest probability
 
@@ -0,0 +1,185 @@
+#ifndef EMBED_FAST5_SRC_MEMORYREPORT_HPP_
+#define EMBED_FAST5_SRC_MEMORYREPORT_HPP_
+
+// std libs
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <utility>
+#include <sstream>
+#include <iomanip>
+#include <ostream>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+using std::pair;
+
+/*
+Heap accounting helpers. Sizes follow the libstdc++ layouts: a string only allocates once it outgrows its small
+string buffer, vectors allocate their capacity, unordered_map allocates a bucket array plus one node per element
+holding the next pointer, the value and (for string keys) the cached hash, and make_shared allocates the object next
+to its two reference counts and vtable pointer.
+*/
+
+inline uint64_t string_memory(const string& s){
+  const char* data = s.data();
+  const char* self = reinterpret_cast<const char*>(&s);
+  if (data >= self and data < self + sizeof(string)){
+    return 0;
+  }
+  return s.capacity() + 1;
+}
+
+template<class T>
+inline uint64_t vector_memory(const vector<T>& v){
+  return v.capacity() * sizeof(T);
+}
+
+template<class K, class V>
+inline uint64_t unordered_map_memory(const unordered_map<K, V>& m){
+  uint64_t node_size = sizeof(void*) + sizeof(pair<const K, V>) + (std::is_same<K, string>::value ? sizeof(size_t) : 0);
+  return m.bucket_count() * sizeof(void*) + m.size() * node_size;
+}
+
+template<class T>
+inline uint64_t make_shared_memory(){
+  return sizeof(T) + 2 * sizeof(int) + sizeof(void*);
+}
+
+/**
+Named byte counts for the components of a data structure
+
+@param components: (name, bytes) in the order they were added
+*/
+class MemoryReport {
+ public:
+  vector<pair<string, uint64_t>> components;
+
+  /**
+  Add bytes to a component, creating it if needed
+  */
+  void add(const string& name, uint64_t bytes){
+    for (auto &component: components){
+      if (component.first == name){
+        component.second += bytes;
+        return;
+      }
+    }
+    components.emplace_back(name, bytes);
+  }
+
+  /**
+  Add every component of another report
+  */
+  void add(const MemoryReport& other){
+    for (auto &component: other.components){
+      this->add(component.first, component.second);
+    }
+  }
+
+  uint64_t get(const string& name) const {
+    for (auto &component: components){
+      if (component.first == name){
+        return component.second;
+      }
+    }
+    return 0;
+  }
+
+  uint64_t total() const {
+    uint64_t bytes = 0;
+    for (auto &component: components){
+      bytes += component.second;
+    }
+    return bytes;
+  }
+
+  /**
+  Single line report eg. "total=1.50MB contig_strand_positions=1.00MB pos_kmer_events=512.00KB"
+  */
+  string format() const {
+    std::ostringstream line;
+    line << "total=" << format_bytes(this->total());
+    for (auto &component: components){
+      line << ' ' << component.first << '=' << format_bytes(component.second);
+    }
+    return line.str();
+  }
+
+  static string format_bytes(uint64_t bytes){
+    const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+    double value = bytes;
+    uint64_t unit = 0;
+    while (value >= 1024 and unit < 4){
+      value /= 1024;
+      unit += 1;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(unit == 0 ? 0 : 2) << value << units[unit];
+    return out.str();
+  }
+};
+
+/**
+Background thread which writes a memory report every interval seconds until it is destroyed
+
+@param interval: seconds between reports (0 never reports)
+@param reporter: callable returning the current MemoryReport
+@param out: stream to write reports to
+*/
+class MemoryReporter {
+ public:
+  MemoryReporter(uint64_t interval, std::function<MemoryReport()> reporter, std::ostream& out) :
+      interval(interval), reporter(std::move(reporter)), out(out) {
+    if (this->interval > 0){
+      report_thread = std::thread(&MemoryReporter::run, this);
+    }
+  }
+  ~MemoryReporter() {
+    this->stop();
+  }
+  MemoryReporter(const MemoryReporter&) = delete;
+  MemoryReporter& operator=(const MemoryReporter&) = delete;
+
+  void stop(){
+    {
+      std::lock_guard<std::mutex> lk(stop_mutex);
+      stopped = true;
+    }
+    stop_cv.notify_all();
+    if (report_thread.joinable()){
+      report_thread.join();
+    }
+  }
+
+  uint64_t num_reports = 0;
+
+ private:
+  uint64_t interval;
+  std::function<MemoryReport()> reporter;
+  std::ostream& out;
+  std::thread report_thread;
+  std::mutex stop_mutex;
+  std::condition_variable stop_cv;
+  bool stopped = false;
+
+  void run(){
+    std::unique_lock<std::mutex> lk(stop_mutex);
+    while (!stop_cv.wait_for(lk, std::chrono::seconds(interval), [this]{ return stopped; })){
+      lk.unlock();
+      string line = "[memory] " + reporter().format() + "\n";
+      out << line << std::flush;
+      lk.lock();
+      num_reports += 1;
+    }
+  }
+};
+
+#endif //EMBED_FAST5_SRC_MEMORYREPORT_HPP_
@@ -0,0 +1,261 @@
+// embed lib
+#include "MergeEvents.hpp"
+#include "BinaryEventReader.hpp"
+#include "EmbedUtils.hpp"
+// boost lib
+#include <boost/filesystem.hpp>
+// std lib
+#include <getopt.h>
+#include <iostream>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+
+using namespace std;
+using namespace boost::filesystem;
+using namespace embed_utils;
+
+
+/**
+ * Merge one contig strand of every input into the writer, a block of positions at a time
+ *
+ * @param readers: input event files
+ * @param inputs: indexes of the readers which have this contig strand
+ * @param contig_strand: contig strand to merge
+ * @param writer: output event file
+ * @param max_events: max events to keep per kmer at a position (0 keeps all events)
+ * @param block_size: number of positions to hold in memory before writing them
+ */
+void merge_contig_strand(vector<unique_ptr<BinaryEventReader>>& readers,
+                         const vector<uint64_t>& inputs,
+                         const ContigStrandIndex& contig_strand,
+                         BinaryEventWriter& writer,
+                         const uint64_t& max_events,
+                         const uint64_t& block_size){
+  const string& contig = contig_strand.contig;
+  const string& strand = contig_strand.strand;
+  const string& nanopore_strand = contig_strand.nanopore_strand;
+  vector<vector<uint64_t>> positions;
+  for (auto &i: inputs){
+    positions.push_back(readers[i]->get_written_positions(contig, strand, nanopore_strand));
+  }
+//  walk the sorted position lists of every input together
+  vector<uint64_t> cursors(inputs.size(), 0);
+  vector<Position> block;
+  while (true){
+    uint64_t next = (uint64_t) -1;
+    for (uint64_t j = 0; j < inputs.size(); ++j){
+      if (cursors[j] < positions[j].size()){
+        next = std::min(next, positions[j][cursors[j]]);
+      }
+    }
+    if (next == (uint64_t) -1){
+      break;
+    }
+    block.emplace_back(next);
+    Position& merged = block.back();
+    for (uint64_t j = 0; j < inputs.size(); ++j){
+      if (cursors[j] < positions[j].size() and positions[j][cursors[j]] == next){
+        cursors[j] += 1;
+        Position input(next);
+        readers[inputs[j]]->get_position(input, contig, strand, next, nanopore_strand);
+        for (auto &pos_kmer: input.get_kmer_pointers()){
+          if (!merged.has_kmer(pos_kmer->kmer)){
+            merged.add_kmer(make_shared<PosKmer>(pos_kmer->kmer, max_events, 0));
+          }
+          shared_ptr<PosKmer> merged_kmer = merged.get_pos_kmer(pos_kmer->kmer);
+          for (auto &event: pos_kmer->events){
+            merged_kmer->add_event(event);
+          }
+        }
+      }
+    }
+    if (block.size() >= block_size){
+      writer.write_positions(contig, strand, nanopore_strand, contig_strand.num_positions, block);
+      block.clear();
+    }
+  }
+  if (!block.empty()){
+    writer.write_positions(contig, strand, nanopore_strand, contig_strand.num_positions, block);
+  }
+}
+
+/**
+ * Merge event files from independent split_by_position runs over the same reference into one event file.
+ * Events of the same kmer at the same position are concatenated, or capped to the max_events most probable events.
+ * Positions are streamed from the inputs a block at a time and contig strands are merged in parallel.
+ *
+ * @param event_files: input event files with the same alphabet, kmer length, rna and two_d settings
+ * @param output_file_path: path to output event file
+ * @param max_events: max events to keep per kmer at a position (0 keeps all events)
+ * @param num_threads: number of contig strands to merge at once
+ * @param compress: quantise and compress event payloads in the output file
+ * @param kmer_major: also group every payload by kmer in the output file
+ * @param block_size: number of positions each thread holds in memory before writing them
+ */
+void merge_event_files(const vector<string>& event_files,
+                       const string& output_file_path,
+                       uint64_t max_events,
+                       uint64_t num_threads,
+                       bool compress,
+                       bool kmer_major,
+                       uint64_t block_size){
+  path output_file(output_file_path);
+  throw_assert(!exists(output_file), output_file_path+" already exists")
+  throw_assert(!event_files.empty(), "At least one event file must be provided")
+  throw_assert(block_size > 0, "Block size must be greater than 0")
+  vector<unique_ptr<BinaryEventReader>> readers;
+  for (auto &event_file: event_files){
+    readers.emplace_back(new BinaryEventReader(event_file));
+    BinaryEventReader& first = *readers.front();
+    BinaryEventReader& reader = *readers.back();
+    throw_assert(reader.alphabet == first.alphabet and reader.kmer_length == first.kmer_length and
+                     reader.rna == first.rna and reader.two_d == first.two_d,
+                 event_file + " has a different alphabet, kmer length, rna or two_d setting than " + event_files[0])
+  }
+//  contig strand -> readers which have it
+  map<string, pair<ContigStrandIndex, vector<uint64_t>>> contig_strands;
+  for (uint64_t i = 0; i < readers.size(); ++i){
+    for (auto &index: readers[i]->get_contig_strands()){
+      string key = index.contig+index.strand+index.nanopore_strand;
+      auto found = contig_strands.find(key);
+      if (found == contig_strands.end()){
+        found = contig_strands.emplace(key, make_pair(index, vector<uint64_t>())).first;
+      }
+      throw_assert(found->second.first.num_positions == index.num_positions,
+                   key + " has a different length in " + event_files[i] + " than in an earlier event file")
+      found->second.second.push_back(i);
+    }
+  }
+
+  BinaryEventReader& first = *readers.front();
+  BinaryEventWriter writer(output_file, first.alphabet, first.kmer_length, first.rna, first.two_d,
+                           EVENT_FILE_VERSION, compress, kmer_major);
+  vector<pair<ContigStrandIndex, vector<uint64_t>>*> jobs;
+  for (auto &cs_pair: contig_strands){
+    ContigStrandIndex& index = cs_pair.second.first;
+    writer.add_contig_strand(index.contig, index.strand, index.nanopore_strand, index.num_positions);
+    jobs.push_back(&cs_pair.second);
+  }
+  std::atomic<uint64_t> next_job(0);
+  run_on_threads(std::max(num_threads, (uint64_t) 1), [&](uint64_t){
+    uint64_t i;
+    while ((i = next_job.fetch_add(1)) < jobs.size()){
+      merge_contig_strand(readers, jobs[i]->second, jobs[i]->first, writer, max_events, block_size);
+    }
+  });
+  writer.write_indexes();
+}
+
+// Getopt
+//
+#define SUBPROGRAM "merge_events"
+#define MERGE_EVENTS_VERSION "0.0.1"
+#define THIS_NAME "embed"
+#define PACKAGE_BUGREPORT2 "None"
+
+static const char *MERGE_EVENTS_VERSION_MESSAGE =
+    SUBPROGRAM " Version " MERGE_EVENTS_VERSION "\n";
+
+static const char *MERGE_EVENTS_USAGE_MESSAGE =
+    "Usage: " THIS_NAME " " SUBPROGRAM " [OPTIONS] --event_files EVENT_FILE --event_files EVENT_FILE --output OUTPUT_PATH\n"
+    "Merges binary event files from split_by_position runs over the same reference into one event file.\n"
+    "\n"
+    "      --version                        display version\n"
+    "      --help                           display this help and exit\n"
+    "  -e, --event_files=PATH               binary event file to merge (repeat for each file)\n"
+    "  -o, --output=PATH                    path and name of output event file\n"
+    "  -t, --threads=NUMBER                 number of contig strands to merge at once\n"
+    "  -n, --max_events=NUMBER              max number of events to keep per kmer at each position (default all)\n"
+    "      --compress                       quantise and compress events in the output file\n"
+    "      --kmer_major                     also group events by kmer in the output file for fast kmer lookups\n"
+    "\nReport bugs to " PACKAGE_BUGREPORT2 "\n\n";
+
+namespace opt
+{
+static vector<string> event_files;
+static string output;
+static uint64_t threads = 1;
+static uint64_t max_events = 0;
+static bool compress = false;
+static bool kmer_major = false;
+}
+
+static const char* shortopts = "e:o:t:n:h";
+
+enum { OPT_HELP = 1, OPT_VERSION, OPT_COMPRESS, OPT_KMER_MAJOR };
+
+static const struct option longopts[] = {
+    { "event_files",      required_argument, nullptr, 'e' },
+    { "output",           required_argument, nullptr, 'o' },
+    { "threads",          required_argument, nullptr, 't' },
+    { "max_events",       required_argument, nullptr, 'n' },
+    { "compress",         no_argument,       nullptr, OPT_COMPRESS },
+    { "kmer_major",       no_argument,       nullptr, OPT_KMER_MAJOR },
+    { "help",             no_argument,       nullptr, OPT_HELP },
+    { "version",          no_argument,       nullptr, OPT_VERSION },
+    { nullptr, 0, nullptr, 0 }
+};
+
+void parse_merge_events_main_options(int argc, char** argv)
+{
+  bool die = false;
+  for (char c; (c = getopt_long(argc, argv, shortopts, longopts, nullptr)) != -1;) {
+    std::istringstream arg(optarg != nullptr ? optarg : "");
+    switch (c) {
+      case 'e': opt::event_files.push_back(arg.str()); break;
+      case 'o': arg >> opt::output; break;
+      case 't': arg >> opt::threads; break;
+      case 'n': arg >> opt::max_events; break;
+      case OPT_COMPRESS: opt::compress = true; break;
+      case OPT_KMER_MAJOR: opt::kmer_major = true; break;
+      case OPT_HELP:
+        std::cout << MERGE_EVENTS_USAGE_MESSAGE;
+        exit(EXIT_SUCCESS);
+      case OPT_VERSION:
+        std::cout << MERGE_EVENTS_VERSION_MESSAGE;
+        exit(EXIT_SUCCESS);
+      default:
+        string error = ": unreconized argument -";
+        error += c;
+        error += " \n";
+        std::cerr << SUBPROGRAM + error;
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (argc - optind > 0) {
+    std::cerr << SUBPROGRAM ": too many arguments\n";
+    die = true;
+  }
+  if(opt::event_files.empty()) {
+    std::cerr << SUBPROGRAM ": at least one --event_files file must be provided\n";
+    die = true;
+  }
+  if(opt::output.empty()) {
+    std::cerr << SUBPROGRAM ": --output file must be provided\n";
+    die = true;
+  }
+
+  if (die)
+  {
+    std::cout << "\n" << MERGE_EVENTS_USAGE_MESSAGE;
+    exit(EXIT_FAILURE);
+  }
+}
+
+int merge_events_main(int argc, char** argv)
+{
+  parse_merge_events_main_options(argc, argv);
+  auto bound_funct = bind(merge_event_files,
+                          opt::event_files,
+                          opt::output,
+                          opt::max_events,
+                          opt::threads,
+                          opt::compress,
+                          opt::kmer_major,
+                          1024);
+  cout << get_time_string(bound_funct);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,18 @@
+#ifndef EMBED_FAST5_SRC_MERGEEVENTS_HPP_
+#define EMBED_FAST5_SRC_MERGEEVENTS_HPP_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+int merge_events_main(int argc, char** argv);
+void merge_event_files(const vector<string>& event_files,
+                       const string& output_file_path,
+                       uint64_t max_events = 0,
+                       uint64_t num_threads = 1,
+                       bool compress = false,
+                       bool kmer_major = false,
+                       uint64_t block_size = 1024);
+
+#endif //EMBED_FAST5_SRC_MERGEEVENTS_HPP_
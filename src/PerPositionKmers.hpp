@@ -12,10 +12,13 @@
 #include "BinaryEventWriter.hpp"
 // boost lib
 #include <boost/filesystem.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
 // std lib
 #include <map>
 #include <fstream>
 #include <mutex>
+#include <atomic>
 
 /**
 Class for handling processing of alignment files into the underlying ContigStrand data structure
@@ -56,29 +59,191 @@ class PerPositionKmers {
   //  read in alignment file data
   void process_alignment(AlignmentFile &af) {
     uint64_t hash_value;
+    {
+//    spills need exclusive access to the data so hold the spill lock shared while parsing the file
+      boost::shared_lock<boost::shared_mutex> spill_lk(this->spill_mutex);
 //    set<char> alphabet;
-    for (auto &event: af.iterate()){
-      //    lock position
-      hash_value = compute_string_hash(event.path_kmer);
+      for (auto &event: af.iterate()){
+        //    lock position
+        hash_value = compute_string_hash(event.path_kmer);
 //      alphabet = add_string_to_set(alphabet, event.path_kmer);
 //      cout << event.path_kmer << ' ' << hash_value << endl;
-      std::unique_lock<std::mutex> lk(this->locks[hash_value % this->num_locks]);
-      data.add_kmer_event(event.contig, af.strand, event.strand, event.reference_index, event.path_kmer, event.descaled_event_mean, event.posterior_probability);
+        std::unique_lock<std::mutex> lk(this->locks[hash_value % this->num_locks]);
+        num_events += data.add_kmer_event(event.contig, af.strand, event.strand, event.reference_index,
+                                          event.path_kmer, event.descaled_event_mean, event.posterior_probability);
 //    unlock position
-      lk.unlock();
+        lk.unlock();
+      }
     }
 //    std::unique_lock<std::mutex> lk(alphabet_lock);
 //    data.add_set_to_alphabet(alphabet);
 //    lk.unlock();
+    if (this->over_memory_limit()){
+      this->spill();
+    }
+  }
+
+  /**
+  Bound the memory used by aggregated events. Once the estimate passes memory_limit bytes the events are spilled to
+  sorted run files in spill_dir and merged when writing the output file.
+
+  @param memory_limit_bytes: memory budget in bytes (0 disables spilling)
+  @param spill_directory: directory for run files. Created on first spill and removed after the merge
+  */
+  void set_memory_limit(uint64_t memory_limit_bytes, const path& spill_directory) {
+    memory_limit = memory_limit_bytes;
+    spill_dir = spill_directory;
+  }
+
+  /**
+  Keep only the max_events most probable events for each kmer at each position (0 keeps all)
+  */
+  void set_max_events(uint64_t max_events) {
+    data.set_max_events(max_events);
+  }
+
+  /**
+  Select the top max_events per kmer in bulk once bulk_factor * max_events events are buffered (0 keeps a heap)
+  */
+  void set_bulk_factor(uint64_t bulk_factor) {
+    data.set_bulk_factor(bulk_factor);
+  }
+
+  /**
+  Quantise and compress event payloads in the output file
+  */
+  void set_compression(bool compress) {
+    data.set_compression(compress);
+  }
+
+  /**
+  Also group every payload by kmer in the output file
+  */
+  void set_kmer_major(bool kmer_major) {
+    data.set_kmer_major(kmer_major);
+  }
+
+  /**
+  Rough number of bytes held by aggregated events. Events kept by the max_events cap are charged at their packed
+  size and every PosKmer is charged for the struct, its control block, its key strings and a node in the position
+  and by-kmer maps.
+  */
+  uint64_t estimated_memory() {
+    return num_events.load() * sizeof(Event) +
+        data.get_num_pos_kmers() * this->pos_kmer_overhead();
+  }
+
+  uint64_t pos_kmer_overhead() {
+    uint64_t map_node = sizeof(pair<const string, shared_ptr<PosKmer>>) + 2 * sizeof(void*);
+    return sizeof(PosKmer) + 2 * sizeof(uint64_t) + 2 * map_node + 2 * (kmer_length + 32);
+  }
+
+  bool over_memory_limit() {
+    return memory_limit > 0 and this->estimated_memory() > memory_limit;
+  }
+
+  /**
+  Write all in memory events to a new run file and release them. Waits for in flight alignment files to finish.
+  */
+  void spill() {
+    boost::unique_lock<boost::shared_mutex> spill_lk(this->spill_mutex);
+//    another thread may have spilled while we waited for the lock
+    if (!this->over_memory_limit()){
+      return;
+    }
+    this->write_run();
+  }
+
+  uint64_t num_spills() {
+    return run_files.size();
+  }
+
+  /**
+  Measure the aggregated data. Never waits for in flight alignment files: the handler keeps byte counters up to date
+  as events are added, so the report is exact without walking data that is being changed.
+  */
+  MemoryReport memory_report() {
+    MemoryReport report = data.tracked_memory_report();
+    report.add("locks", vector_memory(locks));
+    return report;
   }
-//  write data to binary file
-  void write_to_file(path& output_file) {
-    data.write_to_file(output_file);
+
+  /**
+  Stream finished contigs to output_file instead of holding every event until write_to_file. Spilling to run files
+  and streaming are exclusive.
+  */
+  void open_stream(path& output_file) {
+    throw_assert(memory_limit == 0, "Events can not be streamed to a file while spilling to disk")
+    data.open_stream(output_file);
+  }
+
+  /**
+  Write every position of a contig to the open stream and release them. No alignment to the contig may be processed
+  afterwards. Waits for in flight alignment files to finish.
+
+  @return number of positions written
+  */
+  uint64_t flush_contig(const string& contig) {
+    boost::unique_lock<boost::shared_mutex> spill_lk(this->spill_mutex);
+    uint64_t written = 0;
+    for (auto &strand: {"+", "-"}){
+      for (auto &nanopore_strand: {"t", "c"}){
+        if (data.has_contig_strand(contig, strand, nanopore_strand)){
+          written += data.flush_positions(contig, strand, nanopore_strand);
+        }
+      }
+    }
+    return written;
+  }
+
+  /**
+  Write the positions left in memory and the indexes of the open stream
+  */
+  void close_stream() {
+    boost::unique_lock<boost::shared_mutex> spill_lk(this->spill_mutex);
+    data.close_stream();
+  }
+
+//  write data to binary file, serialising contig strands on num_threads threads when nothing was spilled
+  void write_to_file(path& output_file, uint64_t num_threads=1) {
+    if (run_files.empty()){
+      data.write_to_file(output_file, num_threads);
+    } else {
+//      flush the remaining events so each event lives in exactly one run
+      this->write_run();
+      data.write_runs_to_file(run_files, output_file);
+      for (auto &run_file: run_files){
+        remove(run_file);
+      }
+      run_files.clear();
+      if (boost::filesystem::is_empty(spill_dir)){
+        remove(spill_dir);
+      }
+    }
   }
  private:
 //  mutexes
   std::vector<mutex> locks;
+  boost::shared_mutex spill_mutex;
 //  mutex alphabet_lock;
+//  memory bookkeeping for spills
+//  events currently stored, summed under the kmer locks from the changes add_kmer_event reports
+  std::atomic<int64_t> num_events{0};
+  uint64_t memory_limit = 0;
+  path spill_dir;
+  vector<path> run_files;
+
+  void write_run() {
+    if (run_files.empty()){
+      throw_assert(!spill_dir.empty(), "A spill directory must be set in order to spill events to disk")
+      create_directories(spill_dir);
+    }
+    path run_file = spill_dir / ("run_" + to_string(run_files.size()) + ".events");
+    data.write_run(run_file);
+    run_files.push_back(run_file);
+    data.clear_events();
+    num_events = 0;
+  }
 };
 
 #endif //EMBED_FAST5_SRC_PERPOSITIONKMERS_HPP_
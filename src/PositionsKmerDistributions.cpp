@@ -6,6 +6,7 @@
 #include "PositionsKmerDistributions.hpp"
 #include "PerPositionKmers.hpp"
 #include "AmbigModel.hpp"
+#include "TextWriter.hpp"
 // boost lib
 #include <boost/filesystem.hpp>
 // std lib
@@ -14,7 +15,9 @@
 #include <chrono>
 #include <thread>
 #include <functional>
-#include<algorithm>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 
 
 using namespace std;
@@ -24,43 +27,33 @@ static std::exception_ptr globalExceptionPtr = nullptr;
 
 void write_kmer_distribution_file(const vector<uint64_t>& data, const path& output_path, const float& min, const float& max,
                                   const uint64_t& steps, const float& threshold){
-  boost::filesystem::ofstream myfile(output_path);
   throw_assert(data.size() == steps,
                "Number of steps:" + to_string(steps) + " does not equal length of the data: " + to_string(steps))
-  if (myfile.is_open())
-  {
-    myfile << min << ',' << max << ',' << steps << ',' << threshold << '\n';
+  TextWriter myfile(output_path);
+  myfile << min << ',' << max << ',' << steps << ',' << threshold << '\n';
 
-    for (uint64_t i=0; i < steps-1; ++i){
-      myfile << data[i] << ',';
-    }
-    myfile << data[steps-1] << '\n';
-    myfile.close();
-  } else{
-    cout << "Unable to open file: " << output_path.string() << "\n";
+  for (uint64_t i=0; i < steps-1; ++i){
+    myfile << data[i] << ',';
   }
+  myfile << data[steps-1] << '\n';
+  myfile.close();
 }
 
 void write_plot_kmer_dist_file(const path& output_path, const float& min, const float& max,
                                const uint64_t& steps, const float& threshold,
                                const vector<pair<string, vector<uint64_t>>>& data){
-  boost::filesystem::ofstream myfile(output_path);
-  if (myfile.is_open())
-  {
-    myfile << min << ',' << max << ',' << steps << ',' << threshold << ',' << data.size() <<'\n';
-    for (auto &my_pair: data){
-      throw_assert(my_pair.second.size() == steps,
-                   "Number of steps:" + to_string(steps) + " does not equal length of the data: " + to_string(steps))
-      myfile << my_pair.first << '\n';
-      for (uint64_t i=0; i < steps-1; ++i){
-        myfile << my_pair.second[i] << ',';
-      }
-      myfile << my_pair.second[steps-1] << '\n';
+  TextWriter myfile(output_path);
+  myfile << min << ',' << max << ',' << steps << ',' << threshold << ',' << data.size() <<'\n';
+  for (auto &my_pair: data){
+    throw_assert(my_pair.second.size() == steps,
+                 "Number of steps:" + to_string(steps) + " does not equal length of the data: " + to_string(steps))
+    myfile << my_pair.first << '\n';
+    for (uint64_t i=0; i < steps-1; ++i){
+      myfile << my_pair.second[i] << ',';
     }
-    myfile.close();
-  } else{
-    cout << "Unable to open file: " << output_path.string() << "\n";
+    myfile << my_pair.second[steps-1] << '\n';
   }
+  myfile.close();
 }
 
 
@@ -71,11 +64,13 @@ void write_plot_kmer_dist_file(const path& output_path, const float& min, const
  @param output_dir: path to output directory
  @param reference: path to reference file
  @param event_file: path to event file
+ @param n_threads: number of positions to query at once
  @param nanopore_strand: "t" or "c" nanopore strand to process
  @param min: low bound on histogram
  @param max: high bound on histogram
  @param size: number of bars in histogram
  @param min_prob_threshold: minimum probability to process
+ @param cache_budget: max bytes of positions and kmers kept in memory (0 keeps everything)
 */
 void get_kmer_distributions_by_position(const string &positions_file_path,
                                         const string &output_dir,
@@ -87,7 +82,8 @@ void get_kmer_distributions_by_position(const string &positions_file_path,
                                         const float& min,
                                         const float& max,
                                         const uint64_t& size,
-                                        const float& min_prob_threshold) {
+                                        const float& min_prob_threshold,
+                                        const uint64_t& cache_budget) {
 //  check output dirs
   path output_dir_path(output_dir);
   throw_assert(exists(output_dir_path), output_dir+" does not exist")
@@ -98,58 +94,62 @@ void get_kmer_distributions_by_position(const string &positions_file_path,
   ReferenceHandler rh(reference);
   PositionsFile pf(positions_file_path);
   EventDataHandler edh(rh, event_file);
+  edh.set_index_threads(n_threads);
+  edh.set_cache_budget(cache_budget);
   uint64_t kmer_length = edh.get_kmer_length();
-//  kmer histograms of correct size
-  vector<uint64_t> kmer_hist(size, 0);
-  vector<uint64_t> pos_hist(size, 0);
   string ref_pos;
   path pos_specific_dir;
-  path pos_file;
-  path kmer_file;
-//  string prev_contig = "";
-//  uint64_t prev_pos = -1;
-//  string prev_strand = "";
+  vector<PositionLine> lines;
+  vector<path> pos_specific_dirs;
 
   for (auto &line: pf.iterate()){
     cout << line.contig << " " << line.position << '\n';
     ref_pos = rh.get_reference_sequence(line.contig, line.position, line.position+1);
-//    if ((prev_contig == line.contig) & (prev_strand == line.strand) & (line.position - prev_pos) >= kmer_length) {
-//    }
     pos_specific_dir = position_output_dir / path(line.contig+line.strand+to_string(line.position));
     create_directory(pos_specific_dir);
     throw_assert( ref_pos == line.change_from,
                   "Reference position does not match positions file. Check both.\ncontig:" + line.contig +
                   "\n" + "strand:" + line.strand + "\n" + "position:" + to_string(line.position) + "\n" +
                   "change_from:" + line.change_from + "\n" + "ref base:" + ref_pos + "\n");
-    try{
-      for (uint64_t i=0; i < kmer_length; ++i){
-        vector<pair<string, vector<uint64_t>>> data;
-        Position& pos = edh.get_position(line.contig, line.strand, nanopore_strand, line.position-i);
-        set<string> kmers = pos.get_kmer_strings();
-        set<string> canonical_kmers = am.get_canonical_kmers(kmers);
-        kmers.insert(canonical_kmers.begin(), canonical_kmers.end());
+    lines.push_back(line);
+    pos_specific_dirs.push_back(pos_specific_dir);
+  }
+//  positions are written to their own files so each thread takes the next position and queries the event file
+//  through the thread safe snapshots
+  std::atomic<uint64_t> next_line(0);
+  std::mutex cout_mutex;
+  run_on_threads(std::max(n_threads, (uint64_t) 1), [&](uint64_t){
+    uint64_t l;
+    while ((l = next_line.fetch_add(1)) < lines.size()){
+      const PositionLine& line = lines[l];
+      try{
+        for (uint64_t i=0; i < kmer_length; ++i){
+          vector<pair<string, vector<uint64_t>>> data;
+          Position pos = edh.query_position(line.contig, line.strand, nanopore_strand, line.position-i);
+          set<string> kmers = pos.get_kmer_strings();
+          set<string> canonical_kmers = am.get_canonical_kmers(kmers);
+          kmers.insert(canonical_kmers.begin(), canonical_kmers.end());
 
-        for (auto &k: kmers){
-          if (edh.has_kmer(k)) {
-            Kmer& kmer = edh.get_kmer(k);
-            kmer_hist = kmer.get_hist(min, max, size, min_prob_threshold);
-            data.push_back(make_pair(k, kmer_hist));
-            for (auto &pos_k: kmer.pos_kmer_map){
-              ContigStrandPosition csp = kmer.split_pos_kmer_map_key(pos_k.first);
-              data.push_back(make_pair(csp.contig+"_"+csp.strand+"_"+to_string(csp.position)+"_"+k, pos_k.second->get_hist(min, max, size, min_prob_threshold)));
+          for (auto &k: kmers){
+            if (edh.has_kmer(k)) {
+              Kmer kmer = edh.query_kmer(k);
+              data.push_back(make_pair(k, kmer.get_hist(min, max, size, min_prob_threshold)));
+              for (auto &pos_k: kmer.pos_kmer_map){
+                ContigStrandPosition csp = kmer.split_pos_kmer_map_key(pos_k.first);
+                data.push_back(make_pair(csp.contig+"_"+csp.strand+"_"+to_string(csp.position)+"_"+k, pos_k.second->get_hist(min, max, size, min_prob_threshold)));
+              }
             }
           }
+          path pos_file = pos_specific_dirs[l] / path(line.contig+"_"+line.strand+"_"+to_string(line.position-i)+".csv");
+          write_plot_kmer_dist_file(pos_file, min, max, size, min_prob_threshold, data);
         }
-        pos_file = pos_specific_dir / path(line.contig+"_"+line.strand+"_"+to_string(line.position-i)+".csv");
-        write_plot_kmer_dist_file(pos_file, min, max, size, min_prob_threshold, data);
+      } catch(std::runtime_error& e){
+        std::lock_guard<std::mutex> lk(cout_mutex);
+        cout << e.what() << "\n";
       }
-//    prev_contig = line.contig;
-//    prev_pos = line.position;
-//    prev_strand = line.strand;
-    } catch(std::runtime_error& e){
-      cout << e.what() << "\n";
     }
-  }
+  });
+  cout << "cache " << edh.get_cache_stats().format() << '\n';
 }
 
 
@@ -180,6 +180,7 @@ static const char *GET_KMER_DISTRIBUTIONS_USAGE_MESSAGE =
     "  -m, --min_prob=PROB                  Minimum probability threshold \n"
 
     "  -t, --threads=NUMBER                 number of threads\n"
+    "  -c, --cache_mb=NUMBER                max megabytes of events kept in memory (default all)\n"
     "\nReport bugs to " PACKAGE_BUGREPORT2 "\n\n";
 
 namespace opt
@@ -192,9 +193,10 @@ static string reference;
 static string event_file;
 static string ambig_model;
 static float min_prob = 0.0;
+static uint64_t cache_mb = 0;
 }
 
-static const char* shortopts = "p:t:m:o:r:a:e:vh";
+static const char* shortopts = "p:t:m:o:r:a:e:c:vh";
 
 enum { OPT_HELP = 1, OPT_VERSION };
 
@@ -207,6 +209,7 @@ static const struct option longopts[] = {
     { "event_file",       required_argument, nullptr, 'e' },
     { "threads",          optional_argument, nullptr, 't' },
     { "min_prob",         optional_argument, nullptr, 'm' },
+    { "cache_mb",         required_argument, nullptr, 'c' },
     { "help",             no_argument,       nullptr, OPT_HELP },
     { "version",          no_argument,       nullptr, OPT_VERSION },
     { nullptr, 0, nullptr, 0 }
@@ -225,6 +228,7 @@ void parse_get_kmer_distributions_main_options(int argc, char** argv)
       case 'r': arg >> opt::reference; break;
       case 'a': arg >> opt::ambig_model; break;
       case 'm': arg >> opt::min_prob; break;
+      case 'c': arg >> opt::cache_mb; break;
       case 'v': opt::verbose++; break;
       case OPT_HELP:
         std::cout << GET_KMER_DISTRIBUTIONS_USAGE_MESSAGE;
@@ -288,7 +292,8 @@ int get_kmer_distributions_main(int argc, char** argv)
                           0.0,
                           200.0,
                           2000,
-                          opt::min_prob);
+                          opt::min_prob,
+                          opt::cache_mb * 1024 * 1024);
   cout << get_time_string(bound_funct);
 
   return EXIT_SUCCESS;
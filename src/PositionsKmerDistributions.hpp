@@ -21,6 +21,7 @@ void get_kmer_distributions_by_position(const string &positions_file_path,
                                         const float& min,
                                         const float& max,
                                         const uint64_t& size,
-                                        const float& min_prob_threshold);
+                                        const float& min_prob_threshold,
+                                        const uint64_t& cache_budget = 0);
 
 #endif //EMBED_FAST5_SRC_POSITIONSKMERDISTRIBUTIONS_HPP_
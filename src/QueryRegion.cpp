@@ -0,0 +1,190 @@
+// embed lib
+#include "QueryRegion.hpp"
+#include "EmbedUtils.hpp"
+// boost lib
+#include <boost/filesystem.hpp>
+// std lib
+#include <getopt.h>
+#include <iostream>
+#include <functional>
+
+using namespace std;
+using namespace boost::filesystem;
+using namespace embed_utils;
+
+
+/**
+ * Parse a region string of the form contig:start-end into a zero based, end exclusive range
+ *
+ * @param region: region string eg. "pUC19:100-150"
+ * @param contig: output contig name
+ * @param start: output first position
+ * @param end: output position after the last position
+ */
+void parse_region(const string& region, string& contig, uint64_t& start, uint64_t& end){
+  uint64_t colon = region.rfind(':');
+  uint64_t dash = region.rfind('-');
+  throw_assert(colon != string::npos and dash != string::npos and colon > 0 and dash > colon + 1 and
+                   dash + 1 < region.size(),
+               "Region must be formatted as contig:start-end: " + region)
+  string start_string = region.substr(colon + 1, dash - colon - 1);
+  string end_string = region.substr(dash + 1);
+  throw_assert(start_string.find_first_not_of("0123456789") == string::npos and
+                   end_string.find_first_not_of("0123456789") == string::npos,
+               "Region start and end must be positive integers: " + region)
+  contig = region.substr(0, colon);
+  start = stoull(start_string);
+  end = stoull(end_string);
+  throw_assert(start < end, "Region start must be less than region end: " + region)
+}
+
+/**
+ * Write one tab separated line per event: contig, strand, nanopore_strand, position, kmer, descaled_event_mean and
+ * posterior_probability
+ */
+void write_region_events(TextWriter& out, const RegionEvents& region, const string& contig, const string& strand,
+                         const string& nanopore_strand){
+  for (uint64_t i = 0; i < region.num_kmers(); ++i){
+    for (uint64_t e = region.event_offsets[i]; e < region.event_offsets[i + 1]; ++e){
+      out << contig << '\t' << strand << '\t' << nanopore_strand << '\t' << region.positions[i] << '\t'
+          << region.kmers[i] << '\t' << region.descaled_event_means[e] << '\t'
+          << region.posterior_probabilities[e] << '\n';
+    }
+  }
+}
+
+/**
+ * Write every kmer event in a region of an event file to a tsv
+ *
+ * @param event_file: path to binary event file
+ * @param region: region string eg. "pUC19:100-150"
+ * @param strand: reference strand
+ * @param nanopore_strand: template (t) or complement (c)
+ * @param output: path to output tsv
+ */
+void query_event_file_region(const string& event_file,
+                             const string& region,
+                             const string& strand,
+                             const string& nanopore_strand,
+                             const string& output){
+  string contig;
+  uint64_t start;
+  uint64_t end;
+  parse_region(region, contig, start, end);
+  BinaryEventReader reader(event_file);
+  RegionEvents events;
+  reader.query_region(events, contig, strand, start, end, nanopore_strand);
+  TextWriter out(output);
+  write_region_events(out, events, contig, strand, nanopore_strand);
+  out.close();
+}
+
+// Getopt
+//
+#define SUBPROGRAM "query_region"
+#define QUERY_REGION_VERSION "0.0.1"
+#define THIS_NAME "embed"
+#define PACKAGE_BUGREPORT2 "None"
+
+static const char *QUERY_REGION_VERSION_MESSAGE =
+    SUBPROGRAM " Version " QUERY_REGION_VERSION "\n";
+
+static const char *QUERY_REGION_USAGE_MESSAGE =
+    "Usage: " THIS_NAME " " SUBPROGRAM " [OPTIONS] --event_file EVENT_FILE --region CONTIG:START-END --output OUTPUT_PATH\n"
+    "Writes every kmer event in a region of a binary event file to a tsv.\n"
+    "\n"
+    "      --version                        display version\n"
+    "      --help                           display this help and exit\n"
+    "  -e, --event_file=PATH                binary event file written by split_by_position\n"
+    "  -r, --region=CONTIG:START-END        zero based region, end exclusive\n"
+    "  -s, --strand=STRAND                  reference strand (default +)\n"
+    "  -n, --nanopore_strand=STRAND         nanopore strand, t or c (default t)\n"
+    "  -o, --output=PATH                    path and name of output tsv\n"
+    "\nReport bugs to " PACKAGE_BUGREPORT2 "\n\n";
+
+namespace opt
+{
+static string event_file;
+static string region;
+static string strand = "+";
+static string nanopore_strand = "t";
+static string output;
+}
+
+static const char* shortopts = "e:r:s:n:o:h";
+
+enum { OPT_HELP = 1, OPT_VERSION };
+
+static const struct option longopts[] = {
+    { "event_file",       required_argument, nullptr, 'e' },
+    { "region",           required_argument, nullptr, 'r' },
+    { "strand",           required_argument, nullptr, 's' },
+    { "nanopore_strand",  required_argument, nullptr, 'n' },
+    { "output",           required_argument, nullptr, 'o' },
+    { "help",             no_argument,       nullptr, OPT_HELP },
+    { "version",          no_argument,       nullptr, OPT_VERSION },
+    { nullptr, 0, nullptr, 0 }
+};
+
+void parse_query_region_main_options(int argc, char** argv)
+{
+  bool die = false;
+  for (char c; (c = getopt_long(argc, argv, shortopts, longopts, nullptr)) != -1;) {
+    std::istringstream arg(optarg != nullptr ? optarg : "");
+    switch (c) {
+      case 'e': arg >> opt::event_file; break;
+      case 'r': arg >> opt::region; break;
+      case 's': arg >> opt::strand; break;
+      case 'n': arg >> opt::nanopore_strand; break;
+      case 'o': arg >> opt::output; break;
+      case OPT_HELP:
+        std::cout << QUERY_REGION_USAGE_MESSAGE;
+        exit(EXIT_SUCCESS);
+      case OPT_VERSION:
+        std::cout << QUERY_REGION_VERSION_MESSAGE;
+        exit(EXIT_SUCCESS);
+      default:
+        string error = ": unreconized argument -";
+        error += c;
+        error += " \n";
+        std::cerr << SUBPROGRAM + error;
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (argc - optind > 0) {
+    std::cerr << SUBPROGRAM ": too many arguments\n";
+    die = true;
+  }
+  if(opt::event_file.empty()) {
+    std::cerr << SUBPROGRAM ": --event_file must be provided\n";
+    die = true;
+  }
+  if(opt::region.empty()) {
+    std::cerr << SUBPROGRAM ": --region must be provided\n";
+    die = true;
+  }
+  if(opt::output.empty()) {
+    std::cerr << SUBPROGRAM ": --output file must be provided\n";
+    die = true;
+  }
+
+  if (die)
+  {
+    std::cout << "\n" << QUERY_REGION_USAGE_MESSAGE;
+    exit(EXIT_FAILURE);
+  }
+}
+
+int query_region_main(int argc, char** argv)
+{
+  parse_query_region_main_options(argc, argv);
+  auto bound_funct = bind(query_event_file_region,
+                          opt::event_file,
+                          opt::region,
+                          opt::strand,
+                          opt::nanopore_strand,
+                          opt::output);
+  cout << get_time_string(bound_funct);
+  return EXIT_SUCCESS;
+}
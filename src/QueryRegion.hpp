@@ -0,0 +1,22 @@
+#ifndef EMBED_FAST5_SRC_QUERYREGION_HPP_
+#define EMBED_FAST5_SRC_QUERYREGION_HPP_
+
+// embed lib
+#include "BinaryEventReader.hpp"
+#include "TextWriter.hpp"
+// std lib
+#include <string>
+
+using namespace std;
+
+int query_region_main(int argc, char** argv);
+void parse_region(const string& region, string& contig, uint64_t& start, uint64_t& end);
+void write_region_events(TextWriter& out, const RegionEvents& region, const string& contig, const string& strand,
+                         const string& nanopore_strand);
+void query_event_file_region(const string& event_file,
+                             const string& region,
+                             const string& strand,
+                             const string& nanopore_strand,
+                             const string& output);
+
+#endif //EMBED_FAST5_SRC_QUERYREGION_HPP_
@@ -0,0 +1,192 @@
+#ifndef EMBED_FAST5_SRC_REGIONINDEX_HPP_
+#define EMBED_FAST5_SRC_REGIONINDEX_HPP_
+
+// embed libs
+#include "EmbedUtils.hpp"
+// std libs
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace embed_utils;
+
+/**
+Rows read and rows dropped by a RegionIndex filter
+*/
+struct RegionFilterStats {
+  uint64_t rows = 0;
+  uint64_t skipped_rows = 0;
+
+  /**
+  Single line report eg. "rows=100 skipped_rows=90 kept_rows=10"
+  */
+  string format() const {
+    ostringstream line;
+    line << "rows=" << rows << " skipped_rows=" << skipped_rows << " kept_rows=" << rows - skipped_rows;
+    return line.str();
+  }
+};
+
+/**
+Sorted, merged, half open intervals of one contig strand
+*/
+struct RegionIntervals {
+  vector<uint64_t> starts;
+  vector<uint64_t> ends;
+
+  /**
+  Does any interval overlap [start, end)
+  */
+  bool overlaps(uint64_t start, uint64_t end) const {
+//    first interval which ends after start
+    auto found = std::upper_bound(ends.begin(), ends.end(), start);
+    return found != ends.end() and starts[found - ends.begin()] < end;
+  }
+
+  bool contains(uint64_t position) const {
+    return this->overlaps(position, position + 1);
+  }
+};
+
+/**
+Target regions from a BED file, indexed per contig strand for filtering alignment rows while they are parsed.
+BED lines without a strand, or with '.', cover both strands. Intervals are zero based and end exclusive like BED.
+Once loaded the index is read only and can be shared between threads, only the row counters are updated.
+
+@param bed_path: path to BED file of target regions
+*/
+class RegionIndex {
+ public:
+  RegionIndex() = default;
+  explicit RegionIndex(const string& bed_path) {
+    this->load_bed(bed_path);
+  }
+  RegionIndex(const RegionIndex&) = delete;
+  RegionIndex& operator=(const RegionIndex&) = delete;
+
+  void load_bed(const string& bed_path){
+    std::ifstream bed_file(bed_path);
+    throw_assert(bed_file.good(), "ERROR: could not read regions file " + bed_path)
+    string line;
+    uint64_t line_number = 0;
+    while (getline(bed_file, line)){
+      line_number += 1;
+      if (!line.empty() and line.back() == '\r'){
+        line.pop_back();
+      }
+      if (line.empty() or line[0] == '#' or line.compare(0, 5, "track") == 0 or line.compare(0, 7, "browser") == 0){
+        continue;
+      }
+      vector<string> fields = split_string(line, '\t');
+      throw_assert(fields.size() >= 3 and
+                       fields[1].find_first_not_of("0123456789") == string::npos and !fields[1].empty() and
+                       fields[2].find_first_not_of("0123456789") == string::npos and !fields[2].empty(),
+                   "ERROR: bad BED line " + to_string(line_number) + " in " + bed_path + ": " + line)
+      uint64_t start = stoull(fields[1]);
+      uint64_t end = stoull(fields[2]);
+      throw_assert(start < end, "ERROR: BED start must be less than end on line " + to_string(line_number) +
+          " in " + bed_path)
+      string strand = fields.size() >= 6 ? fields[5] : ".";
+      throw_assert(strand == "+" or strand == "-" or strand == ".",
+                   "ERROR: BED strand must be +, - or . on line " + to_string(line_number) + " in " + bed_path)
+      this->add_region(fields[0], strand, start, end);
+    }
+    this->finalize();
+  }
+
+  /**
+  Add [start, end) on a contig strand ("." adds both strands). Call finalize once every region is added.
+  */
+  void add_region(const string& contig, const string& strand, uint64_t start, uint64_t end){
+    if (strand == "."){
+      this->add_region(contig, "+", start, end);
+      this->add_region(contig, "-", start, end);
+      return;
+    }
+    RegionIntervals& intervals = index[contig + strand];
+    intervals.starts.push_back(start);
+    intervals.ends.push_back(end);
+  }
+
+  /**
+  Sort and merge overlapping or touching intervals of every contig strand
+  */
+  void finalize(){
+    vector<pair<uint64_t, uint64_t>> sorted;
+    for (auto &contig_strand: index){
+      RegionIntervals& intervals = contig_strand.second;
+      sorted.clear();
+      for (uint64_t i = 0; i < intervals.starts.size(); ++i){
+        sorted.emplace_back(intervals.starts[i], intervals.ends[i]);
+      }
+      std::sort(sorted.begin(), sorted.end());
+      intervals.starts.clear();
+      intervals.ends.clear();
+      for (auto &interval: sorted){
+        if (!intervals.ends.empty() and interval.first <= intervals.ends.back()){
+          intervals.ends.back() = std::max(intervals.ends.back(), interval.second);
+        } else {
+          intervals.starts.push_back(interval.first);
+          intervals.ends.push_back(interval.second);
+        }
+      }
+      intervals.starts.shrink_to_fit();
+      intervals.ends.shrink_to_fit();
+    }
+  }
+
+  /**
+  Intervals of a contig strand, nullptr if it has none
+  */
+  const RegionIntervals* get_intervals(const string& contig, const string& strand) const {
+    auto found = index.find(contig + strand);
+    return found == index.end() ? nullptr : &found->second;
+  }
+
+  bool overlaps(const string& contig, const string& strand, uint64_t start, uint64_t end) const {
+    const RegionIntervals* intervals = this->get_intervals(contig, strand);
+    return intervals != nullptr and intervals->overlaps(start, end);
+  }
+
+  bool contains(const string& contig, const string& strand, uint64_t position) const {
+    return this->overlaps(contig, strand, position, position + 1);
+  }
+
+  /**
+  Number of merged intervals over every contig strand
+  */
+  uint64_t num_intervals() const {
+    uint64_t total = 0;
+    for (auto &contig_strand: index){
+      total += contig_strand.second.starts.size();
+    }
+    return total;
+  }
+
+  /**
+  Add the rows a parser read and dropped
+  */
+  void count_rows(uint64_t rows, uint64_t skipped_rows) const {
+    rows_read.fetch_add(rows, std::memory_order_relaxed);
+    rows_skipped.fetch_add(skipped_rows, std::memory_order_relaxed);
+  }
+
+  RegionFilterStats get_stats() const {
+    RegionFilterStats stats;
+    stats.rows = rows_read.load(std::memory_order_relaxed);
+    stats.skipped_rows = rows_skipped.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  unordered_map<string, RegionIntervals> index;
+  mutable std::atomic<uint64_t> rows_read{0};
+  mutable std::atomic<uint64_t> rows_skipped{0};
+};
+
+#endif //EMBED_FAST5_SRC_REGIONINDEX_HPP_
@@ -0,0 +1,239 @@
+#ifndef EMBED_FAST5_SRC_RINGBUFFERQUEUE_HPP_
+#define EMBED_FAST5_SRC_RINGBUFFERQUEUE_HPP_
+
+// embed libs
+#include "ConcurrentQueue.hpp"
+// std libs
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * Bounded lock free queue for many producers and one consumer, with the push, wait_and_pop and stop interface of
+ * ConcurrentQueue so it can replace it where the handoff to a single writer is the bottleneck.
+ * Each slot of a power of two ring carries a sequence number which tells producers and the consumer whose turn it is
+ * (Dmitry Vyukov's bounded queue: http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue).
+ * Nothing blocks in the kernel: waiting producers and consumers spin, then yield, then sleep briefly.
+ * Unlike ConcurrentQueue, which grows past its capacity once stopped, a full ring has nowhere to put more items, so
+ * producers still waiting for room when the queue is stopped give up and report the items they could not push.
+ *
+ * @tparam Data: data class for queue, must be default constructible and move assignable
+ */
+template<typename Data>
+class RingBufferQueue {
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    Data data;
+  };
+  static const size_t CACHE_LINE = 64;
+
+  size_t mask;
+  std::unique_ptr<Cell[]> buffer;
+  char pad0[CACHE_LINE];
+  std::atomic<size_t> enqueue_pos;
+  char pad1[CACHE_LINE];
+  std::atomic<size_t> dequeue_pos;
+  char pad2[CACHE_LINE];
+  std::atomic<uint64_t> full_waits;
+  std::atomic<uint64_t> empty_waits;
+
+  static size_t round_up_capacity(size_t capacity){
+    size_t size = 2;
+    while (size < capacity){
+      size <<= 1;
+    }
+    return size;
+  }
+
+  /**
+  Spin for the first few rounds, then yield, then sleep so an idle queue does not burn a core
+  */
+  static void backoff(uint64_t& round){
+    round += 1;
+    if (round < 64){
+      return;
+    } else if (round < 128){
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+
+ public:
+  /**
+  @param capacity: max number of queued items, rounded up to a power of two
+  */
+  explicit RingBufferQueue(size_t capacity=1024) :
+      mask(round_up_capacity(capacity) - 1), buffer(new Cell[mask + 1]), enqueue_pos(0), dequeue_pos(0),
+      full_waits(0), empty_waits(0), no_additional_data(false) {
+    for (size_t i = 0; i <= mask; ++i){
+      buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  RingBufferQueue(const RingBufferQueue&) = delete;
+  RingBufferQueue& operator=(const RingBufferQueue&) = delete;
+  std::atomic<bool> no_additional_data;
+
+  size_t capacity() const {
+    return mask + 1;
+  }
+
+  /**
+  Move data into the queue if there is room, data is left untouched otherwise
+  */
+  bool try_push(Data& data){
+    Cell* cell;
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true){
+      cell = &buffer[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      auto dif = (intptr_t) sequence - (intptr_t) pos;
+      if (dif == 0){
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+          break;
+        }
+      } else if (dif < 0){
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = std::move(data);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+  Wait for room and move data into the queue
+
+  @return false if the queue was stopped while waiting for room, data is left untouched and not queued
+  */
+  bool push(Data&& data){
+    if (this->try_push(data)){
+      return true;
+    }
+    full_waits.fetch_add(1, std::memory_order_relaxed);
+    uint64_t round = 0;
+    while (!this->try_push(data)){
+      if (no_additional_data.load(std::memory_order_acquire)){
+        return false;
+      }
+      backoff(round);
+    }
+    return true;
+  }
+
+  /**
+  Move every item into the queue, waiting for room as needed, and remove the queued items from items
+
+  @return number of items left in items because the queue was stopped while waiting for room, 0 if all were queued
+  */
+  size_t push_bulk(std::vector<Data>& items){
+    size_t pushed = 0;
+    while (pushed < items.size() and this->push(std::move(items[pushed]))){
+      pushed += 1;
+    }
+    items.erase(items.begin(), items.begin() + pushed);
+    return items.size();
+  }
+
+  bool try_pop(Data& popped_value){
+    Cell* cell;
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    while (true){
+      cell = &buffer[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      auto dif = (intptr_t) sequence - (intptr_t) (pos + 1);
+      if (dif == 0){
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+          break;
+        }
+      } else if (dif < 0){
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    popped_value = std::move(cell->data);
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+  Wait for an item. Returns false once the queue is stopped and every item pushed before stop was popped.
+  */
+  bool wait_and_pop(Data& popped_value){
+    if (this->try_pop(popped_value)){
+      return true;
+    }
+    if (!no_additional_data.load(std::memory_order_acquire)){
+      empty_waits.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint64_t round = 0;
+    while (!this->try_pop(popped_value)){
+      if (no_additional_data.load(std::memory_order_acquire)){
+//        items pushed before stop are visible now
+        return this->try_pop(popped_value);
+      }
+      backoff(round);
+    }
+    return true;
+  }
+
+  /**
+  Wait for items and move up to max_items of them onto the end of popped_values
+
+  @return number of items popped, 0 once the queue is stopped and empty
+  */
+  size_t pop_bulk(std::vector<Data>& popped_values, size_t max_items=(size_t) -1){
+    Data value;
+    if (max_items == 0 or !this->wait_and_pop(value)){
+      return 0;
+    }
+    popped_values.push_back(std::move(value));
+    size_t popped = 1;
+    while (popped < max_items and this->try_pop(value)){
+      popped_values.push_back(std::move(value));
+      popped += 1;
+    }
+    return popped;
+  }
+
+  /**
+  Approximate number of queued items
+  */
+  size_t size() const {
+    size_t pushed = enqueue_pos.load(std::memory_order_acquire);
+    size_t popped = dequeue_pos.load(std::memory_order_acquire);
+    return pushed > popped ? pushed - popped : 0;
+  }
+
+  bool empty() const {
+    return this->size() == 0;
+  }
+
+  /**
+  No more items will be pushed. Waiting consumers drain what is left and producers waiting for room give up: push
+  returns false and push_bulk returns the number of items it could not queue. Pushes that find room still succeed.
+  */
+  void stop(){
+    no_additional_data.store(true, std::memory_order_release);
+  }
+
+  /**
+  Push and pop counts and waits. Depth is not sampled on the lock free path so max_depth and depth_sum stay 0.
+  */
+  ConcurrentQueueStats get_stats() const {
+    ConcurrentQueueStats stats;
+    stats.pushed = enqueue_pos.load(std::memory_order_acquire);
+    stats.popped = dequeue_pos.load(std::memory_order_acquire);
+    stats.full_waits = full_waits.load(std::memory_order_relaxed);
+    stats.empty_waits = empty_waits.load(std::memory_order_relaxed);
+    return stats;
+  }
+};
+
+#endif //EMBED_FAST5_SRC_RINGBUFFERQUEUE_HPP_
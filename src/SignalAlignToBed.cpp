@@ -6,10 +6,13 @@
 #include "EmbedUtils.hpp"
 #include "MarginalizeVariants.hpp"
 #include "ConcurrentQueue.hpp"
+#include "TextWriter.hpp"
+#include "VariantCallWriter.hpp"
 #include <getopt.h>
 #include <iostream>
 #include <boost/filesystem.hpp>
 #include <chrono>
+#include <memory>
 
 using namespace std::chrono;
 using namespace std;
@@ -23,6 +26,7 @@ static std::exception_ptr globalExceptionPtr = nullptr;
  *
  * @param signalalign_output_files: reference to vector of signalalign files
  * @param mv: MarginalizeVariants class object
+ * @param thread_id: index of this worker's partial counts in mv
  * @param variant_queue: templated reference to thread safe queue
  * @param job_index: atomic index for selecting output files to process
  * @param n_files: max number of files to process
@@ -30,29 +34,35 @@ static std::exception_ptr globalExceptionPtr = nullptr;
  * @param rna: boolean option if reads are rna
  * @param ambig_bases: string of all ambiguous characters
  * @param ambig_bases_map: map of ambig bases to expected chars
+ * @param regions: only call variants in these target regions (nullptr calls every variant)
  */
 void get_variants_worker(
     vector<path>& signalalign_output_files,
     MarginalizeVariants& mv,
+    uint64_t thread_id,
     ConcurrentQueue<tuple<string, vector<VariantCall>>>& variant_queue,
     atomic<uint64_t>& job_index,
     int64_t& n_files,
     bool& verbose,
     bool& rna,
     string &ambig_bases,
-    std::map<string, string>& ambig_bases_map) {
+    std::map<string, string>& ambig_bases_map,
+    const RegionIndex* regions) {
   try {
     tuple<string, vector<VariantCall>> read_id_and_variants;
+    VariantCallScratch scratch;
+    vector<VariantCall> vc_calls;
     while (job_index < n_files and !globalExceptionPtr) {
       // Fetch add
       uint64_t thread_job_index = job_index.fetch_add(1);
       if (thread_job_index < n_files){
         path current_file = signalalign_output_files[thread_job_index];
         AlignmentFile af(current_file.string(), rna);
-        vector<VariantCall> vc_calls = af.get_variant_calls(ambig_bases, &ambig_bases_map);
-        mv.load_variants(&vc_calls);
-        read_id_and_variants = make_tuple(af.read_id, vc_calls);
-        variant_queue.push(read_id_and_variants);
+        af.set_regions(regions);
+        af.get_variant_calls(ambig_bases, &ambig_bases_map, scratch, vc_calls);
+        mv.load_variants(&vc_calls, thread_id);
+        read_id_and_variants = make_tuple(af.read_id, std::move(vc_calls));
+        variant_queue.push(std::move(read_id_and_variants));
         if (verbose) {
 //      cout << current_file << "\n";
           // Print status update to stdout
@@ -63,7 +73,6 @@ void get_variants_worker(
   } catch(...){
     globalExceptionPtr = std::current_exception();
   }
-  variant_queue.stop();
 }
 
 /**
@@ -85,46 +94,70 @@ uint64_t get_max_n_variants_in_model_file(std::map<string, string>& ambig_bases_
 }
 
 /**
- * Worker which reads and writes variants from a queue.
+ * Worker which reads and writes variants from a queue until the queue is stopped and empty.
  *
  * @param variant_queue: instance of ConcurrentQueue object made up of vector of variant calls
  * @param max_n_variants: the max number of variants and thus the max number of columns for each row
- * @param output_file: path to output file
+ * @param my_file: open output file, written behind on its own thread
  */
 void write_tsv_file_worker(
     ConcurrentQueue<tuple<string, vector<VariantCall>>>& variant_queue,
     uint64_t& max_n_variants,
-    path& output_file){
-  std::ofstream my_file(output_file.string());
-  if (my_file.is_open())
-  {
+    TextWriter& my_file){
+  try {
     my_file << "read_id,contig,reference_index,strand,variants";
     for (uint64_t i=0; i < max_n_variants; i++){
-      my_file << ",prob" << to_string(i+1);
+      my_file << ",prob" << i+1;
     }
-    my_file << endl;
+    my_file << '\n';
 
-    tuple<string, vector<VariantCall>> nvc;
-    vector<VariantCall> vc;
-    string read_id;
+    vector<tuple<string, vector<VariantCall>>> batch;
     uint64_t delta = 0;
-    while (variant_queue.wait_and_pop(nvc)){
-      read_id = get<0>(nvc);
-      vc = get<1>(nvc);
-      for (const auto& variant: vc){
-        my_file << read_id << "," << variant.contig << "," << variant.reference_index << "," << variant.strand << "," << variant.bases;
-        for (auto &prob: variant.normalized_probs){
-          my_file << "," << prob;
+    while (variant_queue.pop_bulk(batch) > 0){
+      for (auto &nvc: batch){
+        const string& read_id = get<0>(nvc);
+        for (const auto& variant: get<1>(nvc)){
+          my_file << read_id << ',' << variant.contig << ',' << variant.reference_index << ',' << variant.strand << ',' << variant.bases;
+          for (auto &prob: variant.normalized_probs){
+            my_file << ',' << prob;
+          }
+          delta = max_n_variants - variant.normalized_probs.size();
+          for (uint64_t j=0; j < delta; j++){
+            my_file << ',';
+          }
+          my_file << '\n';
         }
-        delta = max_n_variants - variant.normalized_probs.size();
-        for (uint64_t j=0; j < delta; j++){
-          my_file << ",";
-        }
-        my_file << endl;
       }
+      batch.clear();
     }
-  } else{
-    cout << "Unable to open file: " << output_file.string() << "\n";
+  } catch(...){
+    globalExceptionPtr = std::current_exception();
+//    let blocked parsers finish
+    variant_queue.stop();
+  }
+}
+
+/**
+ * Worker which writes variants from a queue to a binary variant call file until the queue is stopped and empty.
+ *
+ * @param variant_queue: instance of ConcurrentQueue object made up of vector of variant calls
+ * @param calls_file: open variant call file
+ */
+void write_binary_file_worker(
+    ConcurrentQueue<tuple<string, vector<VariantCall>>>& variant_queue,
+    VariantCallWriter& calls_file){
+  try {
+    vector<tuple<string, vector<VariantCall>>> batch;
+    while (variant_queue.pop_bulk(batch) > 0){
+      for (auto &nvc: batch){
+        calls_file.add_read(get<0>(nvc), get<1>(nvc));
+      }
+      batch.clear();
+    }
+  } catch(...){
+    globalExceptionPtr = std::current_exception();
+//    let blocked parsers finish
+    variant_queue.stop();
   }
 }
 
@@ -135,27 +168,41 @@ void write_tsv_file_worker(
  @param sa_output_paths: vector of paths to sa files
  @param output_file_path: path to output bed file
  @param ambig_bases: possible ambiguous bases to search for
- @param n_locks: number of locks for writing to common data structure
  @param n_threads: number of threads to process files
  @param ambig_model: path to ambig model if not using default
  @param verbose: boolean option to output file names as they are being processed (not helpful)
+ @param overwrite: overwrite existing output files
+ @param queue_size: max number of reads waiting to be written to the csv (0 is unbounded)
+ @param compress: gzip the csv and name it .csv.gz
+ @param binary: write the per read calls to a binary variant call file (.calls) instead of a csv
+ @param regions_bed: BED file of target regions, rows outside them are dropped while parsing (empty keeps every row)
+ @param resume_from: marginal counts state files of earlier runs or shards to add to the new counts
+ @param save_state: path to save the combined marginal counts so a later run can resume from them (empty to skip)
 */
 void dump_signalalign_variant_calls(vector<string> &sa_output_paths,
                                     string &output_file_path,
                                     string ambig_bases,
                                     uint64_t n_threads=2,
-                                    uint64_t n_locks=2,
                                     bool rna=false,
                                     string ambig_model = "",
                                     bool verbose=true,
-                                    bool overwrite=false) {
+                                    bool overwrite=false,
+                                    uint64_t queue_size=1024,
+                                    bool compress=false,
+                                    bool binary=false,
+                                    const string& regions_bed="",
+                                    const vector<string>& resume_from={},
+                                    const string& save_state="") {
+  n_threads = std::max(n_threads, (uint64_t) 1);
   path output_file(output_file_path);
-  path output_tsv_file = change_extension(output_file_path, "csv");
+  path output_tsv_file = change_extension(output_file_path, binary ? "calls" : (compress ? "csv.gz" : "csv"));
   if (!overwrite){
     throw_assert(!exists(output_file),
         output_file_path+" already exists: overwrite to true")
     throw_assert(!exists(output_tsv_file),
         output_tsv_file.string()+" already exists: overwrite to true")
+    throw_assert(save_state.empty() or !exists(save_state),
+        save_state+" already exists: overwrite to true")
   }
 // create ambig model
   throw_assert(exists(ambig_model), ambig_model+" does not exist")
@@ -164,60 +211,106 @@ void dump_signalalign_variant_calls(vector<string> &sa_output_paths,
 // check tsv files
   vector<path> all_tsvs = filter_emtpy_files(sa_output_paths, ".tsv");
   throw_assert(!all_tsvs.empty(), "There are no valid .tsv files")
+  unique_ptr<RegionIndex> regions;
+  if (!regions_bed.empty()){
+    regions.reset(new RegionIndex(regions_bed));
+  }
   auto number_of_files = (int64_t) all_tsvs.size();
-// create thread safe queue
-  ConcurrentQueue<tuple<string, vector<VariantCall>>> variant_queue;
-//  create marginalize variants
-  MarginalizeVariants mv(n_locks);
+// create thread safe queue which holds at most queue_size reads
+  ConcurrentQueue<tuple<string, vector<VariantCall>>> variant_queue(queue_size);
+//  create marginalize variants with one partial per thread
+  MarginalizeVariants mv(n_threads);
+//  load earlier counts before parsing so a bad state file fails fast
+  for (auto &state_path: resume_from){
+    mv.load_state(state_path);
+  }
 //  get kmer length
   atomic<uint64_t> job_index(0);
   vector<thread> threads;
   globalExceptionPtr = nullptr;
-  // Launch threads
-  if (n_threads == 1){
-    thread t1(get_variants_worker,
-           ref(all_tsvs),
-           ref(mv),
-           ref(variant_queue),
-           ref(job_index),
-           ref(number_of_files),
-           ref(verbose),
-           ref(rna),
-           ref(ambig_bases),
-           ref(ambig_bases_map));
-    t1.join();
+  // Launch the writer first so parsers blocked on a full queue always make progress
+  unique_ptr<TextWriter> tsv_file;
+  unique_ptr<VariantCallWriter> calls_file;
+  thread writer;
+  if (binary){
+    calls_file.reset(new VariantCallWriter(output_tsv_file, max_n_variants));
+    writer = thread(write_binary_file_worker, ref(variant_queue), ref(*calls_file));
   } else {
-    for (uint64_t i=0; i<n_threads; i++){
-      threads.emplace_back(thread(get_variants_worker,
-                                  ref(all_tsvs),
-                                  ref(mv),
-                                  ref(variant_queue),
-                                  ref(job_index),
-                                  ref(number_of_files),
-                                  ref(verbose),
-                                  ref(rna),
-                                  ref(ambig_bases),
-                                  ref(ambig_bases_map)));
-    }
-//    threads.emplace_back(thread(write_tsv_file_worker,
-//                                ref(variant_queue),
-//                                ref(max_n_variants),
-//                                ref(output_tsv_file)));
-    // Wait for threads to finish
-    for (auto& t: threads){
-      t.join();
-    }
+    tsv_file.reset(new TextWriter(output_tsv_file, compress));
+    writer = thread(write_tsv_file_worker, ref(variant_queue), ref(max_n_variants), ref(*tsv_file));
+  }
+  for (uint64_t i=0; i<n_threads; i++){
+    threads.emplace_back(thread(get_variants_worker,
+                                ref(all_tsvs),
+                                ref(mv),
+                                i,
+                                ref(variant_queue),
+                                ref(job_index),
+                                ref(number_of_files),
+                                ref(verbose),
+                                ref(rna),
+                                ref(ambig_bases),
+                                ref(ambig_bases_map),
+                                regions.get()));
+  }
+  // Wait for threads to finish
+  for (auto& t: threads){
+    t.join();
+  }
+  variant_queue.stop();
+  writer.join();
+  if (binary){
+    calls_file->close();
+  } else {
+    tsv_file->close();
   }
   if (globalExceptionPtr){
     std::rethrow_exception(globalExceptionPtr);
   }
-  write_tsv_file_worker(variant_queue, max_n_variants, output_tsv_file);
+  cerr << "[queue] " << variant_queue.get_stats().format() << "\n" << flush;
+  if (regions){
+    cerr << "[regions] " << regions->get_stats().format() << "\n" << flush;
+  }
+  mv.merge_partials(n_threads);
   mv.write_to_file(output_file);
+  if (!save_state.empty()){
+    mv.save_state(save_state);
+  }
   if (verbose){
     cerr << "\n" << flush;
   }
 }
 
+/**
+ Combine the marginal counts state files of several runs or shards into one bed file without any alignment files
+
+ @param state_paths: marginal counts state files written with save_state
+ @param output_file_path: path to output bed file
+ @param overwrite: overwrite existing output files
+ @param save_state: path to save the combined marginal counts (empty to skip)
+*/
+void merge_marginal_states(const vector<string> &state_paths,
+                           string &output_file_path,
+                           bool overwrite=false,
+                           const string& save_state="") {
+  path output_file(output_file_path);
+  if (!overwrite){
+    throw_assert(!exists(output_file),
+        output_file_path+" already exists: overwrite to true")
+    throw_assert(save_state.empty() or !exists(save_state),
+        save_state+" already exists: overwrite to true")
+  }
+  throw_assert(!state_paths.empty(), "There are no marginal counts state files to merge")
+  MarginalizeVariants mv;
+  for (auto &state_path: state_paths){
+    mv.load_state(state_path);
+  }
+  mv.write_to_file(output_file);
+  if (!save_state.empty()){
+    mv.save_state(save_state);
+  }
+}
+
 // Getopt
 //
 #define SUBPROGRAM "sa2bed"
@@ -240,8 +333,15 @@ static const char *SA2BED_ALIGNMENT_USAGE_MESSAGE =
     "  -o, --output=PATH                    path and name of output bed file\n"
     "  -c, --ambig_chars=NUCLEOTIDES        a string containing all ambiguous characters (default is P which corresponds to cytosine and 5methylcytosine \n"
     "  -t, --threads=NUMBER                 number of threads\n"
-    "  -l, --locks=NUMBER                   number of locks for multithreading\n"
+    "  -l, --locks=NUMBER                   ignored, threads count variants without locks\n"
     "  -r, --rna                            set if rna reads\n"
+    "  -q, --queue_size=NUMBER              max number of parsed reads waiting to be written (default 1024, 0 is unbounded)\n"
+    "  -z, --gzip                           gzip the per read csv\n"
+    "      --binary                         write per read calls to a binary columnar .calls file instead of a csv\n"
+    "      --regions=BED                    only call variants in the regions of a BED file\n"
+    "      --save_state=PATH                save the per position counts so later runs can resume from them\n"
+    "      --resume_from=PATH               add the saved counts of an earlier run or shard, repeat to merge several.\n"
+    "                                       Without --alignment_files the saved counts are only merged into the bed file\n"
 
     "\nReport bugs to " PACKAGE_BUGREPORT2 "\n\n";
 
@@ -256,11 +356,17 @@ static unsigned int threads;
 static std::string ambig_model;
 static bool rna=false;
 static bool overwrite=false;
+static uint64_t queue_size=1024;
+static bool gzip=false;
+static bool binary=false;
+static std::string regions;
+static std::string save_state;
+static std::vector<std::string> resume_from;
 }
 
-static const char* shortopts = "a:t:c:o:d:r:l:vh";
+static const char* shortopts = "a:t:c:o:d:r:l:q:zvh";
 
-enum { OPT_HELP = 1, OPT_VERSION };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_BINARY, OPT_REGIONS, OPT_SAVE_STATE, OPT_RESUME_FROM };
 
 static const struct option longopts[] = {
     { "verbose",          no_argument,       nullptr, 'v' },
@@ -273,6 +379,12 @@ static const struct option longopts[] = {
     { "help",             no_argument,       nullptr, OPT_HELP },
     { "rna",              no_argument,       nullptr, 'r' },
     { "overwrite",        no_argument,       nullptr, 'b'},
+    { "queue_size",       required_argument, nullptr, 'q' },
+    { "gzip",             no_argument,       nullptr, 'z' },
+    { "binary",           no_argument,       nullptr, OPT_BINARY },
+    { "regions",          required_argument, nullptr, OPT_REGIONS },
+    { "save_state",       required_argument, nullptr, OPT_SAVE_STATE },
+    { "resume_from",      required_argument, nullptr, OPT_RESUME_FROM },
     { "version",          no_argument,       nullptr, OPT_VERSION },
     { nullptr, 0, nullptr, 0 }
 };
@@ -293,6 +405,12 @@ void parse_sa2bed_main_options(int argc, char** argv)
       case 'a': arg >> opt::ambig_model; break;
       case 'r': opt::rna = true; break;
       case 'b': opt::overwrite = true; break;
+      case 'q': arg >> opt::queue_size; break;
+      case 'z': opt::gzip = true; break;
+      case OPT_BINARY: opt::binary = true; break;
+      case OPT_REGIONS: arg >> opt::regions; break;
+      case OPT_SAVE_STATE: arg >> opt::save_state; break;
+      case OPT_RESUME_FROM: opt::resume_from.emplace_back(arg.str()); break;
       case 'v': opt::verbose++; break;
       case OPT_HELP:
         std::cout << SA2BED_ALIGNMENT_USAGE_MESSAGE;
@@ -314,8 +432,8 @@ void parse_sa2bed_main_options(int argc, char** argv)
     die = true;
   }
 
-  if(opt::alignment_files.empty()) {
-    std::cerr << SUBPROGRAM ": --alignment_files file must be provided\n";
+  if(opt::alignment_files.empty() and opt::resume_from.empty()) {
+    std::cerr << SUBPROGRAM ": --alignment_files or --resume_from must be provided\n";
     die = true;
   }
   if(opt::output.empty()) {
@@ -338,6 +456,11 @@ void parse_sa2bed_main_options(int argc, char** argv)
 int sa2bed_main(int argc, char** argv)
 {
   parse_sa2bed_main_options(argc, argv);
+  if (opt::alignment_files.empty()){
+    auto bound_merge = bind(merge_marginal_states, opt::resume_from, opt::output, opt::overwrite, opt::save_state);
+    cout << get_time_string(bound_merge);
+    return EXIT_SUCCESS;
+  }
   path input_dir(opt::alignment_files);
   vector<string> all_tsvs;
   string extension = ".tsv";
@@ -350,11 +473,16 @@ int sa2bed_main(int argc, char** argv)
       opt::output,
       opt::ambig_chars,
       opt::threads,
-      opt::num_locks,
       opt::rna,
       opt::ambig_model,
       false,
-      opt::overwrite);
+      opt::overwrite,
+      opt::queue_size,
+      opt::gzip,
+      opt::binary,
+      opt::regions,
+      opt::resume_from,
+      opt::save_state);
   string funct_time = get_time_string(bound_funct);
   cout << funct_time;
   return EXIT_SUCCESS;
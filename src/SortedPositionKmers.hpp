@@ -0,0 +1,344 @@
+#ifndef EMBED_FAST5_SRC_SORTEDPOSITIONKMERS_HPP_
+#define EMBED_FAST5_SRC_SORTEDPOSITIONKMERS_HPP_
+
+// embed source
+#include "BaseKmer.hpp"
+#include "AlignmentFile.hpp"
+#include "BinaryEventWriter.hpp"
+#include "EventRunFile.hpp"
+#include "ReferenceHandler.hpp"
+// std lib
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+Compact event record used by the sort based aggregation engine
+
+@param position_key: dense key of contig strand offset + reference position
+@param kmer: kmer packed with SortedPositionKmers::pack_kmer
+*/
+struct SortedEventRecord {
+  uint64_t position_key;
+  uint64_t kmer;
+  float descaled_event_mean;
+  float posterior_probability;
+};
+
+/**
+Least significant digit radix sort of records by (position_key, kmer) one byte at a time. Bytes which are the same
+for every record are skipped.
+
+@param data: records to sort
+@param temp: scratch space of the same size
+@param n: number of records
+@return pointer to whichever of data or temp holds the sorted records
+*/
+inline SortedEventRecord* radix_sort_event_records(SortedEventRecord* data, SortedEventRecord* temp, uint64_t n){
+  if (n < 256){
+    std::sort(data, data + n, [](const SortedEventRecord& a, const SortedEventRecord& b){
+      return a.position_key < b.position_key or (a.position_key == b.position_key and a.kmer < b.kmer);
+    });
+    return data;
+  }
+  uint64_t kmer_diff = 0;
+  uint64_t position_diff = 0;
+  for (uint64_t i = 1; i < n; ++i){
+    kmer_diff |= data[i].kmer ^ data[0].kmer;
+    position_diff |= data[i].position_key ^ data[0].position_key;
+  }
+  uint64_t counts[256];
+//  kmer is the least significant part of the key so it is sorted first
+  for (auto field: {&SortedEventRecord::kmer, &SortedEventRecord::position_key}){
+    uint64_t diff = field == &SortedEventRecord::kmer ? kmer_diff : position_diff;
+    for (uint64_t shift = 0; shift < 64; shift += 8){
+      if (((diff >> shift) & 0xff) == 0){
+        continue;
+      }
+      std::fill(counts, counts + 256, 0);
+      for (uint64_t i = 0; i < n; ++i){
+        counts[(data[i].*field >> shift) & 0xff] += 1;
+      }
+      uint64_t sum = 0;
+      for (auto &count: counts){
+        uint64_t c = count;
+        count = sum;
+        sum += c;
+      }
+      for (uint64_t i = 0; i < n; ++i){
+        temp[counts[(data[i].*field >> shift) & 0xff]++] = data[i];
+      }
+      std::swap(data, temp);
+    }
+  }
+  return data;
+}
+
+/**
+Sort buffers of records by (position_key, kmer). Records are first scattered into num_buckets buckets on the high bits
+of the position key and each bucket is then radix sorted, both in parallel. Buffers are released once scattered.
+
+@param buffers: unsorted record buffers
+@param key_range: every position_key is less than key_range
+@param num_threads: number of threads
+@param max_buckets: max number of top level buckets
+@return all records in sorted order
+*/
+inline vector<SortedEventRecord> sort_event_records(vector<vector<SortedEventRecord>>& buffers,
+                                                    uint64_t key_range,
+                                                    uint64_t num_threads,
+                                                    uint64_t max_buckets = 4096){
+  num_threads = max(num_threads, (uint64_t) 1);
+  uint64_t total = 0;
+  for (auto &buffer: buffers){
+    total += buffer.size();
+  }
+  uint64_t shift = 0;
+  while ((key_range >> shift) >= max_buckets){
+    shift += 1;
+  }
+  uint64_t num_buckets = (key_range >> shift) + 1;
+//  per thread histograms so every thread can scatter its buffers without locking
+  vector<vector<uint64_t>> offsets(num_threads, vector<uint64_t>(num_buckets, 0));
+  run_on_threads(num_threads, [&](uint64_t t){
+    for (uint64_t b = t; b < buffers.size(); b += num_threads){
+      for (auto &record: buffers[b]){
+        offsets[t][record.position_key >> shift] += 1;
+      }
+    }
+  });
+  vector<uint64_t> bucket_starts(num_buckets + 1, 0);
+  uint64_t sum = 0;
+  for (uint64_t bucket = 0; bucket < num_buckets; ++bucket){
+    bucket_starts[bucket] = sum;
+    for (uint64_t t = 0; t < num_threads; ++t){
+      uint64_t c = offsets[t][bucket];
+      offsets[t][bucket] = sum;
+      sum += c;
+    }
+  }
+  bucket_starts[num_buckets] = sum;
+  vector<SortedEventRecord> scattered(total);
+  run_on_threads(num_threads, [&](uint64_t t){
+    for (uint64_t b = t; b < buffers.size(); b += num_threads){
+      for (auto &record: buffers[b]){
+        scattered[offsets[t][record.position_key >> shift]++] = record;
+      }
+      vector<SortedEventRecord>().swap(buffers[b]);
+    }
+  });
+  buffers.clear();
+
+  vector<SortedEventRecord> sorted(total);
+  atomic<uint64_t> next_bucket(0);
+  run_on_threads(num_threads, [&](uint64_t){
+    uint64_t bucket;
+    while ((bucket = next_bucket.fetch_add(1)) < num_buckets){
+      uint64_t start = bucket_starts[bucket];
+      uint64_t n = bucket_starts[bucket + 1] - start;
+      SortedEventRecord* result = radix_sort_event_records(scattered.data() + start, sorted.data() + start, n);
+      if (result != sorted.data() + start){
+        std::copy(result, result + n, sorted.data() + start);
+      }
+    }
+  });
+  return sorted;
+}
+
+/**
+Sort based alternative to PerPositionKmers. Alignment files are parsed into compact records which are radix sorted
+and grouped in a single linear pass when writing, instead of being inserted into the ContigStrand hash maps.
+The event file written is the same as the one written by PerPositionKmers.
+
+@param reference: ReferenceHandler object to initialize contig strands
+@param alphabet: alphabet of the kmers
+@param kmer_length: length of kmers
+@param num_threads: number of threads used to sort records
+@param two_d: option to initialize complement contig strands
+*/
+class SortedPositionKmers {
+ public:
+  SortedPositionKmers(ReferenceHandler &reference,
+                      set<char> alphabet = {'A', 'C', 'G', 'T'},
+                      uint64_t kmer_length = 6,
+                      uint64_t num_threads = 1,
+                      bool two_d = false) :
+      kmer_length(kmer_length), alphabet(move(alphabet)), num_threads(num_threads), two_d(two_d)
+  {
+    this->initialize_kmer_packing();
+    this->initialize_contig_strands(reference);
+  }
+  ~SortedPositionKmers() = default;
+
+  uint64_t kmer_length;
+  set<char> alphabet;
+  uint64_t num_threads;
+  bool two_d;
+  bool rna = false;
+
+  /**
+  Parse an alignment file into a record buffer
+  */
+  void process_alignment(AlignmentFile &af) {
+    vector<SortedEventRecord> records;
+    string contig;
+    string nanopore_strand;
+    uint64_t offset = 0;
+    uint64_t num_positions = 0;
+    for (auto &event: af.iterate()){
+      if (records.empty() or event.contig != contig or event.strand != nanopore_strand){
+        contig = event.contig;
+        nanopore_strand = event.strand;
+        string contig_strand = contig + af.strand + nanopore_strand;
+        auto found = contig_strand_lookup.find(contig_strand);
+        throw_assert(found != contig_strand_lookup.end(),
+                     "contig_strand: " + contig_strand + " is not in SortedPositionKmers.")
+        offset = offsets[found->second];
+        num_positions = contig_strands[found->second].num_positions;
+      }
+      throw_assert(event.reference_index < num_positions,
+                   "Reference Position " + to_string(event.reference_index) +" not found in " + contig)
+      records.push_back({offset + event.reference_index, this->pack_kmer(event.path_kmer),
+                         (float) event.descaled_event_mean, (float) event.posterior_probability});
+    }
+    std::lock_guard<std::mutex> lk(buffers_mutex);
+    num_events += records.size();
+    buffers.push_back(move(records));
+  }
+
+  /**
+  Keep only the max_events most probable events for each kmer at each position (0 keeps all)
+  */
+  void set_max_events(uint64_t new_max_events) {
+    max_events = new_max_events;
+  }
+
+  /**
+  Quantise and compress event payloads in the output file
+  */
+  void set_compression(bool new_compress) {
+    compress = new_compress;
+  }
+
+  /**
+  Also group every payload by kmer in the output file
+  */
+  void set_kmer_major(bool new_kmer_major) {
+    kmer_major = new_kmer_major;
+  }
+
+  uint64_t get_num_events() {
+    return num_events;
+  }
+
+  MemoryReport memory_report() {
+    std::lock_guard<std::mutex> lk(buffers_mutex);
+    uint64_t bytes = vector_memory(buffers);
+    for (auto &buffer: buffers){
+      bytes += vector_memory(buffer);
+    }
+    MemoryReport report;
+    report.add("event_records", bytes);
+    report.add("contig_strands", vector_memory(contig_strands) + vector_memory(offsets) +
+        unordered_map_memory(contig_strand_lookup));
+    return report;
+  }
+
+  /**
+  Sort all records and write them to a binary event file. Records are released while sorting.
+  */
+  void write_to_file(path& output_file) {
+    vector<SortedEventRecord> records = sort_event_records(buffers, offsets.back(), num_threads);
+    num_events = 0;
+    BinaryEventWriter bew(output_file, alphabet, kmer_length, rna, two_d, EVENT_FILE_VERSION, compress, kmer_major);
+    for (auto &entry: contig_strands){
+      bew.add_contig_strand(entry.contig, entry.strand, entry.nanopore_strand, entry.num_positions);
+    }
+    uint64_t cs_id = 0;
+    uint64_t i = 0;
+    uint64_t n = records.size();
+    Position position;
+    while (i < n){
+      uint64_t key = records[i].position_key;
+      while (key >= offsets[cs_id + 1]){
+        cs_id += 1;
+      }
+      position.clear();
+      position.position = key - offsets[cs_id];
+      while (i < n and records[i].position_key == key){
+        uint64_t kmer = records[i].kmer;
+        vector<Event> events;
+        while (i < n and records[i].position_key == key and records[i].kmer == kmer){
+          events.emplace_back(records[i].descaled_event_mean, records[i].posterior_probability);
+          i += 1;
+        }
+        shared_ptr<PosKmer> pos_kmer = make_shared<PosKmer>(this->unpack_kmer(kmer), max_events, 0);
+        pos_kmer->set_events(move(events));
+        position.add_kmer(pos_kmer);
+      }
+      ContigStrandRunEntry& entry = contig_strands[cs_id];
+      bew.write_position(entry.contig, entry.strand, entry.nanopore_strand, entry.num_positions, position);
+    }
+    bew.write_indexes();
+  }
+
+  /**
+  Pack a kmer into an integer using the rank of each base in the alphabet. Packed kmers sort in the same order as the
+  kmer strings.
+  */
+  uint64_t pack_kmer(const string& kmer) {
+    return packer.pack(kmer);
+  }
+
+  string unpack_kmer(uint64_t packed) {
+    return packer.unpack(packed);
+  }
+
+ private:
+  std::mutex buffers_mutex;
+  vector<vector<SortedEventRecord>> buffers;
+  uint64_t num_events = 0;
+  uint64_t max_events = 0;
+  bool compress = false;
+  bool kmer_major = false;
+//  contig strands sorted by name, offsets[i] is the first position key of contig strand i
+  vector<ContigStrandRunEntry> contig_strands;
+  vector<uint64_t> offsets;
+  unordered_map<string, uint64_t> contig_strand_lookup;
+  KmerPacker packer;
+
+  void initialize_kmer_packing() {
+    packer = KmerPacker(alphabet, kmer_length);
+  }
+
+  void initialize_contig_strands(ReferenceHandler &reference) {
+    vector<string> strands{"+", "-"};
+    vector<string> nanopore_strands{"t"};
+    if (two_d){
+      nanopore_strands.emplace_back("c");
+    }
+    for (auto &contig: reference.get_chromosome_names()){
+      for (auto &strand: strands){
+        for (auto &nanopore_strand: nanopore_strands){
+          contig_strands.push_back({contig, strand, nanopore_strand, reference.get_chromosome_sequence_length(contig)});
+        }
+      }
+    }
+    sort(contig_strands.begin(), contig_strands.end(),
+         [](const ContigStrandRunEntry& a, const ContigStrandRunEntry& b){
+           return a.contig+a.strand+a.nanopore_strand < b.contig+b.strand+b.nanopore_strand;
+         });
+    offsets.push_back(0);
+    for (uint64_t i = 0; i < contig_strands.size(); ++i){
+      ContigStrandRunEntry& entry = contig_strands[i];
+      contig_strand_lookup.emplace(entry.contig+entry.strand+entry.nanopore_strand, i);
+      offsets.push_back(offsets.back() + entry.num_positions);
+    }
+  }
+};
+
+#endif //EMBED_FAST5_SRC_SORTEDPOSITIONKMERS_HPP_
@@ -5,7 +5,9 @@
 // embed lib
 #include "SplitByRefPosition.hpp"
 #include "PerPositionKmers.hpp"
+#include "SortedPositionKmers.hpp"
 #include "EmbedUtils.hpp"
+#include "MemoryReport.hpp"
 // boost lib
 #include <boost/filesystem.hpp>
 // std lib
@@ -14,6 +16,8 @@
 #include <chrono>
 #include <thread>
 #include <functional>
+#include <map>
+#include <memory>
 
 using namespace std;
 using namespace boost::filesystem;
@@ -25,20 +29,23 @@ static std::exception_ptr globalExceptionPtr = nullptr;
  * worker which parses "full" signalalign file by position
  *
  * @param signalalign_output_files: reference to vector of signalalign files
- * @param ppk: PerPositonKmers class object
+ * @param ppk: PerPositonKmers or SortedPositionKmers class object
  * @param job_index: atomic index for selecting output files to process
  * @param n_files: max number of files to process
  * @param verbose: option for printing files processed
  * @param rna: boolean option if reads are rna
+ * @param regions: only parse rows in these target regions (nullptr parses every row)
  */
+template<class Aggregator>
 void per_position_worker(
     vector<path>& signalalign_output_files,
-    PerPositionKmers& ppk,
+    Aggregator& ppk,
     atomic<uint64_t>& job_index,
     uint64_t& n_files,
     bool& verbose,
     bool& rna,
-    ProgressBar& pb) {
+    ProgressBar& pb,
+    const RegionIndex* regions) {
   uint64_t step = floor(n_files / 100) + 1;
   try {
     tuple<string, vector<VariantCall>> read_id_and_variants;
@@ -48,6 +55,7 @@ void per_position_worker(
       if (thread_job_index < n_files){
         path current_file = signalalign_output_files[thread_job_index];
         AlignmentFile af(current_file.string(), rna);
+        af.set_regions(regions);
         ppk.process_alignment(af);
         if (verbose) {
           // Print status update to stdout
@@ -63,6 +71,67 @@ void per_position_worker(
   }
 }
 
+/**
+ Parse all alignment files into an aggregator with n_threads worker threads
+
+ @param all_tsvs: alignment files
+ @param ppk: PerPositonKmers or SortedPositionKmers class object
+ @param n_threads: number of threads to process
+ @param verbose: option for printing files processed
+ @param rna: boolean option if reads are rna
+ @param memory_report: seconds between memory reports written to stderr (0 never reports)
+ @param regions: only parse rows in these target regions (nullptr parses every row)
+*/
+template<class Aggregator>
+void run_per_position_workers(vector<path>& all_tsvs, Aggregator& ppk, uint64_t n_threads, bool verbose, bool rna,
+                              uint64_t memory_report, const RegionIndex* regions) {
+  uint64_t number_of_files = all_tsvs.size();
+  MemoryReporter reporter(memory_report, [&ppk](){ return ppk.memory_report(); }, cerr);
+  //  creat job index, threads and reset exception pointer
+  atomic<uint64_t> job_index(0);
+  vector<thread> threads;
+  globalExceptionPtr = nullptr;
+  cout << "\33[2K\rStarting threads..\n ";
+  // Launch threads
+  {
+    ProgressBar progress{std::cout, 70u, "Working"};
+    for (uint64_t i = 0; i < n_threads; i++) {
+      threads.emplace_back(thread(per_position_worker<Aggregator>,
+                                  ref(all_tsvs),
+                                  ref(ppk),
+                                  ref(job_index),
+                                  ref(number_of_files),
+                                  ref(verbose),
+                                  ref(rna),
+                                  ref(progress),
+                                  regions));
+    }
+    // Wait for threads to finish
+    for (auto &t: threads) {
+      t.join();
+    }
+    if (globalExceptionPtr) {
+      std::rethrow_exception(globalExceptionPtr);
+    }
+    if (verbose) {
+      cerr << "\n" << flush;
+    }
+  }
+  reporter.stop();
+  if (memory_report > 0) {
+    cerr << "[memory] " << ppk.memory_report().format() << "\n" << flush;
+  }
+}
+
+/**
+ Write how many rows the region filter read and dropped to stderr
+*/
+void report_region_stats(const RegionIndex* regions){
+  if (regions != nullptr){
+    cerr << "[regions] " << regions->get_stats().format() << "\n" << flush;
+  }
+}
+
 /**
  Split full signalalign output by reference position and write a file with top n most probable kmers
 
@@ -71,6 +140,7 @@ void per_position_worker(
  @param ambig_bases: possible ambiguous bases to search for
  @param num_locks: number of locks for writing to common data structure
  @param n_threads: number of threads to process
+ @param options: max events, spilling, engine, output format and region switches, see SplitByRefOptions
  @return tuple of uint64_t's [hours, minutes, seconds, microseconds]
 */
 void split_signal_align_by_ref_position(const vector<string> &sa_input_dir,
@@ -81,10 +151,16 @@ void split_signal_align_by_ref_position(const vector<string> &sa_input_dir,
                                         bool verbose,
                                         bool rna,
                                         bool two_d,
-                                        set<char> alphabet) {
+                                        set<char> alphabet,
+                                        const SplitByRefOptions& options) {
   //  check output file does not exist
   path output_file(output_file_path);
   throw_assert(!exists(output_file), output_file_path+" already exists")
+  throw_assert(options.engine == "hash" or options.engine == "sort",
+               "Aggregation engine must be 'hash' or 'sort'. Got: " + options.engine)
+  throw_assert(options.engine == "hash" or options.memory_limit == 0, "The sort engine does not support a memory limit")
+  throw_assert(!options.stream or (options.engine == "hash" and options.memory_limit == 0),
+               "Streaming is only supported by the hash engine without a memory limit")
 
 //  process all tsvs from directories
   vector<path> all_tsvs;
@@ -96,41 +172,56 @@ void split_signal_align_by_ref_position(const vector<string> &sa_input_dir,
       all_tsvs.push_back(i);
     }
   }
-  uint64_t number_of_files = all_tsvs.size();
+  unique_ptr<RegionIndex> regions;
+  if (!options.regions_bed.empty()){
+    regions.reset(new RegionIndex(options.regions_bed));
+  }
 //  initialize per-position dataset using info from reference
   ReferenceHandler rh(reference);
-  PerPositionKmers ppk(rh, alphabet, AlignmentFile(all_tsvs[0].string()).get_k(), num_locks, two_d);
-  //  creat job index, threads and reset exception pointer
-  atomic<uint64_t> job_index(0);
-  vector<thread> threads;
-  globalExceptionPtr = nullptr;
-  cout << "\33[2K\rStarting threads..\n ";
-  // Launch threads
-  {
-    ProgressBar progress{std::cout, 70u, "Working"};
-    for (uint64_t i = 0; i < n_threads; i++) {
-      threads.emplace_back(thread(per_position_worker,
-                                  ref(all_tsvs),
-                                  ref(ppk),
-                                  ref(job_index),
-                                  ref(number_of_files),
-                                  ref(verbose),
-                                  ref(rna),
-                                  ref(progress)));
-    }
-    // Wait for threads to finish
-    for (auto &t: threads) {
-      t.join();
-    }
-    if (globalExceptionPtr) {
-      std::rethrow_exception(globalExceptionPtr);
+  int64_t kmer_length = AlignmentFile(all_tsvs[0].string()).get_k();
+  if (options.engine == "sort"){
+    SortedPositionKmers spk(rh, alphabet, kmer_length, n_threads, two_d);
+    spk.set_max_events(options.max_events);
+    spk.set_compression(options.compress);
+    spk.set_kmer_major(options.kmer_major);
+    run_per_position_workers(all_tsvs, spk, n_threads, verbose, rna, options.memory_report, regions.get());
+    report_region_stats(regions.get());
+    cout << "\33[2K\rSorting and writing to file.. \n ";
+    spk.write_to_file(output_file);
+    return;
+  }
+  PerPositionKmers ppk(rh, alphabet, kmer_length, num_locks, two_d);
+  ppk.set_max_events(options.max_events);
+  ppk.set_bulk_factor(4);
+  ppk.set_compression(options.compress);
+  ppk.set_kmer_major(options.kmer_major);
+  path spill_dir = absolute(output_file).parent_path() / (output_file.filename().string() + ".spill");
+  ppk.set_memory_limit(options.memory_limit, spill_dir);
+  if (options.stream) {
+//    every alignment file covers one contig so a contig is finished once its files are processed
+    map<string, vector<path>> contig_tsvs;
+    for (auto &tsv: all_tsvs){
+      contig_tsvs[AlignmentFile(tsv.string()).contig].push_back(tsv);
     }
-    if (verbose) {
-      cerr << "\n" << flush;
+    ppk.open_stream(output_file);
+    for (auto &contig_files: contig_tsvs){
+      cout << "\33[2K\rProcessing " << contig_files.first << ".. \n ";
+      run_per_position_workers(contig_files.second, ppk, n_threads, verbose, rna, options.memory_report,
+                               regions.get());
+      ppk.flush_contig(contig_files.first);
     }
+    report_region_stats(regions.get());
+    cout << "\33[2K\rWriting indexes.. \n ";
+    ppk.close_stream();
+    return;
+  }
+  run_per_position_workers(all_tsvs, ppk, n_threads, verbose, rna, options.memory_report, regions.get());
+  report_region_stats(regions.get());
+  if (ppk.num_spills() > 0) {
+    cout << "\33[2K\rMerging " << ppk.num_spills() + 1 << " spilled runs.. \n ";
   }
   cout << "\33[2K\rWriting to file.. \n ";
-  ppk.write_to_file(output_file);
+  ppk.write_to_file(output_file, n_threads);
 }
 
 // Getopt
@@ -158,6 +249,14 @@ static const char *SPLIT_BY_REF_USAGE_MESSAGE =
     "  -c, --alphabet=PATH                  characters that make up alphabet\n"
     "  --rna                                boolean option if reads are rna\n"
     "  --two_d                              boolean option if reads are 2d\n"
+    "  -n, --max_events=NUMBER              max number of events to keep per kmer at each position (default all)\n"
+    "  -m, --memory_limit=MB                spill sorted runs to disk once events use this much memory\n"
+    "  -e, --engine=NAME                    aggregation engine: hash (default) or sort\n"
+    "      --memory_report=SECONDS          write a memory report to stderr every SECONDS seconds\n"
+    "      --compress                       quantise and compress events in the output file\n"
+    "      --kmer_major                     also group events by kmer in the output file for fast kmer lookups\n"
+    "      --stream                         write each contig to the output file as soon as its alignments are processed\n"
+    "      --regions=BED                    only keep events whose kmer overlaps a region of a BED file\n"
     "\nReport bugs to " PACKAGE_BUGREPORT2 "\n\n";
 
 namespace opt
@@ -171,12 +270,19 @@ static string reference;
 static bool rna=false;
 static bool two_d=false;
 static string alphabet;
-
+static uint64_t max_events = 0;
+static uint64_t memory_limit = 0;
+static string engine = "hash";
+static uint64_t memory_report = 0;
+static bool compress = false;
+static bool kmer_major = false;
+static bool stream = false;
+static string regions;
 }
 
-static const char* shortopts = "a:t:o:r:l:d:b:c:vh";
+static const char* shortopts = "a:t:o:r:l:d:b:c:n:m:e:vh";
 
-enum { OPT_HELP = 1, OPT_VERSION };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_MEMORY_REPORT, OPT_COMPRESS, OPT_KMER_MAJOR, OPT_STREAM, OPT_REGIONS };
 
 static const struct option longopts[] = {
     { "verbose",          no_argument,       nullptr, 'v' },
@@ -188,6 +294,14 @@ static const struct option longopts[] = {
     { "threads",          optional_argument, nullptr, 't' },
     { "rna",              no_argument,       nullptr, 'b' },
     { "two_d",            no_argument,       nullptr, 'd' },
+    { "max_events",       required_argument, nullptr, 'n' },
+    { "memory_limit",     required_argument, nullptr, 'm' },
+    { "engine",           required_argument, nullptr, 'e' },
+    { "memory_report",    required_argument, nullptr, OPT_MEMORY_REPORT },
+    { "compress",         no_argument,       nullptr, OPT_COMPRESS },
+    { "kmer_major",       no_argument,       nullptr, OPT_KMER_MAJOR },
+    { "stream",           no_argument,       nullptr, OPT_STREAM },
+    { "regions",          required_argument, nullptr, OPT_REGIONS },
     { "help",             no_argument,       nullptr, OPT_HELP },
     { "version",          no_argument,       nullptr, OPT_VERSION },
     { nullptr, 0, nullptr, 0 }
@@ -207,6 +321,14 @@ void parse_split_by_ref_main_options(int argc, char** argv)
       case 'c': arg >> opt::alphabet; break;
       case 'b': opt::rna = true; break;
       case 'd': opt::two_d = true; break;
+      case 'n': arg >> opt::max_events; break;
+      case 'm': arg >> opt::memory_limit; break;
+      case 'e': arg >> opt::engine; break;
+      case OPT_MEMORY_REPORT: arg >> opt::memory_report; break;
+      case OPT_COMPRESS: opt::compress = true; break;
+      case OPT_KMER_MAJOR: opt::kmer_major = true; break;
+      case OPT_STREAM: opt::stream = true; break;
+      case OPT_REGIONS: arg >> opt::regions; break;
       case 'v': opt::verbose++; break;
       case OPT_HELP:
         std::cout << SPLIT_BY_REF_USAGE_MESSAGE;
@@ -240,6 +362,18 @@ void parse_split_by_ref_main_options(int argc, char** argv)
     std::cerr << SUBPROGRAM ": a --alphabet string must be provided\n";
     die = true;
   }
+  if(opt::engine != "hash" and opt::engine != "sort") {
+    std::cerr << SUBPROGRAM ": --engine must be hash or sort\n";
+    die = true;
+  }
+  if(opt::engine == "sort" and opt::memory_limit > 0) {
+    std::cerr << SUBPROGRAM ": --memory_limit is only supported by the hash engine\n";
+    die = true;
+  }
+  if(opt::stream and (opt::engine == "sort" or opt::memory_limit > 0)) {
+    std::cerr << SUBPROGRAM ": --stream is only supported by the hash engine without a --memory_limit\n";
+    die = true;
+  }
   if (die)
   {
     std::cout << "\n" << SPLIT_BY_REF_USAGE_MESSAGE;
@@ -252,6 +386,15 @@ int split_by_ref_main(int argc, char** argv)
 {
   parse_split_by_ref_main_options(argc, argv);
   set<char> alphabet = string_to_char_set(opt::alphabet);
+  SplitByRefOptions options;
+  options.max_events = opt::max_events;
+  options.memory_limit = opt::memory_limit * 1024 * 1024;
+  options.engine = opt::engine;
+  options.memory_report = opt::memory_report;
+  options.compress = opt::compress;
+  options.kmer_major = opt::kmer_major;
+  options.stream = opt::stream;
+  options.regions_bed = opt::regions;
   auto bound_funct = bind(split_signal_align_by_ref_position,
                           opt::alignment_files,
                           opt::output,
@@ -261,7 +404,8 @@ int split_by_ref_main(int argc, char** argv)
                           opt::verbose,
                           opt::rna,
                           opt::two_d,
-                          alphabet);
+                          alphabet,
+                          options);
   string funct_time = get_time_string(bound_funct);
   cout << funct_time;
 
@@ -11,6 +11,29 @@
 
 using namespace std;
 
+/**
+Optional switches of split_signal_align_by_ref_position, the defaults aggregate every event in memory
+
+@param max_events: max number of events to keep for each kmer at a position (0 keeps all)
+@param memory_limit: bytes of events to hold in memory before spilling sorted runs to disk (0 never spills)
+@param engine: "hash" aggregates into per position hash maps, "sort" radix sorts compact event records
+@param memory_report: seconds between memory reports written to stderr (0 never reports)
+@param compress: quantise and compress event payloads in the output file
+@param kmer_major: also group every payload by kmer in the output file
+@param stream: process alignment files a contig at a time and write each contig to the output file once it is done
+@param regions_bed: BED file of target regions, rows whose kmer is outside them are dropped while parsing
+*/
+struct SplitByRefOptions {
+  uint64_t max_events = 0;
+  uint64_t memory_limit = 0;
+  string engine = "hash";
+  uint64_t memory_report = 0;
+  bool compress = false;
+  bool kmer_major = false;
+  bool stream = false;
+  string regions_bed;
+};
+
 int split_by_ref_main(int argc, char** argv);
 void split_signal_align_by_ref_position(const std::vector<string> &sa_input_dir,
                                         string &output_file_path,
@@ -20,6 +43,7 @@ void split_signal_align_by_ref_position(const std::vector<string> &sa_input_dir,
                                         bool verbose,
                                         bool rna,
                                         bool two_d,
-                                        std::set<char> alphabet);
+                                        std::set<char> alphabet,
+                                        const SplitByRefOptions& options = SplitByRefOptions());
 
 #endif //EMBED_FAST5_SRC_SCRIPTS_SPLITBYREFPOSITION_HPP_
@@ -0,0 +1,248 @@
+#ifndef EMBED_FAST5_SRC_TEXTWRITER_HPP_
+#define EMBED_FAST5_SRC_TEXTWRITER_HPP_
+
+// embed libs
+#include "EmbedUtils.hpp"
+// boost libs
+#include <boost/filesystem.hpp>
+// zlib
+#include <zlib.h>
+// std libs
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+using namespace std;
+using namespace embed_utils;
+
+/**
+Buffered writer for csv, tsv and bed outputs. Text is formatted straight into a large buffer, integers with a digit
+loop and floating point numbers like ostream's default format (printf "%g"), so files match what operator<< on an
+ofstream wrote. Full buffers are written behind on a background thread while the caller fills the other buffer, and
+the output can be gzipped.
+
+@param output_path: path to output file
+@param compress: gzip the output
+@param buffer_size: bytes to format before handing a buffer to the writer thread
+@param async: write on a background thread, otherwise full buffers are written by the caller
+*/
+class TextWriter {
+ public:
+  static const uint64_t DEFAULT_BUFFER_SIZE = 1 << 20;
+
+  explicit TextWriter(const boost::filesystem::path& output_path, bool compress=false,
+                      uint64_t buffer_size=DEFAULT_BUFFER_SIZE, bool async=true) :
+      output_path(output_path), compress(compress), buffer_size(std::max(buffer_size, (uint64_t) 64)), async(async) {
+    if (compress){
+      gz_file = gzopen(output_path.string().c_str(), "wb");
+      throw_assert(gz_file != nullptr, "Unable to open file: " + output_path.string())
+    } else {
+      file = fopen(output_path.string().c_str(), "wb");
+      throw_assert(file != nullptr, "Unable to open file: " + output_path.string())
+    }
+    active.reserve(this->buffer_size + 64);
+    if (async){
+      pending.reserve(this->buffer_size + 64);
+      writer = std::thread(&TextWriter::run, this);
+    }
+  }
+  TextWriter(const TextWriter&) = delete;
+  TextWriter& operator=(const TextWriter&) = delete;
+
+  ~TextWriter() {
+    try {
+      this->close();
+    } catch (...) {
+      cerr << "Failed to close " << output_path.string() << "\n";
+    }
+  }
+
+  void write(const char* data, size_t length){
+    active.append(data, length);
+    if (active.size() >= buffer_size){
+      this->hand_off();
+    }
+  }
+
+  TextWriter& operator<<(const string& value){
+    this->write(value.data(), value.size());
+    return *this;
+  }
+
+  TextWriter& operator<<(const char* value){
+    this->write(value, strlen(value));
+    return *this;
+  }
+
+  TextWriter& operator<<(char value){
+    active.push_back(value);
+    if (active.size() >= buffer_size){
+      this->hand_off();
+    }
+    return *this;
+  }
+
+  TextWriter& operator<<(unsigned long long value){
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* start = end;
+    do {
+      *--start = (char) ('0' + value % 10);
+      value /= 10;
+    } while (value > 0);
+    this->write(start, end - start);
+    return *this;
+  }
+
+  TextWriter& operator<<(long long value){
+    if (value < 0){
+      *this << '-';
+//      negate in unsigned arithmetic so the most negative value does not overflow
+      return *this << ((unsigned long long) 0 - (unsigned long long) value);
+    }
+    return *this << (unsigned long long) value;
+  }
+
+  TextWriter& operator<<(unsigned long value){
+    return *this << (unsigned long long) value;
+  }
+
+  TextWriter& operator<<(long value){
+    return *this << (long long) value;
+  }
+
+  TextWriter& operator<<(unsigned int value){
+    return *this << (unsigned long long) value;
+  }
+
+  TextWriter& operator<<(int value){
+    return *this << (long long) value;
+  }
+
+  TextWriter& operator<<(double value){
+    char number[32];
+    int length = snprintf(number, sizeof(number), "%g", value);
+    this->write(number, (size_t) length);
+    return *this;
+  }
+
+  TextWriter& operator<<(float value){
+    return *this << (double) value;
+  }
+
+  /**
+  Write everything buffered, wait for the writer thread and close the file
+  */
+  void close(){
+    if (closed){
+      return;
+    }
+    closed = true;
+    if (!active.empty()){
+      this->hand_off();
+    }
+    if (async){
+      {
+        std::unique_lock<std::mutex> lk(mutex);
+        closing = true;
+      }
+      work_ready.notify_one();
+      writer.join();
+    }
+    if (compress){
+      if (gzclose(gz_file) != Z_OK){
+        failed = true;
+      }
+    } else if (fclose(file) != 0){
+      failed = true;
+    }
+    throw_assert(!failed, "Failed writing " + output_path.string())
+  }
+
+  bool good() const {
+    return !failed;
+  }
+
+  /**
+  Bytes handed to the file so far, before compression
+  */
+  uint64_t bytes_written() const {
+    return written;
+  }
+
+ private:
+  boost::filesystem::path output_path;
+  bool compress;
+  uint64_t buffer_size;
+  bool async;
+  FILE* file = nullptr;
+  gzFile gz_file = nullptr;
+//  the caller formats into active while the writer thread writes pending
+  string active;
+  string pending;
+  bool pending_full = false;
+  bool closing = false;
+  bool closed = false;
+  std::atomic<bool> failed{false};
+  std::atomic<uint64_t> written{0};
+  std::mutex mutex;
+  std::condition_variable work_ready;
+  std::condition_variable work_done;
+  std::thread writer;
+
+  void write_buffer(const string& buffer){
+    if (buffer.empty() or failed){
+      return;
+    }
+    if (compress){
+      if (gzwrite(gz_file, buffer.data(), (unsigned) buffer.size()) != (int) buffer.size()){
+        failed = true;
+      }
+    } else if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()){
+      failed = true;
+    }
+    written += buffer.size();
+  }
+
+  /**
+  Swap the full active buffer with the pending one once the writer thread has finished with it
+  */
+  void hand_off(){
+    if (!async){
+      this->write_buffer(active);
+      active.clear();
+      return;
+    }
+    {
+      std::unique_lock<std::mutex> lk(mutex);
+      work_done.wait(lk, [this]{ return !pending_full; });
+      active.swap(pending);
+      pending_full = true;
+    }
+    work_ready.notify_one();
+    active.clear();
+  }
+
+  void run(){
+    std::unique_lock<std::mutex> lk(mutex);
+    while (true){
+      work_ready.wait(lk, [this]{ return pending_full or closing; });
+      if (pending_full){
+        lk.unlock();
+        this->write_buffer(pending);
+        lk.lock();
+        pending_full = false;
+        work_done.notify_one();
+      } else {
+        return;
+      }
+    }
+  }
+};
+
+#endif //EMBED_FAST5_SRC_TEXTWRITER_HPP_
@@ -24,6 +24,7 @@ using namespace embed_utils;
  * @param alphabet: alphabet used to generate kmers
  * @param n_threads: set number of threads to use: default 2
  * @param verbose: print out files as they are being processed
+ * @param memory_report: seconds between memory reports written to stderr (0 never reports)
  */
 void generate_master_kmer_table_wrapper(vector<string> event_table_files,
                                         string &output_file,
@@ -33,19 +34,20 @@ void generate_master_kmer_table_wrapper(vector<string> event_table_files,
                                         double min_prob,
                                         uint64_t n_threads,
                                         bool verbose,
-                                        bool write_full) {
+                                        bool write_full,
+                                        uint64_t memory_report) {
   uint64_t n_col = number_of_columns(event_table_files[0]);
   throw_assert(n_col == 16 or n_col == 4,
                "Incorrect number of columns in tsv: " + event_table_files[0])
   if (n_col == 4) {
     generate_master_kmer_table<AssignmentFile, eventkmer>(event_table_files, output_file, log_file,
                                                           alphabet, heap_size, min_prob, n_threads,
-                                                          verbose, write_full);
+                                                          verbose, write_full, memory_report);
 
   } else if (n_col == 16) {
     generate_master_kmer_table<AlignmentFile, FullSaEvent>(event_table_files, output_file, log_file,
                                                            alphabet, heap_size, min_prob, n_threads,
-                                                           verbose, write_full);
+                                                           verbose, write_full, memory_report);
   }
 }
 
@@ -71,6 +73,7 @@ static const char *TOP_KMER_USAGE_MESSAGE =
     "  -t, --threads=NUMBER                 number of threads\n"
     "  -s, --heap_size=NUMBER               size of heap for each kmer\n"
     "  -a, --alphabet=STRING                alphabet for kmers\n"
+    "      --memory_report=SECONDS          write a memory report to stderr every SECONDS seconds\n"
 
     "\nReport bugs to " PACKAGE_BUGREPORT2 "\n\n";
 
@@ -84,11 +87,12 @@ static unsigned int heap_size;
 static string alphabet;
 static int num_threads = 1;
 static double min_prob = 0.0;
+static uint64_t memory_report = 0;
 }
 
 static const char* shortopts = "a:d:s:t:o:m:vh";
 
-enum { OPT_HELP = 1, OPT_VERSION };
+enum { OPT_HELP = 1, OPT_VERSION, OPT_MEMORY_REPORT };
 
 static const struct option longopts[] = {
     { "verbose",          no_argument,       nullptr, 'v' },
@@ -98,6 +102,7 @@ static const struct option longopts[] = {
     { "alphabet",         required_argument, nullptr, 'a' },
     { "min_prob",         required_argument, nullptr, 'm' },
     { "threads",          optional_argument, nullptr, 't' },
+    { "memory_report",    required_argument, nullptr, OPT_MEMORY_REPORT },
     { "help",             no_argument,       nullptr, OPT_HELP },
     { "version",          no_argument,       nullptr, OPT_VERSION },
     { nullptr, 0, nullptr, 0 }
@@ -115,6 +120,7 @@ void parse_top_kmers_main_options(int argc, char** argv)
       case 'a': arg >> opt::alphabet; break;
       case 'm': arg >> opt::min_prob; break;
       case 's': arg >> opt::heap_size; break;
+      case OPT_MEMORY_REPORT: arg >> opt::memory_report; break;
       case 'v': opt::verbose++; break;
       case OPT_HELP:
         std::cout << TOP_KMER_USAGE_MESSAGE;
@@ -189,7 +195,8 @@ auto top_kmers_main(int argc, char** argv) -> int
                                      opt::alphabet,
                                      opt::min_prob,
                                      opt::threads,
-                                     opt::verbose, true);
+                                     opt::verbose, true,
+                                     opt::memory_report);
 
   return EXIT_SUCCESS;
 }
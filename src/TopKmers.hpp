@@ -8,6 +8,7 @@
 #include "AssignmentFile.hpp"
 #include "AlignmentFile.hpp"
 #include "MaxKmers.hpp"
+#include "MemoryReport.hpp"
 #include <unordered_set>
 #include <thread>
 #include <atomic>
@@ -23,7 +24,8 @@ void generate_master_kmer_table_wrapper(vector<string> event_table_files,
                                         double min_prob,
                                         uint64_t n_threads,
                                         bool verbose,
-                                        bool write_full);
+                                        bool write_full,
+                                        uint64_t memory_report = 0);
 
 
 /**
@@ -73,6 +75,7 @@ void bin_max_kmer_worker(vector<path>& signalalign_output_files, T2& max_kmers,
  * @param min_prob: minimum probability
  * @param n_threads: set number of threads to use: default 2
  * @param verbose: boolean verbose option
+ * @param memory_report: seconds between memory reports written to stderr (0 never reports)
  */
 template<class T1, class T2>
 void generate_master_kmer_table(vector<string> &sa_output_paths,
@@ -83,7 +86,8 @@ void generate_master_kmer_table(vector<string> &sa_output_paths,
                                 double min_prob = 0.0,
                                 unsigned int n_threads = 1,
                                 bool verbose = false,
-                                bool write_full = false) {
+                                bool write_full = false,
+                                uint64_t memory_report = 0) {
 
 //  filter out empty files and check if there are any left
   vector<path> all_tsvs = filter_emtpy_files<string>(sa_output_paths, ".tsv");
@@ -97,6 +101,7 @@ void generate_master_kmer_table(vector<string> &sa_output_paths,
   atomic<uint64_t> job_index(0);
   vector<thread> threads;
   globalExceptionPtr = nullptr;
+  MemoryReporter reporter(memory_report, [&mk](){ return mk.memory_report(); }, cerr);
   // Launch threads
   for (uint64_t i=0; i<n_threads; i++){
       threads.emplace_back(thread(bin_max_kmer_worker<T1, MaxKmers<T2>>,
@@ -110,12 +115,16 @@ void generate_master_kmer_table(vector<string> &sa_output_paths,
   for (auto& t: threads){
     t.join();
   }
+  reporter.stop();
   if (globalExceptionPtr){
     std::rethrow_exception(globalExceptionPtr);
   }
   if (verbose){
     cerr << "\n" << flush;
   }
+  if (memory_report > 0){
+    cerr << "[memory] " << mk.memory_report().format() << "\n" << flush;
+  }
   path output_path(output_file);
   path log_path(log_file);
 
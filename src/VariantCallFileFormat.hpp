@@ -0,0 +1,123 @@
+#ifndef EMBED_FAST5_SRC_VARIANTCALLFILEFORMAT_HPP_
+#define EMBED_FAST5_SRC_VARIANTCALLFILEFORMAT_HPP_
+
+// std libs
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+Binary per read variant call file, the columnar alternative to the sa2bed per read csv. Every offset is an absolute
+byte offset into the file and every column and table starts on an 8 byte boundary.
+
+  VariantCallFileHeader
+  row groups, each one column after another:
+    read rows:     uint32_t[num_rows]   row of the read id dictionary
+    contig rows:   uint32_t[num_rows]   row of the contig dictionary
+    positions:     uint64_t[num_rows]   reference index
+    strands:       char[num_rows]       '+' or '-'
+    variant rows:  uint32_t[num_rows]   row of the variant dictionary, eg. "CE"
+    probabilities: float[num_rows * max_n_variants]   normalized probabilities, NaN past the variant's bases
+  VariantCallFileFooter
+  row group table: VariantCallRowGroupRecord[num_row_groups]
+  read id table:   VariantCallStringRecord[num_read_ids]
+  contig table:    VariantCallStringRecord[num_contigs]
+  variant table:   VariantCallStringRecord[num_variants]
+  string pool:     every dictionary string
+  VariantCallFileTrailer
+*/
+
+const char VARIANT_CALL_FILE_MAGIC[8] = {'E', 'M', 'B', 'E', 'D', 'V', 'C', '1'};
+const uint64_t VARIANT_CALL_FILE_VERSION = 1;
+
+struct VariantCallFileHeader {
+  char magic[8];
+  uint64_t version;
+  uint64_t max_n_variants;
+  uint64_t reserved;
+};
+
+struct VariantCallFileFooter {
+  uint64_t num_rows;
+  uint64_t num_row_groups;
+  uint64_t row_group_table_offset;
+  uint64_t num_read_ids;
+  uint64_t read_id_table_offset;
+  uint64_t num_contigs;
+  uint64_t contig_table_offset;
+  uint64_t num_variants;
+  uint64_t variant_table_offset;
+  uint64_t string_pool_offset;
+  uint64_t string_pool_length;
+};
+
+/**
+@param first_row: row of the whole file the group starts at
+@param num_rows: number of calls in the group
+*/
+struct VariantCallRowGroupRecord {
+  uint64_t first_row;
+  uint64_t num_rows;
+  uint64_t read_row_offset;
+  uint64_t contig_row_offset;
+  uint64_t position_offset;
+  uint64_t strand_offset;
+  uint64_t variant_row_offset;
+  uint64_t probability_offset;
+};
+
+/**
+@param offset: absolute offset of the string in the string pool
+*/
+struct VariantCallStringRecord {
+  uint64_t offset;
+  uint64_t length;
+};
+
+struct VariantCallFileTrailer {
+  uint64_t footer_offset;
+  char magic[8];
+};
+
+inline bool is_variant_call_file_magic(const char* magic){
+  return std::memcmp(magic, VARIANT_CALL_FILE_MAGIC, sizeof(VARIANT_CALL_FILE_MAGIC)) == 0;
+}
+
+/**
+Calls as columns, one entry per call. The probabilities of row i are
+[i * max_n_variants, (i + 1) * max_n_variants) in probabilities.
+*/
+struct VariantCallColumns {
+  uint64_t max_n_variants = 0;
+  std::vector<uint32_t> read_rows;
+  std::vector<uint32_t> contig_rows;
+  std::vector<uint64_t> positions;
+  std::vector<char> strands;
+  std::vector<uint32_t> variant_rows;
+  std::vector<float> probabilities;
+
+  uint64_t num_rows() const {
+    return positions.size();
+  }
+
+  void clear(){
+    read_rows.clear();
+    contig_rows.clear();
+    positions.clear();
+    strands.clear();
+    variant_rows.clear();
+    probabilities.clear();
+  }
+
+  void resize(uint64_t num_rows){
+    read_rows.resize(num_rows);
+    contig_rows.resize(num_rows);
+    positions.resize(num_rows);
+    strands.resize(num_rows);
+    variant_rows.resize(num_rows);
+    probabilities.resize(num_rows * max_n_variants);
+  }
+};
+
+#endif //EMBED_FAST5_SRC_VARIANTCALLFILEFORMAT_HPP_
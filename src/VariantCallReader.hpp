@@ -0,0 +1,193 @@
+#ifndef EMBED_FAST5_SRC_VARIANTCALLREADER_HPP_
+#define EMBED_FAST5_SRC_VARIANTCALLREADER_HPP_
+
+// embed libs
+#include "BinaryIO.hpp"
+#include "EmbedUtils.hpp"
+#include "VariantCallFileFormat.hpp"
+// std libs
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace embed_utils;
+
+/**
+Reads the binary per read variant call files written by VariantCallWriter. The dictionaries are read when the file
+is opened, row groups are read on request straight into VariantCallColumns.
+
+@param file_path: path to variant call file
+*/
+class VariantCallReader {
+ public:
+  explicit VariantCallReader(const string& file_path) : file_path(file_path) {
+    this->file_descriptor = ::open(file_path.c_str(), O_RDONLY);
+    throw_assert(this->file_descriptor != -1, "ERROR: could not read " + file_path)
+    try {
+      this->file_length = lseek(this->file_descriptor, 0, SEEK_END);
+      this->read_footer();
+    } catch (...) {
+//      the destructor does not run when the constructor throws
+      ::close(this->file_descriptor);
+      throw;
+    }
+  }
+  VariantCallReader(const VariantCallReader&) = delete;
+  VariantCallReader& operator=(const VariantCallReader&) = delete;
+
+  ~VariantCallReader() {
+    if (this->file_descriptor >= 0){
+      ::close(this->file_descriptor);
+    }
+  }
+
+  uint64_t num_rows() const {
+    return footer.num_rows;
+  }
+
+  uint64_t num_row_groups() const {
+    return row_groups.size();
+  }
+
+  uint64_t max_n_variants() const {
+    return header.max_n_variants;
+  }
+
+  const vector<string>& get_read_ids() const {
+    return read_ids;
+  }
+
+  const vector<string>& get_contigs() const {
+    return contigs;
+  }
+
+  const vector<string>& get_variants() const {
+    return variants;
+  }
+
+  const VariantCallRowGroupRecord& get_row_group(uint64_t row_group) const {
+    throw_assert(row_group < row_groups.size(), "ERROR: row group " + to_string(row_group) +
+        " is past the end of " + file_path)
+    return row_groups[row_group];
+  }
+
+  /**
+  Append the calls of one row group to columns
+  */
+  void read_row_group(uint64_t row_group, VariantCallColumns& columns) const {
+    const VariantCallRowGroupRecord& record = this->get_row_group(row_group);
+    columns.max_n_variants = header.max_n_variants;
+    uint64_t start = columns.num_rows();
+    columns.resize(start + record.num_rows);
+    this->read_column(record.read_row_offset, columns.read_rows, start, record.num_rows);
+    this->read_column(record.contig_row_offset, columns.contig_rows, start, record.num_rows);
+    this->read_column(record.position_offset, columns.positions, start, record.num_rows);
+    this->read_column(record.strand_offset, columns.strands, start, record.num_rows);
+    this->read_column(record.variant_row_offset, columns.variant_rows, start, record.num_rows);
+    this->read_column(record.probability_offset, columns.probabilities, start * header.max_n_variants,
+                      record.num_rows * header.max_n_variants);
+    for (uint64_t i = start; i < columns.num_rows(); ++i){
+      throw_assert(columns.read_rows[i] < read_ids.size() and columns.contig_rows[i] < contigs.size() and
+                       columns.variant_rows[i] < variants.size(),
+                   "ERROR: dictionary row is past the end of the dictionary in " + file_path)
+    }
+  }
+
+  /**
+  Read every row group into columns, replacing what was there
+  */
+  void read_all(VariantCallColumns& columns) const {
+    columns.clear();
+    columns.max_n_variants = header.max_n_variants;
+    columns.read_rows.reserve(footer.num_rows);
+    columns.contig_rows.reserve(footer.num_rows);
+    columns.positions.reserve(footer.num_rows);
+    columns.strands.reserve(footer.num_rows);
+    columns.variant_rows.reserve(footer.num_rows);
+    columns.probabilities.reserve(footer.num_rows * header.max_n_variants);
+    for (uint64_t i = 0; i < row_groups.size(); ++i){
+      this->read_row_group(i, columns);
+    }
+  }
+
+ private:
+  string file_path;
+  int file_descriptor = -1;
+  off_t file_length = 0;
+  VariantCallFileHeader header{};
+  VariantCallFileFooter footer{};
+  vector<VariantCallRowGroupRecord> row_groups;
+  vector<string> read_ids;
+  vector<string> contigs;
+  vector<string> variants;
+
+  bool in_file(uint64_t offset, uint64_t num_rows, uint64_t row_size) const {
+    auto end = (uint64_t) file_length;
+    return offset <= end and (row_size == 0 or num_rows <= (end - offset) / row_size);
+  }
+
+  template<class T>
+  void read_table(uint64_t offset, uint64_t num_rows, vector<T>& table) const {
+    throw_assert(in_file(offset, num_rows, sizeof(T)), "ERROR: table is past the end of " + file_path)
+    table.resize(num_rows);
+    auto byte_index = (off_t) offset;
+    pread_bytes(file_descriptor, reinterpret_cast<char*>(table.data()), num_rows * sizeof(T), byte_index);
+  }
+
+  template<class T>
+  void read_column(uint64_t offset, vector<T>& column, uint64_t start, uint64_t num_rows) const {
+    throw_assert(in_file(offset, num_rows, sizeof(T)), "ERROR: column is past the end of " + file_path)
+    auto byte_index = (off_t) offset;
+    pread_bytes(file_descriptor, reinterpret_cast<char*>(column.data() + start), num_rows * sizeof(T), byte_index);
+  }
+
+  void read_strings(uint64_t offset, uint64_t num_rows, const string& string_pool, vector<string>& dictionary){
+    vector<VariantCallStringRecord> table;
+    this->read_table(offset, num_rows, table);
+    dictionary.reserve(num_rows);
+    for (auto &record: table){
+      throw_assert(record.offset >= footer.string_pool_offset and
+                       record.offset - footer.string_pool_offset <= string_pool.size() and
+                       record.length <= string_pool.size() - (record.offset - footer.string_pool_offset),
+                   "ERROR: string is past the end of the string pool in " + file_path)
+      dictionary.emplace_back(string_pool, record.offset - footer.string_pool_offset, record.length);
+    }
+  }
+
+  void read_footer(){
+    throw_assert(file_length >= off_t(sizeof(VariantCallFileHeader) + sizeof(VariantCallFileTrailer)),
+                 "ERROR: variant call file is too short: " + file_path)
+    off_t byte_index = 0;
+    pread_bytes(file_descriptor, reinterpret_cast<char*>(&header), sizeof(header), byte_index);
+    throw_assert(is_variant_call_file_magic(header.magic), "ERROR: corrupt header in variant call file: " + file_path)
+    throw_assert(header.version == VARIANT_CALL_FILE_VERSION,
+                 "ERROR: unsupported variant call file version " + to_string(header.version) + ": " + file_path)
+    VariantCallFileTrailer trailer{};
+    byte_index = file_length - sizeof(VariantCallFileTrailer);
+    pread_bytes(file_descriptor, reinterpret_cast<char*>(&trailer), sizeof(trailer), byte_index);
+    throw_assert(is_variant_call_file_magic(trailer.magic) and
+                     trailer.footer_offset >= sizeof(VariantCallFileHeader) and
+                     in_file(trailer.footer_offset, 1, sizeof(VariantCallFileFooter)),
+                 "ERROR: corrupt trailer in variant call file: " + file_path)
+    byte_index = trailer.footer_offset;
+    pread_bytes(file_descriptor, reinterpret_cast<char*>(&footer), sizeof(footer), byte_index);
+    this->read_table(footer.row_group_table_offset, footer.num_row_groups, row_groups);
+    string string_pool;
+    throw_assert(in_file(footer.string_pool_offset, footer.string_pool_length, 1),
+                 "ERROR: string pool is past the end of " + file_path)
+    string_pool.resize(footer.string_pool_length);
+    byte_index = footer.string_pool_offset;
+    pread_bytes(file_descriptor, &string_pool[0], string_pool.size(), byte_index);
+    this->read_strings(footer.read_id_table_offset, footer.num_read_ids, string_pool, read_ids);
+    this->read_strings(footer.contig_table_offset, footer.num_contigs, string_pool, contigs);
+    this->read_strings(footer.variant_table_offset, footer.num_variants, string_pool, variants);
+    uint64_t num_rows = 0;
+    for (auto &record: row_groups){
+      throw_assert(record.first_row == num_rows, "ERROR: row groups are out of order in " + file_path)
+      num_rows += record.num_rows;
+    }
+    throw_assert(num_rows == footer.num_rows, "ERROR: row groups do not add up to the number of rows in " + file_path)
+  }
+};
+
+#endif //EMBED_FAST5_SRC_VARIANTCALLREADER_HPP_
@@ -0,0 +1,212 @@
+#ifndef EMBED_FAST5_SRC_VARIANTCALLWRITER_HPP_
+#define EMBED_FAST5_SRC_VARIANTCALLWRITER_HPP_
+
+// embed libs
+#include "BinaryIO.hpp"
+#include "EmbedUtils.hpp"
+#include "VariantCall.hpp"
+#include "VariantCallFileFormat.hpp"
+// boost libs
+#include <boost/filesystem.hpp>
+// std libs
+#include <fstream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace embed_utils;
+using namespace boost::filesystem;
+
+/**
+Writes per read variant calls to the binary columnar file described in VariantCallFileFormat.hpp.
+Calls are buffered as columns and written as a row group every row_group_size calls, read ids, contigs and variant
+bases are written once each in dictionaries after the last row group.
+
+@param file_path: path to output file
+@param max_n_variants: the max number of variants at a position, the width of the probability column
+@param row_group_size: number of calls in each row group
+*/
+class VariantCallWriter {
+ public:
+  static const uint64_t DEFAULT_ROW_GROUP_SIZE = 1 << 16;
+
+  VariantCallWriter(const path& file_path, uint64_t max_n_variants,
+                    uint64_t row_group_size=DEFAULT_ROW_GROUP_SIZE) :
+      file_path(file_path), row_group_size(std::max(row_group_size, (uint64_t) 1)) {
+    throw_assert(max_n_variants > 0, "max_n_variants must be greater than 0")
+    group.max_n_variants = max_n_variants;
+    this->file = std::ofstream(file_path.c_str(), std::ofstream::binary);
+    throw_assert(this->file.is_open(), "ERROR: could not open file " + file_path.string())
+    VariantCallFileHeader header{};
+    std::memcpy(header.magic, VARIANT_CALL_FILE_MAGIC, sizeof(VARIANT_CALL_FILE_MAGIC));
+    header.version = VARIANT_CALL_FILE_VERSION;
+    header.max_n_variants = max_n_variants;
+    write_value_to_binary(this->file, header);
+  }
+  VariantCallWriter(const VariantCallWriter&) = delete;
+  VariantCallWriter& operator=(const VariantCallWriter&) = delete;
+
+  ~VariantCallWriter() {
+    try {
+      this->close();
+    } catch (...) {
+      cerr << "Failed to close " << file_path.string() << "\n";
+    }
+  }
+
+  /**
+  Add every call of a read
+  */
+  void add_read(const string& read_id, const vector<VariantCall>& calls){
+    if (calls.empty()){
+      return;
+    }
+    uint32_t read_row = dictionary_row(read_id_rows, read_ids, read_id);
+    for (auto &call: calls){
+      throw_assert(call.normalized_probs.size() <= group.max_n_variants,
+                   "Variant call has more probabilities than max_n_variants: " + call.bases)
+      group.read_rows.push_back(read_row);
+      group.contig_rows.push_back(dictionary_row(contig_rows, contigs, call.contig));
+      group.positions.push_back(call.reference_index);
+      group.strands.push_back(call.strand.empty() ? '.' : call.strand[0]);
+      group.variant_rows.push_back(dictionary_row(variant_rows, variants, call.bases));
+      for (auto &prob: call.normalized_probs){
+        group.probabilities.push_back((float) prob);
+      }
+      group.probabilities.resize(group.num_rows() * group.max_n_variants, std::numeric_limits<float>::quiet_NaN());
+      if (group.num_rows() >= row_group_size){
+        this->write_row_group();
+      }
+    }
+  }
+
+  /**
+  Write the last row group, the dictionaries and the footer
+  */
+  void close(){
+    if (closed){
+      return;
+    }
+    closed = true;
+    this->write_row_group();
+    VariantCallFileFooter footer{};
+    uint64_t footer_offset = this->file.tellp();
+    footer.num_rows = num_rows_written;
+    footer.num_row_groups = row_groups.size();
+    footer.row_group_table_offset = footer_offset + sizeof(VariantCallFileFooter);
+    string string_pool;
+    vector<VariantCallStringRecord> read_id_table = string_table(read_ids, string_pool);
+    vector<VariantCallStringRecord> contig_table = string_table(contigs, string_pool);
+    vector<VariantCallStringRecord> variant_table = string_table(variants, string_pool);
+    footer.num_read_ids = read_id_table.size();
+    footer.read_id_table_offset = footer.row_group_table_offset + row_groups.size() * sizeof(VariantCallRowGroupRecord);
+    footer.num_contigs = contig_table.size();
+    footer.contig_table_offset = footer.read_id_table_offset + read_id_table.size() * sizeof(VariantCallStringRecord);
+    footer.num_variants = variant_table.size();
+    footer.variant_table_offset = footer.contig_table_offset + contig_table.size() * sizeof(VariantCallStringRecord);
+    footer.string_pool_offset = footer.variant_table_offset + variant_table.size() * sizeof(VariantCallStringRecord);
+    string_pool.resize((string_pool.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t), '\0');
+    footer.string_pool_length = string_pool.size();
+    for (auto &table: {&read_id_table, &contig_table, &variant_table}){
+      for (auto &record: *table){
+        record.offset += footer.string_pool_offset;
+      }
+    }
+    write_value_to_binary(this->file, footer);
+    write_vector_to_binary(this->file, row_groups);
+    write_vector_to_binary(this->file, read_id_table);
+    write_vector_to_binary(this->file, contig_table);
+    write_vector_to_binary(this->file, variant_table);
+    write_string_to_binary(this->file, string_pool);
+    VariantCallFileTrailer trailer{};
+    trailer.footer_offset = footer_offset;
+    std::memcpy(trailer.magic, VARIANT_CALL_FILE_MAGIC, sizeof(VARIANT_CALL_FILE_MAGIC));
+    write_value_to_binary(this->file, trailer);
+    this->file.close();
+    throw_assert(!this->file.fail(), "ERROR: failed writing " + file_path.string())
+  }
+
+  uint64_t num_rows() const {
+    return num_rows_written + group.num_rows();
+  }
+
+ private:
+  path file_path;
+  uint64_t row_group_size;
+  std::ofstream file;
+  bool closed = false;
+  uint64_t num_rows_written = 0;
+  VariantCallColumns group;
+  vector<VariantCallRowGroupRecord> row_groups;
+  vector<string> read_ids;
+  vector<string> contigs;
+  vector<string> variants;
+  unordered_map<string, uint32_t> read_id_rows;
+  unordered_map<string, uint32_t> contig_rows;
+  unordered_map<string, uint32_t> variant_rows;
+
+  static uint32_t dictionary_row(unordered_map<string, uint32_t>& rows, vector<string>& dictionary,
+                                 const string& value){
+    auto found = rows.find(value);
+    if (found != rows.end()){
+      return found->second;
+    }
+    throw_assert(dictionary.size() < std::numeric_limits<uint32_t>::max(), "Too many dictionary entries: " + value)
+    auto row = (uint32_t) dictionary.size();
+    rows.emplace(value, row);
+    dictionary.push_back(value);
+    return row;
+  }
+
+  /**
+  Append every string to the pool and return their records with offsets relative to the start of the pool
+  */
+  static vector<VariantCallStringRecord> string_table(const vector<string>& dictionary, string& string_pool){
+    vector<VariantCallStringRecord> table;
+    table.reserve(dictionary.size());
+    for (auto &value: dictionary){
+      table.push_back({string_pool.size(), value.size()});
+      string_pool += value;
+    }
+    return table;
+  }
+
+  void write_padding(){
+    uint64_t remainder = uint64_t(this->file.tellp()) % sizeof(uint64_t);
+    if (remainder != 0){
+      string padding(sizeof(uint64_t) - remainder, '\0');
+      write_string_to_binary(this->file, padding);
+    }
+  }
+
+  template<class T>
+  uint64_t write_column(const vector<T>& column){
+    this->write_padding();
+    uint64_t offset = this->file.tellp();
+    write_vector_to_binary(this->file, column);
+    return offset;
+  }
+
+  void write_row_group(){
+    if (group.num_rows() == 0){
+      return;
+    }
+    VariantCallRowGroupRecord record{};
+    record.first_row = num_rows_written;
+    record.num_rows = group.num_rows();
+    record.read_row_offset = this->write_column(group.read_rows);
+    record.contig_row_offset = this->write_column(group.contig_rows);
+    record.position_offset = this->write_column(group.positions);
+    record.strand_offset = this->write_column(group.strands);
+    record.variant_row_offset = this->write_column(group.variant_rows);
+    record.probability_offset = this->write_column(group.probabilities);
+    this->write_padding();
+    row_groups.push_back(record);
+    num_rows_written += group.num_rows();
+    group.clear();
+  }
+};
+
+#endif //EMBED_FAST5_SRC_VARIANTCALLWRITER_HPP_
@@ -11,15 +11,52 @@
 
 #include "LoadVariantPaths.hpp"
 #include "TopKmers.hpp"
+#include "VariantCallReader.hpp"
 
 using namespace pybind11;
 
+/**
+Numpy view of a column owned by the capsule, no data is copied
+*/
+template<class T>
+array_t<T> column_view(vector<T>& column, const capsule& owner, vector<ssize_t> shape){
+  vector<ssize_t> strides(shape.size(), sizeof(T));
+  for (int64_t i = (int64_t) shape.size() - 2; i >= 0; --i){
+    strides[i] = strides[i + 1] * shape[i + 1];
+  }
+  return array_t<T>(shape, strides, column.data(), owner);
+}
+
+/**
+Read every row group of a binary variant call file into numpy arrays which share memory with the loaded columns
+*/
+dict read_variant_call_columns(const VariantCallReader& reader){
+  auto columns = new VariantCallColumns();
+  try {
+    reader.read_all(*columns);
+  } catch (...) {
+    delete columns;
+    throw;
+  }
+  capsule owner(columns, [](void* data){ delete reinterpret_cast<VariantCallColumns*>(data); });
+  auto num_rows = (ssize_t) columns->num_rows();
+  dict out;
+  out["read_id"] = column_view(columns->read_rows, owner, {num_rows});
+  out["contig"] = column_view(columns->contig_rows, owner, {num_rows});
+  out["position"] = column_view(columns->positions, owner, {num_rows});
+  out["strand"] = array(dtype("S1"), {num_rows}, {(ssize_t) sizeof(char)}, columns->strands.data(), owner);
+  out["variant"] = column_view(columns->variant_rows, owner, {num_rows});
+  out["probabilities"] = column_view(columns->probabilities, owner, {num_rows, (ssize_t) columns->max_n_variants});
+  return out;
+}
+
 
 PYBIND11_MODULE(bindings, module) {
   module.doc() = R"pbdoc(
         Embed Wrappers:
         - LoadVariantPaths
         - generate_master_kmer_table
+        - VariantCallReader
     )pbdoc";
 
   class_<LoadVariantPaths>(module, "LoadVariantPaths")
@@ -39,6 +76,26 @@ PYBIND11_MODULE(bindings, module) {
            pybind11::arg("output_path"))
            ;
 
+  class_<VariantCallReader>(module, "VariantCallReader")
+      .def(init<const std::string &>(),
+          "Open a binary per read variant call file written by sa2bed --binary",
+          pybind11::arg("file_path"))
+      .def_property_readonly("num_rows", &VariantCallReader::num_rows)
+      .def_property_readonly("num_row_groups", &VariantCallReader::num_row_groups)
+      .def_property_readonly("max_n_variants", &VariantCallReader::max_n_variants)
+      .def_property_readonly("read_ids", &VariantCallReader::get_read_ids,
+          "read id of each row of the read_id column")
+      .def_property_readonly("contigs", &VariantCallReader::get_contigs,
+          "contig of each row of the contig column")
+      .def_property_readonly("variants", &VariantCallReader::get_variants,
+          "variant bases of each row of the variant column")
+      .def("read_columns",
+          &read_variant_call_columns,
+          R"pbdoc(
+  - Read every call into a dict of numpy arrays: read_id, contig, position, strand, variant and probabilities
+    (num_rows x max_n_variants, NaN past the number of variant bases). The arrays share memory with the loaded columns.
+    )pbdoc");
+
   module.def("generate_master_kmer_table", &generate_master_kmer_table_wrapper, R"pbdoc(
   - Generate the master assignment table by parsing assignment files and outputting the top n kmers to a files
  @param event_table_files: vector of strings of files
@@ -49,6 +106,7 @@ PYBIND11_MODULE(bindings, module) {
  @param n_threads: set number of threads to use: default 2
  @param verbose: print out files as they are being processed
  @param full: boolean option to write out full signalalign output or assignments file format
+ @param memory_report: seconds between memory reports written to stderr (0 never reports)
 
     )pbdoc",
     pybind11::arg("event_table_files"),
@@ -59,7 +117,8 @@ PYBIND11_MODULE(bindings, module) {
     pybind11::arg("min_prob") = 0.0,
     pybind11::arg("n_threads") = 2,
     pybind11::arg("verbose") = false,
-    pybind11::arg("full") = true);
+    pybind11::arg("full") = true,
+    pybind11::arg("memory_report") = 0);
 
 #ifdef VERSION_INFO
   module.attr("__version__") = VERSION_INFO;
@@ -14,6 +14,8 @@
 #include "SignalAlignToBed.hpp"
 #include "SplitByRefPosition.hpp"
 #include "PositionsKmerDistributions.hpp"
+#include "QueryRegion.hpp"
+#include "MergeEvents.hpp"
 #include "nanopolish_squiggle_read.h"
 #include "nanopolish_index.h"
 #include "nanopolish_extract.h"
@@ -37,6 +39,8 @@ static std::map< std::string, std::function<int(int, char**)> > programs = {
     {"top_kmers",                top_kmers_main},
     {"split_by_position",        split_by_ref_main},
     {"kmer_distributions",       get_kmer_distributions_main},
+    {"query_region",             query_region_main},
+    {"merge_events",             merge_events_main},
     {"sa2bed",                   sa2bed_main}
 };
 
@@ -13,11 +13,15 @@
 // gtest
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+// std
+#include <chrono>
 
 using namespace boost::filesystem;
 using namespace std;
 using namespace embed_utils;
 using namespace test_files;
+using ::testing::UnorderedElementsAre;
+using ::testing::UnorderedElementsAreArray;
 
 
 TEST (BaseKmerTests, test_Event) {
@@ -47,6 +51,98 @@ TEST (BaseKmerTests, test_PosKmer) {
   EXPECT_EQ(2, k2.num_events());
 }
 
+TEST (BaseKmerTests, test_PosKmer_bulk) {
+  Redirect a(true, true);
+  PosKmer heap_kmer("ATGCC", 3);
+  PosKmer bulk_kmer("ATGCC", 3, 2);
+  int64_t heap_stored = 0;
+  int64_t bulk_stored = 0;
+  for (uint64_t i = 0; i < 20; ++i){
+    float prob = (float) ((i * 7) % 20) / 20;
+    heap_stored += heap_kmer.add_event(i, prob);
+    bulk_stored += bulk_kmer.add_event(i, prob);
+  }
+//  add_event reports every change to the stored events, including compactions
+  EXPECT_EQ(3, heap_stored);
+  EXPECT_EQ((int64_t) bulk_kmer.events.size(), bulk_stored);
+  EXPECT_FALSE(bulk_kmer.finalized);
+  EXPECT_THROW(bulk_kmer.num_events(), AssertionFailureException);
+  bulk_kmer.finalize();
+  EXPECT_TRUE(bulk_kmer.finalized);
+  EXPECT_EQ(3, bulk_kmer.num_events());
+  EXPECT_EQ(17, bulk_kmer.num_ignored_kmers);
+  EXPECT_FLOAT_EQ(heap_kmer.events.front().posterior_probability, bulk_kmer.events.front().posterior_probability);
+  vector<float> heap_probs;
+  vector<float> bulk_probs;
+  for (auto &event: heap_kmer.events){
+    heap_probs.push_back(event.posterior_probability);
+  }
+  for (auto &event: bulk_kmer.events){
+    bulk_probs.push_back(event.posterior_probability);
+  }
+  ASSERT_THAT(bulk_probs, UnorderedElementsAreArray(heap_probs));
+  ASSERT_THAT(bulk_probs, UnorderedElementsAre(0.95f, 0.9f, 0.85f));
+//  finalize is idempotent and adding after finalize keeps the cap
+  bulk_kmer.finalize();
+  EXPECT_EQ(3, bulk_kmer.num_events());
+  bulk_kmer.add_event(100, 1.0);
+  bulk_kmer.finalize();
+  EXPECT_EQ(3, bulk_kmer.num_events());
+  EXPECT_FLOAT_EQ(0.9, bulk_kmer.events.front().posterior_probability);
+//  uncapped bulk mode keeps every event
+  PosKmer uncapped("ATGCC", 0, 4);
+  for (uint64_t i = 0; i < 20; ++i){
+    uncapped.add_event(i, 0.5);
+  }
+  uncapped.finalize();
+  EXPECT_EQ(20, uncapped.num_events());
+}
+
+TEST (BaseKmerTests, test_PosKmer_bulk_timing) {
+  Redirect a(true, true);
+//  the shape of a split_signal_align_by_ref_position run: every read adds one event to each position kmer it covers,
+//  so events reach thousands of kmers interleaved rather than one kmer at a time
+  uint64_t max_events = 100;
+  uint64_t num_pos_kmers = 10000;
+  uint64_t coverage = 1000;
+  vector<float> probs(num_pos_kmers * coverage);
+  uint64_t state = 12345;
+  for (auto &prob: probs){
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    prob = (float) (state >> 40) / (float) (1ULL << 24);
+  }
+  auto time_kmers = [&](vector<PosKmer>& kmers){
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t read = 0; read < coverage; ++read){
+      for (uint64_t i = 0; i < num_pos_kmers; ++i){
+        kmers[i].add_event((float) read, probs[read * num_pos_kmers + i]);
+      }
+    }
+    for (auto &kmer: kmers){
+      kmer.finalize();
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  };
+  vector<PosKmer> heap_kmers(num_pos_kmers, PosKmer("ATGCC", max_events));
+  vector<PosKmer> bulk_kmers(num_pos_kmers, PosKmer("ATGCC", max_events, 4));
+  auto heap_time = time_kmers(heap_kmers);
+  auto bulk_time = time_kmers(bulk_kmers);
+  RecordProperty("heap_us", (int) heap_time);
+  RecordProperty("bulk_us", (int) bulk_time);
+  for (uint64_t i = 0; i < num_pos_kmers; i += 997){
+    vector<float> heap_probs;
+    vector<float> bulk_probs;
+    for (auto &event: heap_kmers[i].events){
+      heap_probs.push_back(event.posterior_probability);
+    }
+    for (auto &event: bulk_kmers[i].events){
+      bulk_probs.push_back(event.posterior_probability);
+    }
+    ASSERT_THAT(bulk_probs, UnorderedElementsAreArray(heap_probs));
+    EXPECT_EQ(coverage - max_events, bulk_kmers[i].num_ignored_kmers);
+  }
+}
+
 TEST (BaseKmerTests, test_PosKmer_kde) {
   Redirect a(true, true);
   PosKmer k("ATGCC");
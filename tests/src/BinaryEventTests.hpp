@@ -7,6 +7,9 @@
 
 // embed source
 #include "BinaryEventReader.hpp"
+#include "EventCodec.hpp"
+#include "QueryRegion.hpp"
+#include "MergeEvents.hpp"
 #include "TestFiles.hpp"
 //boost
 #include <boost/filesystem.hpp>
@@ -18,6 +21,7 @@ using namespace boost::filesystem;
 using namespace std;
 using namespace embed_utils;
 using namespace test_files;
+using ::testing::ElementsAre;
 
 
 TEST (BinaryEventTests, test_read_and_write) {
@@ -48,6 +52,7 @@ TEST (BinaryEventTests, test_read_and_write) {
   bew.close();
   string contig_strand = "asd+t";
   BinaryEventReader ber(test_file.string());
+  ber.load_indexes();
   EXPECT_EQ("ACGT", ber.alphabet_string);
   ASSERT_THAT(alphabet, ElementsAreArray(ber.alphabet));
   EXPECT_EQ(5, ber.kmer_length);
@@ -100,11 +105,420 @@ TEST (BinaryEventTests, test_create_kmer_map) {
   bew.close();
   string contig_strand = "asd+t";
   BinaryEventReader ber(test_file.string());
+  ber.load_indexes();
   EXPECT_EQ(2, ber.kmer_map.get_kmer_index(kmer).kmer_index_ptrs.size());
   Kmer kmer_struct("ATGCC");
   ber.populate_kmer(kmer_struct);
   EXPECT_EQ(2, kmer_struct.pos_kmer_map.size());
 }
 
+TEST (BinaryEventTests, test_corrupt_index) {
+  Redirect a(true, true);
+  path test_file = temp_directory_path() / "test_corrupt.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+//  index start points past the end of the file
+  std::ofstream file_handle = std::ofstream(test_file.string(), std::ofstream::binary);
+  write_value_to_binary(file_handle, (uint64_t) 1000);
+  file_handle.close();
+  EXPECT_THROW(BinaryEventReader ber(test_file.string()), AssertionFailureException);
+//  index is cut short
+  file_handle = std::ofstream(test_file.string(), std::ofstream::binary);
+  write_value_to_binary(file_handle, (uint64_t) 5);
+  write_value_to_binary(file_handle, (uint64_t) 0);
+  file_handle.close();
+  EXPECT_THROW(BinaryEventReader ber(test_file.string()), runtime_error);
+}
+
+/**
+Write the same two contig strands to an event file
+*/
+void write_test_event_file(const path& test_file, uint64_t version, bool compress=false, bool kmer_major=false){
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  ContigStrand cs("asd", "+", 10, "t");
+  ContigStrand cs2("abc", "-", 20, "c");
+  vector<string> kmers{"ATGCC", "TTTTT", "AAAAA"};
+  for (uint64_t pos = 0; pos < 10; pos += 3){
+    for (uint64_t i = 0; i < kmers.size(); ++i){
+      shared_ptr<PosKmer> k = make_shared<PosKmer>(kmers[i], 3);
+      k->add_event(pos + i, 0.1 * (i + 1));
+      k->add_event(pos + i + 0.5, 0.05);
+      cs.add_kmer(pos, k);
+      shared_ptr<PosKmer> k2 = make_shared<PosKmer>(kmers[i], 3);
+      k2->add_event(2 * pos + i, 0.2);
+      cs2.add_kmer(2 * pos + 1, k2);
+    }
+  }
+  BinaryEventWriter bew(test_file, {'A', 'C', 'G', 'T'}, 5, true, true, version, compress, kmer_major);
+  bew.write_contig_strand(cs);
+  bew.write_contig_strand(cs2);
+  bew.write_indexes();
+  bew.close();
+}
+
+TEST (BinaryEventTests, test_flat_index) {
+  Redirect a(true, true);
+  path v1_file = temp_directory_path() / "test_v1.event";
+  path v2_file = temp_directory_path() / "test_v2.event";
+  write_test_event_file(v1_file, 1);
+  write_test_event_file(v2_file, 2);
+  BinaryEventReader v1(v1_file.string());
+  BinaryEventReader v2(v2_file.string());
+  EXPECT_EQ(1, v1.version);
+  EXPECT_EQ(2, v2.version);
+//  nothing is loaded onto the heap until a legacy index accessor is used
+  EXPECT_TRUE(v2.indexes.empty());
+  for (auto reader: {&v1, &v2}){
+    EXPECT_EQ("ACGT", reader->alphabet_string);
+    EXPECT_EQ(5, reader->kmer_length);
+    EXPECT_TRUE(reader->rna);
+    EXPECT_TRUE(reader->two_d);
+    EXPECT_TRUE(reader->has_kmer_index("TTTTT"));
+    EXPECT_FALSE(reader->has_kmer_index("GGGGG"));
+    EXPECT_FALSE(reader->has_kmer_index("NNNNN"));
+    EXPECT_EQ(8, reader->num_kmer_positions("ATGCC"));
+    EXPECT_THROW(reader->get_position_kmer("ATGCC", "asd", "+", 1, "t"), runtime_error);
+    EXPECT_THROW(reader->get_position_kmer("GGGGG", "asd", "+", 3, "t"), runtime_error);
+    EXPECT_THROW(reader->get_position_kmer("ATGCC", "asd", "-", 3, "t"), runtime_error);
+    EXPECT_THROW(reader->get_position_kmer("ATGCC", "abcd", "-", 3, "c"), runtime_error);
+  }
+  for (uint64_t pos = 0; pos < 10; pos += 3){
+    Position p1(pos);
+    Position p2(pos);
+    v1.get_position(p1, "asd", "+", pos, "t");
+    v2.get_position(p2, "asd", "+", pos, "t");
+    EXPECT_TRUE(p2.populated);
+    ASSERT_THAT(p2.get_kmer_strings(), UnorderedElementsAreArray(p1.get_kmer_strings()));
+    for (auto &kmer: p1.get_kmer_strings()){
+      EXPECT_THAT(p2.get_pos_kmer(kmer)->events, ElementsAreArray(p1.get_pos_kmer(kmer)->events));
+      shared_ptr<PosKmer> k = v2.get_position_kmer(kmer, "abc", "-", 2 * pos + 1, "c");
+      EXPECT_EQ(kmer, k->kmer);
+      EXPECT_THAT(k->events, ElementsAreArray(v1.get_position_kmer(kmer, "abc", "-", 2 * pos + 1, "c")->events));
+    }
+  }
+  Kmer k1("AAAAA");
+  Kmer k2("AAAAA");
+  v1.populate_kmer(k1);
+  v2.populate_kmer(k2);
+  EXPECT_EQ(8, k2.pos_kmer_map.size());
+  for (auto &pos_kmer: k1.pos_kmer_map){
+    ASSERT_TRUE(k2.pos_kmer_map.find(pos_kmer.first) != k2.pos_kmer_map.end());
+    EXPECT_THAT(k2.pos_kmer_map[pos_kmer.first]->events, ElementsAreArray(pos_kmer.second->events));
+  }
+//  legacy indexes match the version 1 indexes
+  EXPECT_EQ(3, v2.get_position_index("asd", "+", "t", 3).get_kmers().size());
+  EXPECT_FALSE(v2.indexes.empty());
+  ASSERT_EQ(v1.indexes.size(), v2.indexes.size());
+  for (auto &cs_pair: v1.indexes){
+    ContigStrandIndex& csi = v2.indexes.at(cs_pair.first);
+    EXPECT_EQ(cs_pair.second.num_positions, csi.num_positions);
+    EXPECT_EQ(cs_pair.second.num_written_positions, csi.num_written_positions);
+    EXPECT_EQ(cs_pair.second.position_indexes.size(), csi.position_indexes.size());
+  }
+  EXPECT_EQ(8, v2.get_kmer_index("ATGCC").positions.size());
+}
+
+TEST (BinaryEventTests, test_flat_index_duplicate_position) {
+  Redirect a(true, true);
+  path test_file = temp_directory_path() / "test_duplicate.event";
+  shared_ptr<PosKmer> k = make_shared<PosKmer>("ATGCC", 2);
+  k->add_event(1, 1);
+  Position position(1);
+  position.add_kmer(k);
+  BinaryEventWriter bew(test_file, {'A', 'C', 'G', 'T'}, 5, false, false);
+  bew.write_position("asd", "+", "t", 10, position);
+  bew.write_position("asd", "+", "t", 10, position);
+  EXPECT_THROW(bew.write_indexes(), AssertionFailureException);
+}
+
+TEST (BinaryEventTests, test_corrupt_flat_index) {
+  Redirect a(true, true);
+  path test_file = temp_directory_path() / "test_corrupt_v2.event";
+  write_test_event_file(test_file, 2);
+  uint64_t length = file_size(test_file);
+//  footer offset points past the tables
+  std::fstream file_handle(test_file.string(), std::ios::binary | std::ios::in | std::ios::out);
+  file_handle.seekp(length - sizeof(EventFileTrailer));
+  write_value_to_binary(file_handle, length);
+  file_handle.close();
+  EXPECT_THROW(BinaryEventReader ber(test_file.string()), AssertionFailureException);
+//  unknown version
+  write_test_event_file(test_file, 2);
+  file_handle.open(test_file.string(), std::ios::binary | std::ios::in | std::ios::out);
+  file_handle.seekp(sizeof(EVENT_FILE_MAGIC));
+  write_value_to_binary(file_handle, (uint64_t) 3);
+  file_handle.close();
+  EXPECT_THROW(BinaryEventReader ber(test_file.string()), AssertionFailureException);
+}
+
+TEST (BinaryEventTests, test_event_codec) {
+  Redirect a(true, true);
+  vector<Event> events;
+  for (uint64_t i = 0; i < 1000; ++i){
+    events.emplace_back(80 + (i % 37) * 0.37, (i % 101) / 100.0);
+  }
+  string block;
+  encode_event_block(events, block);
+  EXPECT_EQ(EVENT_BLOCK_DEFLATED, (uint8_t) block[0]);
+  EXPECT_LT(block.size(), events.size() * sizeof(Event) / 4);
+  vector<Event> decoded;
+  decode_event_block(block.data(), block.size(), events.size(), decoded);
+  ASSERT_EQ(events.size(), decoded.size());
+  for (uint64_t i = 0; i < events.size(); ++i){
+    EXPECT_NEAR(events[i].descaled_event_mean, decoded[i].descaled_event_mean, 0.0051);
+    EXPECT_NEAR(events[i].posterior_probability, decoded[i].posterior_probability, 1.0 / 65535);
+  }
+//  a single event does not deflate
+  vector<Event> one{Event(100.256, 0.5)};
+  encode_event_block(one, block);
+  EXPECT_EQ(EVENT_BLOCK_SHUFFLED, (uint8_t) block[0]);
+  EXPECT_EQ(5, block.size());
+  decode_event_block(block.data(), block.size(), 1, decoded);
+  EXPECT_FLOAT_EQ(100.26, decoded[0].descaled_event_mean);
+//  means outside of the int16 range are kept as raw floats
+  one[0].descaled_event_mean = 1000;
+  encode_event_block(one, block);
+  EXPECT_EQ(EVENT_BLOCK_RAW, (uint8_t) block[0]);
+  decode_event_block(block.data(), block.size(), 1, decoded);
+  EXPECT_EQ(one[0], decoded[0]);
+  EXPECT_THROW(decode_event_block(block.data(), block.size(), 2, decoded), runtime_error);
+  block[0] = 7;
+  EXPECT_THROW(decode_event_block(block.data(), block.size(), 1, decoded), runtime_error);
+}
+
+TEST (BinaryEventTests, test_compressed_event_file) {
+  Redirect a(true, true);
+  path raw_file = temp_directory_path() / "test_raw.event";
+  path compressed_file = temp_directory_path() / "test_compressed.event";
+  write_test_event_file(raw_file, 2);
+  write_test_event_file(compressed_file, 2, true);
+  vector<string> kmers{"ATGCC", "TTTTT", "AAAAA"};
+  EXPECT_THROW(BinaryEventWriter(compressed_file, {'A', 'C', 'G', 'T'}, 5, true, true, 1, true),
+               AssertionFailureException);
+
+  BinaryEventReader raw(raw_file.string());
+  BinaryEventReader compressed(compressed_file.string());
+  EXPECT_TRUE(compressed.compressed);
+  for (uint64_t pos = 0; pos < 10; pos += 3){
+    for (auto &kmer: kmers){
+      vector<Event> expected = raw.get_position_kmer(kmer, "asd", "+", pos, "t")->events;
+      vector<Event> events = compressed.get_position_kmer(kmer, "asd", "+", pos, "t")->events;
+      ASSERT_EQ(expected.size(), events.size());
+      for (uint64_t i = 0; i < events.size(); ++i){
+        EXPECT_NEAR(expected[i].descaled_event_mean, events[i].descaled_event_mean, 0.0051);
+        EXPECT_NEAR(expected[i].posterior_probability, events[i].posterior_probability, 1.0 / 65535);
+      }
+    }
+  }
+//  the legacy index path decompresses too
+  compressed.load_indexes();
+  Kmer kmer_struct("AAAAA");
+  compressed.populate_kmer(kmer_struct);
+  EXPECT_EQ(8, kmer_struct.pos_kmer_map.size());
+  shared_ptr<PosKmer> k = make_shared<PosKmer>();
+  compressed.get_position_kmer(k, compressed.get_pos_kmer_index("abc", "-", "c", 7, "TTTTT"));
+  ASSERT_EQ(1, k->events.size());
+  EXPECT_NEAR(7, k->events[0].descaled_event_mean, 0.0051);
+}
+
+TEST (BinaryEventTests, test_kmer_major_event_file) {
+  Redirect a(true, true);
+  path position_major_file = temp_directory_path() / "test_position_major.event";
+  path kmer_major_file = temp_directory_path() / "test_kmer_major.event";
+  path compressed_file = temp_directory_path() / "test_kmer_major_compressed.event";
+  write_test_event_file(position_major_file, 2);
+  write_test_event_file(kmer_major_file, 2, false, true);
+  write_test_event_file(compressed_file, 2, true, true);
+  EXPECT_THROW(BinaryEventWriter(kmer_major_file, {'A', 'C', 'G', 'T'}, 5, true, true, 1, false, true),
+               AssertionFailureException);
+  write_test_event_file(kmer_major_file, 2, false, true);
+//  every payload is stored twice
+  uint64_t payload_bytes = (4 * 3 * 2 + 4 * 3) * sizeof(Event);
+  EXPECT_EQ(file_size(position_major_file) + payload_bytes + sizeof(EventFileKmerMajorFooter) +
+                (4 * 3 * 2 + 1) * sizeof(uint64_t),
+            file_size(kmer_major_file));
+
+  BinaryEventReader position_major(position_major_file.string());
+  BinaryEventReader kmer_major(kmer_major_file.string());
+  BinaryEventReader compressed(compressed_file.string());
+  EXPECT_FALSE(position_major.kmer_major);
+  EXPECT_TRUE(kmer_major.kmer_major);
+  EXPECT_TRUE(compressed.kmer_major);
+  for (auto &kmer: {"ATGCC", "TTTTT", "AAAAA"}){
+    Kmer expected(kmer);
+    position_major.populate_kmer(expected);
+    for (auto reader: {&kmer_major, &compressed}){
+      Kmer k(kmer);
+      reader->populate_kmer(k);
+      ASSERT_EQ(expected.pos_kmer_map.size(), k.pos_kmer_map.size());
+      for (auto &pos_kmer_pair: expected.pos_kmer_map){
+        vector<Event>& expected_events = pos_kmer_pair.second->events;
+        vector<Event>& events = k.pos_kmer_map.at(pos_kmer_pair.first)->events;
+        EXPECT_EQ(kmer, k.pos_kmer_map.at(pos_kmer_pair.first)->kmer);
+        ASSERT_EQ(expected_events.size(), events.size());
+        for (uint64_t i = 0; i < events.size(); ++i){
+          EXPECT_NEAR(expected_events[i].descaled_event_mean, events[i].descaled_event_mean, 0.0051);
+          EXPECT_NEAR(expected_events[i].posterior_probability, events[i].posterior_probability, 1.0 / 65535);
+        }
+      }
+    }
+  }
+//  position lookups still read the position major payloads
+  EXPECT_EQ(4, kmer_major.get_position_kmer("TTTTT", "asd", "+", 3, "t")->events[1].descaled_event_mean);
+  Kmer missing("GGGGG");
+  EXPECT_THROW(kmer_major.populate_kmer(missing), runtime_error);
+}
+
+TEST (BinaryEventTests, test_write_contig_strands) {
+  Redirect a(true, true);
+  path serial_file = temp_directory_path() / "test_serial.event";
+  path parallel_file = temp_directory_path() / "test_parallel.event";
+  for (auto &p: {serial_file, parallel_file}){
+    if (exists(p)){
+      remove(p);
+    }
+  }
+  vector<ContigStrand> contigs{ContigStrand("asd", "+", 100, "t"), ContigStrand("abc", "-", 50, "t")};
+  for (auto &cs: contigs){
+    for (uint64_t pos = 0; pos < cs.num_positions; pos += 2){
+      shared_ptr<PosKmer> k = make_shared<PosKmer>("ATGCC", 3);
+      k->add_event(pos, 0.5);
+      cs.add_kmer(pos, k);
+    }
+  }
+  vector<ContigStrand*> pointers{&contigs[0], &contigs[1]};
+  BinaryEventWriter serial(serial_file, {'A', 'C', 'G', 'T'}, 5, false, false);
+  serial.write_contig_strands(pointers, 1);
+  serial.write_indexes();
+  serial.close();
+//  shards of 7 positions split both contig strands between the threads
+  BinaryEventWriter parallel(parallel_file, {'A', 'C', 'G', 'T'}, 5, false, false);
+  parallel.write_contig_strands(pointers, 3, 7);
+  parallel.write_indexes();
+  parallel.close();
+  EXPECT_EQ(file_size(serial_file), file_size(parallel_file));
+  BinaryEventReader ber(parallel_file.string());
+  ber.load_indexes();
+  EXPECT_EQ(50, ber.indexes["asd+t"].num_written_positions);
+  EXPECT_EQ(25, ber.indexes["abc-t"].num_written_positions);
+  for (uint64_t pos = 0; pos < 100; pos += 2){
+    ASSERT_EQ(pos, ber.get_position_kmer("ATGCC", "asd", "+", pos, "t")->events[0].descaled_event_mean);
+  }
+//  errors in the writing threads are rethrown
+  contigs[1].add_kmer(1, make_shared<PosKmer>("ATGCC", 3));
+  remove(parallel_file);
+  BinaryEventWriter broken(parallel_file, {'A', 'C', 'G', 'T'}, 5, false, false);
+  EXPECT_THROW(broken.write_contig_strands(pointers, 3, 7), runtime_error);
+}
+
+TEST (BinaryEventTests, test_query_region) {
+  Redirect a(true, true);
+  path v1_file = temp_directory_path() / "test_region_v1.event";
+  path v2_file = temp_directory_path() / "test_region_v2.event";
+  path compressed_file = temp_directory_path() / "test_region_compressed.event";
+  write_test_event_file(v1_file, 1);
+  write_test_event_file(v2_file, 2);
+  write_test_event_file(compressed_file, 2, true);
+  for (auto &test_file: {v1_file, v2_file, compressed_file}){
+    BinaryEventReader reader(test_file.string());
+    RegionEvents region;
+    reader.query_region(region, "asd", "+", 2, 10, "t");
+    EXPECT_EQ(9, region.num_kmers());
+    EXPECT_EQ(18, region.num_events());
+    EXPECT_EQ(10, region.event_offsets.size());
+//    payloads are written in position order so the region is one contiguous range
+    EXPECT_EQ(1, region.num_byte_ranges);
+    EXPECT_THAT(region.positions, ElementsAre(3, 3, 3, 6, 6, 6, 9, 9, 9));
+    EXPECT_THAT(vector<string>(region.kmers.begin(), region.kmers.begin() + 3),
+                ElementsAre("AAAAA", "ATGCC", "TTTTT"));
+    for (uint64_t i = 0; i < region.num_kmers(); ++i){
+      shared_ptr<PosKmer> k = reader.get_position_kmer(region.kmers[i], "asd", "+", region.positions[i], "t");
+      ASSERT_EQ(k->events.size(), region.event_offsets[i + 1] - region.event_offsets[i]);
+      for (uint64_t e = 0; e < k->events.size(); ++e){
+        EXPECT_EQ(k->events[e].descaled_event_mean, region.descaled_event_means[region.event_offsets[i] + e]);
+        EXPECT_EQ(k->events[e].posterior_probability, region.posterior_probabilities[region.event_offsets[i] + e]);
+      }
+    }
+    reader.query_region(region, "abc", "-", 7, 8, "c");
+    EXPECT_THAT(region.positions, ElementsAre(7, 7, 7));
+    reader.query_region(region, "asd", "+", 10, 100, "t");
+    EXPECT_EQ(0, region.num_kmers());
+    EXPECT_EQ(0, region.num_byte_ranges);
+    EXPECT_THAT(region.event_offsets, ElementsAre(0));
+    EXPECT_THROW(reader.query_region(region, "asd", "-", 0, 10, "t"), runtime_error);
+  }
+}
+
+TEST (BinaryEventTests, test_query_event_file_region) {
+  Redirect a(true, true);
+  path test_file = temp_directory_path() / "test_region.event";
+  path output_file = temp_directory_path() / "test_region.tsv";
+  write_test_event_file(test_file, 2);
+  string contig;
+  uint64_t start;
+  uint64_t end;
+  parse_region("chr1:10:5-20", contig, start, end);
+  EXPECT_EQ("chr1:10", contig);
+  EXPECT_EQ(5, start);
+  EXPECT_EQ(20, end);
+  EXPECT_THROW(parse_region("chr1", contig, start, end), AssertionFailureException);
+  EXPECT_THROW(parse_region("chr1:5-", contig, start, end), AssertionFailureException);
+  EXPECT_THROW(parse_region("chr1:a-5", contig, start, end), AssertionFailureException);
+  EXPECT_THROW(parse_region("chr1:20-5", contig, start, end), AssertionFailureException);
+
+  query_event_file_region(test_file.string(), "abc:0-4", "-", "c", output_file.string());
+  std::ifstream in(output_file.string());
+  vector<string> lines;
+  for (string line; getline(in, line);){
+    lines.push_back(line);
+  }
+  ASSERT_EQ(3, lines.size());
+  EXPECT_EQ("abc\t-\tc\t1\tAAAAA\t2\t0.2", lines[0]);
+}
+
+TEST (BinaryEventTests, test_merge_event_files) {
+  Redirect a(true, true);
+  path v1_file = temp_directory_path() / "test_merge_v1.event";
+  path v2_file = temp_directory_path() / "test_merge_v2.event";
+  path merged_file = temp_directory_path() / "test_merged.event";
+  path other_file = temp_directory_path() / "test_merge_other.event";
+  write_test_event_file(v1_file, 1);
+  write_test_event_file(v2_file, 2, true);
+  for (uint64_t max_events: {0, 3}){
+    if (exists(merged_file)){
+      remove(merged_file);
+    }
+    merge_event_files({v1_file.string(), v2_file.string()}, merged_file.string(), max_events, 2, false, true, 1);
+    BinaryEventReader merged(merged_file.string());
+    EXPECT_EQ("ACGT", merged.alphabet_string);
+    EXPECT_TRUE(merged.rna);
+    EXPECT_TRUE(merged.two_d);
+    EXPECT_TRUE(merged.kmer_major);
+    vector<ContigStrandIndex> contig_strands = merged.get_contig_strands();
+    ASSERT_EQ(2, contig_strands.size());
+    EXPECT_EQ("abc-c", contig_strands[0].contig + contig_strands[0].strand + contig_strands[0].nanopore_strand);
+    EXPECT_EQ(20, contig_strands[0].num_positions);
+    EXPECT_THAT(merged.get_written_positions("asd", "+", "t"), ElementsAre(0, 3, 6, 9));
+//    every event is in both inputs so the merged kmers have twice the events unless they are capped
+    EXPECT_EQ(max_events > 0 ? 3 : 4, merged.get_position_kmer("ATGCC", "asd", "+", 3, "t")->num_events());
+    EXPECT_EQ(2, merged.get_position_kmer("TTTTT", "abc", "-", 7, "c")->num_events());
+    Kmer kmer("AAAAA");
+    merged.populate_kmer(kmer);
+    EXPECT_EQ(8, kmer.pos_kmer_map.size());
+  }
+  if (exists(other_file)){
+    remove(other_file);
+  }
+  BinaryEventWriter other(other_file, {'A', 'C', 'G', 'T'}, 6, true, true);
+  other.write_indexes();
+  other.close();
+  remove(merged_file);
+  EXPECT_THROW(merge_event_files({v1_file.string(), other_file.string()}, merged_file.string()),
+               AssertionFailureException);
+}
+
 
 #endif //EMBED_FAST5_TESTS_SRC_BINARYEVENTTESTS_HPP_
@@ -19,6 +19,7 @@ using namespace boost::filesystem;
 using namespace std;
 using namespace embed_utils;
 using namespace test_files;
+using ::testing::ElementsAre;
 
 
 TEST (BinaryIOTests, test_read_write_string_to_binary) {
@@ -185,4 +186,76 @@ TEST (BinaryIOTests, test_read_write_queue_of_Events_to_binary) {
   EXPECT_EQ(1, read_to_me[0].descaled_event_mean);
   EXPECT_EQ(2, read_to_me[1].descaled_event_mean);
   ::close(sequence_file_descriptor);
-}
\ No newline at end of file
+}
+TEST (BinaryIOTests, test_mapped_region) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path();
+  path test_file = tempdir / "test_mapped.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  std::ofstream file_handle = std::ofstream(test_file.string(), std::ofstream::binary);
+  string padding(5000, 'x');
+  write_string_to_binary(file_handle, padding);
+  uint64_t value = 42;
+  string name = "ATGCC";
+  write_value_to_binary(file_handle, value);
+  write_string_to_binary(file_handle, name);
+  file_handle.close();
+
+  int sequence_file_descriptor = ::open(test_file.c_str(), O_RDONLY);
+//  offset is not page aligned
+  MappedRegion region(sequence_file_descriptor, 5000, sizeof(uint64_t) + name.size());
+  ::close(sequence_file_descriptor);
+  EXPECT_TRUE(region.is_mapped());
+  BinaryBuffer buffer = region.buffer();
+  uint64_t byte_index = 0;
+  uint64_t read_value = 0;
+  string read_name;
+  memread_value_from_binary(buffer, read_value, byte_index);
+  memread_string_from_binary(buffer, read_name, 5, byte_index);
+  EXPECT_EQ(42, read_value);
+  EXPECT_EQ("ATGCC", read_name);
+  EXPECT_EQ(buffer.length, byte_index);
+  EXPECT_THROW(memread_value_from_binary(buffer, read_value, byte_index), runtime_error);
+}
+
+TEST (BinaryIOTests, test_pread_batch) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path();
+  path test_file = tempdir / "test_batch.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  std::ofstream file_handle = std::ofstream(test_file.string(), std::ofstream::binary);
+  vector<uint32_t> values(3000);
+  std::iota(values.begin(), values.end(), 0);
+  write_vector_to_binary(file_handle, values);
+  file_handle.close();
+
+  int sequence_file_descriptor = ::open(test_file.c_str(), O_RDONLY);
+//  two touching requests, one separate request and an empty request
+  vector<uint32_t> first(2);
+  vector<uint32_t> second(3);
+  vector<uint32_t> third(1);
+  vector<ReadRequest> requests{{40, 4, reinterpret_cast<char*>(third.data())},
+                               {8, 12, reinterpret_cast<char*>(second.data())},
+                               {20, 0, nullptr},
+                               {0, 8, reinterpret_cast<char*>(first.data())}};
+  EXPECT_EQ(2, pread_batch(sequence_file_descriptor, requests));
+  EXPECT_THAT(first, ElementsAre(0, 1));
+  EXPECT_THAT(second, ElementsAre(2, 3, 4));
+  EXPECT_THAT(third, ElementsAre(10));
+//  more touching requests than one preadv accepts
+  vector<uint32_t> read_values(values.size());
+  requests.clear();
+  for (uint64_t i = 0; i < values.size(); ++i){
+    requests.push_back({i * sizeof(uint32_t), sizeof(uint32_t), reinterpret_cast<char*>(&read_values[i])});
+  }
+  EXPECT_EQ(1, pread_batch(sequence_file_descriptor, requests));
+  EXPECT_EQ(values, read_values);
+//  reading past the end of the file throws
+  requests = {{values.size() * sizeof(uint32_t), 4, reinterpret_cast<char*>(third.data())}};
+  EXPECT_THROW(pread_batch(sequence_file_descriptor, requests), runtime_error);
+  ::close(sequence_file_descriptor);
+}
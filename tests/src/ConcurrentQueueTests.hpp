@@ -12,6 +12,8 @@
 #include <gmock/gmock.h>
 // Standard Libray
 #include <future>
+#include <memory>
+#include <algorithm>
 
 using namespace std;
 
@@ -40,4 +42,83 @@ TEST (ConcurrentQueueTests, test_ConcurrentQueue) {
   EXPECT_EQ("Test", i);
 }
 
+TEST (ConcurrentQueueTests, test_bounded_push_blocks) {
+  ConcurrentQueue<int> cq(2);
+  cq.push(1);
+  cq.push(2);
+  std::atomic<bool> pushed(false);
+  std::thread producer([&](){
+    cq.push(3);
+    pushed = true;
+  });
+//  wait until the producer is blocked on the full queue
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (cq.get_stats().full_waits == 0 and std::chrono::steady_clock::now() < deadline){
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(1, cq.get_stats().full_waits);
+  EXPECT_FALSE(pushed);
+  EXPECT_EQ(2, cq.size());
+  int value;
+  EXPECT_TRUE(cq.try_pop(value));
+  EXPECT_EQ(1, value);
+  producer.join();
+  EXPECT_TRUE(pushed);
+  ConcurrentQueueStats stats = cq.get_stats();
+  EXPECT_EQ(3, stats.pushed);
+  EXPECT_EQ(1, stats.popped);
+  EXPECT_EQ(2, stats.max_depth);
+  EXPECT_EQ(1, stats.full_waits);
+//  a stopped queue does not block producers
+  cq.stop();
+  cq.push(4);
+  EXPECT_EQ(3, cq.size());
+}
+
+TEST (ConcurrentQueueTests, test_bulk_push_and_pop) {
+  ConcurrentQueue<unique_ptr<int>> cq(3);
+  uint64_t num_producers = 4;
+  uint64_t items_per_producer = 1000;
+  vector<thread> producers;
+  for (uint64_t p = 0; p < num_producers; ++p){
+    producers.emplace_back([&, p](){
+      vector<unique_ptr<int>> items;
+      for (uint64_t i = 0; i < items_per_producer; ++i){
+        items.emplace_back(new int(p * items_per_producer + i));
+        if (items.size() == 7){
+          cq.push_bulk(items);
+          EXPECT_TRUE(items.empty());
+        }
+      }
+      cq.push_bulk(items);
+    });
+  }
+  vector<unique_ptr<int>> popped;
+  std::thread consumer([&](){
+    while (cq.pop_bulk(popped, 5) > 0){
+      EXPECT_GE(3, cq.get_stats().max_depth);
+    }
+  });
+  for (auto &t: producers){
+    t.join();
+  }
+  cq.stop();
+  consumer.join();
+  ASSERT_EQ(num_producers * items_per_producer, popped.size());
+  vector<int> values;
+  for (auto &item: popped){
+    values.push_back(*item);
+  }
+  sort(values.begin(), values.end());
+  for (uint64_t i = 0; i < values.size(); ++i){
+    EXPECT_EQ(i, values[i]);
+  }
+  ConcurrentQueueStats stats = cq.get_stats();
+  EXPECT_EQ(popped.size(), stats.pushed);
+  EXPECT_EQ(popped.size(), stats.popped);
+  EXPECT_EQ(3, stats.max_depth);
+  EXPECT_LT(0, stats.mean_depth());
+  EXPECT_EQ(0, cq.pop_bulk(popped));
+}
+
 #endif //EMBED_FAST5_TESTS_SRC_CONCURRENTQUEUETESTS_HPP_
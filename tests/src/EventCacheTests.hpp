@@ -0,0 +1,131 @@
+#ifndef EMBED_FAST5_TESTS_SRC_EVENTCACHETESTS_HPP_
+#define EMBED_FAST5_TESTS_SRC_EVENTCACHETESTS_HPP_
+
+// embed source
+#include "EventCache.hpp"
+#include "PerPositionKmers.hpp"
+#include "TestFiles.hpp"
+// gtest
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+using namespace test_files;
+using namespace embed_utils;
+using ::testing::ElementsAre;
+
+TEST (EventCacheTests, test_clock_eviction) {
+  vector<string> evicted;
+  auto evict = [&](const string& key){ evicted.push_back(key); };
+  EventCache cache(120);
+  cache.insert("a", 40, evict);
+  cache.insert("b", 40, evict);
+  cache.insert("c", 40, evict);
+  EXPECT_TRUE(evicted.empty());
+//  every entry is referenced so the hand clears them all before evicting a
+  cache.insert("d", 40, evict);
+  EXPECT_THAT(evicted, ElementsAre("a"));
+//  a hit gives b a second chance so c is evicted first
+  cache.hit("b");
+  cache.insert("e", 40, evict);
+  EXPECT_THAT(evicted, ElementsAre("a", "c"));
+  EXPECT_TRUE(cache.contains("b"));
+  EXPECT_EQ(120, cache.get_stats().bytes);
+  EXPECT_EQ(3, cache.get_stats().entries);
+  EXPECT_EQ(2, cache.get_stats().evictions);
+  EXPECT_EQ(1, cache.get_stats().hits);
+//  an entry bigger than the budget evicts everything else but is kept itself
+  cache.insert("e", 200, evict);
+  EXPECT_THAT(evicted, ElementsAre("a", "c", "b", "d"));
+  EXPECT_TRUE(cache.contains("e"));
+  EXPECT_EQ(240, cache.get_stats().bytes);
+  cache.set_memory_budget(10, evict);
+  EXPECT_THAT(evicted, ElementsAre("a", "c", "b", "d", "e"));
+  EXPECT_EQ(0, cache.get_stats().bytes);
+  EXPECT_EQ(0, cache.get_stats().entries);
+}
+
+TEST (EventCacheTests, test_disabled_cache) {
+  uint64_t evictions = 0;
+  auto evict = [&](const string&){ evictions += 1; };
+  EventCache cache;
+  EXPECT_FALSE(cache.enabled());
+  cache.miss();
+  cache.insert("a", 1000, evict);
+  cache.hit("a");
+  EXPECT_FALSE(cache.contains("a"));
+  EXPECT_EQ(0, evictions);
+  EXPECT_EQ(1, cache.get_stats().hits);
+  EXPECT_EQ(1, cache.get_stats().misses);
+  EXPECT_EQ(0.5, cache.get_stats().hit_rate());
+  cache.reset_stats();
+  EXPECT_EQ(0, cache.get_stats().hits);
+  EXPECT_EQ("hits=0 misses=0 evictions=0 entries=0 bytes=0B", cache.get_stats().format());
+}
+
+TEST (EventCacheTests, test_event_data_handler_cache_budget) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path test_file = tempdir / "test_cache.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af);
+  ppk.write_to_file(test_file);
+
+  EventDataHandler unbounded(reference, test_file.string());
+  EventDataHandler bounded(reference, test_file.string());
+  bounded.set_cache_budget(4096);
+  EXPECT_EQ(4096, bounded.get_cache_budget());
+  vector<uint64_t> positions;
+  for (uint64_t i = 0; i < 2686; ++i){
+    if (ppk.data.get_position("pUC19", "+", "c", i).has_data){
+      positions.push_back(i);
+    }
+  }
+  ASSERT_LT(10, positions.size());
+//  two passes over every position, the bounded handler stays within budget and answers the same events
+  for (uint64_t pass = 0; pass < 2; ++pass){
+    for (auto &i: positions){
+      Position& expected = unbounded.get_position("pUC19", "+", "c", i);
+      Position& pos = bounded.get_position("pUC19", "+", "c", i);
+      ASSERT_EQ(expected.get_kmer_strings(), pos.get_kmer_strings());
+      for (auto &k: expected.get_kmer_strings()){
+        EXPECT_THAT(pos.get_pos_kmer(k)->events, ElementsAreArray(expected.get_pos_kmer(k)->events));
+      }
+      EXPECT_GE(4096 + pos.memory_usage(), bounded.get_cache_stats().bytes);
+    }
+  }
+  EXPECT_EQ(2 * positions.size(), bounded.get_cache_stats().misses);
+  EXPECT_LT(0, bounded.get_cache_stats().evictions);
+  EXPECT_EQ(positions.size(), unbounded.get_cache_stats().misses);
+  EXPECT_EQ(positions.size(), unbounded.get_cache_stats().hits);
+  EXPECT_EQ(0, unbounded.get_cache_stats().evictions);
+//  repeated lookups of a position are hits
+  bounded.reset_cache_stats();
+  bounded.get_position("pUC19", "+", "c", positions[0]);
+  bounded.get_position("pUC19", "+", "c", positions[0]);
+  EXPECT_EQ(1, bounded.get_cache_stats().hits);
+//  kmers are cached on their own and reread after they are evicted
+  bounded.reset_cache_stats();
+  Kmer& expected_kmer = unbounded.get_kmer("ATTGA");
+  uint64_t n_positions = expected_kmer.pos_kmer_map.size();
+  EXPECT_EQ(n_positions, bounded.get_kmer("ATTGA").pos_kmer_map.size());
+  EXPECT_EQ(n_positions, bounded.get_kmer("ATTGA").pos_kmer_map.size());
+  EXPECT_EQ(1, bounded.get_cache_stats().misses);
+  EXPECT_EQ(1, bounded.get_cache_stats().hits);
+  for (auto &i: positions){
+    bounded.get_position("pUC19", "+", "c", i);
+  }
+  EXPECT_TRUE(bounded.get_kmer("ATTGA").pos_kmer_map.size() == n_positions);
+//  the first position was still cached, every other one and the kmer were read again
+  EXPECT_EQ(1 + positions.size(), bounded.get_cache_stats().misses);
+  for (auto &pos_kmer: expected_kmer.pos_kmer_map){
+    EXPECT_THAT(bounded.get_kmer("ATTGA").pos_kmer_map.at(pos_kmer.first)->events,
+                ElementsAreArray(pos_kmer.second->events));
+  }
+}
+
+#endif //EMBED_FAST5_TESTS_SRC_EVENTCACHETESTS_HPP_
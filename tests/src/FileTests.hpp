@@ -16,6 +16,7 @@
 #include <gmock/gmock.h>
 //std lib
 #include <numeric>
+#include <chrono>
 
 using namespace test_files;
 using namespace embed_utils;
@@ -133,6 +134,113 @@ TEST (AlignmentFileTests, test_get_variant_calls) {
   }
 }
 
+/**
+Variant calls summed with a map over every parsed event, to check the scratch based get_variant_calls against
+*/
+vector<VariantCall> map_variant_calls(AlignmentFile& af, string& ambig_bases,
+                                      std::map<string, string>& ambig_bases_map){
+  std::map<uint64_t, VariantCall> variant_calls;
+  for (auto &event: af.iterate()) {
+    for (char &c : ambig_bases) {
+      uint64_t path_kmer_pos = event.aligned_kmer.find(c);
+      if (path_kmer_pos == std::string::npos) {
+        continue;
+      }
+      uint64_t position;
+      if (af.rna){
+        position = event.reference_index - path_kmer_pos + (af.k-1);
+      } else if (af.strand == "+") {
+        position = event.reference_index + path_kmer_pos;
+      } else {
+        position = event.reference_index + (af.k - path_kmer_pos - 1);
+      }
+      string possible_bases = ambig_bases_map.at(string(1, c));
+      auto found = variant_calls.find(position);
+      if (found == variant_calls.end()) {
+        found = variant_calls.emplace(position, VariantCall(event.contig, af.strand, position, possible_bases)).first;
+        found->second.positional_probs.resize(possible_bases.length(), 0.0);
+      }
+      found->second.positional_probs[possible_bases.find(event.path_kmer[path_kmer_pos])] +=
+          event.posterior_probability;
+    }
+  }
+  vector<VariantCall> calls;
+  for (auto &element: variant_calls) {
+    double sum_of_elements = std::accumulate(element.second.positional_probs.begin(),
+                                             element.second.positional_probs.end(), 0.0);
+    for (auto &prob: element.second.positional_probs){
+      element.second.normalized_probs.push_back(prob / sum_of_elements);
+    }
+    calls.push_back(element.second);
+  }
+  return calls;
+}
+
+TEST (AlignmentFileTests, test_get_variant_calls_scratch) {
+  Redirect a(true, true);
+  std::map<string, string> ambig_bases = create_ambig_bases();
+  vector<tuple<path, bool, string>> reads = {make_tuple(ALIGNMENT_FILE_MOD, true, "f"),
+                                             make_tuple(RRNA_TEST_VARIANTS, true, "YK"),
+                                             make_tuple(DNA_TEST_VARIANTS, false, "P")};
+//  one scratch is reused across reads and ambiguous bases
+  VariantCallScratch scratch;
+  vector<VariantCall> calls;
+  for (auto &read: reads){
+    AlignmentFile af(get<0>(read).string(), get<1>(read));
+    string bases = get<2>(read);
+    vector<VariantCall> expected = map_variant_calls(af, bases, ambig_bases);
+    af.get_variant_calls(bases, &ambig_bases, scratch, calls);
+    ASSERT_LT(0, expected.size());
+    ASSERT_EQ(expected.size(), calls.size());
+    for (size_t i = 0; i < calls.size(); ++i){
+      EXPECT_EQ(expected[i].contig, calls[i].contig);
+      EXPECT_EQ(expected[i].strand, calls[i].strand);
+      EXPECT_EQ(expected[i].reference_index, calls[i].reference_index);
+      EXPECT_EQ(expected[i].bases, calls[i].bases);
+      ASSERT_EQ(expected[i].normalized_probs.size(), calls[i].normalized_probs.size());
+      for (size_t j = 0; j < calls[i].normalized_probs.size(); ++j){
+        EXPECT_DOUBLE_EQ(expected[i].normalized_probs[j], calls[i].normalized_probs[j]);
+      }
+    }
+  }
+//  an ambiguous base missing from the map is only an error once a read has it
+  std::map<string, string> no_p = ambig_bases;
+  no_p.erase("P");
+  string bases = "P";
+  AlignmentFile af(DNA_TEST_VARIANTS.string(), false);
+  EXPECT_THROW(af.get_variant_calls(bases, &no_p, scratch, calls), runtime_error);
+  AlignmentFile af2(ALIGNMENT_FILE_MOD.string(), true);
+  bases = "fP";
+  EXPECT_NO_THROW(af2.get_variant_calls(bases, &no_p, scratch, calls));
+}
+
+TEST (AlignmentFileTests, test_get_variant_calls_timing) {
+  Redirect a(true, true);
+  std::map<string, string> ambig_bases = create_ambig_bases();
+  string bases = "YK";
+  uint64_t repeats = 20;
+  AlignmentFile af(RRNA_TEST_VARIANTS.string(), true);
+  auto start = std::chrono::steady_clock::now();
+  uint64_t map_calls = 0;
+  for (uint64_t i = 0; i < repeats; ++i){
+    map_calls += map_variant_calls(af, bases, ambig_bases).size();
+  }
+  auto map_time =
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  VariantCallScratch scratch;
+  vector<VariantCall> calls;
+  uint64_t scratch_calls = 0;
+  start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < repeats; ++i){
+    af.get_variant_calls(bases, &ambig_bases, scratch, calls);
+    scratch_calls += calls.size();
+  }
+  auto scratch_time =
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "map: " << map_time << "us scratch: " << scratch_time << "us\n";
+  EXPECT_EQ(map_calls, scratch_calls);
+}
+
 TEST (AlignmentFileTests, test_filter) {
   Redirect a(true, true);
   path tempdir = temp_directory_path()/ "temp";
@@ -72,4 +72,194 @@ TEST (MarginalizeVariantsTests, test_write_to_file) {
   EXPECT_TRUE(compare_files(bed_file, bed_file2));
 }
 
+TEST (MarginalizeVariantsTests, test_merge_partials) {
+  Redirect a(true, true);
+  vector<VariantCall> data;
+  for (uint64_t i = 0; i < 1000; ++i){
+    VariantCall vc("test" + to_string(i % 3), i % 2 == 0 ? "+" : "-", i % 17, "AT");
+    vc.normalized_probs = {i % 5 == 0 ? 0.9 : 0.1, i % 5 == 0 ? 0.1 : 0.9};
+    data.push_back(vc);
+  }
+  MarginalizeVariants serial;
+  serial.load_variants(&data);
+//  each thread counts every fourth call into its own partial
+  uint64_t num_threads = 4;
+  MarginalizeVariants mv(num_threads);
+  run_on_threads(num_threads, [&](uint64_t thread_id){
+    vector<VariantCall> calls;
+    for (uint64_t i = thread_id; i < data.size(); i += num_threads){
+      calls.push_back(data[i]);
+    }
+    mv.load_variants(&calls, thread_id);
+  });
+  EXPECT_TRUE(mv.per_genomic_position.empty());
+  mv.merge_partials(num_threads);
+  ASSERT_EQ(serial.per_genomic_position.size(), mv.per_genomic_position.size());
+  for (auto &contig: serial.per_genomic_position){
+    auto& merged = mv.per_genomic_position.at(contig.first);
+    ASSERT_EQ(contig.second.first.size(), merged.first.size());
+    ASSERT_EQ(contig.second.second.size(), merged.second.size());
+    for (auto &position: contig.second.first){
+      EXPECT_EQ(position.second.coverage, merged.first.at(position.first).coverage);
+      EXPECT_THAT(merged.first.at(position.first).hits, ElementsAreArray(position.second.hits));
+    }
+    for (auto &position: contig.second.second){
+      EXPECT_EQ(position.second.coverage, merged.second.at(position.first).coverage);
+      EXPECT_THAT(merged.second.at(position.first).hits, ElementsAreArray(position.second.hits));
+    }
+  }
+//  partials are freed once merged so a second merge changes nothing
+  mv.merge_partials(num_threads);
+  EXPECT_EQ(serial.per_genomic_position.at("test0").first.at(0).coverage,
+            mv.per_genomic_position.at("test0").first.at(0).coverage);
+}
+
+TEST (MarginalizeVariantsTests, test_write_partials_to_file) {
+  Redirect a(true, true);
+  VariantCall vc1("test", "+", 10, "AT");
+  vc1.normalized_probs = {0.1, 0.9};
+  VariantCall vc2("test", "+", 14, "GT");
+  vc2.normalized_probs = {0.1, 0.9};
+  VariantCall vc3("test", "+", 10, "AT");
+  vc3.normalized_probs = {0.9, 0.1};
+  vector<VariantCall> data1 = {vc1, vc2};
+  vector<VariantCall> data2 = {vc3};
+
+  MarginalizeVariants mf(2);
+  mf.load_variants(&data1, 0);
+  mf.load_variants(&data2, 1);
+  path bed_file = TEST_FILES / "bed_files/test.bed";
+  path bed_file2 = temp_directory_path() / "test3.bed";
+  mf.write_to_file(bed_file2);
+  EXPECT_TRUE(compare_files(bed_file, bed_file2));
+}
+
+TEST (MarginalizeVariantsTests, test_save_and_load_state) {
+  Redirect a(true, true);
+  VariantCall vc1("test", "+", 10, "AT");
+  vc1.normalized_probs = {0.1, 0.9};
+  VariantCall vc2("test", "+", 14, "GT");
+  vc2.normalized_probs = {0.1, 0.9};
+  VariantCall vc3("test", "+", 10, "AT");
+  vc3.normalized_probs = {0.9, 0.1};
+  VariantCall vc4("other", "-", 3, "CE");
+  vc4.normalized_probs = {0.2, 0.8};
+  vector<VariantCall> shard1 = {vc1, vc4};
+  vector<VariantCall> shard2 = {vc2, vc3, vc4};
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path state1 = tempdir / "shard1.state";
+  path state2 = tempdir / "shard2.state";
+  MarginalizeVariants mv1(1);
+  mv1.load_variants(&shard1, 0);
+  mv1.save_state(state1);
+  MarginalizeVariants mv2;
+  mv2.load_variants(&shard2);
+  mv2.save_state(state2);
+//  resuming from shard1 and adding shard2 gives the same counts as merging the two saved shards
+  MarginalizeVariants resumed;
+  resumed.load_state(state1);
+  resumed.load_variants(&shard2);
+  MarginalizeVariants merged;
+  merged.load_state(state1);
+  merged.load_state(state2);
+  for (auto mv: {&resumed, &merged}){
+    auto& test = mv->per_genomic_position.at("test").first;
+    EXPECT_EQ(2, test.at(10).coverage);
+    EXPECT_EQ(1, test.at(10).hits[0]);
+    EXPECT_EQ(1, test.at(10).hits[1]);
+    EXPECT_EQ(1, test.at(14).coverage);
+    auto& other = mv->per_genomic_position.at("other").second;
+    EXPECT_EQ(2, other.at(3).coverage);
+    EXPECT_EQ(2, other.at(3).hits[1]);
+    EXPECT_EQ("CE", other.at(3).bases);
+  }
+  path merged_bed = tempdir / "merged.bed";
+  path merged_state = tempdir / "merged.state";
+  merged.save_state(merged_state);
+  MarginalizeVariants reloaded;
+  reloaded.load_state(merged_state);
+  reloaded.per_genomic_position.erase("other");
+  reloaded.write_to_file(merged_bed);
+  EXPECT_TRUE(compare_files(TEST_FILES / "bed_files/test.bed", merged_bed));
+//  merge moves the counts of the other object
+  MarginalizeVariants combined;
+  combined.merge(mv1);
+  EXPECT_TRUE(mv1.per_genomic_position.empty());
+  EXPECT_EQ(1, combined.per_genomic_position.at("other").second.at(3).coverage);
+  remove_all(tempdir);
+}
+
+TEST (MarginalizeVariantsTests, test_load_bad_state) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path state_path = tempdir / "bad.state";
+  {
+    std::ofstream state_file(state_path.string());
+    state_file << "not a state file";
+  }
+  MarginalizeVariants mv;
+  EXPECT_THROW(mv.load_state(state_path), AssertionFailureException);
+  EXPECT_THROW(mv.load_state(tempdir / "missing.state"), AssertionFailureException);
+  VariantCall vc1("test", "+", 10, "AT");
+  vc1.normalized_probs = {0.1, 0.9};
+  vector<VariantCall> data = {vc1};
+  mv.load_variants(&data);
+  mv.save_state(state_path);
+  resize_file(state_path, file_size(state_path) - 1);
+  EXPECT_THROW(mv.load_state(state_path), AssertionFailureException);
+//  a failed load leaves the counts unchanged
+  EXPECT_EQ(1, mv.per_genomic_position.at("test").first.at(10).coverage);
+//  the same position with different variants cannot be merged
+  VariantCall vc2("test", "+", 10, "CE");
+  vc2.normalized_probs = {0.1, 0.9};
+  vector<VariantCall> conflict = {vc2};
+  MarginalizeVariants other;
+  other.load_variants(&conflict);
+  EXPECT_THROW(mv.merge(other), AssertionFailureException);
+  remove_all(tempdir);
+}
+
+TEST (MarginalizeVariantsTests, test_conflicting_state_leaves_counts_unchanged) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path state_path = tempdir / "conflict.state";
+  VariantCall vc1("test", "+", 10, "AT");
+  vc1.normalized_probs = {0.1, 0.9};
+  VariantCall vc2("test", "+", 20, "GT");
+  vc2.normalized_probs = {0.9, 0.1};
+  vector<VariantCall> data = {vc1, vc2};
+  MarginalizeVariants mv;
+  mv.load_variants(&data);
+//  positions before and after the conflicting one would be merged by a single pass
+  VariantCall before("test", "+", 5, "AT");
+  before.normalized_probs = {0.1, 0.9};
+  VariantCall conflict("test", "+", 10, "CE");
+  conflict.normalized_probs = {0.1, 0.9};
+  VariantCall after("test", "+", 20, "GT");
+  after.normalized_probs = {0.1, 0.9};
+  VariantCall other_contig("other", "-", 3, "CE");
+  other_contig.normalized_probs = {0.1, 0.9};
+  vector<VariantCall> shard = {before, conflict, after, other_contig};
+  MarginalizeVariants conflicting;
+  conflicting.load_variants(&shard);
+  conflicting.save_state(state_path);
+  EXPECT_THROW(mv.load_state(state_path), AssertionFailureException);
+  EXPECT_THROW(mv.merge(conflicting), AssertionFailureException);
+  ASSERT_EQ(1, mv.per_genomic_position.size());
+  auto& test = mv.per_genomic_position.at("test").first;
+  ASSERT_EQ(2, test.size());
+  EXPECT_EQ(1, test.at(10).coverage);
+  EXPECT_EQ("AT", test.at(10).bases);
+  EXPECT_EQ(1, test.at(20).coverage);
+  EXPECT_EQ(1, test.at(20).hits[0]);
+  EXPECT_EQ(0, test.at(20).hits[1]);
+//  the failed merge does not consume the other counts either
+  EXPECT_EQ(4, conflicting.per_genomic_position.at("test").first.size() +
+      conflicting.per_genomic_position.at("other").second.size());
+  remove_all(tempdir);
+}
+
 #endif //EMBED_FAST5_TESTS_SRC_MARGINALIZEVARIANTSTESTS_HPP_
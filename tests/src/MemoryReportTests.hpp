@@ -0,0 +1,184 @@
+#ifndef EMBED_FAST5_TESTS_SRC_MEMORYREPORTTESTS_HPP_
+#define EMBED_FAST5_TESTS_SRC_MEMORYREPORTTESTS_HPP_
+
+// embed source
+#include "MemoryReport.hpp"
+#include "MaxKmers.hpp"
+#include "PerPositionKmers.hpp"
+#include "TestFiles.hpp"
+// gtest
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+// std
+#include <sstream>
+
+using namespace test_files;
+using namespace embed_utils;
+
+TEST (MemoryReportTests, test_container_memory) {
+  Redirect a(true, true);
+  string short_string = "ATGC";
+  EXPECT_EQ(0, string_memory(short_string));
+  string long_string(100, 'A');
+  EXPECT_EQ(long_string.capacity() + 1, string_memory(long_string));
+  vector<Event> events;
+  events.reserve(10);
+  EXPECT_EQ(10 * sizeof(Event), vector_memory(events));
+  unordered_map<uint64_t, uint64_t> map;
+  EXPECT_EQ(map.bucket_count() * sizeof(void*), unordered_map_memory(map));
+  map[1] = 2;
+  EXPECT_EQ(map.bucket_count() * sizeof(void*) + sizeof(void*) + sizeof(pair<const uint64_t, uint64_t>),
+            unordered_map_memory(map));
+}
+
+TEST (MemoryReportTests, test_memory_report) {
+  Redirect a(true, true);
+  MemoryReport report;
+  report.add("a", 1000);
+  report.add("b", 3 * 1024 * 1024);
+  report.add("a", 24);
+  EXPECT_EQ(1024, report.get("a"));
+  EXPECT_EQ(0, report.get("c"));
+  EXPECT_EQ(1024 + 3 * 1024 * 1024, report.total());
+  EXPECT_EQ("total=3.00MB a=1.00KB b=3.00MB", report.format());
+  EXPECT_EQ("12B", MemoryReport::format_bytes(12));
+  MemoryReport other;
+  other.add("b", 1024);
+  other.add("c", 1);
+  report.add(other);
+  EXPECT_EQ(3 * 1024 * 1024 + 1024, report.get("b"));
+  EXPECT_EQ(1, report.get("c"));
+}
+
+TEST (MemoryReportTests, test_memory_reporter) {
+  std::ostringstream out;
+  {
+    MemoryReporter reporter(1, [](){
+      MemoryReport report;
+      report.add("a", 1);
+      return report;
+    }, out);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    reporter.stop();
+    EXPECT_EQ(1, reporter.num_reports);
+  }
+  EXPECT_EQ("[memory] total=1B a=1B\n", out.str());
+//  an interval of 0 never starts the reporting thread
+  MemoryReporter disabled(0, [](){ return MemoryReport(); }, out);
+  disabled.stop();
+  EXPECT_EQ(0, disabled.num_reports);
+}
+
+/**
+Components of the handler's walk over its data must match the counters behind PerPositionKmers::memory_report
+*/
+void expect_same_report(const MemoryReport& walked, const MemoryReport& tracked){
+  for (auto &name: {"contig_strand_positions", "pos_kmer_events", "by_kmer", "reader_indexes", "stream_indexes"}){
+    EXPECT_EQ(walked.get(name), tracked.get(name)) << name;
+  }
+}
+
+TEST (MemoryReportTests, test_per_position_kmers_memory_report) {
+  Redirect a(true, true);
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  MemoryReport empty = ppk.memory_report();
+  EXPECT_EQ(0, empty.get("pos_kmer_events"));
+  EXPECT_LT(4 * 2686 * sizeof(Position), empty.get("contig_strand_positions"));
+  EXPECT_LT(0, empty.get("by_kmer"));
+  EXPECT_EQ(1000 * sizeof(std::mutex), empty.get("locks"));
+  expect_same_report(ppk.data.memory_report(), empty);
+
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af);
+  MemoryReport full = ppk.memory_report();
+  uint64_t num_events = 0;
+  for (auto &cs: {"+t", "+c", "-t", "-c"}){
+    ContigStrand& contig_strand = ppk.data.get_contig_strand("pUC19", string(1, cs[0]), string(1, cs[1]));
+    for (auto &position: contig_strand.positions){
+      for (auto &kmer: position.get_kmer_strings()){
+        num_events += position.get_pos_kmer(kmer)->events.size();
+      }
+    }
+  }
+  EXPECT_LT(0, num_events);
+  EXPECT_LE(num_events * sizeof(Event), full.get("pos_kmer_events"));
+//  the counters kept while parsing match a walk over the data
+  expect_same_report(ppk.data.memory_report(), full);
+  EXPECT_LT(empty.get("contig_strand_positions"), full.get("contig_strand_positions"));
+//  the by kmer index is only built when it is queried
+  EXPECT_EQ(empty.get("by_kmer"), full.get("by_kmer"));
+  ppk.data.build_by_kmer_index();
+  EXPECT_LT(empty.get("by_kmer"), ppk.memory_report().get("by_kmer"));
+  expect_same_report(ppk.data.memory_report(), ppk.memory_report());
+  EXPECT_EQ(full.total(), full.get("contig_strand_positions") + full.get("pos_kmer_events") +
+      full.get("by_kmer") + full.get("reader_indexes") + full.get("locks"));
+}
+
+TEST (MemoryReportTests, test_memory_report_tracks_capped_and_streamed_events) {
+  Redirect a(true, true);
+  path test_file = temp_directory_path() / "temp" / "test_tracked_memory.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  ppk.set_max_events(2);
+  ppk.set_bulk_factor(4);
+  ppk.open_stream(test_file);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+//  the second pass fills the bulk buffers past the cap so some of them are compacted
+  ppk.process_alignment(af);
+  ppk.process_alignment(af);
+  MemoryReport full = ppk.memory_report();
+  EXPECT_LT(0, full.get("pos_kmer_events"));
+  expect_same_report(ppk.data.memory_report(), full);
+//  flushed positions give their bytes back
+  ppk.flush_contig("pUC19");
+  MemoryReport flushed = ppk.memory_report();
+  EXPECT_EQ(0, flushed.get("pos_kmer_events"));
+  EXPECT_LT(0, flushed.get("stream_indexes"));
+  expect_same_report(ppk.data.memory_report(), flushed);
+  ppk.close_stream();
+}
+
+TEST (MemoryReportTests, test_reader_index_memory) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path test_file = tempdir / "test_memory.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af);
+  ppk.write_to_file(test_file);
+  BinaryEventReader ber(test_file.string());
+//  the flat index tables are used in place from the mapped file
+  EXPECT_GT(64, ber.index_memory_usage());
+  EventDataHandler handler(reference, test_file.string());
+  EXPECT_EQ(ber.index_memory_usage(), handler.memory_report().get("reader_indexes"));
+//  every written position has at least one kmer index
+  ber.load_indexes();
+  EXPECT_LT(2514 * (sizeof(PositionIndex) + make_shared_memory<PosKmerIndex>()), ber.index_memory_usage());
+}
+
+TEST (MemoryReportTests, test_max_kmers_memory_report) {
+  Redirect a(true, true);
+  MaxKmers<FullSaEvent> mk(10, "ATGC", 5, 0);
+  MemoryReport empty = mk.memory_report();
+  EXPECT_EQ(1024 * sizeof(boost::heap::priority_queue<FullSaEvent>), empty.get("max_kmers_heaps"));
+  FullSaEvent event("a", 1, "string reference_kmer", "string read_file", "t",
+                    10, 20, 20, 20, "string aligned_kmer",
+                    20, 20, 1.2, 10,
+                    3, "AAAAA");
+  mk.add_to_heap(event);
+  mk.add_to_heap(event);
+  MemoryReport full = mk.memory_report();
+  EXPECT_EQ(empty.get("max_kmers_heaps") + 2 * (sizeof(FullSaEvent) + event.memory_usage()),
+            full.get("max_kmers_heaps"));
+  EXPECT_LT(0, event.memory_usage());
+}
+
+#endif //EMBED_FAST5_TESTS_SRC_MEMORYREPORTTESTS_HPP_
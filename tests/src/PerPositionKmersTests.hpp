@@ -10,6 +10,8 @@
 #include "TestFiles.hpp"
 #include "BinaryEventReader.hpp"
 #include "SplitByRefPosition.hpp"
+#include "SortedPositionKmers.hpp"
+#include "MergeEvents.hpp"
 
 //boost
 #include <boost/filesystem.hpp>
@@ -59,6 +61,7 @@ TEST (PerPositionKmersTests, test_write_to_file) {
   ppk.write_to_file(test_file);
 
   BinaryEventReader ber(test_file.string());
+  ber.load_indexes();
 
   string contig_strand = "pUC19+c";
   uint64_t position = 1770;
@@ -103,6 +106,7 @@ TEST (PerPositionKmersTests, test_split_signal_align_by_ref_position) {
                                      num_locks, n_threads, verbose, rna, two_d, {'A', 'C', 'G', 'T'});
 
   BinaryEventReader ber(output_file_path);
+  ber.load_indexes();
 
   string contig_strand = "pUC19+c";
   uint64_t position = 1770;
@@ -148,6 +152,7 @@ TEST (PerPositionKmersTests, test_rna_reads) {
                                      num_locks, n_threads, verbose, rna, two_d, {'A', 'C', 'G', 'T', 'p'});
 
   BinaryEventReader ber(output_file_path);
+  ber.load_indexes();
   string contig_strand = "ecoli_MRE600+t";
   uint64_t position = 200;
   string kmer = "AGGGG";
@@ -172,5 +177,568 @@ TEST (PerPositionKmersTests, test_rna_reads) {
   EXPECT_EQ(9, kmer_struct2->num_events());
 }
 
+/**
+Sorted copy of the events so event files written in different orders can be compared.
+Capped kmers can keep different events with tied probabilities so the means can be dropped.
+*/
+vector<pair<float, float>> sorted_events(const vector<Event>& events, bool probabilities_only=false){
+  vector<pair<float, float>> sorted;
+  for (auto &e: events){
+    sorted.emplace_back(e.posterior_probability, probabilities_only ? 0 : e.descaled_event_mean);
+  }
+  sort(sorted.begin(), sorted.end());
+  return sorted;
+}
+
+/**
+Check two event files hold the same positions, kmers and events
+*/
+void expect_same_event_files(const path& file1, const path& file2, bool probabilities_only=false){
+  BinaryEventReader ber1(file1.string());
+  ber1.load_indexes();
+  BinaryEventReader ber2(file2.string());
+  ber2.load_indexes();
+  ASSERT_EQ(ber1.indexes.size(), ber2.indexes.size());
+  for (auto &cs_pair: ber1.indexes){
+    ContigStrandIndex& csi = cs_pair.second;
+    ContigStrandIndex& csi2 = ber2.get_contig_index(csi.contig, csi.strand, csi.nanopore_strand);
+    EXPECT_EQ(csi.num_positions, csi2.num_positions);
+    ASSERT_EQ(csi.num_written_positions, csi2.num_written_positions);
+    for (auto &pos_pair: csi.position_indexes){
+      PositionIndex& pi2 = csi2.get_position_index(pos_pair.first);
+      ASSERT_EQ(pos_pair.second.num_kmers, pi2.num_kmers);
+      for (auto &kmer: pos_pair.second.get_kmers()){
+        shared_ptr<PosKmer> k1 = ber1.get_position_kmer(kmer, csi.contig, csi.strand, pos_pair.first, csi.nanopore_strand);
+        shared_ptr<PosKmer> k2 = ber2.get_position_kmer(kmer, csi.contig, csi.strand, pos_pair.first, csi.nanopore_strand);
+        ASSERT_THAT(sorted_events(k1->events, probabilities_only),
+                    ElementsAreArray(sorted_events(k2->events, probabilities_only)));
+      }
+    }
+  }
+}
+
+TEST (PerPositionKmersTests, test_split_by_ref_position_spill_to_disk) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path in_memory_file = tempdir / "in_memory.event";
+  path spilled_file = tempdir / "spilled.event";
+  for (auto &p: {in_memory_file, spilled_file}){
+    if (exists(p)){
+      remove(p);
+    }
+  }
+  vector<string> sa_input_dir = {PUC_5MER_ALIGNMENTS.string()};
+  string reference = PUC_REFERENCE.string();
+  string output_file_path = in_memory_file.string();
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'});
+//  a one byte budget spills after every alignment file
+  output_file_path = spilled_file.string();
+  SplitByRefOptions spill;
+  spill.memory_limit = 1;
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, spill);
+  EXPECT_FALSE(exists(tempdir / "spilled.event.spill"));
+  expect_same_event_files(in_memory_file, spilled_file);
+//  cap the number of events during the merge
+  for (auto &p: {in_memory_file, spilled_file}){
+    remove(p);
+  }
+  SplitByRefOptions capped;
+  capped.max_events = 3;
+  output_file_path = in_memory_file.string();
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, capped);
+  output_file_path = spilled_file.string();
+  capped.memory_limit = 1;
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, capped);
+  expect_same_event_files(in_memory_file, spilled_file, true);
+
+  BinaryEventReader ber(spilled_file.string());
+  EXPECT_EQ(3, ber.get_position_kmer("ATTGA", "pUC19", "+", 1770, "c")->num_events());
+  EXPECT_EQ(3, ber.get_position_kmer("ATTGA", "pUC19", "+", 2681, "c")->num_events());
+}
+
+TEST (PerPositionKmersTests, test_merge_event_files) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path first_dir = tempdir / "merge_first";
+  path second_dir = tempdir / "merge_second";
+  path all_file = tempdir / "merge_all.event";
+  path first_file = tempdir / "merge_first.event";
+  path second_file = tempdir / "merge_second.event";
+  path merged_file = tempdir / "merged.event";
+  for (auto &p: {first_dir, second_dir, all_file, first_file, second_file, merged_file}){
+    if (exists(p)){
+      remove_all(p);
+    }
+  }
+//  split the alignments between two runs
+  create_directories(first_dir);
+  create_directories(second_dir);
+  uint64_t i = 0;
+  string extension = ".tsv";
+  for (auto &tsv: list_files_in_dir(PUC_5MER_ALIGNMENTS, extension)){
+    copy_file(tsv, (i++ % 2 == 0 ? first_dir : second_dir) / tsv.filename());
+  }
+  string reference = PUC_REFERENCE.string();
+  for (uint64_t max_events: {0, 3}){
+    SplitByRefOptions options;
+    options.max_events = max_events;
+    for (auto &p: {all_file, first_file, second_file, merged_file}){
+      if (exists(p)){
+        remove(p);
+      }
+    }
+    vector<pair<path, path>> runs{{PUC_5MER_ALIGNMENTS, all_file}, {first_dir, first_file},
+                                  {second_dir, second_file}};
+    for (auto &run: runs){
+      string output_file_path = run.second.string();
+      split_signal_align_by_ref_position({run.first.string()}, output_file_path, reference,
+                                         1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, options);
+    }
+//    small blocks so every contig strand is written in several blocks
+    merge_event_files({first_file.string(), second_file.string()}, merged_file.string(), max_events, 3, false,
+                      false, 7);
+    expect_same_event_files(all_file, merged_file, max_events > 0);
+  }
+  EXPECT_THROW(merge_event_files({first_file.string()}, merged_file.string()), AssertionFailureException);
+}
+
+TEST (PerPositionKmersTests, test_spill_and_merge_runs) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path test_file = tempdir / "test_spill.event";
+  path spill_dir = tempdir / "test_spill";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  ppk.set_memory_limit(1, spill_dir);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af);
+  EXPECT_EQ(1, ppk.num_spills());
+  EXPECT_EQ(0, ppk.estimated_memory());
+  AlignmentFile af2((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af2);
+  EXPECT_EQ(2, ppk.num_spills());
+  ppk.write_to_file(test_file);
+  EXPECT_FALSE(exists(spill_dir));
+
+  BinaryEventReader ber(test_file.string());
+  ber.load_indexes();
+  EXPECT_EQ(2514, ber.indexes["pUC19+c"].num_written_positions);
+  EXPECT_EQ(6, ber.get_position_kmer("ATTGA", "pUC19", "+", 1770, "c")->num_events());
+  EXPECT_EQ(2, ber.get_position_kmer("ATTGA", "pUC19", "+", 2681, "c")->num_events());
+}
+
+TEST (PerPositionKmersTests, test_estimated_memory_counts_kept_events) {
+  Redirect a(true, true);
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  ppk.set_max_events(1);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af);
+  ppk.process_alignment(af);
+//  events dropped by the max_events cap are not charged
+  uint64_t num_events = 0;
+  uint64_t num_pos_kmers = 0;
+  for (auto &nanopore_strand: {"t", "c"}){
+    for (auto &position: ppk.data.get_contig_strand("pUC19", "+", nanopore_strand).positions){
+      for (auto &pos_kmer: position.get_kmer_pointers()){
+        num_events += pos_kmer->num_events();
+        num_pos_kmers += 1;
+      }
+    }
+  }
+  EXPECT_LT(0, num_pos_kmers);
+  EXPECT_EQ(num_pos_kmers, num_events);
+  EXPECT_EQ(num_pos_kmers, ppk.data.get_num_pos_kmers());
+  EXPECT_EQ(num_events * sizeof(Event) + num_pos_kmers * ppk.pos_kmer_overhead(), ppk.estimated_memory());
+}
+
+TEST (PerPositionKmersTests, test_parallel_write_to_file) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path serial_file = tempdir / "serial.event";
+  path parallel_file = tempdir / "parallel.event";
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  for (bool compress: {false, true}){
+    for (auto &p: {serial_file, parallel_file}){
+      if (exists(p)){
+        remove(p);
+      }
+    }
+    PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+    ppk.set_compression(compress);
+    for (auto &tsv: {"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv",
+                     "03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv"}){
+      AlignmentFile af((PUC_5MER_ALIGNMENTS/tsv).string());
+      ppk.process_alignment(af);
+    }
+    ppk.write_to_file(serial_file);
+    ppk.write_to_file(parallel_file, 4);
+    EXPECT_EQ(file_size(serial_file), file_size(parallel_file));
+    expect_same_event_files(serial_file, parallel_file);
+    BinaryEventReader ber(parallel_file.string());
+    EXPECT_EQ(compress, ber.compressed);
+    EXPECT_EQ(2, ber.get_position_kmer("ATTGA", "pUC19", "+", 2681, "c")->num_events());
+  }
+}
+
+TEST (PerPositionKmersTests, test_sort_event_records) {
+  Redirect a(true, true);
+  vector<vector<SortedEventRecord>> buffers(5);
+  vector<SortedEventRecord> expected;
+  uint64_t state = 42;
+  uint64_t key_range = 1ULL << 33;
+  for (uint64_t i = 0; i < 20000; ++i){
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    SortedEventRecord record{(state >> 20) % key_range, (state >> 7) & 0xfff, (float) i, 0};
+    buffers[i % buffers.size()].push_back(record);
+    expected.push_back(record);
+  }
+  auto key_less = [](const SortedEventRecord& a, const SortedEventRecord& b){
+    return a.position_key < b.position_key or (a.position_key == b.position_key and a.kmer < b.kmer);
+  };
+  std::stable_sort(expected.begin(), expected.end(), key_less);
+//  few buckets so the radix passes over the position key are used
+  vector<SortedEventRecord> sorted = sort_event_records(buffers, key_range, 3, 4);
+  EXPECT_TRUE(buffers.empty());
+  ASSERT_EQ(expected.size(), sorted.size());
+  for (uint64_t i = 0; i < sorted.size(); ++i){
+    ASSERT_EQ(expected[i].position_key, sorted[i].position_key);
+    ASSERT_EQ(expected[i].kmer, sorted[i].kmer);
+  }
+}
+
+TEST (PerPositionKmersTests, test_sorted_position_kmers) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path test_file = tempdir / "test_sorted.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  SortedPositionKmers spk(reference, {'A', 'C', 'G', 'T'}, 5, 2, true);
+  EXPECT_EQ("ATTGA", spk.unpack_kmer(spk.pack_kmer("ATTGA")));
+  EXPECT_LT(spk.pack_kmer("ATTGA"), spk.pack_kmer("ATTGC"));
+  EXPECT_THROW(spk.pack_kmer("ATTGN"), AssertionFailureException);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  spk.process_alignment(af);
+  EXPECT_LT(0, spk.get_num_events());
+  spk.write_to_file(test_file);
+  EXPECT_EQ(0, spk.get_num_events());
+
+  BinaryEventReader ber(test_file.string());
+  ber.load_indexes();
+  EXPECT_EQ(4, ber.indexes.size());
+  EXPECT_EQ(2686, ber.indexes["pUC19+c"].num_positions);
+  EXPECT_EQ(2514, ber.indexes["pUC19+c"].num_written_positions);
+  EXPECT_EQ(3, ber.get_position_kmer("ATTGA", "pUC19", "+", 1770, "c")->num_events());
+  EXPECT_EQ(1, ber.get_position_kmer("ATTGA", "pUC19", "+", 2681, "c")->num_events());
+}
+
+TEST (PerPositionKmersTests, test_split_by_ref_position_sort_engine) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path hash_file = tempdir / "hash_engine.event";
+  path sort_file = tempdir / "sort_engine.event";
+  vector<string> sa_input_dir = {PUC_5MER_ALIGNMENTS.string()};
+  string reference = PUC_REFERENCE.string();
+  for (uint64_t max_events: {0, 3}){
+    SplitByRefOptions options;
+    options.max_events = max_events;
+    for (auto &p: {hash_file, sort_file}){
+      if (exists(p)){
+        remove(p);
+      }
+    }
+    string output_file_path = hash_file.string();
+    split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                       1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, options);
+    output_file_path = sort_file.string();
+    options.engine = "sort";
+    split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                       1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, options);
+    expect_same_event_files(hash_file, sort_file, max_events > 0);
+  }
+  remove(sort_file);
+  string output_file_path = sort_file.string();
+  SplitByRefOptions spill;
+  spill.memory_limit = 1;
+  spill.engine = "sort";
+  EXPECT_THROW(split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                                  1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, spill),
+               AssertionFailureException);
+}
+
+TEST (PerPositionKmersTests, test_split_by_ref_position_kmer_major) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path position_major_file = tempdir / "position_major.event";
+  path kmer_major_file = tempdir / "kmer_major.event";
+  for (auto &p: {position_major_file, kmer_major_file}){
+    if (exists(p)){
+      remove(p);
+    }
+  }
+  vector<string> sa_input_dir = {PUC_5MER_ALIGNMENTS.string()};
+  string reference = PUC_REFERENCE.string();
+  string output_file_path = position_major_file.string();
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'});
+  output_file_path = kmer_major_file.string();
+  SplitByRefOptions kmer_major_options;
+  kmer_major_options.engine = "sort";
+  kmer_major_options.kmer_major = true;
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, kmer_major_options);
+  ReferenceHandler rh(reference);
+  EventDataHandler position_major(rh, position_major_file.string());
+  EventDataHandler kmer_major(rh, kmer_major_file.string());
+//  the engines agree on the events but may store them in a different heap order
+  for (auto &kmer: {"ATTGA", "GGCCA", "TTTTT"}){
+    Kmer& expected = position_major.get_kmer(kmer);
+    Kmer& k = kmer_major.get_kmer(kmer);
+    ASSERT_EQ(expected.pos_kmer_map.size(), k.pos_kmer_map.size());
+    for (auto &pos_kmer_pair: expected.pos_kmer_map){
+      EXPECT_THAT(k.pos_kmer_map.at(pos_kmer_pair.first)->events,
+                  ::testing::UnorderedElementsAreArray(pos_kmer_pair.second->events));
+    }
+  }
+}
+
+TEST (PerPositionKmersTests, test_split_by_ref_position_compress) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path raw_file = tempdir / "raw.event";
+  path compressed_file = tempdir / "compressed.event";
+  for (auto &p: {raw_file, compressed_file}){
+    if (exists(p)){
+      remove(p);
+    }
+  }
+  vector<string> sa_input_dir = {PUC_5MER_ALIGNMENTS.string()};
+  string reference = PUC_REFERENCE.string();
+  string output_file_path = raw_file.string();
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'});
+  output_file_path = compressed_file.string();
+  SplitByRefOptions compress;
+  compress.compress = true;
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, compress);
+//  payloads are about half the size, the rest of the file is index tables
+  EXPECT_LT(file_size(compressed_file), file_size(raw_file) * 4 / 5);
+
+  BinaryEventReader raw(raw_file.string());
+  BinaryEventReader compressed(compressed_file.string());
+  EXPECT_FALSE(raw.compressed);
+  EXPECT_TRUE(compressed.compressed);
+  raw.load_indexes();
+  for (auto &cs_pair: raw.indexes){
+    ContigStrandIndex& csi = cs_pair.second;
+    for (auto &pos_pair: csi.position_indexes){
+      for (auto &kmer: pos_pair.second.get_kmers()){
+        shared_ptr<PosKmer> k1 = raw.get_position_kmer(kmer, csi.contig, csi.strand, pos_pair.first, csi.nanopore_strand);
+        shared_ptr<PosKmer> k2 = compressed.get_position_kmer(kmer, csi.contig, csi.strand, pos_pair.first,
+                                                              csi.nanopore_strand);
+        ASSERT_EQ(k1->events.size(), k2->events.size());
+        for (uint64_t i = 0; i < k1->events.size(); ++i){
+          EXPECT_NEAR(k1->events[i].descaled_event_mean, k2->events[i].descaled_event_mean, 0.0051);
+          EXPECT_NEAR(k1->events[i].posterior_probability, k2->events[i].posterior_probability, 1.0 / 65535);
+        }
+      }
+    }
+  }
+}
+
+TEST (PerPositionKmersTests, test_lazy_by_kmer_index) {
+  Redirect a(true, true);
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af);
+  EXPECT_FALSE(ppk.data.is_by_kmer_index_built());
+  uint64_t expected = 0;
+  for (auto &cs: {"+t", "+c", "-t", "-c"}){
+    for (auto &position: ppk.data.get_contig_strand("pUC19", string(1, cs[0]), string(1, cs[1])).positions){
+      expected += position.has_kmer("ATTGA");
+    }
+  }
+  ppk.data.set_index_threads(3);
+  Kmer& kmer = ppk.data.get_kmer("ATTGA");
+  EXPECT_TRUE(ppk.data.is_by_kmer_index_built());
+  EXPECT_LT(0, expected);
+  EXPECT_EQ(expected, kmer.pos_kmer_map.size());
+  EXPECT_EQ(3, kmer.get_pos_kmer("pUC19+c", 1770)->num_events());
+//  a new PosKmer marks the index stale and the next query picks it up
+  ppk.data.add_kmer_event("pUC19", "+", "c", 10, "ATTGA", 1, 1);
+  EXPECT_FALSE(ppk.data.is_by_kmer_index_built());
+  EXPECT_EQ(expected + 1, ppk.data.get_kmer("ATTGA").pos_kmer_map.size());
+}
+
+TEST (PerPositionKmersTests, test_parallel_by_kmer_index) {
+  Redirect a(true, true);
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  PerPositionKmers serial(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  PerPositionKmers parallel(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  serial.process_alignment(af);
+  parallel.process_alignment(af);
+  parallel.data.set_index_threads(4);
+  serial.data.build_by_kmer_index();
+  parallel.data.build_by_kmer_index();
+  uint64_t num_pos_kmers = 0;
+  uint64_t kmer_length = 5;
+  for (auto &k: all_string_permutations("ACGT", kmer_length)){
+    Kmer& expected = serial.data.get_kmer(k);
+    Kmer& kmer = parallel.data.get_kmer(k);
+//    positions are added in the same order whatever the number of threads
+    EXPECT_EQ(expected.contig_positions, kmer.contig_positions);
+    num_pos_kmers += kmer.pos_kmer_map.size();
+  }
+  EXPECT_LT(0, num_pos_kmers);
+}
+
+TEST (PerPositionKmersTests, test_query_region_bulk_mode) {
+  Redirect a(true, true);
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, false);
+  ppk.data.set_max_events(3);
+  ppk.data.set_bulk_factor(4);
+//  the bulk buffer holds more than max_events unordered events until it is finalized
+  for (uint64_t i = 0; i < 20; ++i){
+    ppk.data.add_kmer_event("pUC19", "+", "t", 10, "ATTGA", (float) i, (float) i / 20);
+  }
+  ppk.data.add_kmer_event("pUC19", "+", "t", 11, "TTGAC", 1, 0.5);
+  RegionEvents region;
+  ppk.data.query_region(region, "pUC19", "+", 10, 12, "t");
+  ASSERT_EQ(2, region.num_kmers());
+  EXPECT_THAT(region.positions, testing::ElementsAre(10, 11));
+  EXPECT_EQ(4, region.num_events());
+  vector<float> means(region.descaled_event_means.begin(), region.descaled_event_means.begin() + 3);
+  std::sort(means.begin(), means.end());
+  EXPECT_THAT(means, testing::ElementsAre(17, 18, 19));
+//  same events as the written file
+  path test_file = temp_directory_path() / "test_query_region_bulk.event";
+  ppk.write_to_file(test_file);
+  BinaryEventReader reader(test_file.string());
+  RegionEvents file_region;
+  reader.query_region(file_region, "pUC19", "+", 10, 12, "t");
+  EXPECT_EQ(region.positions, file_region.positions);
+  EXPECT_EQ(region.kmers, file_region.kmers);
+  EXPECT_EQ(region.descaled_event_means, file_region.descaled_event_means);
+  EXPECT_EQ(region.posterior_probabilities, file_region.posterior_probabilities);
+  remove(test_file);
+}
+
+TEST (PerPositionKmersTests, test_concurrent_queries) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path test_file = tempdir / "test_concurrent.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af);
+  ppk.write_to_file(test_file);
+  vector<uint64_t> positions;
+  for (uint64_t i = 0; i < 2686; ++i){
+    if (ppk.data.get_position("pUC19", "+", "c", i).has_data){
+      positions.push_back(i);
+    }
+  }
+  vector<string> kmers = {"ATTGA", "GGCCA", "TTTTT", "CAGGA"};
+//  threads query overlapping positions and kmers, with and without a cache budget small enough to evict
+  for (uint64_t budget: {(uint64_t) 0, (uint64_t) 8192}){
+    EventDataHandler handler(reference, test_file.string());
+    handler.set_cache_budget(budget);
+    handler.set_num_locks(7);
+    std::atomic<uint64_t> mismatches(0);
+    run_on_threads(8, [&](uint64_t thread_index){
+      for (uint64_t j = thread_index; j < positions.size() + thread_index; ++j){
+        uint64_t i = positions[j % positions.size()];
+        Position pos = handler.query_position("pUC19", "+", "c", i);
+        Position& expected = ppk.data.get_position("pUC19", "+", "c", i);
+        for (auto &k: expected.get_kmer_strings()){
+          if (!pos.has_kmer(k) or pos.get_pos_kmer(k)->num_events() != expected.get_pos_kmer(k)->num_events() or
+              handler.get_position_kmer("pUC19", "+", "c", i, k)->num_events() != expected.get_pos_kmer(k)->num_events()){
+            mismatches += 1;
+          }
+        }
+        if (j % 100 == 0){
+          Kmer kmer = handler.query_kmer(kmers[j % kmers.size()]);
+          if (kmer.pos_kmer_map.size() != ppk.data.get_kmer(kmer.kmer).pos_kmer_map.size()){
+            mismatches += 1;
+          }
+        }
+      }
+    });
+    EXPECT_EQ(0, mismatches);
+    EventCacheStats stats = handler.get_cache_stats();
+    EXPECT_LE(8 * positions.size(), stats.hits + stats.misses);
+    EXPECT_EQ(budget > 0, stats.evictions > 0);
+  }
+}
+
+TEST (PerPositionKmersTests, test_split_by_ref_position_stream) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path in_memory_file = tempdir / "in_memory.event";
+  path streamed_file = tempdir / "streamed.event";
+  for (auto &p: {in_memory_file, streamed_file}){
+    if (exists(p)){
+      remove(p);
+    }
+  }
+  vector<string> sa_input_dir = {PUC_5MER_ALIGNMENTS.string()};
+  string reference = PUC_REFERENCE.string();
+  string output_file_path = in_memory_file.string();
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'});
+  output_file_path = streamed_file.string();
+  SplitByRefOptions stream;
+  stream.stream = true;
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, stream);
+  expect_same_event_files(in_memory_file, streamed_file);
+  remove(streamed_file);
+  stream.memory_limit = 1;
+  EXPECT_THROW(split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                                  1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, stream),
+               AssertionFailureException);
+}
+
+TEST (PerPositionKmersTests, test_flush_contig) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  path test_file = tempdir / "test_flush.event";
+  if (exists(test_file)){
+    remove(test_file);
+  }
+  ReferenceHandler reference(PUC_REFERENCE.string());
+  PerPositionKmers ppk(reference, {'A', 'C', 'G', 'T'}, 5, 1000, true);
+  AlignmentFile af((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  ppk.process_alignment(af);
+  EXPECT_THROW(ppk.flush_contig("pUC19"), AssertionFailureException);
+  ppk.open_stream(test_file);
+  EXPECT_LT(0, ppk.flush_contig("pUC19"));
+//  flushed positions are released and can not take more events
+  EXPECT_FALSE(ppk.data.get_position("pUC19", "+", "c", 1770).has_data);
+  AlignmentFile af2((PUC_5MER_ALIGNMENTS/"03274a9a-0eab-422e-ace7-b35fd3a0f48c.sm.forward.tsv").string());
+  EXPECT_THROW(ppk.process_alignment(af2), AssertionFailureException);
+  EXPECT_EQ(0, ppk.flush_contig("pUC19"));
+  ppk.close_stream();
+
+  BinaryEventReader ber(test_file.string());
+  EXPECT_EQ(3, ber.get_position_kmer("ATTGA", "pUC19", "+", 1770, "c")->num_events());
+  EXPECT_EQ(1, ber.get_position_kmer("ATTGA", "pUC19", "+", 2681, "c")->num_events());
+}
 
 #endif //EMBED_FAST5_TESTS_SRC_PERPOSITIONKMERSTESTS_HPP_
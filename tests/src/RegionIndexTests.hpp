@@ -0,0 +1,156 @@
+#ifndef EMBED_FAST5_TESTS_SRC_REGIONINDEXTESTS_HPP_
+#define EMBED_FAST5_TESTS_SRC_REGIONINDEXTESTS_HPP_
+
+// embed source
+#include "RegionIndex.hpp"
+#include "AlignmentFile.hpp"
+#include "BinaryEventReader.hpp"
+#include "SplitByRefPosition.hpp"
+#include "TestFiles.hpp"
+// boost
+#include <boost/filesystem.hpp>
+// gtest
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+// Standard Libray
+#include <fstream>
+
+using namespace std;
+using namespace boost::filesystem;
+using namespace test_files;
+
+void write_bed_file(const path& bed_path, const string& contents){
+  std::ofstream bed_file(bed_path.string());
+  bed_file << contents;
+}
+
+TEST (RegionIndexTests, test_load_bed) {
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path bed_path = tempdir / "regions.bed";
+  write_bed_file(bed_path, "track name=targets\n"
+                           "# comment\n"
+                           "chr1\t100\t110\n"
+                           "chr1\t105\t120\tsite\t0\t.\n"
+                           "chr1\t120\t130\tsite\t0\t+\n"
+                           "chr1\t200\t201\tsite\t0\t-\n"
+                           "chr2\t5\t6\r\n");
+  RegionIndex regions(bed_path.string());
+//  chr1+ [100, 130), chr1- [100, 120) [200, 201) and chr2 [5, 6) on both strands
+  EXPECT_EQ(5, regions.num_intervals());
+  const RegionIntervals* plus = regions.get_intervals("chr1", "+");
+  ASSERT_TRUE(plus != nullptr);
+  EXPECT_THAT(plus->starts, testing::ElementsAre(100));
+  EXPECT_THAT(plus->ends, testing::ElementsAre(130));
+  EXPECT_TRUE(regions.contains("chr1", "+", 100));
+  EXPECT_TRUE(regions.contains("chr1", "+", 129));
+  EXPECT_FALSE(regions.contains("chr1", "+", 130));
+  EXPECT_FALSE(regions.contains("chr1", "+", 99));
+  EXPECT_TRUE(regions.contains("chr1", "-", 119));
+  EXPECT_FALSE(regions.contains("chr1", "-", 120));
+  EXPECT_TRUE(regions.contains("chr1", "-", 200));
+  EXPECT_FALSE(regions.contains("chr1", "+", 200));
+  EXPECT_TRUE(regions.contains("chr2", "+", 5));
+  EXPECT_FALSE(regions.contains("chr3", "+", 5));
+  EXPECT_TRUE(regions.overlaps("chr1", "+", 95, 101));
+  EXPECT_FALSE(regions.overlaps("chr1", "+", 95, 100));
+  EXPECT_TRUE(regions.get_intervals("chr3", "+") == nullptr);
+
+  write_bed_file(bed_path, "chr1\t110\t100\n");
+  EXPECT_THROW(RegionIndex bad(bed_path.string()), AssertionFailureException);
+  write_bed_file(bed_path, "chr1\tten\t100\n");
+  EXPECT_THROW(RegionIndex bad(bed_path.string()), AssertionFailureException);
+  write_bed_file(bed_path, "chr1\t10\t100\tsite\t0\tx\n");
+  EXPECT_THROW(RegionIndex bad(bed_path.string()), AssertionFailureException);
+  EXPECT_THROW(RegionIndex bad((tempdir / "missing.bed").string()), AssertionFailureException);
+  remove_all(tempdir);
+}
+
+TEST (RegionIndexTests, test_variant_calls_in_regions) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path bed_path = tempdir / "regions.bed";
+  write_bed_file(bed_path, "ecoli_MRE600\t85\t100\n");
+  RegionIndex regions(bed_path.string());
+  std::map<string, string> ambig_bases = create_ambig_bases();
+  string bases = "YK";
+  AlignmentFile af(RRNA_TEST_VARIANTS.string(), true);
+  vector<VariantCall> all_calls = af.get_variant_calls(bases, &ambig_bases);
+  af.set_regions(&regions);
+  VariantCallScratch scratch;
+  vector<VariantCall> region_calls;
+  af.get_variant_calls(bases, &ambig_bases, scratch, region_calls);
+  vector<VariantCall> expected;
+  for (auto &call: all_calls){
+    if (call.reference_index >= 85 and call.reference_index < 100){
+      expected.push_back(call);
+    }
+  }
+  ASSERT_LT(0, expected.size());
+  ASSERT_LT(expected.size(), all_calls.size());
+  ASSERT_EQ(expected.size(), region_calls.size());
+  for (size_t i = 0; i < expected.size(); ++i){
+    EXPECT_EQ(expected[i].reference_index, region_calls[i].reference_index);
+    EXPECT_EQ(expected[i].bases, region_calls[i].bases);
+    ASSERT_EQ(expected[i].normalized_probs.size(), region_calls[i].normalized_probs.size());
+    for (size_t j = 0; j < expected[i].normalized_probs.size(); ++j){
+      EXPECT_DOUBLE_EQ(expected[i].normalized_probs[j], region_calls[i].normalized_probs[j]);
+    }
+  }
+  RegionFilterStats stats = regions.get_stats();
+  EXPECT_LT(0, stats.skipped_rows);
+  EXPECT_LT(stats.skipped_rows, stats.rows);
+//  the event iterator skips the same rows
+  uint64_t num_events = 0;
+  for (auto &event: af.iterate()){
+    EXPECT_TRUE(event.reference_index + af.k > 85 and event.reference_index < 100);
+    num_events += 1;
+  }
+  EXPECT_EQ(2 * stats.rows, regions.get_stats().rows);
+  EXPECT_EQ(stats.rows - stats.skipped_rows, num_events);
+//  a contig without regions skips every row
+  write_bed_file(bed_path, "other\t85\t100\n");
+  RegionIndex other_regions(bed_path.string());
+  af.set_regions(&other_regions);
+  af.get_variant_calls(bases, &ambig_bases, scratch, region_calls);
+  EXPECT_TRUE(region_calls.empty());
+  EXPECT_EQ(other_regions.get_stats().rows, other_regions.get_stats().skipped_rows);
+  remove_all(tempdir);
+}
+
+TEST (RegionIndexTests, test_split_by_ref_position_regions) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path bed_path = tempdir / "regions.bed";
+  path all_file = tempdir / "all.event";
+  path region_file = tempdir / "region.event";
+  write_bed_file(bed_path, "pUC19\t1765\t1775\tsite\t0\t+\n");
+  vector<string> sa_input_dir = {PUC_5MER_ALIGNMENTS.string()};
+  string reference = PUC_REFERENCE.string();
+  string output_file_path = all_file.string();
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'});
+  output_file_path = region_file.string();
+  SplitByRefOptions options;
+  options.regions_bed = bed_path.string();
+  split_signal_align_by_ref_position(sa_input_dir, output_file_path, reference,
+                                     1000, 2, false, false, true, {'A', 'C', 'G', 'T'}, options);
+  BinaryEventReader all_reader(all_file.string());
+  BinaryEventReader region_reader(region_file.string());
+  for (const string nanopore_strand: {"t", "c"}){
+    RegionEvents expected;
+    RegionEvents events;
+//    5mers starting at 1761 overlap 1765
+    all_reader.query_region(expected, "pUC19", "+", 1761, 1775, nanopore_strand);
+    region_reader.query_region(events, "pUC19", "+", 0, 3000, nanopore_strand);
+    ASSERT_LT(0, expected.num_events());
+    EXPECT_EQ(expected.positions, events.positions);
+    EXPECT_EQ(expected.kmers, events.kmers);
+    EXPECT_EQ(expected.num_events(), events.num_events());
+  }
+  remove_all(tempdir);
+}
+
+#endif //EMBED_FAST5_TESTS_SRC_REGIONINDEXTESTS_HPP_
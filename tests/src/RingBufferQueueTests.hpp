@@ -0,0 +1,162 @@
+#ifndef EMBED_FAST5_TESTS_SRC_RINGBUFFERQUEUETESTS_HPP_
+#define EMBED_FAST5_TESTS_SRC_RINGBUFFERQUEUETESTS_HPP_
+
+// embed source
+#include "RingBufferQueue.hpp"
+#include "ConcurrentQueue.hpp"
+#include "EmbedUtils.hpp"
+// gtest
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+// Standard Libray
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <thread>
+
+using namespace std;
+
+TEST (RingBufferQueueTests, test_push_and_pop) {
+  RingBufferQueue<unique_ptr<int>> rb(3);
+  EXPECT_EQ(4, rb.capacity());
+  for (int i = 0; i < 4; ++i){
+    EXPECT_TRUE(rb.push(unique_ptr<int>(new int(i))));
+  }
+  unique_ptr<int> extra(new int(4));
+  EXPECT_FALSE(rb.try_push(extra));
+  EXPECT_TRUE(extra != nullptr);
+  EXPECT_EQ(4, rb.size());
+  unique_ptr<int> value;
+  EXPECT_TRUE(rb.try_pop(value));
+  EXPECT_EQ(0, *value);
+  EXPECT_TRUE(rb.try_push(extra));
+  EXPECT_TRUE(extra == nullptr);
+  vector<unique_ptr<int>> popped;
+  EXPECT_EQ(2, rb.pop_bulk(popped, 2));
+  EXPECT_EQ(2, rb.pop_bulk(popped));
+  ASSERT_EQ(4, popped.size());
+  for (int i = 0; i < 4; ++i){
+    EXPECT_EQ(i + 1, *popped[i]);
+  }
+  EXPECT_TRUE(rb.empty());
+  EXPECT_FALSE(rb.try_pop(value));
+//  items pushed before stop are still handed out
+  rb.push(unique_ptr<int>(new int(5)));
+  rb.stop();
+  EXPECT_TRUE(rb.wait_and_pop(value));
+  EXPECT_EQ(5, *value);
+  EXPECT_FALSE(rb.wait_and_pop(value));
+  EXPECT_EQ(6, rb.get_stats().pushed);
+  EXPECT_EQ(6, rb.get_stats().popped);
+}
+
+TEST (RingBufferQueueTests, test_full_queue_waits) {
+  RingBufferQueue<int> rb(2);
+  rb.push(1);
+  rb.push(2);
+  std::atomic<bool> pushed(false);
+  std::thread producer([&](){
+    rb.push(3);
+    pushed = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(pushed);
+  int value;
+  EXPECT_TRUE(rb.wait_and_pop(value));
+  EXPECT_EQ(1, value);
+  producer.join();
+  EXPECT_TRUE(pushed);
+  EXPECT_EQ(1, rb.get_stats().full_waits);
+//  2 and 3 fill the queue, a producer waiting for room gives up once it is stopped
+  EXPECT_EQ(2, rb.size());
+  std::thread blocked([&](){
+    EXPECT_FALSE(rb.push(4));
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  rb.stop();
+  blocked.join();
+}
+
+TEST (RingBufferQueueTests, test_stop_while_full) {
+  RingBufferQueue<int> rb(2);
+  rb.push(1);
+  rb.push(2);
+  vector<int> items = {3, 4, 5};
+  size_t dropped = 0;
+  std::thread producer([&](){
+    dropped = rb.push_bulk(items);
+  });
+  while (rb.get_stats().full_waits == 0){
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  rb.stop();
+  producer.join();
+//  nothing fit so every item is handed back to the producer
+  EXPECT_EQ(3, dropped);
+  EXPECT_THAT(items, testing::ElementsAre(3, 4, 5));
+//  items queued before stop still drain and room freed after stop is still usable
+  int value;
+  EXPECT_TRUE(rb.wait_and_pop(value));
+  EXPECT_EQ(1, value);
+  EXPECT_EQ(2, rb.push_bulk(items));
+  EXPECT_THAT(items, testing::ElementsAre(4, 5));
+  EXPECT_TRUE(rb.wait_and_pop(value));
+  EXPECT_EQ(2, value);
+  EXPECT_TRUE(rb.wait_and_pop(value));
+  EXPECT_EQ(3, value);
+  EXPECT_FALSE(rb.wait_and_pop(value));
+}
+
+/**
+Push num_items from each producer through the queue to one consumer and return the microseconds it took
+*/
+template<class Queue>
+int64_t time_handoff(Queue& queue, uint64_t num_producers, uint64_t num_items, uint64_t& total){
+  auto start = std::chrono::steady_clock::now();
+  vector<thread> producers;
+  for (uint64_t p = 0; p < num_producers; ++p){
+    producers.emplace_back([&queue, num_items](){
+      for (uint64_t i = 0; i < num_items; ++i){
+        queue.push(i + 1);
+      }
+    });
+  }
+  total = 0;
+  std::thread consumer([&queue, &total](){
+    uint64_t value;
+    while (queue.wait_and_pop(value)){
+      total += value;
+    }
+  });
+  for (auto &t: producers){
+    t.join();
+  }
+  queue.stop();
+  consumer.join();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+TEST (RingBufferQueueTests, test_handoff_timing) {
+  embed_utils::Redirect a(true, true);
+  uint64_t num_items = 200000;
+  for (uint64_t num_producers: {1, 4}){
+    uint64_t expected = num_producers * num_items * (num_items + 1) / 2;
+    ConcurrentQueue<uint64_t> unbounded;
+    ConcurrentQueue<uint64_t> bounded(1024);
+    RingBufferQueue<uint64_t> ring(1024);
+    uint64_t unbounded_total;
+    uint64_t bounded_total;
+    uint64_t ring_total;
+    auto unbounded_time = time_handoff(unbounded, num_producers, num_items, unbounded_total);
+    auto bounded_time = time_handoff(bounded, num_producers, num_items, bounded_total);
+    auto ring_time = time_handoff(ring, num_producers, num_items, ring_total);
+    std::cout << num_producers << " producers: ConcurrentQueue " << unbounded_time << "us ConcurrentQueue(1024) "
+              << bounded_time << "us RingBufferQueue(1024) " << ring_time << "us\n";
+    EXPECT_EQ(expected, unbounded_total);
+    EXPECT_EQ(expected, bounded_total);
+    EXPECT_EQ(expected, ring_total);
+    EXPECT_EQ(num_producers * num_items, ring.get_stats().popped);
+  }
+}
+
+#endif //EMBED_FAST5_TESTS_SRC_RINGBUFFERQUEUETESTS_HPP_
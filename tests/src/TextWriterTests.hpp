@@ -0,0 +1,99 @@
+#ifndef EMBED_FAST5_TESTS_SRC_TEXTWRITERTESTS_HPP_
+#define EMBED_FAST5_TESTS_SRC_TEXTWRITERTESTS_HPP_
+
+// embed source
+#include "TextWriter.hpp"
+// boost
+#include <boost/filesystem.hpp>
+// gtest
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+// zlib
+#include <zlib.h>
+// Standard Libray
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+using namespace boost::filesystem;
+
+string read_text_file(const path& file_path){
+  std::ifstream in_file(file_path.string());
+  stringstream contents;
+  contents << in_file.rdbuf();
+  return contents.str();
+}
+
+string read_gzip_file(const path& file_path){
+  gzFile in_file = gzopen(file_path.string().c_str(), "rb");
+  string contents;
+  char buffer[4096];
+  int length;
+  while ((length = gzread(in_file, buffer, sizeof(buffer))) > 0){
+    contents.append(buffer, length);
+  }
+  gzclose(in_file);
+  return contents;
+}
+
+/**
+Write the same values to a TextWriter and an ostringstream
+*/
+template<class Stream>
+void write_test_values(Stream& out){
+  out << "read_id" << ',' << string("contig") << '\t';
+  out << 0 << ',' << -1 << ',' << 42u << ',' << (uint64_t) 18446744073709551615ULL << ','
+      << numeric_limits<int64_t>::min() << ',' << numeric_limits<int64_t>::max() << '\n';
+  out << 0.1 << ',' << 1.0 << ',' << -2.5 << ',' << 1e-7 << ',' << 123456789.0 << ',' << 0.123456789 << ','
+      << 0.0f << ',' << 0.7f << ',' << 83.4521f << ',' << (float) 1e20 << '\n';
+}
+
+TEST (TextWriterTests, test_formatting_matches_ostream) {
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path out_path = tempdir / "test_format.csv";
+  ostringstream expected;
+  write_test_values(expected);
+  for (bool async: {true, false}){
+    TextWriter writer(out_path, false, TextWriter::DEFAULT_BUFFER_SIZE, async);
+    write_test_values(writer);
+    writer.close();
+    EXPECT_TRUE(writer.good());
+    EXPECT_EQ(expected.str(), read_text_file(out_path));
+    EXPECT_EQ(expected.str().size(), writer.bytes_written());
+  }
+  remove_all(tempdir);
+}
+
+TEST (TextWriterTests, test_small_buffers_and_gzip) {
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  ostringstream expected;
+  for (uint64_t i = 0; i < 10000; ++i){
+    expected << "contig\t" << i << '\t' << i * 0.25 << '\n';
+  }
+//  a 64 byte buffer forces thousands of hand offs to the writer thread
+  for (bool compress: {false, true}){
+    for (bool async: {true, false}){
+      path out_path = tempdir / (compress ? "test_buffers.tsv.gz" : "test_buffers.tsv");
+      {
+        TextWriter writer(out_path, compress, 64, async);
+        for (uint64_t i = 0; i < 10000; ++i){
+          writer << "contig\t" << i << '\t' << i * 0.25 << '\n';
+        }
+      }
+      EXPECT_EQ(expected.str(), compress ? read_gzip_file(out_path) : read_text_file(out_path));
+    }
+  }
+  EXPECT_LT(file_size(tempdir / "test_buffers.tsv.gz"), file_size(tempdir / "test_buffers.tsv"));
+  remove_all(tempdir);
+}
+
+TEST (TextWriterTests, test_open_failure) {
+  path missing = temp_directory_path() / "missing_text_writer_dir" / "out.tsv";
+  ASSERT_THROW(TextWriter writer(missing), AssertionFailureException);
+  ASSERT_THROW(TextWriter writer(missing, true), AssertionFailureException);
+}
+
+#endif //EMBED_FAST5_TESTS_SRC_TEXTWRITERTESTS_HPP_
@@ -0,0 +1,142 @@
+#ifndef EMBED_FAST5_TESTS_SRC_VARIANTCALLFILETESTS_HPP_
+#define EMBED_FAST5_TESTS_SRC_VARIANTCALLFILETESTS_HPP_
+
+// embed source
+#include "VariantCallWriter.hpp"
+#include "VariantCallReader.hpp"
+#include "AlignmentFile.hpp"
+#include "TestFiles.hpp"
+// boost
+#include <boost/filesystem.hpp>
+// gtest
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+// Standard Libray
+#include <cmath>
+#include <fstream>
+
+using namespace std;
+using namespace boost::filesystem;
+using namespace test_files;
+
+VariantCall make_variant_call(const string& contig, const string& strand, uint64_t reference_index,
+                              const string& bases, const vector<double>& probs){
+  VariantCall call(contig, strand, reference_index, bases);
+  call.normalized_probs = probs;
+  return call;
+}
+
+TEST (VariantCallFileTests, test_write_and_read) {
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path calls_path = tempdir / "test.calls";
+  vector<pair<string, vector<VariantCall>>> reads = {
+      {"read1", {make_variant_call("contig1", "+", 10, "CE", {0.25, 0.75}),
+                 make_variant_call("contig1", "+", 12, "ACE", {0.5, 0.25, 0.25})}},
+      {"read2", {}},
+      {"read3", {make_variant_call("contig2", "-", 3, "CE", {1, 0}),
+                 make_variant_call("contig1", "-", 7, "GT", {0.125, 0.875}),
+                 make_variant_call("contig2", "-", 9, "CE", {0, 1})}}};
+  {
+//    row groups of 2 calls split read3 across groups
+    VariantCallWriter writer(calls_path, 3, 2);
+    for (auto &read: reads){
+      writer.add_read(read.first, read.second);
+    }
+    EXPECT_EQ(5, writer.num_rows());
+    writer.close();
+  }
+  VariantCallReader reader(calls_path.string());
+  EXPECT_EQ(5, reader.num_rows());
+  EXPECT_EQ(3, reader.num_row_groups());
+  EXPECT_EQ(3, reader.max_n_variants());
+  EXPECT_THAT(reader.get_read_ids(), testing::ElementsAre("read1", "read3"));
+  EXPECT_THAT(reader.get_contigs(), testing::ElementsAre("contig1", "contig2"));
+  EXPECT_THAT(reader.get_variants(), testing::ElementsAre("CE", "ACE", "GT"));
+  VariantCallColumns columns;
+  reader.read_all(columns);
+  ASSERT_EQ(5, columns.num_rows());
+  EXPECT_THAT(columns.read_rows, testing::ElementsAre(0, 0, 1, 1, 1));
+  EXPECT_THAT(columns.contig_rows, testing::ElementsAre(0, 0, 1, 0, 1));
+  EXPECT_THAT(columns.positions, testing::ElementsAre(10, 12, 3, 7, 9));
+  EXPECT_THAT(columns.strands, testing::ElementsAre('+', '+', '-', '-', '-'));
+  EXPECT_THAT(columns.variant_rows, testing::ElementsAre(0, 1, 0, 2, 0));
+  ASSERT_EQ(15, columns.probabilities.size());
+  EXPECT_FLOAT_EQ(0.25, columns.probabilities[0]);
+  EXPECT_FLOAT_EQ(0.75, columns.probabilities[1]);
+  EXPECT_TRUE(std::isnan(columns.probabilities[2]));
+  EXPECT_FLOAT_EQ(0.5, columns.probabilities[3]);
+  EXPECT_FLOAT_EQ(0.875, columns.probabilities[10]);
+  EXPECT_TRUE(std::isnan(columns.probabilities[14]));
+//  single row groups append to the columns
+  VariantCallColumns group;
+  reader.read_row_group(2, group);
+  reader.read_row_group(0, group);
+  EXPECT_THAT(group.positions, testing::ElementsAre(9, 10, 12));
+  EXPECT_EQ(9, group.probabilities.size());
+  EXPECT_THROW(reader.read_row_group(3, group), AssertionFailureException);
+  remove_all(tempdir);
+}
+
+TEST (VariantCallFileTests, test_alignment_file_calls) {
+  Redirect a(true, true);
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path calls_path = tempdir / "rrna.calls";
+  std::map<string, string> ambig_bases = create_ambig_bases();
+  AlignmentFile af(RRNA_TEST_VARIANTS.string(), true);
+  string bases = "YK";
+  vector<VariantCall> calls = af.get_variant_calls(bases, &ambig_bases);
+  ASSERT_LT(0, calls.size());
+  {
+    VariantCallWriter writer(calls_path, 2);
+    writer.add_read(af.read_id, calls);
+  }
+  VariantCallReader reader(calls_path.string());
+  VariantCallColumns columns;
+  reader.read_all(columns);
+  ASSERT_EQ(calls.size(), columns.num_rows());
+  EXPECT_THAT(reader.get_read_ids(), testing::ElementsAre(af.read_id));
+  for (uint64_t i = 0; i < calls.size(); ++i){
+    EXPECT_EQ(calls[i].contig, reader.get_contigs()[columns.contig_rows[i]]);
+    EXPECT_EQ(calls[i].strand[0], columns.strands[i]);
+    EXPECT_EQ(calls[i].reference_index, columns.positions[i]);
+    EXPECT_EQ(calls[i].bases, reader.get_variants()[columns.variant_rows[i]]);
+    for (uint64_t j = 0; j < calls[i].normalized_probs.size(); ++j){
+      EXPECT_FLOAT_EQ(calls[i].normalized_probs[j], columns.probabilities[i * 2 + j]);
+    }
+  }
+  remove_all(tempdir);
+}
+
+TEST (VariantCallFileTests, test_corrupt_file) {
+  path tempdir = temp_directory_path() / "temp";
+  create_directory(tempdir);
+  path calls_path = tempdir / "corrupt.calls";
+  {
+    std::ofstream out_file(calls_path.string());
+    out_file << "not a variant call file, just some text which is long enough to have a header and trailer";
+  }
+  EXPECT_THROW(VariantCallReader reader(calls_path.string()), AssertionFailureException);
+  {
+    VariantCallWriter writer(calls_path, 2);
+    writer.add_read("read1", {make_variant_call("contig1", "+", 10, "CE", {0.25, 0.75})});
+  }
+  resize_file(calls_path, file_size(calls_path) - 4);
+  EXPECT_THROW(VariantCallReader reader(calls_path.string()), AssertionFailureException);
+  EXPECT_THROW(VariantCallReader reader((tempdir / "missing.calls").string()), AssertionFailureException);
+//  failed opens close their file descriptor
+  int next_descriptor = ::open(calls_path.c_str(), O_RDONLY);
+  ::close(next_descriptor);
+  EXPECT_THROW(VariantCallReader reader(calls_path.string()), AssertionFailureException);
+  int after_descriptor = ::open(calls_path.c_str(), O_RDONLY);
+  ::close(after_descriptor);
+  EXPECT_EQ(next_descriptor, after_descriptor);
+  VariantCallWriter narrow_writer(tempdir / "too_many.calls", 1);
+  EXPECT_THROW(narrow_writer.add_read("read1", {make_variant_call("contig1", "+", 10, "CE", {0.25, 0.75})}),
+               AssertionFailureException);
+  narrow_writer.close();
+  remove_all(tempdir);
+}
+
+#endif //EMBED_FAST5_TESTS_SRC_VARIANTCALLFILETESTS_HPP_
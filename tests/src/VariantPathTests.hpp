@@ -106,4 +106,32 @@ TEST (VariantPathTests, test_load_variants){
   EXPECT_TRUE(compare_files(correct_per_path, output_per_path));
 }
 
+TEST (VariantPathTests, test_load_variants_thread_counts){
+  Redirect a(true, true);
+  path positions_file = RRNA_TEST_FILES/"/16S_final_branch_points.positions";
+  int max_threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+  LoadVariantPaths serial(positions_file.string(), RRNA_SIGNAL_FILES.string(), true, 10);
+  omp_set_num_threads(4);
+  LoadVariantPaths threaded(positions_file.string(), RRNA_SIGNAL_FILES.string(), true, 10);
+  omp_set_num_threads(max_threads);
+  EXPECT_EQ(serial.counts, threaded.counts);
+  uint64_t num_reads = 0;
+  for (auto &contig_map: threaded.counts){
+    for (auto &id_map: contig_map.second){
+      num_reads += id_map.second;
+    }
+  }
+  EXPECT_EQ(threaded.read_id_path_id_map.size(), num_reads);
+//  merging more partial counts adds to the existing counts
+  vector<PathCounts> partial_counts(2, serial.counts);
+  threaded.merge_partial_counts(partial_counts);
+  for (auto &contig_map: serial.counts){
+    for (auto &id_map: contig_map.second){
+      EXPECT_EQ(3 * id_map.second, threaded.counts.at(contig_map.first).at(id_map.first));
+    }
+  }
+  EXPECT_TRUE(partial_counts[0].empty());
+}
+
 #endif //EMBED_FAST5_TESTS_SRC_VARIANTPATHTESTS_HPP_
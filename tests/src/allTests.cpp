@@ -5,7 +5,10 @@
 // embed tests
 #include "BinaryIOTests.hpp"
 #include "ConcurrentQueueTests.hpp"
+#include "RingBufferQueueTests.hpp"
+#include "TextWriterTests.hpp"
 #include "EmbedUtilsTests.hpp"
+#include "EventCacheTests.hpp"
 #include "Fast5Tests.hpp"
 #include "AmbigModelTests.hpp"
 #include "FileTests.hpp"
@@ -14,9 +17,12 @@
 #include "MaxKmersTests.hpp"
 #include "TopKmersTests.hpp"
 #include "VariantPathTests.hpp"
+#include "VariantCallFileTests.hpp"
+#include "RegionIndexTests.hpp"
 #include "PerPositionKmersTests.hpp"
 #include "BaseKmerTests.hpp"
 #include "BinaryEventTests.hpp"
+#include "MemoryReportTests.hpp"
 
 // boost
 #include <boost/filesystem.hpp>
@@ -14,6 +14,7 @@ import unittest
 import tempfile
 import os
 import filecmp
+import numpy as np
 from embed import bindings
 from py3helpers.utils import list_dir, captured_output, count_lines_in_file
 
@@ -34,6 +35,7 @@ class TestPythonWrappers(unittest.TestCase):
                                             "tests/test_files/rRNA_test_files/test_output_dir/per_read_calls.tsv")
         cls.assignment_dir = os.path.join(cls.HOME, "tests/test_files/assignment_files")
         cls.alignment_dir = os.path.join(cls.HOME, "tests/test_files/alignment_files")
+        cls.variant_calls = os.path.join(cls.HOME, "tests/test_files/rRNA_test_files/rRNA_variant_calls.calls")
 
     def test_LoadVariantPaths(self):
         with captured_output() as (_, _):
@@ -80,6 +82,23 @@ class TestPythonWrappers(unittest.TestCase):
             #                       list_dir(self.alignment_dir, ext="tsv"),
             #                       output_path, heap_size, "ATGCEF", n_threads)
 
+    def test_VariantCallReader(self):
+        reader = bindings.VariantCallReader(self.variant_calls)
+        self.assertEqual(40, reader.num_rows)
+        self.assertEqual(2, reader.max_n_variants)
+        self.assertEqual(5, len(reader.read_ids))
+        self.assertEqual(["ecoli_MRE600"], reader.contigs)
+        columns = reader.read_columns()
+        self.assertEqual((40,), columns["position"].shape)
+        self.assertEqual(np.uint64, columns["position"].dtype)
+        self.assertEqual((40, 2), columns["probabilities"].shape)
+        self.assertTrue(np.all(columns["strand"] == b"+"))
+        self.assertTrue(np.allclose(1.0, columns["probabilities"].sum(axis=1)))
+        self.assertSetEqual({"CT", "GT"}, {reader.variants[i] for i in columns["variant"]})
+        # the arrays share the loaded columns instead of owning a copy
+        self.assertFalse(columns["position"].flags["OWNDATA"])
+        self.assertRaises(RuntimeError, bindings.VariantCallReader, self.positions_file)
+
 
 if __name__ == '__main__':
     unittest.main()